@@ -0,0 +1,104 @@
+/* obbyconv - converts obby session files between text and binary format
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Reads a session file in either format and writes it in the requested
+ * one. The session is streamed, so files of any size can be converted.
+ *
+ * Build with:
+ *   g++ obbyconv.cpp -o obbyconv `pkg-config --cflags --libs obby-0.4`
+ *
+ * Usage:
+ *   obbyconv --text|--binary <input> <output>
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <obby/serialise/error.hpp>
+#include <obby/serialise/mapped_file.hpp>
+#include <obby/serialise/reader.hpp>
+#include <obby/serialise/writer.hpp>
+
+namespace
+{
+	void convert(obby::serialise::reader& src,
+	             obby::serialise::writer& dest)
+	{
+		for(;;)
+		{
+			switch(src.read() )
+			{
+			case obby::serialise::reader::OBJECT_BEGIN:
+				dest.begin_object(src.get_name() );
+				break;
+			case obby::serialise::reader::ATTRIBUTE:
+				dest.add_attribute(
+					src.get_name(),
+					src.get_value_data(),
+					src.get_value_size()
+				);
+				break;
+			case obby::serialise::reader::OBJECT_END:
+				dest.end_object();
+				break;
+			case obby::serialise::reader::END_OF_INPUT:
+				return;
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[]) try
+{
+	if(argc != 4)
+	{
+		std::cerr << "Usage: " << argv[0]
+		          << " --text|--binary <input> <output>" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::string mode = argv[1];
+	obby::serialise::writer::format_type format;
+
+	if(mode == "--text")
+		format = obby::serialise::writer::FORMAT_TEXT;
+	else if(mode == "--binary")
+		format = obby::serialise::writer::FORMAT_BINARY;
+	else
+		throw std::runtime_error("Unknown format: " + mode);
+
+	obby::serialise::mapped_file file(argv[2]);
+	obby::serialise::reader src(file.get_data(), file.get_size() );
+	obby::serialise::writer dest(argv[3], src.get_type(), format);
+
+	convert(src, dest);
+	dest.flush();
+
+	return EXIT_SUCCESS;
+}
+catch(obby::serialise::error& e)
+{
+	std::cerr << argv[2] << ":" << e.get_line() << ": " << e.what()
+	          << std::endl;
+	return EXIT_FAILURE;
+}
+catch(std::exception& e)
+{
+	std::cerr << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
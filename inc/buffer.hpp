@@ -19,13 +19,16 @@
 #ifndef _OBBY_BUFFER_HPP_
 #define _OBBY_BUFFER_HPP_
 
+#include <cstdio>
 #include <set>
+#include <map>
 #include <list>
 
 #include <net6/main.hpp>
 #include <net6/object.hpp>
 
 #include "serialise/parser.hpp"
+#include "serialise/writer.hpp"
 #include "common.hpp"
 #include "format_string.hpp"
 #include "user_table.hpp"
@@ -113,9 +116,14 @@ public:
 	 */
 	const selector_type& get_selector() const;
 
-	/** Serialises the complete obby session into <em>file</em>.
+	/** Serialises the complete obby session into <em>file</em>. Binary
+	 * snapshots are faster to save and load, basic_server_buffer::open
+	 * recognises both formats. The file is replaced only once the
+	 * session has been written completely.
 	 */
-	void serialise(const std::string& file) const;
+	void serialise(const std::string& file,
+	               serialise::writer::format_type format =
+	               	serialise::writer::FORMAT_TEXT) const;
 
 	/* Creates a new document with predefined content.
 	 * signal_document_insert will be emitted if it has been created.
@@ -242,6 +250,46 @@ protected:
 	 */
 	void session_close_impl();
 
+	/** Writes the complete obby session to <em>writer</em>.
+	 */
+	void serialise(serialise::writer& writer) const;
+
+	/** Adds further attributes to the session object written by
+	 * serialise(). The default implementation adds none.
+	 */
+	virtual void serialise_attributes(serialise::writer& writer) const;
+
+	/** Keeps the title index up to date when a document gets renamed.
+	 */
+	void on_document_rename(const std::string& title,
+	                        document_info_type& info);
+
+	/** Entry of the document index. It remembers the position in the
+	 * document list and the title and suffix the document is currently
+	 * indexed with, since the document itself already carries the new
+	 * ones when its rename signal is emitted.
+	 */
+	struct document_entry
+	{
+		typename document_list::iterator iter;
+		std::string title;
+		unsigned int suffix;
+	};
+
+	/** Documents are indexed by owner ID and document ID.
+	 */
+	typedef std::pair<unsigned int, unsigned int> document_key;
+	typedef std::map<document_key, document_entry> document_map;
+
+	/** Suffixes in use for each document title.
+	 */
+	typedef std::map<std::string, std::multiset<unsigned int> > title_map;
+
+	/** Internal functions to maintain the title index.
+	 */
+	void title_insert(const std::string& title, unsigned int suffix);
+	void title_erase(const std::string& title, unsigned int suffix);
+
 	signal_sync_init_type m_signal_sync_init;
 	signal_sync_final_type m_signal_sync_final;
 
@@ -260,6 +308,8 @@ protected:
 	chat m_chat;
 
 	document_list m_docs;
+	document_map m_doc_map;
+	title_map m_title_map;
 	document_template_type m_document_template;
 	unsigned int m_doc_counter;
 
@@ -333,36 +383,70 @@ const typename basic_buffer<Document, Selector>::selector_type&
 
 template<typename Document, typename Selector>
 void basic_buffer<Document, Selector>::
-	serialise(const std::string& session) const
+	serialise(const std::string& session,
+	          serialise::writer::format_type format) const
 {
-	serialise::parser parser;
-	parser.set_type("obby");
+	// Write to a temporary file first, so that a failed save does not
+	// destroy the previous session.
+	std::string temp = session + ".new";
 
-	serialise::object& root = parser.get_root();
-	root.set_name("session");
-	root.add_attribute("version").set_value(obby_version() );
+	try
+	{
+		serialise::writer writer(temp, "obby", format);
+		serialise(writer);
+		writer.flush();
+	}
+	catch(...)
+	{
+		std::remove(temp.c_str() );
+		throw;
+	}
+
+#ifdef WIN32
+	// rename() does not replace existing files on WIN32
+	std::remove(session.c_str() );
+#endif
 
-	serialise::object& user_table = root.add_child();
+	if(std::rename(temp.c_str(), session.c_str()) != 0)
+	{
+		format_string str(_("Could not replace file '%0%'") );
+		str << session;
+		throw std::runtime_error(str.str() );
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_buffer<Document, Selector>::
+	serialise(serialise::writer& writer) const
+{
+	// Documents and chat are written while walking them, the user
+	// table is built as an object first.
+	writer.begin_object("session");
+	writer.add_attribute("version", obby_version() );
+	serialise_attributes(writer);
+
+	serialise::object user_table;
 	user_table.set_name("user_table");
 	m_user_table.serialise(user_table);
+	writer.add_object(user_table);
 
-	serialise::object& chat = root.add_child();
-	chat.set_name("chat");
-	m_chat.serialise(chat);
+	writer.begin_object("chat");
+	m_chat.serialise(writer);
+	writer.end_object();
 
 	for(document_iterator iter = document_begin();
 	    iter != document_end();
 	    ++ iter)
 	{
 		// Do not serialise this document if we do not have its content
-		try { iter->get_content(); } catch(...) { continue; }
+		if(!iter->can_serialise() ) continue;
 
-		serialise::object& doc = root.add_child();
-		doc.set_name("document");
-		iter->serialise(doc);
+		writer.begin_object("document");
+		iter->serialise(writer);
+		writer.end_object();
 	}
 
-	parser.serialise(session);
+	writer.end_object();
 }
 
 template<typename Document, typename Selector>
@@ -370,18 +454,13 @@ typename basic_buffer<Document, Selector>::document_info_type*
 basic_buffer<Document, Selector>::document_find(unsigned int owner_id,
                                                 unsigned int id) const
 {
-	document_iterator iter;
-	for(iter = m_docs.begin(); iter != m_docs.end(); ++ iter)
-	{
-		// Check document ID
-		if(iter->get_id() != id) continue;
-		// Check owner ID
-		if(iter->get_owner_id() != owner_id) continue;
-		// Found requested document
-		return &(*iter);
-	}
+	typename document_map::const_iterator iter =
+		m_doc_map.find(document_key(owner_id, id) );
 
-	return NULL;
+	if(iter == m_doc_map.end() )
+		return NULL;
+
+	return *iter->second.iter;
 }
 
 template<typename Document, typename Selector>
@@ -447,25 +526,43 @@ unsigned int basic_buffer<Document, Selector>::
 	find_free_suffix(const std::string& for_title,
 	                 const document_info_type* ignore) const
 {
-	// Set that sorts suffixes in ascending order
-	std::set<unsigned int> suffixes;
+	typename title_map::const_iterator title_iter =
+		m_title_map.find(for_title);
+	if(title_iter == m_title_map.end() )
+		return 1;
 
-	// Put all suffixes into the set
-	for(document_iterator it = m_docs.begin(); it != m_docs.end(); ++ it)
+	// The document to ignore might not have been added yet, it is still
+	// being constructed in this case.
+	bool skip_ignore = false;
+	unsigned int ignore_suffix = 0;
+	if(ignore != NULL)
 	{
-		if(ignore == &(*it) )
-			continue;
+		typename document_map::const_iterator iter = m_doc_map.find(
+			document_key(ignore->get_owner_id(), ignore->get_id()) );
 
-		if(it->get_title() == for_title)
-			suffixes.insert(it->get_suffix() );
+		if(iter != m_doc_map.end() && *iter->second.iter == ignore &&
+		   iter->second.title == for_title)
+		{
+			skip_ignore = true;
+			ignore_suffix = iter->second.suffix;
+		}
 	}
 
-	// Choose the lowest free one
+	// Choose the lowest free one, suffixes are in ascending order
+	const std::multiset<unsigned int>& suffixes = title_iter->second;
 	unsigned int prev_suffix = 0;
-	for(std::set<unsigned int>::const_iterator iter = suffixes.begin();
+	for(std::multiset<unsigned int>::const_iterator iter =
+		suffixes.begin();
 	    iter != suffixes.end();
 	    ++ iter)
 	{
+		// Ignore one occurence of the given document's suffix
+		if(skip_ignore && *iter == ignore_suffix)
+		{
+			skip_ignore = false;
+			continue;
+		}
+
 		if(*iter > prev_suffix + 1)
 			break;
 		else
@@ -546,8 +643,24 @@ void basic_buffer<Document, Selector>::
 		users.insert(&(*iter));
 	}
 
-	// Add new document into list
-	m_docs.push_back(&info);
+	// Add new document into list and index
+	document_entry entry;
+	entry.iter = m_docs.insert(m_docs.end(), &info);
+	entry.title = info.get_title();
+	entry.suffix = info.get_suffix();
+
+	m_doc_map[document_key(info.get_owner_id(), info.get_id())] = entry;
+	title_insert(entry.title, entry.suffix);
+
+	// Keep the title index up to date. This is connected before anyone
+	// else may connect to the rename signal.
+	info.rename_event().connect(
+		sigc::bind(
+			sigc::mem_fun(*this, &basic_buffer::on_document_rename),
+			sigc::ref(info)
+		)
+	);
+
 	// Emit document_insert signal
 	m_signal_document_insert.emit(info);
 	// Emit user_subscribe signal for each user that was initially
@@ -569,11 +682,16 @@ void basic_buffer<Document, Selector>::
 	// TODO: Emit user_unsubscribe signal for each user that was subscribed?
 	// Emit document_remove signal
 	m_signal_document_remove.emit(info);
-	// Delete from list (TODO: Use std::set?)
-	m_docs.erase(
-		std::remove(m_docs.begin(), m_docs.end(), &info),
-		m_docs.end()
-	);
+	// Delete from list and index
+	typename document_map::iterator iter = m_doc_map.find(
+		document_key(info.get_owner_id(), info.get_id()) );
+
+	if(iter != m_doc_map.end() )
+	{
+		title_erase(iter->second.title, iter->second.suffix);
+		m_docs.erase(iter->second.iter);
+		m_doc_map.erase(iter);
+	}
 
 	// Delete document
 	delete &info;
@@ -588,6 +706,54 @@ void basic_buffer<Document, Selector>::document_clear()
 		delete *iter;
 
 	m_docs.clear();
+	m_doc_map.clear();
+	m_title_map.clear();
+}
+
+template<typename Document, typename Selector>
+void basic_buffer<Document, Selector>::
+	serialise_attributes(serialise::writer& writer) const
+{
+}
+
+template<typename Document, typename Selector>
+void basic_buffer<Document, Selector>::
+	on_document_rename(const std::string& title, document_info_type& info)
+{
+	typename document_map::iterator iter = m_doc_map.find(
+		document_key(info.get_owner_id(), info.get_id()) );
+
+	if(iter == m_doc_map.end() )
+		return;
+
+	title_erase(iter->second.title, iter->second.suffix);
+	iter->second.title = title;
+	iter->second.suffix = info.get_suffix();
+	title_insert(iter->second.title, iter->second.suffix);
+}
+
+template<typename Document, typename Selector>
+void basic_buffer<Document, Selector>::
+	title_insert(const std::string& title, unsigned int suffix)
+{
+	m_title_map[title].insert(suffix);
+}
+
+template<typename Document, typename Selector>
+void basic_buffer<Document, Selector>::
+	title_erase(const std::string& title, unsigned int suffix)
+{
+	typename title_map::iterator iter = m_title_map.find(title);
+	if(iter == m_title_map.end() ) return;
+
+	// Erase only one occurence
+	std::multiset<unsigned int>::iterator suffix_iter =
+		iter->second.find(suffix);
+	if(suffix_iter != iter->second.end() )
+		iter->second.erase(suffix_iter);
+
+	if(iter->second.empty() )
+		m_title_map.erase(iter);
 }
 
 template<typename Document, typename Selector>
@@ -20,17 +20,23 @@
 #define _OBBY_CHAT_HPP_
 
 #include <ctime>
-#include <list>
+#include <string>
+#include <vector>
 #include <sigc++/signal.h>
 #include <sigc++/connection.h>
 #include "user.hpp"
 #include "user_table.hpp"
+#include "serialise/writer.hpp"
 //#include "document_info.hpp"
 
 namespace obby
 {
 
 /** Handles obby chat messages.
+ *
+ * The history is a ring of fixed-size records whose texts are appended to
+ * a single string. Message objects are only created when the history is
+ * iterated or a new message is announced.
  */
 class chat
 {
@@ -118,11 +124,63 @@ public:
 		virtual std::string repr() const;
 	};
 
-	typedef ptr_iterator<
-		message,
-		std::list<message*>,
-		std::list<message*>::const_iterator
-	> message_iterator;
+	/** Iterates through the chat history from the oldest message to the
+	 * newest one. The message an iterator points to is created when it
+	 * is first accessed and lives as long as the iterator stays at it.
+	 * Iterators are invalidated when a message is added.
+	 */
+	class message_iterator
+	{
+	public:
+		message_iterator();
+		message_iterator(const chat& chat, std::size_t index);
+		message_iterator(const message_iterator& other);
+		~message_iterator();
+
+		message_iterator& operator=(const message_iterator& other);
+
+		const message& operator*() const;
+		const message* operator->() const;
+
+		message_iterator& operator++();
+		message_iterator operator++(int);
+		message_iterator& operator--();
+		message_iterator operator--(int);
+
+		bool operator==(const message_iterator& other) const;
+		bool operator!=(const message_iterator& other) const;
+
+		/** Returns the position of the message in the history, the
+		 * oldest message being at 0.
+		 */
+		std::size_t get_index() const;
+	private:
+		void reset();
+
+		const chat* m_chat;
+		std::size_t m_index;
+		mutable message* m_message;
+	};
+
+	friend class message_iterator;
+
+	/** Fields of a message in the history, read without creating a
+	 * message object. <em>text</em> points into the history and is
+	 * valid until a message is added.
+	 */
+	struct message_data
+	{
+		/** Name the message is serialised with, such as
+		 * "user_message".
+		 */
+		const char* type;
+		std::time_t timestamp;
+		/** Author of user and emote messages, NULL otherwise.
+		 */
+		const user* from;
+		const char* text;
+		std::size_t length;
+	};
 
 	typedef sigc::signal<void, const message&>
 		signal_message_type;
@@ -143,6 +201,11 @@ public:
 	 */
 	void serialise(serialise::object& obj) const;
 
+	/** Writes the chat history as children of the object that
+	 * <em>writer</em> has begun last.
+	 */
+	void serialise(serialise::writer& writer) const;
+
 	/** Deserialises a chat history from a serialisation object.
 	 * @param obj Object to deserialise from.
 	 * @param user_table user_table where to read user information from.
@@ -176,11 +239,87 @@ public:
 	 */
 	message_iterator message_end() const;
 
+	/** Returns an iterator pointing at the message at <em>index</em>,
+	 * the oldest message being at 0, or message_end().
+	 */
+	message_iterator message_at(std::size_t index) const;
+
+	/** Returns an iterator pointing at the first message that has not
+	 * been written before <em>timestamp</em>, or message_end().
+	 */
+	message_iterator message_find(std::time_t timestamp) const;
+
+	/** Returns the number of messages in the history.
+	 */
+	std::size_t message_count() const;
+
+	/** Returns the fields of the message at <em>index</em>, the oldest
+	 * message being at 0.
+	 */
+	message_data message_data_at(std::size_t index) const;
+
+	/** Adds the position before the message at <em>index</em> to
+	 * <em>pack</em>. It consists of the timestamp of the message before
+	 * and the number of messages with that timestamp up to it, which
+	 * stays valid when old messages are discarded. The number of
+	 * messages before the position follows.
+	 */
+	void write_position(net6::packet& pack, std::size_t index) const;
+
+	/** Answers a backlog request. <em>request</em> holds a position
+	 * as written by write_position() and the number of messages the
+	 * client wants before it. The position before the oldest message
+	 * sent is added to <em>reply</em>, followed by the messages from
+	 * the oldest to the newest one. Fewer messages are sent than asked
+	 * for if they are too large, the client asks again for more.
+	 */
+	void write_backlog(const net6::packet& request,
+	                   net6::packet& reply) const;
+
 	/** Signal that will be emitted if a user message arrived.
 	 */
 	signal_message_type message_event() const;
 protected:
-	void add_message(message* msg);
+	enum message_type
+	{
+		USER_MESSAGE,
+		EMOTE_MESSAGE,
+		SERVER_MESSAGE,
+		SYSTEM_MESSAGE
+	};
+
+	/** Entry of the history. The text is <em>length</em> bytes at
+	 * <em>offset</em> in the text arena.
+	 */
+	struct record
+	{
+		message_type type;
+		std::time_t timestamp;
+		const user* from;
+		std::size_t offset;
+		std::size_t length;
+	};
+
+	/** Appends a message to the history, discarding the oldest one if
+	 * the history is full, and emits the message signal.
+	 */
+	void add_message(message_type type,
+	                 const std::string& text,
+	                 std::time_t timestamp,
+	                 const user* from);
+
+	/** Returns the record at <em>index</em>, the oldest one being
+	 * at 0.
+	 */
+	const record& get_record(std::size_t index) const;
+
+	/** Creates the message object for the record at <em>index</em>.
+	 */
+	message* create_message(std::size_t index) const;
+
+	/** Returns the name messages of the given type are serialised with.
+	 */
+	static const char* type_name(message_type type);
 
 	void on_sync_init(unsigned int);
 	void on_sync_final();
@@ -195,7 +334,19 @@ protected:
 	void on_document_remove(DocumentInfo& document);
 
 	unsigned int m_max_messages;
-	std::list<message*> m_messages;
+
+	/** Ring of at most m_max_messages records, the oldest one being at
+	 * m_first.
+	 */
+	std::vector<record> m_records;
+	std::size_t m_first;
+	std::size_t m_count;
+
+	/** Texts of the records in the order they have been added. The
+	 * texts of discarded records are removed when they make up more
+	 * than half of it.
+	 */
+	std::string m_arena;
 
 	signal_message_type m_signal_message;
 
@@ -207,7 +358,7 @@ protected:
 
 template<typename Buffer>
 chat::chat(const Buffer& buffer, unsigned int max_messages):
-	m_max_messages(max_messages)
+	m_max_messages(max_messages), m_first(0), m_count(0)
 {
 	typedef typename Buffer::document_info_type document_info_type;
 
@@ -256,7 +407,7 @@ void chat::on_document_insert(DocumentInfo& document)
 		localised_str = str.str();
 	}
 
-	add_message(new system_message(localised_str, std::time(NULL)) );
+	add_message(SYSTEM_MESSAGE, localised_str, std::time(NULL), NULL);
 }
 
 template<typename DocumentInfo>
@@ -264,7 +415,7 @@ void chat::on_document_remove(DocumentInfo& document)
 {
 	obby::format_string str(_("Document %0% has been removed"));
 	str << document.get_title();
-	add_message(new system_message(str.str(), std::time(NULL)));
+	add_message(SYSTEM_MESSAGE, str.str(), std::time(NULL), NULL);
 }
 
 } // namespace obby
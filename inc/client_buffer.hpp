@@ -19,6 +19,8 @@
 #ifndef _OBBY_CLIENT_BUFFER_HPP_
 #define _OBBY_CLIENT_BUFFER_HPP_
 
+#include <map>
+#include <vector>
 #include <net6/default_accumulator.hpp>
 #include <net6/client.hpp>
 #include "error.hpp"
@@ -65,6 +67,8 @@ public:
 		signal_login_failed_type;
 	typedef sigc::signal<void>
 		signal_close_type;
+	typedef sigc::signal<void, const chat::message&>
+		signal_chat_backlog_type;
 
 	typedef typename sigc::signal<bool, connection_settings&>
 		::template accumulated<login_accumulator>
@@ -82,6 +86,7 @@ public:
 	/** Creates a new client_buffer that is not connected to anywhere.
 	 */
 	basic_client_buffer();
+	~basic_client_buffer();
 
 	/** Connects to the given host where a obby server is assumed to be
 	 * running. After the connection has been established, signal_welcome
@@ -197,6 +202,20 @@ public:
 	 */
 	void set_enable_keepalives(bool enable);
 
+	/** Asks the server for up to <em>count</em> of the chat messages
+	 * that have been written before the ones received so far, starting
+	 * with those written before the local user joined. The server may
+	 * send fewer. chat_backlog_event() is emitted for each of them.
+	 * Does nothing if a request is still pending or there are no
+	 * older messages.
+	 */
+	void request_chat_backlog(unsigned int count);
+
+	/** Returns whether the server has older chat messages than those
+	 * received so far.
+	 */
+	bool has_chat_backlog() const;
+
 	/** Signal which will be emitted after the first packet, the welcome
 	 * packet, is received. This is a good place to perform a call to
 	 * the login function. Note that you cannot login earlier because the
@@ -229,6 +248,13 @@ public:
 	 */
 	signal_prompt_user_password_type prompt_user_password_event() const;
 
+	/** Signal which will be emitted for each chat message received
+	 * after request_chat_backlog(), from the newest to the oldest one,
+	 * so that each may be put in front of the messages shown so far.
+	 * The messages are not added to the chat history.
+	 */
+	signal_chat_backlog_type chat_backlog_event() const;
+
 protected:
 	/** Registers the signal handlers for the net6::client object. It may
 	 * be used by derived classes to register these signal handlers.
@@ -305,6 +331,13 @@ protected:
 	virtual void on_net_sync_doclist_document(const net6::packet& pack);
 	virtual void on_net_sync_final(const net6::packet& pack);
 
+	/** Batched synchronisation commands. They update the cached lists,
+	 * which are added to the buffer when the synchronisation is final.
+	 */
+	virtual void on_net_sync_usertable(const net6::packet& pack);
+	virtual void on_net_sync_doclist(const net6::packet& pack);
+	virtual void on_net_sync_doclist_remove(const net6::packet& pack);
+
 	/** Forwarding commands.
 	 */
 	virtual void on_net_document(const net6::packet& pack);
@@ -313,6 +346,15 @@ protected:
 	 */
 	virtual void on_net_command_result(const net6::packet& pack);
 
+	/** Flow control: The server wants to know that the packets it has
+	 * sent so far have arrived.
+	 */
+	virtual void on_net_ack_request(const net6::packet& pack);
+
+	/** Chat messages requested by request_chat_backlog().
+	 */
+	virtual void on_net_chat_backlog(const net6::packet& pack);
+
 	void on_command_emote(const command_query& query,
 	                      const command_result& result);
 
@@ -325,13 +367,87 @@ protected:
 	 */
 	void session_close_impl();
 
+	typedef typename document_info_type::resume_state resume_state;
+	typedef std::map<
+		std::pair<unsigned int, unsigned int>,
+		resume_state*
+	> resume_map;
+
+	/** Takes the resume state of all documents the local user was
+	 * subscribed to. Must be called before the user table is cleared.
+	 */
+	void resume_store();
+
+	/** Drops stored resume states.
+	 */
+	void resume_clear();
+
+	/** User and document list as the server has sent it, kept across
+	 * connections so that the server only needs to send what has
+	 * changed since.
+	 */
+	struct sync_user
+	{
+		std::string name;
+		obby::colour user_colour;
+	};
+
+	struct sync_document
+	{
+		std::string title;
+		unsigned int suffix;
+		std::string encoding;
+		std::vector<unsigned int> users;
+	};
+
+	typedef std::map<unsigned int, sync_user> sync_user_map;
+	typedef std::map<
+		std::pair<unsigned int, unsigned int>,
+		sync_document
+	> sync_document_map;
+
+	/** Adds the cached users that are not yet known and the cached
+	 * documents to the buffer.
+	 */
+	void sync_apply();
+
 	const user* m_self;
 
+	/** Token the server handed out for this session, empty if the
+	 * server does not support resuming subscriptions.
+	 */
+	std::string m_session_token;
+
+	/** Subscriptions to resume after the synchronisation, indexed by
+	 * owner ID and document ID.
+	 */
+	resume_map m_resume_states;
+
+	/** Version history and version of the cached lists. The version is
+	 * only updated when a synchronisation has been completed.
+	 */
+	std::string m_sync_id;
+	unsigned long m_sync_version;
+	unsigned long m_sync_pending;
+	bool m_sync_batched;
+
+	sync_user_map m_sync_users;
+	sync_document_map m_sync_documents;
+
+	/** Position in the server's chat history before which the next
+	 * requested messages are, and the number of messages before it.
+	 */
+	std::time_t m_backlog_timestamp;
+	unsigned int m_backlog_skip;
+	unsigned int m_backlog_remaining;
+	bool m_backlog_pending;
+
 	connection_settings m_settings;
 	bool m_enable_keepalives;
 
 	signal_welcome_type m_signal_welcome;
 	signal_close_type m_signal_close;
+	signal_chat_backlog_type m_signal_chat_backlog;
 	signal_login_failed_type m_signal_login_failed;
 
 	signal_prompt_name_type m_signal_prompt_name;
@@ -355,6 +471,9 @@ typedef basic_client_buffer<obby::document, net6::selector> client_buffer;
 template<typename Document, typename Selector>
 basic_client_buffer<Document, Selector>::basic_client_buffer():
 	basic_local_buffer<Document, Selector>(), m_self(NULL),
+	m_sync_version(0), m_sync_pending(0), m_sync_batched(false),
+	m_backlog_timestamp(0), m_backlog_skip(0), m_backlog_remaining(0),
+	m_backlog_pending(false),
 	m_enable_keepalives(false)
 {
 	const command_queue& queue =
@@ -365,6 +484,12 @@ basic_client_buffer<Document, Selector>::basic_client_buffer():
 	);
 }
 
+template<typename Document, typename Selector>
+basic_client_buffer<Document, Selector>::~basic_client_buffer()
+{
+	resume_clear();
+}
+
 template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	connect(const std::string& hostname,
@@ -703,6 +828,33 @@ basic_client_buffer<Document, Selector>::close_event() const
 	return m_signal_close;
 }
 
+template<typename Document, typename Selector>
+typename basic_client_buffer<Document, Selector>::signal_chat_backlog_type
+basic_client_buffer<Document, Selector>::chat_backlog_event() const
+{
+	return m_signal_chat_backlog;
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	request_chat_backlog(unsigned int count)
+{
+	if(m_backlog_pending || m_backlog_remaining == 0 || count == 0)
+		return;
+
+	net6::packet pack("obby_chat_backlog");
+	pack << m_backlog_timestamp << m_backlog_skip << count;
+	net6_client().send(pack);
+
+	m_backlog_pending = true;
+}
+
+template<typename Document, typename Selector>
+bool basic_client_buffer<Document, Selector>::has_chat_backlog() const
+{
+	return m_backlog_remaining > 0;
+}
+
 template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::on_join(const net6::user& user6,
                                                       const net6::packet& pack)
@@ -806,15 +958,13 @@ template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	on_login_extend(net6::packet& pack)
 {
-	// Add user colour and, if given, (hashed) passwords.
-	pack << m_settings.colour;
-	if(!m_settings.global_password.empty() ||
-	   !m_settings.user_password.empty() )
-	{
-		pack << m_settings.global_password;
-		if(!m_settings.user_password.empty() )
-			pack << m_settings.user_password;
-	}
+	// Add user colour and (hashed) passwords. Empty passwords are the
+	// same as none. The version of the cached user and document lists
+	// follows, so that the server only sends what has changed since.
+	// The last parameter tells that obby_ack_request is answered.
+	pack << m_settings.colour << m_settings.global_password
+	     << m_settings.user_password << m_sync_id << m_sync_version
+	     << 1u;
 }
 
 template<typename Document, typename Selector>
@@ -855,12 +1005,27 @@ bool basic_client_buffer<Document, Selector>::
 	if(pack.get_command() == "obby_sync_final")
 		{ on_net_sync_final(pack); return true; }
 
+	if(pack.get_command() == "obby_sync_usertable")
+		{ on_net_sync_usertable(pack); return true; }
+
+	if(pack.get_command() == "obby_sync_doclist")
+		{ on_net_sync_doclist(pack); return true; }
+
+	if(pack.get_command() == "obby_sync_doclist_remove")
+		{ on_net_sync_doclist_remove(pack); return true; }
+
 	if(pack.get_command() == "obby_document")
 		{ on_net_document(pack); return true; }
 
 	if(pack.get_command() == "obby_command_result")
 		{ on_net_command_result(pack); return true; }
 
+	if(pack.get_command() == "obby_ack_request")
+		{ on_net_ack_request(pack); return true; }
+
+	if(pack.get_command() == "obby_chat_backlog")
+		{ on_net_chat_backlog(pack); return true; }
+
 	return false;
 }
 
@@ -1050,6 +1215,49 @@ template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	on_net_sync_init(const net6::packet& pack)
 {
+	// Servers that are able to resume subscriptions send a token that
+	// identifies us in this session.
+	resume_clear();
+	if(pack.get_param_count() > 1)
+	{
+		m_session_token =
+			pack.get_param(1).net6::parameter::as<std::string>();
+
+		// Keep state of subscribed documents to resume them after
+		// the synchronisation. The user table is still valid here.
+		resume_store();
+	}
+	else
+	{
+		m_session_token = "";
+	}
+
+	// Servers that batch the synchronisation tell the version of the
+	// lists they send and the version they send them relative to.
+	m_sync_batched = (pack.get_param_count() > 4);
+	unsigned long base = 0;
+	if(m_sync_batched)
+	{
+		m_sync_id = pack.get_param(2).net6::parameter::as<std::string>();
+		m_sync_pending =
+			pack.get_param(3).net6::parameter::as<unsigned long>();
+		base = pack.get_param(4).net6::parameter::as<unsigned long>();
+	}
+	else
+	{
+		m_sync_id = "";
+	}
+
+	// Complete lists replace the cached ones. Until the synchronisation
+	// is final, the cache only counts as the version it started from.
+	if(base == 0)
+	{
+		m_sync_users.clear();
+		m_sync_documents.clear();
+	}
+
+	m_sync_version = base;
+
 	// Login was successful, synchronisation begins. Clear users and
 	// documents from old session that have been kept to be able to still
 	// access them while being disconnected.
@@ -1128,9 +1336,117 @@ template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	on_net_sync_final(const net6::packet& pack)
 {
+	if(m_sync_batched)
+	{
+		sync_apply();
+		m_sync_version = m_sync_pending;
+	}
+
+	// Servers that keep a chat history tell where it ended when we
+	// joined.
+	m_backlog_pending = false;
+	m_backlog_remaining = 0;
+	if(pack.get_param_count() > 2)
+	{
+		m_backlog_timestamp =
+			pack.get_param(0).net6::parameter::as<std::time_t>();
+		m_backlog_skip =
+			pack.get_param(1).net6::parameter::as<unsigned int>();
+		m_backlog_remaining =
+			pack.get_param(2).net6::parameter::as<unsigned int>();
+	}
+
+	// Resume subscriptions of documents that still exist
+	for(typename resume_map::iterator iter = m_resume_states.begin();
+	    iter != m_resume_states.end();
+	    ++ iter)
+	{
+		document_info_type* info =
+			document_find(iter->first.first, iter->first.second);
+
+		if(info != NULL)
+		{
+			info->resume(
+				std::auto_ptr<resume_state>(iter->second),
+				m_session_token
+			);
+
+			iter->second = NULL;
+		}
+	}
+
+	resume_clear();
 	basic_buffer<Document, Selector>::m_signal_sync_final.emit();
 }
 
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	on_net_sync_usertable(const net6::packet& pack)
+{
+	for(unsigned int i = 0; i + 2 < pack.get_param_count(); i += 3)
+	{
+		sync_user& entry = m_sync_users[
+			pack.get_param(i).net6::parameter::as<unsigned int>()
+		];
+
+		entry.name =
+			pack.get_param(i + 1).net6::parameter::as<std::string>();
+		entry.user_colour =
+			pack.get_param(i + 2).net6::parameter::as<obby::colour>();
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	on_net_sync_doclist(const net6::packet& pack)
+{
+	unsigned int i = 0;
+	while(i < pack.get_param_count() )
+	{
+		unsigned int owner_id =
+			pack.get_param(i).net6::parameter::as<unsigned int>();
+		unsigned int id =
+			pack.get_param(i + 1).net6::parameter::as<unsigned int>();
+
+		sync_document& entry =
+			m_sync_documents[std::make_pair(owner_id, id)];
+
+		entry.title =
+			pack.get_param(i + 2).net6::parameter::as<std::string>();
+		entry.suffix =
+			pack.get_param(i + 3).net6::parameter::as<unsigned int>();
+		entry.encoding =
+			pack.get_param(i + 4).net6::parameter::as<std::string>();
+
+		unsigned int count =
+			pack.get_param(i + 5).net6::parameter::as<unsigned int>();
+		i += 6;
+
+		entry.users.clear();
+		for(unsigned int j = 0; j < count; ++ j, ++ i)
+		{
+			entry.users.push_back(
+				pack.get_param(i).net6::parameter::as<
+					unsigned int
+				>()
+			);
+		}
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	on_net_sync_doclist_remove(const net6::packet& pack)
+{
+	for(unsigned int i = 0; i + 1 < pack.get_param_count(); i += 2)
+	{
+		m_sync_documents.erase(std::make_pair(
+			pack.get_param(i).net6::parameter::as<unsigned int>(),
+			pack.get_param(i + 1).net6::parameter::as<unsigned int>()
+		) );
+	}
+}
+
 template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	on_net_document(const net6::packet& pack)
@@ -1159,6 +1475,81 @@ void basic_client_buffer<Document, Selector>::
 	basic_local_buffer<Document, Selector>::m_command_queue.result(result);
 }
 
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	on_net_ack_request(const net6::packet& pack)
+{
+	// Everything the server sent before the request has been handled
+	net6::packet reply("obby_ack");
+	reply << pack.get_param(0).net6::parameter::as<unsigned int>();
+	net6_client().send(reply);
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::
+	on_net_chat_backlog(const net6::packet& pack)
+{
+	m_backlog_pending = false;
+	m_backlog_timestamp =
+		pack.get_param(0).net6::parameter::as<std::time_t>();
+	m_backlog_skip = pack.get_param(1).net6::parameter::as<unsigned int>();
+	m_backlog_remaining =
+		pack.get_param(2).net6::parameter::as<unsigned int>();
+
+	// Messages are sent from the oldest to the newest one, four
+	// parameters each.
+	unsigned int count = (pack.get_param_count() - 3) / 4;
+	for(unsigned int i = count; i > 0; -- i)
+	{
+		unsigned int index = 3 + (i - 1) * 4;
+
+		const std::string& type =
+			pack.get_param(index).net6::parameter::as<std::string>();
+		std::time_t timestamp = pack.get_param(index + 1).
+			net6::parameter::as<std::time_t>();
+		const user* from =
+			pack.get_param(index + 2).net6::parameter::as<const user*>(
+				::serialise::hex_context_from<const user*>(
+					basic_buffer<Document, Selector>::
+						get_user_table()
+				)
+			);
+		const std::string& text =
+			pack.get_param(index + 3).net6::parameter::as<std::string>();
+
+		if(type == "user_message" || type == "emote_message")
+		{
+			if(from == NULL)
+				throw net6::bad_value("Chat message without user");
+
+			if(type == "user_message")
+			{
+				chat::user_message msg(text, timestamp, *from);
+				m_signal_chat_backlog.emit(msg);
+			}
+			else
+			{
+				chat::emote_message msg(text, timestamp, *from);
+				m_signal_chat_backlog.emit(msg);
+			}
+		}
+		else if(type == "server_message")
+		{
+			chat::server_message msg(text, timestamp);
+			m_signal_chat_backlog.emit(msg);
+		}
+		else if(type == "system_message")
+		{
+			chat::system_message msg(text, timestamp);
+			m_signal_chat_backlog.emit(msg);
+		}
+		else
+		{
+			throw net6::bad_value("Unknown chat message: " + type);
+		}
+	}
+}
+
 template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::
 	on_command_emote(const command_query& query,
@@ -1185,6 +1576,106 @@ void basic_client_buffer<Document, Selector>::session_close_impl()
 	m_settings.global_password = m_settings.user_password = "";
 }
 
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::sync_apply()
+{
+	const user_table& table = basic_buffer<Document, Selector>::m_user_table;
+
+	// The lists are added the same way as they would have been sent
+	// before, connected users are known already.
+	for(typename sync_user_map::const_iterator iter =
+		m_sync_users.begin();
+	    iter != m_sync_users.end();
+	    ++ iter)
+	{
+		if(table.find(iter->first, user::flags::NONE,
+		              user::flags::NONE) != NULL)
+			continue;
+
+		net6::packet user_pack("obby_sync_usertable_user");
+		user_pack << iter->first << iter->second.name
+		          << iter->second.user_colour;
+		on_net_sync_usertable_user(user_pack);
+	}
+
+	for(typename sync_document_map::const_iterator iter =
+		m_sync_documents.begin();
+	    iter != m_sync_documents.end();
+	    ++ iter)
+	{
+		const user* owner = NULL;
+		if(iter->first.first != 0)
+		{
+			owner = table.find(
+				iter->first.first,
+				user::flags::NONE,
+				user::flags::NONE
+			);
+		}
+
+		net6::packet document_pack("obby_sync_doclist_document");
+		document_pack << owner << iter->first.second
+		              << iter->second.title << iter->second.suffix
+		              << iter->second.encoding;
+
+		for(std::vector<unsigned int>::const_iterator user_iter =
+			iter->second.users.begin();
+		    user_iter != iter->second.users.end();
+		    ++ user_iter)
+		{
+			const user* subscriber = table.find(
+				*user_iter,
+				user::flags::NONE,
+				user::flags::NONE
+			);
+
+			if(subscriber != NULL && subscriber != m_self)
+				document_pack << subscriber;
+		}
+
+		on_net_sync_doclist_document(document_pack);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::resume_store()
+{
+	typedef typename basic_buffer<Document, Selector>::document_list
+		document_list;
+
+	document_list& docs = basic_buffer<Document, Selector>::m_docs;
+	for(typename document_list::iterator iter = docs.begin();
+	    iter != docs.end();
+	    ++ iter)
+	{
+		document_info_type& info =
+			dynamic_cast<document_info_type&>(**iter);
+
+		std::auto_ptr<resume_state> state =
+			info.release_resume_state();
+
+		if(state.get() != NULL)
+		{
+			m_resume_states[
+				std::make_pair(info.get_owner_id(), info.get_id())
+			] = state.release();
+		}
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_client_buffer<Document, Selector>::resume_clear()
+{
+	for(typename resume_map::iterator iter = m_resume_states.begin();
+	    iter != m_resume_states.end();
+	    ++ iter)
+	{
+		delete iter->second;
+	}
+
+	m_resume_states.clear();
+}
+
 template<typename Document, typename Selector>
 void basic_client_buffer<Document, Selector>::register_signal_handlers()
 {
@@ -19,6 +19,7 @@
 #ifndef _OBBY_CLIENT_DOCUMENT_INFO_HPP_
 #define _OBBY_CLIENT_DOCUMENT_INFO_HPP_
 
+#include <list>
 #include <net6/client.hpp>
 #include "format_string.hpp"
 #include "no_operation.hpp"
@@ -52,9 +53,29 @@ public:
 	typedef typename buffer_type::net_type net_type;
 	typedef jupiter_client<Document> jupiter_type;
 	typedef typename jupiter_type::record_type record_type;
+	typedef typename jupiter_type::operation_type operation_type;
+	typedef typename jupiter_type::algorithm_type algorithm_type;
 
 	typedef typename base_local_type::subscription_state subscription_state;
 
+	/** State of the local user's subscription that is kept when the
+	 * connection to the server has been lost. Authors are stored by
+	 * their IDs, so the state stays valid when the user table is
+	 * replaced on reconnect.
+	 */
+	class resume_state: private net6::non_copyable
+	{
+	public:
+		typedef std::pair<std::string, unsigned int> chunk;
+		typedef std::list<chunk> chunk_list;
+
+		resume_state(std::auto_ptr<algorithm_type> algorithm):
+			algorithm(algorithm) {}
+
+		chunk_list chunks;
+		std::auto_ptr<algorithm_type> algorithm;
+	};
+
 	/** Constructor which does not automatically create an underlaying
 	 * document.
 	 */
@@ -111,11 +132,41 @@ public:
 	 */
 	virtual void unsubscribe();
 
+	/** Sends a request to observe the document. The local user gets
+	 * the content and every change to it, but cannot change it. The
+	 * subscribe_event is emitted for the local user if the request
+	 * succeeded, other users do not see the local user subscribed.
+	 * Use unsubscribe() to stop observing. The server answers a
+	 * subscribe() request the same way if the local user does not
+	 * have the privilege to change the document.
+	 */
+	void observe();
+
+	/** @brief Returns whether the local user observes the document
+	 * or has sent a request to observe it.
+	 */
+	bool is_observing() const;
+
         /** @brief Returns the state of the local user's subscription to
 	 * this document.
 	 */
 	virtual subscription_state get_subscription_state() const;
 
+	/** Takes the state that is required to resume the local user's
+	 * subscription after the connection has been lost. Returns NULL if
+	 * the document has been changed while being disconnected or the
+	 * local user was not subscribed.
+	 */
+	std::auto_ptr<resume_state> release_resume_state();
+
+	/** Sends a request to resume the local user's subscription using
+	 * a state obtained from a document of an earlier connection. The
+	 * server performs a complete synchronisation if it cannot
+	 * resume the subscription.
+	 */
+	void resume(std::auto_ptr<resume_state> state,
+	            const std::string& token);
+
 	/** Called by the buffer if a network event occured that belongs to the
 	 * document.
 	 */
@@ -162,6 +213,19 @@ protected:
 	 */
 	virtual void on_net_unsubscribe(const document_packet& pack);
 
+	/** Resume command: The server accepted to resume the subscription.
+	 */
+	virtual void on_net_resume(const document_packet& pack);
+
+	/** Observe command: The local user observes the document.
+	 */
+	virtual void on_net_observe(const document_packet& pack);
+
+	/** Operation that has been applied to the document of the server,
+	 * sent to observers.
+	 */
+	virtual void on_net_operation(const document_packet& pack);
+
 	/** Callback from jupiter implementation with record of local operation
 	 * that has to be sent to the server.
 	 */
@@ -176,6 +240,20 @@ protected:
 	std::auto_ptr<jupiter_type> m_jupiter;
 	subscription_state m_subscription_state;
 
+	/** Whether the local user observes the document instead of being
+	 * subscribed to it.
+	 */
+	bool m_observing;
+
+	/** Algorithm state of the last connection, kept to be able to
+	 * resume the subscription.
+	 */
+	std::auto_ptr<algorithm_type> m_resume_algorithm;
+
+	/** State of a pending resume request.
+	 */
+	std::auto_ptr<resume_state> m_resume_state;
+
 public:
 	/** Returns the buffer to which this document_info belongs.
 	 */
@@ -202,7 +280,8 @@ basic_client_document_info<Document, Selector>::
 	                           const std::string& encoding):
 	base_type(buffer, net, owner, id, title, suffix, encoding),
 	base_local_type(buffer, net, owner, id, title, suffix, encoding),
-	m_subscription_state(base_local_type::UNSUBSCRIBED)
+	m_subscription_state(base_local_type::UNSUBSCRIBED),
+	m_observing(false)
 {
 	// If we created this document, the constructor with initial content
 	// should be called.
@@ -245,7 +324,8 @@ basic_client_document_info<Document, Selector>::
 		title,
 		encoding
 	),
-	m_subscription_state(base_local_type::SUBSCRIBED)
+	m_subscription_state(base_local_type::SUBSCRIBED),
+	m_observing(false)
 {
 	// content is provided, so we should have created this document
 	if(owner != &buffer.get_self() )
@@ -274,7 +354,8 @@ basic_client_document_info<Document, Selector>::
 	// TODO: Find a way to only extract the data once out of the packet
 	base_type(buffer, net, init_pack),
 	base_local_type(buffer, net, init_pack),
-	m_subscription_state(base_local_type::UNSUBSCRIBED)
+	m_subscription_state(base_local_type::UNSUBSCRIBED),
+	m_observing(false)
 {
 	// Load initially subscribed users
 	for(unsigned int i = 5; i < init_pack.get_param_count(); ++ i)
@@ -317,6 +398,14 @@ void basic_client_document_info<Document, Selector>::
 		);
 	}
 
+	if(m_observing)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::insert:\n"
+			"Local user observes the document"
+		);
+	}
+
 	// TODO: Deny insertion when state is not SUBSCRIBED
 
 	if(m_jupiter.get() != NULL)
@@ -326,7 +415,9 @@ void basic_client_document_info<Document, Selector>::
 	}
 	else
 	{
-		// No network connection available: Perform direct insertion
+		// No network connection available: Perform direct insertion.
+		// The server does not know about it, so we cannot resume.
+		m_resume_algorithm.reset(NULL);
 		base_type::m_document->insert(
 			pos,
 			text,
@@ -348,6 +439,14 @@ void basic_client_document_info<Document, Selector>::
 		);
 	}
 
+	if(m_observing)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::erase:\n"
+			"Local user observes the document"
+		);
+	}
+
 	// TODO: Deny erasure when state is not SUBSCRIBED
 
 	if(m_jupiter.get() != NULL)
@@ -357,6 +456,7 @@ void basic_client_document_info<Document, Selector>::
 	}
 	else
 	{
+		m_resume_algorithm.reset(NULL);
 		base_type::m_document->erase(pos, len);
 	}
 }
@@ -440,6 +540,40 @@ void basic_client_document_info<Document, Selector>::unsubscribe()
 	}
 }
 
+template<typename Document, typename Selector>
+void basic_client_document_info<Document, Selector>::observe()
+{
+	if(m_subscription_state == base_local_type::SUBSCRIBED ||
+	   m_subscription_state == base_local_type::SUBSCRIBING)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::observe:\n"
+			"Local user is already subscribed or has sent a "
+			"subscription request"
+		);
+	}
+
+	if(base_type::m_net == NULL)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::observe:\n"
+			"Cannot observe document without being connected"
+		);
+	}
+
+	document_packet pack(*this, "observe");
+	get_net6().send(pack);
+
+	m_subscription_state = base_local_type::SUBSCRIBING;
+	m_observing = true;
+}
+
+template<typename Document, typename Selector>
+bool basic_client_document_info<Document, Selector>::is_observing() const
+{
+	return m_observing;
+}
+
 template<typename Document, typename Selector>
 typename basic_client_document_info<Document, Selector>::subscription_state
 basic_client_document_info<Document, Selector>::get_subscription_state() const
@@ -447,6 +581,70 @@ basic_client_document_info<Document, Selector>::get_subscription_state() const
 	return m_subscription_state;
 }
 
+template<typename Document, typename Selector>
+std::auto_ptr<
+	typename basic_client_document_info<Document, Selector>::resume_state
+> basic_client_document_info<Document, Selector>::release_resume_state()
+{
+	if(m_resume_algorithm.get() == NULL ||
+	   base_type::m_document.get() == NULL)
+	{
+		return std::auto_ptr<resume_state>(NULL);
+	}
+
+	std::auto_ptr<resume_state> state(
+		new resume_state(m_resume_algorithm)
+	);
+
+	const document_type& doc = *base_type::m_document;
+	for(typename document_type::chunk_iterator iter = doc.chunk_begin();
+	    iter != doc.chunk_end();
+	    ++ iter)
+	{
+		const user* author = iter.get_author();
+		state->chunks.push_back(
+			typename resume_state::chunk(
+				iter.get_text(),
+				author == NULL ? 0 : author->get_id()
+			)
+		);
+	}
+
+	return state;
+}
+
+template<typename Document, typename Selector>
+void basic_client_document_info<Document, Selector>::
+	resume(std::auto_ptr<resume_state> state,
+	       const std::string& token)
+{
+	if(m_subscription_state != base_local_type::UNSUBSCRIBED)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::resume:\n"
+			"Local user is already subscribed or has sent a "
+			"subscription request"
+		);
+	}
+
+	if(base_type::m_net == NULL)
+	{
+		throw std::logic_error(
+			"obby::basic_client_document_info::resume:\n"
+			"Cannot resume subscription without being connected"
+		);
+	}
+
+	const vector_time& time = state->algorithm->get_time();
+
+	document_packet pack(*this, "resume");
+	pack << token << time.get_local() << time.get_remote();
+	get_net6().send(pack);
+
+	m_resume_state = state;
+	m_subscription_state = base_local_type::SUBSCRIBING;
+}
+
 template<typename Document, typename Selector>
 void basic_client_document_info<Document, Selector>::
 	on_net_packet(const document_packet& pack)
@@ -490,13 +688,28 @@ void basic_client_document_info<Document, Selector>::
 			);
 		}
 
-		// Create jupiter algorithm to merge changes
-		m_jupiter.reset(
-			new jupiter_type(
-				*basic_document_info<Document, Selector>::
-					m_document
-			)
-		);
+		// Create jupiter algorithm to merge changes, continue with
+		// the state of the last connection if the subscription has
+		// been resumed.
+		if(m_resume_algorithm.get() != NULL)
+		{
+			m_jupiter.reset(
+				new jupiter_type(
+					*basic_document_info<Document, Selector>::
+						m_document,
+					m_resume_algorithm
+				)
+			);
+		}
+		else
+		{
+			m_jupiter.reset(
+				new jupiter_type(
+					*basic_document_info<Document, Selector>::
+						m_document
+				)
+			);
+		}
 
 		// Add existing clients
 		for(typename base_type::user_iterator iter =
@@ -544,6 +757,8 @@ void basic_client_document_info<Document, Selector>::
 		base_type::release_document();
 		// Release jupiter algorithm
 		m_jupiter.reset(NULL);
+		m_resume_algorithm.reset(NULL);
+		m_observing = false;
 	}
 }
 
@@ -570,6 +785,15 @@ bool basic_client_document_info<Document, Selector>::
 	if(pack.get_command() == "unsubscribe")
 		{ on_net_unsubscribe(pack); return true; }
 
+	if(pack.get_command() == "resume")
+		{ on_net_resume(pack); return true; }
+
+	if(pack.get_command() == "observe")
+		{ on_net_observe(pack); return true; }
+
+	if(pack.get_command() == "operation")
+		{ on_net_operation(pack); return true; }
+
 	return false;
 }
 
@@ -635,6 +859,11 @@ void basic_client_document_info<Document, Selector>::
 		throw net6::bad_value(str.str() );
 	}
 
+	// The server could not resume the subscription and synchronises
+	// the whole document instead
+	m_resume_state.reset(NULL);
+	m_resume_algorithm.reset(NULL);
+
 	// Assign empty document
 	base_type::assign_document();
 }
@@ -701,6 +930,106 @@ void basic_client_document_info<Document, Selector>::
 	user_unsubscribe(*old_user);
 }
 
+template<typename Document, typename Selector>
+void basic_client_document_info<Document, Selector>::
+	on_net_resume(const document_packet& pack)
+{
+	if(m_resume_state.get() == NULL ||
+	   m_subscription_state != base_local_type::SUBSCRIBING)
+	{
+		format_string str(
+			"Got resume without having sent a resume request for "
+			"document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	// Restore the content we had when the connection was lost, the
+	// server sends the changes we missed after the subscription.
+	base_type::assign_document();
+
+	const user_table& table = base_type::m_buffer.get_user_table();
+	for(typename resume_state::chunk_list::const_iterator iter =
+		m_resume_state->chunks.begin();
+	    iter != m_resume_state->chunks.end();
+	    ++ iter)
+	{
+		const user* author = NULL;
+		if(iter->second != 0)
+		{
+			author = table.find(
+				iter->second,
+				user::flags::NONE,
+				user::flags::NONE
+			);
+		}
+
+		base_type::m_document->append(iter->first, author);
+	}
+
+	m_resume_algorithm = m_resume_state->algorithm;
+	m_resume_state.reset(NULL);
+}
+
+template<typename Document, typename Selector>
+void basic_client_document_info<Document, Selector>::
+	on_net_observe(const document_packet& pack)
+{
+	if(base_type::m_document.get() == NULL ||
+	   m_subscription_state != base_local_type::SUBSCRIBING)
+	{
+		format_string str(
+			"Got observe without having sent a subscription "
+			"request for document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	// No jupiter algorithm, the server sends the operations in the
+	// order it has applied them.
+	m_subscription_state = base_local_type::SUBSCRIBED;
+	m_observing = true;
+	basic_document_info<Document, Selector>::user_subscribe(
+		get_buffer().get_self()
+	);
+}
+
+template<typename Document, typename Selector>
+void basic_client_document_info<Document, Selector>::
+	on_net_operation(const document_packet& pack)
+{
+	if(!m_observing || base_type::m_document.get() == NULL)
+	{
+		format_string str(
+			"Got operation without observing document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	const user* author = pack.get_param(0).net6::parameter::as<const user*>(
+		::serialise::hex_context_from<const user*>(
+			get_buffer().get_user_table()
+		)
+	);
+
+	unsigned int index = 1 + 2;
+	std::auto_ptr<operation_type> op(
+		operation_type::from_packet(
+			pack,
+			index,
+			base_type::m_buffer.get_user_table()
+		)
+	);
+
+	op->apply(*base_type::m_document, author);
+}
+
 template<typename Document, typename Selector>
 void basic_client_document_info<Document, Selector>::
 	on_jupiter_record(const record_type& rec,
@@ -717,8 +1046,17 @@ template<typename Document, typename Selector>
 void basic_client_document_info<Document, Selector>::session_close_impl()
 {
 	// Jupiter has been reset, but we are still subscribed if
-	// m_document exists.
+	// m_document exists. Keep the algorithm's state to resume the
+	// subscription on reconnect.
+	if(m_jupiter.get() != NULL)
+		m_resume_algorithm = m_jupiter->release_algorithm();
+
 	m_jupiter.reset(NULL);
+	m_resume_state.reset(NULL);
+
+	// Observers have no state to resume, the document may be edited
+	// locally now.
+	m_observing = false;
 }
 
 
@@ -19,6 +19,7 @@
 #ifndef _OBBY_COMMON_HPP_
 #define _OBBY_COMMON_HPP_
 
+#include <string>
 #include "net6/gettext_package.hpp"
 
 extern "C" {
@@ -46,6 +47,12 @@ void init_gettext(net6::gettext_package& package);
  */
 const char* _(const char* msgid);
 
+/** Returns 128 random bits in hexadecimal notation. They are read from the
+ * system's entropy source if there is one, otherwise they are derived from
+ * the current time and the process ID.
+ */
+std::string random_token();
+
 extern const bool IPV6_ENABLED;
 
 }
@@ -29,6 +29,7 @@
 #include "user.hpp"
 #include "document_packet.hpp"
 #include "serialise/object.hpp"
+#include "serialise/writer.hpp"
 
 namespace obby
 {
@@ -151,9 +152,17 @@ public:
 	                    net_type& net,
 	                    const net6::packet& init_pack);
 
-	/** Serialises the document into the given serialisation object.
+	virtual ~basic_document_info();
+
+	/** Returns whether the document may be serialised, which requires
+	 * its content to be available.
+	 */
+	virtual bool can_serialise() const;
+
+	/** Writes the document's attributes and content to the current
+	 * object of <em>writer</em>.
 	 */
-	void serialise(serialise::object& obj) const;
+	virtual void serialise(serialise::writer& writer) const;
 
 	/** Returns the owner of this document. It may return NULL if the
 	 * document has no owner (indicating that the server created the
@@ -265,6 +274,15 @@ protected:
 	void document_rename(const std::string& title,
 	                     unsigned int suffix);
 
+	/** Called by get_content() if the content is not in memory.
+	 * Documents that keep it elsewhere load it here.
+	 */
+	virtual void load_content() const;
+
+	/** Serialises the document's attributes, but not its content.
+	 */
+	void serialise_attributes(serialise::writer& writer) const;
+
 	/** Internal function to create the underlaying document.
 	 */
 	void assign_document();
@@ -801,9 +819,20 @@ basic_document_info<Document, Selector>::
 {
 }
 
+template<typename Document, typename Selector>
+basic_document_info<Document, Selector>::~basic_document_info()
+{
+}
+
+template<typename Document, typename Selector>
+bool basic_document_info<Document, Selector>::can_serialise() const
+{
+	return m_document.get() != NULL;
+}
+
 template<typename Document, typename Selector>
 void basic_document_info<Document, Selector>::
-	serialise(serialise::object& obj) const
+	serialise(serialise::writer& writer) const
 {
 	/* Cannot serialise an object whose content we do not have */
 	if(m_document.get() == NULL)
@@ -814,22 +843,17 @@ void basic_document_info<Document, Selector>::
 		);
 	}
 
-	obj.add_attribute("owner").set_value(m_owner);
-	obj.add_attribute("id").set_value(m_id);
-	obj.add_attribute("title").set_value(m_title);
-	obj.add_attribute("suffix").set_value(m_suffix);
-	obj.add_attribute("encoding").set_value(m_encoding);
+	serialise_attributes(writer);
 
 	for(typename document_type::chunk_iterator chunk_it =
 		m_document->chunk_begin();
 	    chunk_it != m_document->chunk_end();
 	    ++ chunk_it)
 	{
-		serialise::object& chunk = obj.add_child();
-		chunk.set_name("chunk");
-
-		chunk.add_attribute("content").set_value(chunk_it.get_text() );
-		chunk.add_attribute("author").set_value(chunk_it.get_author() );
+		writer.begin_object("chunk");
+		writer.add_attribute("content", chunk_it.get_text() );
+		writer.add_attribute("author", chunk_it.get_author() );
+		writer.end_object();
 	}
 }
 
@@ -888,6 +912,9 @@ const std::string& basic_document_info<Document, Selector>::get_encoding() const
 template<typename Document, typename Selector>
 const Document& basic_document_info<Document, Selector>::get_content() const
 {
+	if(m_document.get() == NULL)
+		load_content();
+
 	if(m_document.get() == NULL)
 	{
 		throw std::logic_error(
@@ -1024,6 +1051,17 @@ void basic_document_info<Document, Selector>::
 	m_signal_rename.emit(title);
 }
 
+template<typename Document, typename Selector>
+void basic_document_info<Document, Selector>::
+	serialise_attributes(serialise::writer& writer) const
+{
+	writer.add_attribute("owner", m_owner);
+	writer.add_attribute("id", m_id);
+	writer.add_attribute("title", m_title);
+	writer.add_attribute("suffix", m_suffix);
+	writer.add_attribute("encoding", m_encoding);
+}
+
 template<typename Document, typename Selector>
 void basic_document_info<Document, Selector>::assign_document()
 {
@@ -1038,6 +1076,11 @@ void basic_document_info<Document, Selector>::release_document()
 	m_document.reset(NULL);
 }
 
+template<typename Document, typename Selector>
+void basic_document_info<Document, Selector>::load_content() const
+{
+}
+
 template<typename Document, typename Selector>
 void basic_document_info<Document, Selector>::session_close_impl()
 {
@@ -1114,7 +1157,13 @@ template<typename Document, typename Selector>
 void basic_document_info<Document, Selector>::privileges_table::
 	privileges_change(const user& user, privileges privs)
 {
-	m_privs[&user] = privs;
+	// privileges has no default constructor for operator[]
+	typename priv_map::iterator iter = m_privs.find(&user);
+	if(iter == m_privs.end() )
+		m_privs.insert(std::make_pair(&user, privs) );
+	else
+		iter->second = privs;
+
 	m_signal_privileges_changed.emit(user, privs);
 }
 
@@ -0,0 +1,143 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_EPOLL_SELECTOR_HPP_
+#define _OBBY_EPOLL_SELECTOR_HPP_
+
+#include <map>
+#include <set>
+#include <vector>
+#include <net6/socket.hpp>
+#include <net6/non_copyable.hpp>
+
+namespace obby
+{
+
+/** Selector built on Linux' epoll, to be used as the Selector parameter
+ * of the buffers instead of net6::selector, for example with
+ * basic_server_buffer<obby::document, obby::epoll_selector>.
+ *
+ * net6::selector passes every socket to select() on each call, which
+ * costs time proportional to the number of connections and limits them
+ * to FD_SETSIZE. Sockets are registered with the kernel edge-triggered
+ * once, a call to select() only sees the sockets that became ready.
+ * Because the handlers of net6 read and write a bounded amount of data
+ * per event, a socket that has been reported stays on a ready list and
+ * is reported again as long as it is still ready. Timeouts are kept
+ * ordered by their deadline.
+ */
+class epoll_selector: private net6::non_copyable
+{
+public:
+	epoll_selector();
+	~epoll_selector();
+
+	/** Returns the conditions <em>sock</em> is watched for.
+	 */
+	net6::io_condition get(const net6::socket& sock) const;
+
+	/** Watches <em>sock</em> for <em>cond</em>. IO_NONE stops watching
+	 * it.
+	 */
+	void set(const net6::socket& sock, net6::io_condition cond);
+
+	/** Returns the milliseconds until the timeout of <em>sock</em>
+	 * elapses, or zero if it has none.
+	 */
+	unsigned long get_timeout(const net6::socket& sock) const;
+
+	/** Emits IO_TIMEOUT on <em>sock</em> after <em>timeout</em>
+	 * milliseconds. The socket has to be watched for IO_TIMEOUT; it is
+	 * no longer once the timeout has elapsed.
+	 */
+	void set_timeout(const net6::socket& sock, unsigned long timeout);
+
+	/** Waits until a watched socket is ready or a timeout elapses and
+	 * emits the io_event of the sockets concerned.
+	 */
+	void select();
+
+	/** Like select(), but waits at most <em>timeout</em> milliseconds.
+	 */
+	void select(unsigned long timeout);
+
+protected:
+	struct watch
+	{
+		const net6::socket* sock;
+		/** Conditions the socket is watched for.
+		 */
+		net6::io_condition cond;
+		/** Conditions the socket has last been seen ready for.
+		 */
+		net6::io_condition ready;
+		/** File descriptor the kernel watches for this socket, or -1.
+		 */
+		int fd;
+		/** Whether the socket is on the ready list.
+		 */
+		bool queued;
+		/** Deadline of the timeout, if the socket has one.
+		 */
+		unsigned long deadline;
+	};
+
+	typedef std::map<const net6::socket*, watch*> watch_map;
+	typedef std::map<int, watch*> fd_map;
+	typedef std::set<std::pair<unsigned long, const net6::socket*> >
+		timer_set;
+	typedef std::vector<const net6::socket*> socket_list;
+
+	/** Waits at most <em>timeout</em> milliseconds, or without limit if
+	 * it is negative, and emits the events.
+	 */
+	void wait(long timeout);
+
+	/** Polls the sockets on the ready list for the conditions they
+	 * have been reported for and removes the ones that would block.
+	 */
+	void recheck();
+
+	/** Registers or unregisters the file descriptor of <em>w</em> with
+	 * the kernel and puts it on the ready list if needed.
+	 */
+	void update(watch& w);
+
+	/** Stops watching the socket of <em>iter</em>.
+	 */
+	void remove(watch_map::iterator iter);
+
+	/** Returns the time in milliseconds from an arbitrary point.
+	 */
+	static unsigned long now();
+
+	int m_epoll;
+
+	watch_map m_watches;
+	fd_map m_fds;
+	timer_set m_timers;
+
+	/** Sockets that may be ready without the kernel reporting them
+	 * again.
+	 */
+	socket_list m_ready;
+};
+
+} // namespace obby
+
+#endif // _OBBY_EPOLL_SELECTOR_HPP_
@@ -119,6 +119,15 @@ protected:
 	virtual base_document_info_type*
 	new_document_info(const serialise::object& obj);
 
+	/** Creates a new document info whose content is loaded from
+	 * <em>source</em> when it is first needed.
+	 */
+	virtual base_document_info_type*
+	new_document_info(const serialise::object& obj,
+	                  const serialise::mapped_file& source,
+	                  std::size_t offset,
+	                  unsigned int line);
+
 	/** Creates the underlaying net6 network object corresponding to the
 	 * buffer's type.
 	 */
@@ -354,6 +363,7 @@ void basic_host_buffer<Document, Selector>::session_close()
 {
 	session_close_impl();
 	basic_local_buffer<Document, Selector>::session_close_impl();
+	basic_server_buffer<Document, Selector>::flush();
 	basic_buffer<Document, Selector>::session_close_impl();
 }
 
@@ -405,6 +415,24 @@ basic_host_buffer<Document, Selector>::
 	return new document_info_type(*this, net6_host(), obj);
 }
 
+template<typename Document, typename Selector>
+typename basic_host_buffer<Document, Selector>::base_document_info_type*
+basic_host_buffer<Document, Selector>::
+	new_document_info(const serialise::object& obj,
+	                  const serialise::mapped_file& source,
+	                  std::size_t offset,
+	                  unsigned int line)
+{
+	return new document_info_type(
+		*this,
+		net6_host(),
+		obj,
+		source,
+		offset,
+		line
+	);
+}
+
 template<typename Document, typename Selector>
 typename basic_host_buffer<Document, Selector>::base_net_type*
 basic_host_buffer<Document, Selector>::new_net()
@@ -61,6 +61,13 @@ public:
 	                         net_type& net,
 	                         const serialise::object& obj);
 
+	basic_host_document_info(const buffer_type& buffer,
+	                         net_type& net,
+	                         const serialise::object& obj,
+	                         const serialise::mapped_file& source,
+	                         std::size_t offset,
+	                         unsigned int line);
+
 	/** Inserts the given text at the given position into the document.
 	 */
 	virtual void insert(position pos, const std::string& text);
@@ -153,6 +160,20 @@ basic_host_document_info<Document, Selector>::
 {
 }
 
+template<typename Document, typename Selector>
+basic_host_document_info<Document, Selector>::
+	basic_host_document_info(const buffer_type& buffer,
+	                         net_type& net,
+	                         const serialise::object& obj,
+	                         const serialise::mapped_file& source,
+	                         std::size_t offset,
+	                         unsigned int line):
+	base_type(buffer, net, obj),
+	base_local_type(buffer, net, obj),
+	base_server_type(buffer, net, obj, source, offset, line)
+{
+}
+
 template<typename Document, typename Selector>
 void basic_host_document_info<Document, Selector>::
 	insert(position pos,
@@ -221,6 +242,7 @@ void basic_host_document_info<Document, Selector>::
 
 	// Do not call server function because it will add the client to
 	// jupiter in any case.
+	base_server_type::swap_in();
 	base_type::user_subscribe(user);
 
 	// Add client to jupiter if it is not the local client
@@ -229,6 +251,9 @@ void basic_host_document_info<Document, Selector>::
 	{
 		base_server_type::m_jupiter->client_add(user);
 	}
+
+	// Not idle anymore
+	base_server_type::document_used();
 }
 
 template<typename Document, typename Selector>
@@ -244,6 +269,9 @@ void basic_host_document_info<Document, Selector>::
 
 	// Call base function
 	base_type::user_unsubscribe(user);
+
+	if(base_type::user_count() == 0)
+		base_server_type::document_used();
 }
 
 template<typename Document, typename Selector>
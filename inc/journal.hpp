@@ -0,0 +1,112 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_JOURNAL_HPP_
+#define _OBBY_JOURNAL_HPP_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <list>
+#include <net6/non_copyable.hpp>
+
+namespace obby
+{
+
+/** Append-only log of changes to a session.
+ *
+ * Each entry is a list of strings. Entries are collected in memory and
+ * written to the file by commit(), which syncs the file to disk once for
+ * all entries appended since the last commit. Every entry is framed with
+ * its length and a checksum, so an entry that has not been written
+ * completely because of a crash is recognised and ignored by read().
+ */
+class journal: private net6::non_copyable
+{
+public:
+	typedef std::vector<std::string> entry;
+	typedef std::list<entry> entry_list;
+
+	/** Opens <em>file</em> for appending, it is created if it does not
+	 * exist. Throws std::runtime_error if the file could not be opened.
+	 */
+	journal(const std::string& file);
+
+	/** Commits pending entries and closes the file. Errors are
+	 * ignored.
+	 */
+	~journal();
+
+	/** Returns the name of the journal file.
+	 */
+	const std::string& get_file() const;
+
+	/** Returns the size of the journal file including entries that
+	 * have not yet been committed.
+	 */
+	unsigned long get_size() const;
+
+	/** Returns whether there are entries that have not yet been
+	 * committed.
+	 */
+	bool has_pending() const;
+
+	/** Appends an entry. It is not written before the next commit().
+	 */
+	void append(const entry& ent);
+
+	/** Writes all pending entries to the file and waits until they
+	 * have reached the disk. Throws std::runtime_error if writing
+	 * fails.
+	 */
+	void commit();
+
+	/** Commits pending entries, then replaces all entries before
+	 * <em>offset</em> by <em>header</em>. <em>offset</em> is a size
+	 * returned by get_size() after a commit().
+	 */
+	void truncate(unsigned long offset, const entry& header);
+
+	/** Reads all complete entries from <em>file</em> into
+	 * <em>entries</em>. Reading stops at the first incomplete or damaged
+	 * entry. Nothing is read if the file does not exist.
+	 */
+	static void read(const std::string& file, entry_list& entries);
+
+	/** Waits until the content of <em>file</em> has reached the disk.
+	 */
+	static void sync(const std::string& file);
+
+protected:
+	void open(const char* mode);
+
+	std::string m_file;
+	std::FILE* m_fp;
+
+	/** Entries that have not yet been committed.
+	 */
+	std::string m_pending;
+
+	/** Size of the committed part of the file.
+	 */
+	unsigned long m_size;
+};
+
+} // namespace obby
+
+#endif // _OBBY_JOURNAL_HPP_
@@ -48,6 +48,22 @@ public:
 	 * the given record.
 	 */
 	std::auto_ptr<operation_type> remote_op(const record_type& rec);
+
+	/** Returns the current state of the algorithm.
+	 */
+	const vector_time& get_time() const;
+
+	/** Returns the number of local operations the remote host has not
+	 * acknowledged yet.
+	 */
+	std::size_t get_ack_count() const;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	/** Returns how many times a remote operation has been transformed
+	 * against a local one.
+	 */
+	unsigned long get_transform_count() const;
+#endif
 protected:
 	/** Helper class that stores an operation with the current local
 	 * operation count.
@@ -103,6 +119,10 @@ protected:
 
 	vector_time m_time;
 	ack_list_type m_ack_list;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	mutable unsigned long m_transform_count;
+#endif
 };
 
 template<typename Document>
@@ -151,6 +171,9 @@ void jupiter_algorithm<Document>::operation_storage::
 template<typename Document>
 jupiter_algorithm<Document>::jupiter_algorithm():
 	m_time(0, 0)
+#ifndef OBBY_DISABLE_STATISTICS
+	, m_transform_count(0)
+#endif
 {
 }
 
@@ -186,6 +209,26 @@ jupiter_algorithm<Document>::remote_op(const record_type& rec)
 	return op;
 }
 
+template<typename Document>
+const vector_time& jupiter_algorithm<Document>::get_time() const
+{
+	return m_time;
+}
+
+template<typename Document>
+std::size_t jupiter_algorithm<Document>::get_ack_count() const
+{
+	return m_ack_list.size();
+}
+
+#ifndef OBBY_DISABLE_STATISTICS
+template<typename Document>
+unsigned long jupiter_algorithm<Document>::get_transform_count() const
+{
+	return m_transform_count;
+}
+#endif
+
 template<typename Document>
 void jupiter_algorithm<Document>::discard_operations(const record_type& rec)
 {
@@ -233,6 +276,10 @@ jupiter_algorithm<Document>::transform(const operation_type& op) const
 		);
 
 		new_op.reset(new_trans_op);
+
+#ifndef OBBY_DISABLE_STATISTICS
+		++ m_transform_count;
+#endif
 	}
 
 	return new_op;
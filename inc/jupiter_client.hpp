@@ -48,6 +48,18 @@ public:
 	 */
 	jupiter_client(document_type& doc);
 
+	/** Creates a new jupiter_client that continues with the state of
+	 * an algorithm taken from an earlier connection to the server.
+	 */
+	jupiter_client(document_type& doc,
+	               std::auto_ptr<algorithm_type> algorithm);
+
+	/** Releases the algorithm, for example to resume the session after
+	 * the connection to the server has been lost. The jupiter_client
+	 * must not be used anymore afterwards.
+	 */
+	std::auto_ptr<algorithm_type> release_algorithm();
+
 	/** Adds a new client to the jupiter algorithm.
 	 */
 	void client_add(const user& client);
@@ -76,7 +88,7 @@ public:
 	signal_record_type record_event() const;
 
 protected:
-	algorithm_type m_algorithm;
+	std::auto_ptr<algorithm_type> m_algorithm;
 	undo_type m_undo;
 
 	document_type& m_document;
@@ -85,8 +97,23 @@ protected:
 
 template<typename Document>
 jupiter_client<Document>::jupiter_client(document_type& doc):
-	m_undo(doc), m_document(doc)
+	m_algorithm(new algorithm_type), m_undo(doc), m_document(doc)
+{
+}
+
+template<typename Document>
+jupiter_client<Document>::
+	jupiter_client(document_type& doc,
+	               std::auto_ptr<algorithm_type> algorithm):
+	m_algorithm(algorithm), m_undo(doc), m_document(doc)
+{
+}
+
+template<typename Document>
+std::auto_ptr<typename jupiter_client<Document>::algorithm_type>
+jupiter_client<Document>::release_algorithm()
 {
+	return m_algorithm;
 }
 
 template<typename Document>
@@ -107,7 +134,7 @@ void jupiter_client<Document>::local_op(const operation_type& op,
 {
 	op.apply(m_document, from);
 	m_undo.local_op(op, from);
-	std::auto_ptr<record_type> rec(m_algorithm.local_op(op) );
+	std::auto_ptr<record_type> rec(m_algorithm->local_op(op) );
 	m_signal_record.emit(*rec, from);
 }
 
@@ -115,7 +142,7 @@ template<typename Document>
 void jupiter_client<Document>::remote_op(const record_type& rec,
                                          const user* from)
 {
-	std::auto_ptr<operation_type> op(m_algorithm.remote_op(rec) );
+	std::auto_ptr<operation_type> op(m_algorithm->remote_op(rec) );
 	op->apply(m_document, from);
 	m_undo.remote_op(*op, from);
 }
@@ -125,7 +152,7 @@ void jupiter_client<Document>::undo_op(const user* from)
 {
 	std::auto_ptr<operation_type> op = m_undo.undo();
 	op->apply(m_document, from);
-	std::auto_ptr<record_type> rec(m_algorithm.local_op(*op) );
+	std::auto_ptr<record_type> rec(m_algorithm->local_op(*op) );
 	m_signal_record.emit(*rec, from);
 }
 
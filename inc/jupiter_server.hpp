@@ -20,6 +20,7 @@
 #define _OBBY_JUPITER_SERVER_HPP_
 
 #include <map>
+#include <list>
 #include <net6/non_copyable.hpp>
 #include "operation.hpp"
 #include "record.hpp"
@@ -30,6 +31,12 @@ namespace obby
 {
 
 /** Jupiter server implementation.
+ *
+ * The server keeps the records it sent to a client until the client
+ * acknowledged them. This allows a client that lost its connection to
+ * resume its state without transmitting the whole document again, as long
+ * as not more than <em>history_size</em> records were generated for it in
+ * the meantime.
  */
 template<typename Document>
 class jupiter_server: private net6::non_copyable
@@ -43,14 +50,19 @@ public:
 
 	typedef sigc::signal<void, const record_type&, const user&, const user*>
 		signal_record_type;
+	typedef sigc::signal<void, const operation_type&, const user*>
+		signal_apply_type;
 
 	/** Creates a new jupiter_server which uses the given document.
 	 * Local and remote changes are applied to this document.
+	 * <em>history_size</em> is the maximum amount of unacknowledged
+	 * records that are stored per client.
 	 */
-	jupiter_server(document_type& doc);
+	jupiter_server(document_type& doc, unsigned int history_size = 256);
 	~jupiter_server();
 
-	/** Adds a new client to the server.
+	/** Adds a new client to the server. State that has been kept for
+	 * this client by client_detach is dropped.
 	 */
 	void client_add(const user& client);
 
@@ -58,6 +70,23 @@ public:
 	 */
 	void client_remove(const user& client);
 
+	/** Removes a client from the server, but keeps its state to
+	 * allow it to resume later via client_resume. The state is dropped
+	 * as soon as more changes happened than the history may hold.
+	 */
+	void client_detach(const user& client);
+
+	/** Checks whether a client that has been detached may be resumed
+	 * from the given state. <em>time</em> is the state of the
+	 * client's algorithm.
+	 */
+	bool can_resume(const user& client, const vector_time& time) const;
+
+	/** Resumes a detached client. record_event is emitted for each
+	 * record the client has not yet received in its state <em>time</em>.
+	 */
+	void client_resume(const user& client, const vector_time& time);
+
 	/** Performs a local operation by the user <em>from</em>. record_event
 	 * will be emitted for each client with a corresponding
 	 * record that may be transmitted to it.
@@ -76,23 +105,104 @@ public:
 	 */
 	void undo_op(const user* from);
 
+	/** Returns the number of records that have been sent to
+	 * <em>client</em> but have not been acknowledged yet, or 0 if the
+	 * client is not known.
+	 */
+	std::size_t get_ack_count(const user& client) const;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	/** Returns how many operations have been transformed for all
+	 * clients there have been.
+	 */
+	unsigned long get_transform_count() const;
+#endif
+
 	/** Signal which will be emitted when a local operation has been
 	 * applied.
 	 */
 	signal_record_type record_event() const;
+
+	/** Signal which will be emitted for every operation that has been
+	 * applied to the document, with the user who caused it.
+	 */
+	signal_apply_type apply_event() const;
 protected:
-	typedef std::map<const user*, algorithm_type*> client_map;
+	/** Record that has been generated for a client, together with the
+	 * user who caused it.
+	 */
+	class history_entry: private net6::non_copyable
+	{
+	public:
+		history_entry(std::auto_ptr<record_type> rec,
+		              const user* author):
+			m_record(rec), m_author(author) {}
+
+		const record_type& get_record() const { return *m_record; }
+		const user* get_author() const { return m_author; }
+	protected:
+		std::auto_ptr<record_type> m_record;
+		const user* m_author;
+	};
+
+	typedef std::list<history_entry*> history_list;
+
+	/** Per-client state.
+	 */
+	struct client_state
+	{
+		algorithm_type* algorithm;
+		history_list history;
+	};
+
+	typedef std::map<const user*, client_state> client_map;
+
+	/** Transforms <em>op</em> for each client except
+	 * <em>except</em> and emits the resulting records to the
+	 * attached ones.
+	 */
+	void broadcast_op(const operation_type& op,
+	                  const user* from,
+	                  const user* except);
+
+	/** Appends a record to the history of <em>state</em>. Returns
+	 * false if the oldest record had to be dropped to make room.
+	 */
+	bool history_push(client_state& state,
+	                  std::auto_ptr<record_type> rec,
+	                  const user* author);
+
+	/** Drops all records up to the local time <em>count</em>.
+	 */
+	void history_discard(client_state& state, unsigned int count);
+
+	/** Releases all resources held by <em>state</em>.
+	 */
+	void state_free(client_state& state);
 
 	client_map m_clients;
+	client_map m_detached;
 	document_type& m_document;
 	undo_type m_undo;
+	unsigned int m_history_size;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	/** Transformations done for clients that have been released.
+	 */
+	unsigned long m_transform_count;
+#endif
 
 	signal_record_type m_signal_record;
+	signal_apply_type m_signal_apply;
 };
 
 template<typename Document>
-jupiter_server<Document>::jupiter_server(document_type& doc):
-	m_document(doc), m_undo(doc)
+jupiter_server<Document>::jupiter_server(document_type& doc,
+                                         unsigned int history_size):
+	m_document(doc), m_undo(doc), m_history_size(history_size)
+#ifndef OBBY_DISABLE_STATISTICS
+	, m_transform_count(0)
+#endif
 {
 }
 
@@ -103,7 +213,14 @@ jupiter_server<Document>::~jupiter_server()
 	    iter != m_clients.end();
 	    ++ iter)
 	{
-		delete iter->second;
+		state_free(iter->second);
+	}
+
+	for(typename client_map::iterator iter = m_detached.begin();
+	    iter != m_detached.end();
+	    ++ iter)
+	{
+		state_free(iter->second);
 	}
 }
 
@@ -118,7 +235,14 @@ void jupiter_server<Document>::client_add(const user& client)
 		);
 	}
 
-	m_clients[&client] = new algorithm_type;
+	typename client_map::iterator detached = m_detached.find(&client);
+	if(detached != m_detached.end() )
+	{
+		state_free(detached->second);
+		m_detached.erase(detached);
+	}
+
+	m_clients[&client].algorithm = new algorithm_type;
 }
 
 template<typename Document>
@@ -133,24 +257,91 @@ void jupiter_server<Document>::client_remove(const user& client)
 		);
 	}
 
-	delete iter->second;
+	state_free(iter->second);
 	m_clients.erase(iter);
 }
 
+template<typename Document>
+void jupiter_server<Document>::client_detach(const user& client)
+{
+	typename client_map::iterator iter = m_clients.find(&client);
+	if(iter == m_clients.end() )
+	{
+		throw std::logic_error(
+			"obby::jupiter_server::client_detach:\n"
+			"Client has not been added"
+		);
+	}
+
+	// The history list holds pointers only, so copying it over is cheap
+	m_detached[&client] = iter->second;
+	m_clients.erase(iter);
+}
+
+template<typename Document>
+bool jupiter_server<Document>::can_resume(const user& client,
+                                          const vector_time& time) const
+{
+	typename client_map::const_iterator iter = m_detached.find(&client);
+	if(iter == m_detached.end() ) return false;
+
+	const vector_time& server_time = iter->second.algorithm->get_time();
+
+	// All operations the client sent must have arrived here
+	if(time.get_local() != server_time.get_remote() ) return false;
+	if(time.get_remote() > server_time.get_local() ) return false;
+
+	// The history must cover everything the client did not yet receive
+	if(time.get_remote() == server_time.get_local() ) return true;
+
+	const history_list& history = iter->second.history;
+	if(history.empty() ) return false;
+
+	return history.front()->get_record().get_time().get_local() <=
+		time.get_remote();
+}
+
+template<typename Document>
+void jupiter_server<Document>::client_resume(const user& client,
+                                             const vector_time& time)
+{
+	if(!can_resume(client, time) )
+	{
+		throw std::logic_error(
+			"obby::jupiter_server::client_resume:\n"
+			"Client cannot be resumed from the given state"
+		);
+	}
+
+	typename client_map::iterator detached = m_detached.find(&client);
+	client_state& state = m_clients[&client];
+	state = detached->second;
+	m_detached.erase(detached);
+
+	// Records the client already received are acknowledged implicitly
+	history_discard(state, time.get_remote() );
+
+	for(typename history_list::const_iterator iter = state.history.begin();
+	    iter != state.history.end();
+	    ++ iter)
+	{
+		m_signal_record.emit(
+			(*iter)->get_record(),
+			client,
+			(*iter)->get_author()
+		);
+	}
+}
+
 template<typename Document>
 void jupiter_server<Document>::local_op(const operation_type& op,
                                         const user* from)
 {
 	op.apply(m_document, from);
 	m_undo.local_op(op, from);
+	m_signal_apply.emit(op, from);
 
-	for(typename client_map::iterator iter = m_clients.begin();
-	    iter != m_clients.end();
-	    ++ iter)
-	{
-		std::auto_ptr<record_type> rec = iter->second->local_op(op);
-		m_signal_record.emit(*rec, *iter->first, from);
-	}
+	broadcast_op(op, from, NULL);
 }
 
 template<typename Document>
@@ -166,20 +357,15 @@ void jupiter_server<Document>::remote_op(const record_type& rec,
 		);
 	}
 
-	std::auto_ptr<operation_type> op = iter->second->remote_op(rec);
+	std::auto_ptr<operation_type> op =
+		iter->second.algorithm->remote_op(rec);
+	history_discard(iter->second, rec.get_time().get_remote() );
+
 	op->apply(m_document, from);
 	m_undo.remote_op(*op, from);
+	m_signal_apply.emit(*op, from);
 
-	for(iter = m_clients.begin(); iter != m_clients.end(); ++ iter)
-	{
-		if(iter->first != from)
-		{
-			std::auto_ptr<record_type> rec =
-				iter->second->local_op(*op);
-
-			m_signal_record.emit(*rec, *iter->first, from);
-		}
-	}
+	broadcast_op(*op, from, from);
 }
 
 template<typename Document>
@@ -187,15 +373,42 @@ void jupiter_server<Document>::undo_op(const user* from)
 {
 	std::auto_ptr<operation_type> op = m_undo.undo();
 	op->apply(m_document, from);
+	m_signal_apply.emit(*op, from);
 
-	for(typename client_map::iterator iter = m_clients.begin();
+	broadcast_op(*op, from, NULL);
+}
+
+template<typename Document>
+std::size_t jupiter_server<Document>::get_ack_count(const user& client) const
+{
+	typename client_map::const_iterator iter = m_clients.find(&client);
+	if(iter == m_clients.end() ) return 0;
+	return iter->second.algorithm->get_ack_count();
+}
+
+#ifndef OBBY_DISABLE_STATISTICS
+template<typename Document>
+unsigned long jupiter_server<Document>::get_transform_count() const
+{
+	unsigned long count = m_transform_count;
+
+	for(typename client_map::const_iterator iter = m_clients.begin();
 	    iter != m_clients.end();
 	    ++ iter)
 	{
-		std::auto_ptr<record_type> rec = iter->second->local_op(*op);
-		m_signal_record.emit(*rec, *iter->first, from);
+		count += iter->second.algorithm->get_transform_count();
+	}
+
+	for(typename client_map::const_iterator iter = m_detached.begin();
+	    iter != m_detached.end();
+	    ++ iter)
+	{
+		count += iter->second.algorithm->get_transform_count();
 	}
+
+	return count;
 }
+#endif
 
 template<typename Document>
 typename jupiter_server<Document>::signal_record_type
@@ -204,6 +417,105 @@ jupiter_server<Document>::record_event() const
 	return m_signal_record;
 }
 
+template<typename Document>
+typename jupiter_server<Document>::signal_apply_type
+jupiter_server<Document>::apply_event() const
+{
+	return m_signal_apply;
+}
+
+template<typename Document>
+void jupiter_server<Document>::broadcast_op(const operation_type& op,
+                                            const user* from,
+                                            const user* except)
+{
+	for(typename client_map::iterator iter = m_clients.begin();
+	    iter != m_clients.end();
+	    ++ iter)
+	{
+		if(iter->first == except) continue;
+
+		std::auto_ptr<record_type> rec =
+			iter->second.algorithm->local_op(op);
+
+		m_signal_record.emit(*rec, *iter->first, from);
+		history_push(iter->second, rec, from);
+	}
+
+	for(typename client_map::iterator iter = m_detached.begin();
+	    iter != m_detached.end(); )
+	{
+		std::auto_ptr<record_type> rec =
+			iter->second.algorithm->local_op(op);
+
+		// Drop the client's state when it cannot be resumed anymore
+		if(!history_push(iter->second, rec, from) )
+		{
+			state_free(iter->second);
+			m_detached.erase(iter ++);
+		}
+		else
+		{
+			++ iter;
+		}
+	}
+}
+
+template<typename Document>
+bool jupiter_server<Document>::history_push(client_state& state,
+                                            std::auto_ptr<record_type> rec,
+                                            const user* author)
+{
+	state.history.push_back(new history_entry(rec, author) );
+
+	// Records in the history are consecutive, so their local times
+	// tell how many there are.
+	unsigned int first = state.history.front()->
+		get_record().get_time().get_local();
+	unsigned int last = state.history.back()->
+		get_record().get_time().get_local();
+
+	if(last - first < m_history_size) return true;
+
+	delete state.history.front();
+	state.history.pop_front();
+	return false;
+}
+
+template<typename Document>
+void jupiter_server<Document>::history_discard(client_state& state,
+                                               unsigned int count)
+{
+	while(!state.history.empty() &&
+	      state.history.front()->get_record().get_time().get_local() <
+	      count)
+	{
+		delete state.history.front();
+		state.history.pop_front();
+	}
+}
+
+template<typename Document>
+void jupiter_server<Document>::state_free(client_state& state)
+{
+	for(typename history_list::iterator iter = state.history.begin();
+	    iter != state.history.end();
+	    ++ iter)
+	{
+		delete *iter;
+	}
+
+	state.history.clear();
+
+#ifndef OBBY_DISABLE_STATISTICS
+	if(state.algorithm != NULL)
+		m_transform_count += state.algorithm->get_transform_count();
+#endif
+
+	delete state.algorithm;
+	state.algorithm = NULL;
+}
+
 } // namespace obby
 
 #endif // _OBBY_JUPITER_SERVER_HPP_
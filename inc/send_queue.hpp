@@ -0,0 +1,250 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SEND_QUEUE_HPP_
+#define _OBBY_SEND_QUEUE_HPP_
+
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <sigc++/signal.h>
+#include <sigc++/slot.h>
+#include <sigc++/connection.h>
+#include <net6/non_copyable.hpp>
+#include <net6/packet.hpp>
+#include <net6/user.hpp>
+
+namespace obby
+{
+
+/** Outgoing packets of a server.
+ *
+ * Every client that has logged in has its own queue. A packet to all
+ * clients is stored once and shared by their queues. Queues are handed to
+ * net6 by flush() as far as the send limit allows. The queue counts the
+ * bytes it has handed to net6 for each client until net6 has written all
+ * of them to the socket, or until the client has confirmed them if it
+ * answers acknowledgement requests. Byte counts are taken from
+ * statistics::get_size().
+ */
+class send_queue: private net6::non_copyable
+{
+public:
+	typedef sigc::slot<void, const net6::packet&, const net6::user&>
+		slot_send_type;
+	typedef sigc::slot<void> slot_schedule_type;
+
+	typedef sigc::signal<void, std::size_t> signal_depth_type;
+
+	/** Creates a queue that hands packets to <em>send</em>.
+	 * <em>schedule</em> is called when there is something to flush.
+	 */
+	send_queue(const slot_send_type& send,
+	           const slot_schedule_type& schedule);
+	~send_queue();
+
+	/** Limits the bytes of every client that have not been written or
+	 * confirmed to <em>limit</em>, zero for no limit. Further packets
+	 * are held back, a client is disconnected if they exceed the limit,
+	 * too, or right away if <em>disconnect</em> is true.
+	 */
+	void set_limit(std::size_t limit, bool disconnect);
+
+	std::size_t get_limit() const;
+	bool get_disconnect() const;
+
+	/** Starts a queue for a client that has logged in. <em>acks</em>
+	 * tells whether it answers acknowledgement requests.
+	 */
+	void add_client(const net6::user& user6, bool acks);
+
+	/** Drops the queue of a client.
+	 */
+	void remove_client(const net6::user& user6);
+
+	/** Returns the number of clients with a queue.
+	 */
+	std::size_t get_client_count() const;
+
+	/** Returns the bytes of <em>user6</em> that have not been written
+	 * or confirmed, including the packets held back.
+	 */
+	std::size_t get_depth(const net6::user& user6) const;
+
+	/** Appends <em>pack</em> to the queues of all clients.
+	 */
+	void append(const net6::packet& pack);
+
+	/** Appends <em>pack</em> to the queue of <em>to</em>, or sends it
+	 * right away if <em>to</em> has not logged in yet.
+	 */
+	void append(const net6::packet& pack, const net6::user& to);
+
+	/** Hands <em>pack</em> to net6 for <em>to</em> right away, past
+	 * the queue.
+	 */
+	void send(const net6::packet& pack, const net6::user& to);
+
+	/** Hands the queues that have received packets or whose client has
+	 * caught up to net6, as far as the send limit allows.
+	 */
+	void flush();
+
+	/** Handles the confirmation of acknowledgement request
+	 * <em>request</em> by <em>user6</em>. Throws net6::bad_value if
+	 * the client has not been asked for it.
+	 */
+	void ack(const net6::user& user6, unsigned int request);
+
+	/** Returns a client that has exceeded the send limit and removes it
+	 * from the list of those, or NULL if there is none left.
+	 */
+	const net6::user* pop_overflow();
+
+	/** Drops all queues.
+	 */
+	void clear();
+
+	/** Signal emitted with the bytes a client has had in its queue
+	 * when it has answered an acknowledgement request or net6 has
+	 * written everything to it.
+	 */
+	signal_depth_type depth_event() const;
+
+protected:
+	/** Packet waiting in the queues of one or more clients.
+	 */
+	struct packet
+	{
+		packet(const net6::packet& pack);
+
+		net6::packet pack;
+		std::size_t size;
+		/** Number of client queues that hold the packet.
+		 */
+		unsigned int refs;
+	};
+
+	/** Packets that have not been handed to net6 for every recipient.
+	 * Iterators remain valid until the packet is removed.
+	 */
+	typedef std::list<packet> packet_list;
+
+	/** Outgoing traffic of a client.
+	 */
+	struct window
+	{
+		window(bool acks);
+
+		/** Whether the client answers acknowledgement requests.
+		 */
+		bool acks;
+
+		/** Bytes handed to net6 since the client has logged in.
+		 */
+		unsigned long sent;
+		/** Bytes net6 has written to the socket or the client has
+		 * confirmed, whichever is more.
+		 */
+		unsigned long acked;
+		/** Value of <em>sent</em> when the last acknowledgement
+		 * request has been sent, and the ID of the request.
+		 */
+		unsigned long requested;
+		unsigned int request;
+		bool pending;
+
+		/** Packets queued for the client that have not been handed
+		 * to net6, oldest first, and their size.
+		 */
+		std::deque<packet_list::iterator> queue;
+		std::size_t queued;
+
+		/** Whether the client is in the list of queues that are
+		 * handed to net6 by the next flush().
+		 */
+		bool ready;
+
+		/** Connection to the send signal of the client's net6
+		 * connection, which tells when net6 has written everything.
+		 */
+		sigc::connection drain;
+	};
+
+	typedef std::map<const net6::user*, window> window_map;
+
+	/** Appends <em>pack</em> to the queue of <em>to</em>.
+	 */
+	void push(packet_list::iterator pack, const net6::user& to);
+
+	/** Hands <em>pack</em> of <em>size</em> bytes to net6 for
+	 * <em>to</em>.
+	 */
+	void send(const net6::packet& pack,
+	          std::size_t size,
+	          const net6::user& to);
+
+	/** Asks the client of <em>win</em> to confirm what it has received
+	 * if enough has been sent since the last request.
+	 */
+	void request(window& win, const net6::user& to);
+
+	/** Hands the queue of <em>to</em> to net6 with the next flush().
+	 */
+	void ready(window& win, const net6::user& to);
+
+	/** Hands the queue of <em>to</em> to net6 as far as the send limit
+	 * allows.
+	 */
+	void flush(window& win, const net6::user& to);
+
+	/** Drops the packets in the queue of <em>win</em>.
+	 */
+	void drop(window& win);
+
+	/** net6 has written everything queued for <em>user6</em>.
+	 */
+	void on_drain(const net6::user* user6);
+
+	slot_send_type m_send;
+	slot_schedule_type m_schedule;
+
+	std::size_t m_limit;
+	bool m_disconnect;
+
+	packet_list m_packets;
+	window_map m_windows;
+
+	/** Clients whose queue has been empty before the packets of the
+	 * current event loop iteration were added.
+	 */
+	std::vector<const net6::user*> m_ready;
+
+	/** Clients that have exceeded the send limit. Packets to them are
+	 * dropped until they are disconnected.
+	 */
+	std::set<const net6::user*> m_overflow;
+
+	signal_depth_type m_signal_depth;
+};
+
+} // namespace obby
+
+#endif // _OBBY_SEND_QUEUE_HPP_
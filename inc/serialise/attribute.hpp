@@ -26,6 +26,8 @@
 #include "../format_string.hpp"
 #include "error.hpp"
 #include "token.hpp"
+#include "reader.hpp"
+#include "identifier.hpp"
 
 namespace obby
 {
@@ -42,14 +44,14 @@ public:
 	 * is serialised using the given context.
 	 */
 	template<typename data_type>
-	attribute(const std::string& name,
+	attribute(const identifier& name,
 	          const data_type& value,
 	          const ::serialise::context_base_to<data_type>& ctx =
 	          ::serialise::default_context_to<data_type>());
 
 	/** Creates a new attribute with the serialised value given.
 	 */
-	attribute(const std::string& name = "Unnamed",
+	attribute(const identifier& name = "Unnamed",
 	          const std::string& value = "Unassigned");
 
 	/** Serialises the attribute to a list of tokens.
@@ -61,6 +63,10 @@ public:
 	void deserialise(const token_list& tokens,
 	                 token_list::iterator& iter);
 
+	/** Takes the attribute that <em>src</em> has just reported.
+	 */
+	void deserialise(const reader& src);
+
 	/** Changes the value of the attribute by serialising the value to
 	 * a string using <em>ctx</em> as context.
 	 */
@@ -81,6 +87,10 @@ public:
 	 */
 	const std::string& get_name() const;
 
+	/** Returns the interned name of the attribute.
+	 */
+	const identifier& get_identifier() const;
+
 	/** Returns the line where the attribute occured in the source file, if
 	 * the attribute was deserialised from a token list.
 	 */
@@ -93,16 +103,16 @@ public:
 	data_type as(const ::serialise::context_base_from<data_type>& ctx =
 	             ::serialise::default_context_from<data_type>()) const;
 private:
-	std::string m_name;
-	::serialise::data m_value;
+	identifier m_name;
+	std::string m_value;
 	unsigned int m_line;
 };
 
 template<typename data_type>
-attribute::attribute(const std::string& name,
+attribute::attribute(const identifier& name,
 	             const data_type& value,
 	             const ::serialise::context_base_to<data_type>& ctx):
-	m_name(name), m_value(value, ctx), m_line(0)
+	m_name(name), m_value(ctx.to_string(value) ), m_line(0)
 {
 }
 
@@ -110,7 +120,7 @@ template<typename data_type>
 void attribute::set_value(const data_type& value,
                           const ::serialise::context_base_to<data_type>& ctx)
 {
-	m_value = ::serialise::data(value, ctx);
+	m_value = ctx.to_string(value);
 }
 
 template<typename data_type>
@@ -119,7 +129,7 @@ data_type attribute::
 {
 	try
 	{
-		return m_value.as<data_type>(ctx);
+		return ctx.from_string(m_value);
 	}
 	catch(::serialise::conversion_error& e)
 	{
@@ -127,7 +137,7 @@ data_type attribute::
 			_("Attribute '%0%' has unexpected type: %1%")
 		);
 
-		str << m_name << e.what();
+		str << m_name.get_name() << e.what();
 		throw error(str.str(), m_line);
 	}
 }
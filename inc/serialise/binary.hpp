@@ -0,0 +1,64 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SERIALISE_BINARY_HPP_
+#define _OBBY_SERIALISE_BINARY_HPP_
+
+namespace obby
+{
+
+namespace serialise
+{
+
+/** Binary snapshot format.
+ *
+ * A snapshot holds the same object tree as the text format. It starts with
+ * MAGIC, the format VERSION and the document type. The tree follows as a
+ * sequence of records, each introduced by a tag byte:
+ *
+ * TAG_OBJECT_BEGIN: name
+ * TAG_ATTRIBUTE: name, value
+ * TAG_OBJECT_END
+ *
+ * Strings are stored as their length followed by the raw bytes, so values
+ * are neither escaped nor scanned. After the root object has been closed,
+ * a TAG_INDEX record lists the offsets of the root's children (that is, of
+ * the user table, the chat and every document of a session). The last four
+ * bytes hold the offset of the index record. All integers are 32 bit
+ * little-endian.
+ */
+namespace binary
+{
+	const char MAGIC[] = "\x89OBBY\r\n\x1a";
+	const unsigned int MAGIC_SIZE = 8;
+	const unsigned int VERSION = 1;
+
+	enum tag_type
+	{
+		TAG_OBJECT_BEGIN = 1,
+		TAG_ATTRIBUTE = 2,
+		TAG_OBJECT_END = 3,
+		TAG_INDEX = 4
+	};
+}
+
+} // namespace serialise
+
+} // namespace obby
+
+#endif // _OBBY_SERIALISE_BINARY_HPP_
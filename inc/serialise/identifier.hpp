@@ -0,0 +1,94 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SERIALISE_IDENTIFIER_HPP_
+#define _OBBY_SERIALISE_IDENTIFIER_HPP_
+
+#include <string>
+
+namespace obby
+{
+
+namespace serialise
+{
+
+/** Name of an object or an attribute.
+ *
+ * Names are interned: each distinct name is stored once in a table that
+ * is shared by the whole process, and an identifier refers to it by a
+ * small integer handle. Session files repeat the same few names very
+ * often, so objects only store handles and compare them as integers.
+ * The table is not protected against concurrent access, identifiers
+ * must only be created by one thread at a time.
+ */
+class identifier
+{
+public:
+	typedef unsigned int handle_type;
+
+	/** Creates the identifier of the empty name.
+	 */
+	identifier();
+
+	/** Creates the identifier of <em>name</em>, adding the name to the
+	 * table if it is not yet known.
+	 */
+	identifier(
+		const std::string& name
+	);
+
+	identifier(
+		const char* name
+	);
+
+	/** Returns the name this identifier refers to. The string remains
+	 * valid until the process exits.
+	 */
+	const std::string& get_name() const;
+
+	/** Returns the handle of the name.
+	 */
+	handle_type get_handle() const;
+
+	bool operator==(const identifier& other) const;
+	bool operator!=(const identifier& other) const;
+
+protected:
+	handle_type m_handle;
+};
+
+inline identifier::handle_type identifier::get_handle() const
+{
+	return m_handle;
+}
+
+inline bool identifier::operator==(const identifier& other) const
+{
+	return m_handle == other.m_handle;
+}
+
+inline bool identifier::operator!=(const identifier& other) const
+{
+	return m_handle != other.m_handle;
+}
+
+} // namespace serialise
+
+} // namespace obby
+
+#endif // _OBBY_SERIALISE_IDENTIFIER_HPP_
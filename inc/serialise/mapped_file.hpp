@@ -0,0 +1,70 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SERIALISE_MAPPED_FILE_HPP_
+#define _OBBY_SERIALISE_MAPPED_FILE_HPP_
+
+#include <string>
+#include <vector>
+#include <net6/non_copyable.hpp>
+
+namespace obby
+{
+
+namespace serialise
+{
+
+/** Read-only view of a whole file. The file is mapped into memory where
+ * the system supports it, otherwise it is read into a buffer.
+ */
+class mapped_file : private net6::non_copyable
+{
+public:
+	/** Maps <em>file</em>. Throws serialise::error if the file could not
+	 * be opened.
+	 */
+	mapped_file(
+		const std::string& file
+	);
+
+	~mapped_file();
+
+	/** Returns the content of the file. It remains valid as long as the
+	 * mapped_file exists.
+	 */
+	const char* get_data() const;
+
+	/** Returns the size of the file in bytes.
+	 */
+	std::size_t get_size() const;
+
+protected:
+	const char* m_data;
+	std::size_t m_size;
+
+	/** Whether m_data has been mapped, rather than read into m_buffer.
+	 */
+	bool m_mapped;
+	std::vector<char> m_buffer;
+};
+
+} // namespace serialise
+
+} // namespace obby
+
+#endif // _OBBY_SERIALISE_MAPPED_FILE_HPP_
@@ -19,9 +19,11 @@
 #ifndef _OBBY_SERIALISE_OBJECT_HPP_
 #define _OBBY_SERIALISE_OBJECT_HPP_
 
-#include <map>
+#include <vector>
 #include <list>
 #include "token.hpp"
+#include "reader.hpp"
+#include "identifier.hpp"
 #include "attribute.hpp"
 
 namespace obby
@@ -30,26 +32,16 @@ namespace obby
 namespace serialise
 {
 
+/** Object of the serialisation tree. Names of objects and attributes are
+ * interned identifiers. Objects have only a few attributes, so they are
+ * kept in a flat list in the order they have been added, and looked up
+ * by comparing identifiers.
+ */
 class object
 {
 public:
-	typedef std::map<std::string, attribute> attribute_map;
-	class attribute_iterator : public attribute_map::const_iterator
-	{
-	public:
-		typedef attribute value_type;
-		typedef attribute_map::const_iterator base_iterator;
-
-		attribute_iterator(
-			const base_iterator& base
-		);
-
-		//value_type& operator*();
-		const value_type& operator*() const;
-
-		//value_type* operator->();
-		const value_type* operator->() const;
-	};
+	typedef std::vector<attribute> attribute_list;
+	typedef attribute_list::const_iterator attribute_iterator;
 
 	typedef std::list<object>::const_iterator child_iterator;
 
@@ -66,30 +58,51 @@ public:
 		token_list::iterator& iter
 	);
 
+	/** Reads the object from <em>src</em> which must just have reported
+	 * OBJECT_BEGIN. Returns after the corresponding OBJECT_END.
+	 */
+	void deserialise(
+		reader& src
+	);
+
+	/** Like deserialise(reader&), but only reads the attributes of the
+	 * object. Its children are skipped without being parsed.
+	 */
+	void deserialise_attributes(
+		reader& src
+	);
+
 	const object* get_parent() const;
 
 	object& add_child();
 
 	const std::string& get_name() const;
 
+	/** Returns the interned name of the object.
+	 */
+	const identifier& get_identifier() const;
+
 	void set_name(
-		const std::string& name
+		const identifier& name
 	);
 
+	/** Adds an attribute, or returns the existing one with the given
+	 * name. The reference is invalidated by adding another attribute.
+	 */
 	attribute& add_attribute(
-		const std::string& name
+		const identifier& name
 	);
 
-	attribute* get_attribute(const std::string& name);
-	const attribute* get_attribute(const std::string& name) const;
+	attribute* get_attribute(const identifier& name);
+	const attribute* get_attribute(const identifier& name) const;
 
 	/** Throws a serialise::error if the attribute is not defined.
 	 */
-	attribute& get_required_attribute(const std::string& name);
+	attribute& get_required_attribute(const identifier& name);
 
 	/** Throws a serialise::error if the attribute is not defined.
 	 */
-	const attribute& get_required_attribute(const std::string& name) const;
+	const attribute& get_required_attribute(const identifier& name) const;
 
 	attribute_iterator attributes_begin() const;
 	attribute_iterator attributes_end() const;
@@ -103,8 +116,8 @@ public:
 
 protected:
 	const object* m_parent;
-	std::string m_name;
-	attribute_map m_attributes;
+	identifier m_name;
+	attribute_list m_attributes;
 	std::list<object> m_children;
 	unsigned int m_line;
 };
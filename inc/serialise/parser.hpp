@@ -23,6 +23,7 @@
 #include <iostream>
 #include <net6/non_copyable.hpp>
 #include "object.hpp"
+#include "writer.hpp"
 
 namespace obby
 {
@@ -48,11 +49,13 @@ public:
 	);
 
 	void serialise(
-		const std::string& file
+		const std::string& file,
+		writer::format_type format = writer::FORMAT_TEXT
 	) const;
 
 	void serialise(
-		std::ostream& stream
+		std::ostream& stream,
+		writer::format_type format = writer::FORMAT_TEXT
 	) const;
 
 	void serialise_memory(
@@ -69,6 +72,12 @@ public:
 	object& get_root();
 
 protected:
+	/** Reads the document type and the root object from <em>src</em>.
+	 */
+	void deserialise(
+		reader& src
+	);
+
 	std::string m_type;
 	object m_object;
 };
@@ -0,0 +1,240 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SERIALISE_READER_HPP_
+#define _OBBY_SERIALISE_READER_HPP_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <net6/non_copyable.hpp>
+
+namespace obby
+{
+
+namespace serialise
+{
+
+/** Streaming reader for the obby serialisation format.
+ *
+ * The reader pulls the input through a fixed-size buffer and reports
+ * objects and attributes one after another, so reading a file requires
+ * memory for the current name and value only. Child objects are reported
+ * between the OBJECT_BEGIN and OBJECT_END of their parent.
+ *
+ * A reader may also work on a block of memory, such as a mapped_file. In
+ * this case values without escape sequences are not copied but referred
+ * to in place, see get_value_data().
+ *
+ * Binary snapshots (see binary.hpp) are recognised by their header and
+ * reported through the same events.
+ */
+class reader : private net6::non_copyable
+{
+public:
+	enum event_type
+	{
+		OBJECT_BEGIN,
+		ATTRIBUTE,
+		OBJECT_END,
+		END_OF_INPUT
+	};
+
+	typedef std::vector<std::size_t> index_type;
+
+	/** Creates a reader that reads from <em>stream</em>. The document
+	 * type is read immediately.
+	 */
+	reader(
+		std::istream& stream
+	);
+
+	/** Creates a reader that reads the <em>size</em> bytes at
+	 * <em>data</em>. The memory must remain valid during the lifetime
+	 * of the reader.
+	 */
+	reader(
+		const char* data,
+		std::size_t size
+	);
+
+	/** Returns the document type given after the initial '!'.
+	 */
+	const std::string& get_type() const;
+
+	/** Reads the next event. Throws serialise::error on malformed input.
+	 */
+	event_type read();
+
+	/** Name of the object or attribute reported by the last event.
+	 */
+	const std::string& get_name() const;
+
+	/** Unescaped value of the attribute reported by the last event.
+	 */
+	const std::string& get_value() const;
+
+	/** Unescaped value of the attribute reported by the last event. This
+	 * does not copy the value if it refers to the input directly. The
+	 * data remains valid until the next call to read().
+	 */
+	const char* get_value_data() const;
+
+	/** Length of the value returned by get_value_data().
+	 */
+	std::size_t get_value_size() const;
+
+	/** Nesting depth of the object the last event belongs to, the root
+	 * object has depth 0.
+	 */
+	unsigned int get_depth() const;
+
+	/** Line of the last event in the input. Binary input has no lines,
+	 * 0 is returned then.
+	 */
+	unsigned int get_line() const;
+
+	/** Returns whether the input is a binary snapshot.
+	 */
+	bool is_binary() const;
+
+	/** Offsets of the root object's children in a binary snapshot read
+	 * from memory. The index is empty for any other input.
+	 */
+	const index_type& get_index() const;
+
+	/** Offset in the input at which the object reported by the last
+	 * OBJECT_BEGIN event starts. Together with get_line() it may be
+	 * passed to seek() if the object is a child of the root object.
+	 */
+	std::size_t get_offset() const;
+
+	/** Continues reading at the child of the root object at
+	 * <em>offset</em>, which must have been taken from get_index() or
+	 * get_offset(). <em>line</em> is the line the object starts at in
+	 * text input. The next read() reports the beginning of that object.
+	 * Only input read from memory supports seeking.
+	 */
+	void seek(std::size_t offset, unsigned int line = 0);
+
+	/** Skips the rest of the object the last event belongs to,
+	 * including its children. The next read() reports whatever
+	 * follows the object's OBJECT_END event.
+	 */
+	void skip_object();
+
+protected:
+	enum state_type
+	{
+		STATE_LINE_BEGIN,
+		STATE_ATTRIBUTES,
+		STATE_END
+	};
+
+	/** Returns the next character without consuming it, or -1 at the
+	 * end of input.
+	 */
+	int peek();
+
+	/** Consumes a character, counting lines.
+	 */
+	void advance();
+
+	/** Refills the read buffer.
+	 */
+	bool fill();
+
+	void read_header();
+	void read_binary_header();
+	void read_binary_index();
+	event_type read_binary();
+
+	/** Takes <em>count</em> bytes from the input. They are referred to
+	 * in place if possible, otherwise they are copied to
+	 * <em>storage</em>.
+	 */
+	const char* read_bytes(std::size_t count, std::string& storage);
+	std::size_t read_size();
+
+	void read_identifier(std::string& target);
+	void read_string();
+	void read_string_escaped(unsigned int orig_line);
+	void skip_blanks();
+
+	/** Skips the rest of the line if it holds a comment.
+	 */
+	void skip_comment();
+
+	/** Stream to read from, or NULL if reading from memory.
+	 */
+	std::istream* m_stream;
+	std::vector<char> m_buffer;
+
+	/** Current input window, either m_buffer or the memory block.
+	 */
+	const char* m_data;
+	std::size_t m_pos;
+	std::size_t m_end;
+
+	std::string m_type;
+	std::string m_name;
+	/** Value of the last attribute. m_value_data either points into the
+	 * input or to m_value, which is filled on demand in the former case.
+	 */
+	const char* m_value_data;
+	std::size_t m_value_size;
+	mutable std::string m_value;
+	mutable bool m_value_valid;
+
+	unsigned int m_depth;
+	unsigned int m_line;
+	unsigned int m_cur_line;
+
+	state_type m_state;
+
+	/** Number of currently open objects.
+	 */
+	unsigned int m_open;
+
+	/** Number of OBJECT_END events to report before the next object.
+	 */
+	unsigned int m_pending_ends;
+
+	/** Whether an object has been read that is reported after the
+	 * pending OBJECT_END events.
+	 */
+	bool m_pending_begin;
+	std::string m_next_name;
+	unsigned int m_next_line;
+
+	/** Offset of the last object begun and of the pending one.
+	 */
+	std::size_t m_offset;
+	std::size_t m_next_offset;
+
+	bool m_had_root;
+
+	bool m_binary;
+	index_type m_index;
+};
+
+} // namespace serialise
+
+} // namespace obby
+
+#endif // _OBBY_SERIALISE_READER_HPP_
@@ -89,6 +89,24 @@ private:
 	list_type m_list;
 };
 
+/** Appends the <em>size</em> bytes at <em>src</em> to <em>target</em>,
+ * escaping characters that cannot appear in a string literal as is.
+ */
+void escape(
+	const char* src,
+	std::size_t size,
+	std::string& target
+);
+
+/** Replaces the escape sequences in the string literal <em>src</em>. The
+ * string is compacted in place. Throws serialise::error, reporting
+ * <em>src_line</em>, if it contains an unknown escape sequence.
+ */
+void unescape(
+	std::string& src,
+	unsigned int src_line
+);
+
 } // namespace serialise
 
 } // namespace obby
@@ -0,0 +1,179 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SERIALISE_WRITER_HPP_
+#define _OBBY_SERIALISE_WRITER_HPP_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <net6/non_copyable.hpp>
+#include <net6/serialise.hpp>
+
+namespace obby
+{
+
+namespace serialise
+{
+
+class object;
+
+/** Streaming writer for the obby serialisation format.
+ *
+ * Objects and attributes are written in the order in which they are added,
+ * so serialising does not require to build an object tree first. Output is
+ * collected in a buffer that is written to the stream whenever it is full.
+ */
+class writer : private net6::non_copyable
+{
+public:
+	enum format_type
+	{
+		/** Human-readable text format.
+		 */
+		FORMAT_TEXT,
+
+		/** Binary snapshot format, see binary.hpp.
+		 */
+		FORMAT_BINARY
+	};
+
+	/** Creates a writer that writes a document of the given type to
+	 * <em>stream</em>. Binary output requires a stream in binary mode.
+	 */
+	writer(
+		std::ostream& stream,
+		const std::string& type,
+		format_type format = FORMAT_TEXT
+	);
+
+	/** Creates a writer that writes a document of the given type to
+	 * <em>file</em>. Throws std::runtime_error if the file could not be
+	 * opened.
+	 */
+	writer(
+		const std::string& file,
+		const std::string& type,
+		format_type format = FORMAT_TEXT
+	);
+
+	/** Writes remaining output to the stream. Write errors are ignored
+	 * here, call flush() to make sure that everything has been written.
+	 */
+	~writer();
+
+	/** Begins a new object. It is a child of the object that has been
+	 * begun last and has not yet been ended.
+	 */
+	void begin_object(
+		const std::string& name
+	);
+
+	/** Ends the object that has been begun last.
+	 */
+	void end_object();
+
+	/** Adds an attribute to the current object. Attributes must be added
+	 * before the first child of the object is begun.
+	 */
+	void add_attribute(
+		const std::string& name,
+		const std::string& value
+	);
+
+	/** Adds an attribute with <em>size</em> bytes at <em>value</em> as
+	 * value.
+	 */
+	void add_attribute(
+		const std::string& name,
+		const char* value,
+		std::size_t size
+	);
+
+	/** Adds an attribute whose value is serialised using <em>ctx</em>.
+	 */
+	template<typename data_type>
+	void add_attribute(
+		const std::string& name,
+		const data_type& value,
+		const ::serialise::context_base_to<data_type>& ctx =
+			::serialise::default_context_to<data_type>()
+	);
+
+	/** Writes <em>obj</em> with its attributes and children as child of
+	 * the current object.
+	 */
+	void add_object(
+		const object& obj
+	);
+
+	/** Writes buffered output to the stream and flushes it. Throws
+	 * std::runtime_error if the stream could not be written.
+	 */
+	void flush();
+
+protected:
+	/** Writes the buffer to the stream if it is full.
+	 */
+	void flush_buffer();
+
+	/** Writes the buffer to the stream. Throws std::runtime_error if
+	 * the stream could not be written.
+	 */
+	void write_buffer();
+
+	void write_header(const std::string& type);
+	void write_index();
+	void write_size(std::size_t size);
+	void write_string(const char* data, std::size_t size);
+
+	std::ofstream m_file;
+	std::ostream& m_stream;
+	std::string m_buffer;
+	format_type m_format;
+
+	/** Number of bytes written to the stream so far.
+	 */
+	std::size_t m_offset;
+
+	/** Offsets of the root object's children in binary output.
+	 */
+	std::vector<std::size_t> m_index;
+
+	/** Number of currently open objects.
+	 */
+	unsigned int m_depth;
+
+	/** Whether the current object has got children already.
+	 */
+	bool m_has_children;
+};
+
+template<typename data_type>
+void writer::add_attribute(const std::string& name,
+                           const data_type& value,
+                           const ::serialise::context_base_to<data_type>& ctx)
+{
+	add_attribute(name, ctx.to_string(value) );
+}
+
+} // namespace serialise
+
+} // namespace obby
+
+#endif // _OBBY_SERIALISE_WRITER_HPP_
@@ -19,11 +19,26 @@
 #ifndef _OBBY_SERVER_BUFFER_HPP_
 #define _OBBY_SERVER_BUFFER_HPP_
 
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <ctime>
+#include <sstream>
+#include <net6/socket.hpp>
 #include "serialise/error.hpp"
 #include "serialise/parser.hpp"
+#include "serialise/mapped_file.hpp"
+#include "serialise/reader.hpp"
 #include "common.hpp"
 #include "error.hpp"
 #include "command.hpp"
+#include "session_journal.hpp"
+#include "statistics.hpp"
+#include "send_queue.hpp"
+#include "swap_list.hpp"
+#include "sync_history.hpp"
 #include "buffer.hpp"
 #include "server_document_info.hpp"
 
@@ -54,11 +69,33 @@ public:
 	// Signal
 	typedef sigc::signal<void, const net6::user&> signal_connect_type;
 	typedef sigc::signal<void, const net6::user&> signal_disconnect_type;
+	typedef sigc::signal<void, const std::string&, const std::string&>
+		signal_snapshot_type;
+
+	/** What happens to a client whose outgoing queue has reached the
+	 * limit given to set_send_limit().
+	 */
+	enum send_policy {
+		/** Further packets are held back by the buffer until the
+		 * client has caught up. This also pauses the synchronisation
+		 * of documents it subscribes to. The client is disconnected
+		 * if the packets held back exceed the limit, too.
+		 */
+		SEND_PAUSE,
+
+		/** The client is disconnected right away.
+		 */
+		SEND_DISCONNECT
+	};
 
 	/** Default constructor.
 	 */
 	basic_server_buffer();
 
+	/** Waits for snapshots that are still being written.
+	 */
+	virtual ~basic_server_buffer();
+
 	/** Opens the server on the given port.
 	 */
 	virtual void open(unsigned int port);
@@ -119,6 +156,40 @@ public:
 	 */
 	void set_enable_keepalives(bool enable);
 
+	/** @brief Limits the outgoing queue of every client to
+	 * <em>limit</em> bytes.
+	 *
+	 * The server counts the bytes it has handed to net6 for each client
+	 * since net6 has last written all of them to the socket. Together
+	 * with the packets held back, they make up the client's outgoing
+	 * queue. Clients that announce to answer acknowledgement requests
+	 * when they log in are also asked from time to time to confirm the
+	 * packets they have handled, which shortens the count while net6
+	 * is still busy writing to them. A slow or stalled client thus
+	 * cannot make the server keep an unbounded amount of data for it.
+	 * Clients that are disconnected keep their document state to resume
+	 * their subscriptions when they reconnect, as long as the documents
+	 * have not been changed too much in the meantime. Zero, the default,
+	 * leaves the queues unlimited.
+	 */
+	void set_send_limit(std::size_t limit,
+	                    send_policy policy = SEND_PAUSE);
+
+	/** @brief Returns the limit of the outgoing queues, or zero if
+	 * they are unlimited.
+	 */
+	std::size_t get_send_limit() const;
+
+	/** @brief Returns what happens to clients that have reached the
+	 * limit of their outgoing queue.
+	 */
+	send_policy get_send_policy() const;
+
+	/** @brief Returns the bytes in the outgoing queue of the given
+	 * user, see set_send_limit().
+	 */
+	std::size_t get_send_queue(const user& user) const;
+
 	/** @brief Provides access to the server's command map.
 	 */
 	command_map& get_command_map();
@@ -127,6 +198,107 @@ public:
 	 */
 	const command_map& get_command_map() const;
 
+	/** @brief Queues a packet that is sent to all connected users.
+	 *
+	 * Every connection has its own queue. A packet to all users is
+	 * stored once and shared by their queues. At the end of the current
+	 * event loop iteration, after the journal has been committed, each
+	 * queue is handed to net6 in one go as far as the send limit allows,
+	 * see set_send_limit(). The rest waits in the queue until the client
+	 * has caught up. The synchronisation of a joining user does not go
+	 * through the queue at all, it is sent immediately so that it
+	 * arrives in order with net6's own login packets.
+	 */
+	void send(const net6::packet& pack) const;
+
+	/** @brief Queues a packet that is sent to the given user.
+	 */
+	void send(const net6::packet& pack, const net6::user& to) const;
+
+	/** @brief Sends all queued packets immediately.
+	 */
+	void flush() const;
+
+	/** @brief Checks whether <em>token</em> is the session token that
+	 * has been handed out to the given user.
+	 *
+	 * The token is sent to every client when it logs in and remains the
+	 * same for a user until the session is closed. A reconnecting client
+	 * presents it to resume its document subscriptions. It guards against
+	 * mixing up the state of different clients, it is not meant to be a
+	 * secret.
+	 */
+	bool check_session_token(const user& user,
+	                         const std::string& token) const;
+
+	/** @brief Enables swapping out the content of documents nobody is
+	 * subscribed to.
+	 *
+	 * Documents nobody has been subscribed to for <em>idle_time</em>
+	 * seconds are written to <em>directory</em> and only loaded again
+	 * when somebody subscribes to them or asks for their content. If
+	 * more than <em>idle_limit</em> documents are idle, the ones that
+	 * have been idle longest are swapped out right away. An idle time of
+	 * zero swaps out by count only. An empty directory disables
+	 * swapping, which is the default. The directory must not be shared
+	 * with another server.
+	 */
+	void set_swap_directory(const std::string& directory,
+	                        unsigned int idle_time = 300,
+	                        unsigned int idle_limit = 16);
+
+	/** @brief Returns the swap directory, or an empty string if
+	 * swapping is disabled.
+	 */
+	const std::string& get_swap_directory() const;
+
+	/** @brief Called by a document that has been loaded, or whose
+	 * subscriptions have changed. Idle documents are appended to the
+	 * list of documents to swap out, others are removed from it. Swaps
+	 * out idle documents except <em>info</em> that have been idle for
+	 * too long or if there are too many of them.
+	 */
+	void document_used(document_info_type& info) const;
+
+	/** @brief Sets whether changes to sessions are journaled.
+	 *
+	 * With journaling enabled, open(session, port) keeps a journal next
+	 * to the session file, named like it with ".journal" appended.
+	 * Users, documents and every operation applied to a document are
+	 * appended to it and written to disk once per event loop iteration,
+	 * before the packets caused by them are sent. When a session is
+	 * opened, changes left in its journal are replayed and the journal
+	 * is compacted into a new session file. This happens again whenever
+	 * the journal has grown larger than the session file. Chat messages
+	 * and user passwords are not journaled.
+	 *
+	 * The option takes effect when the next session is opened.
+	 */
+	void set_journal(bool enable);
+
+	/** @brief Returns whether changes to sessions are journaled.
+	 */
+	bool get_journal() const;
+
+	/** @brief Writes the whole session to the session file and clears
+	 * the journal. Does nothing if the session is not journaled.
+	 */
+	void journal_compact();
+
+	/** @brief Serialises the complete session into <em>file</em>
+	 * without blocking the event loop.
+	 *
+	 * The session is captured when this function is called, later
+	 * changes are not part of the snapshot. It is written to disk in
+	 * the background, and the file is replaced only when the snapshot
+	 * is complete. snapshot_event() is emitted when it is done. If the
+	 * server is not open, the snapshot is written before this function
+	 * returns.
+	 */
+	void serialise_async(const std::string& file,
+	                     serialise::writer::format_type format =
+	                     	serialise::writer::FORMAT_TEXT);
+
 	/** Signal which will be emitted if a new client has connected.
 	 */
 	signal_connect_type connect_event() const;
@@ -135,12 +307,123 @@ public:
 	 */
 	signal_disconnect_type disconnect_event() const;
 
+	/** Signal which will be emitted when a snapshot has been written,
+	 * either by serialise_async() or to compact the journal. The
+	 * parameters are the file and an error message, which is empty
+	 * if the snapshot has been written successfully.
+	 */
+	signal_snapshot_type snapshot_event() const;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	/** @brief Returns the instrumentation counters of the server.
+	 *
+	 * They are reset when a session is opened. Documents keep their
+	 * own counters, see basic_server_document_info::get_statistics().
+	 * Clients may query a summary with the "stats" command, which
+	 * only lists their own connection.
+	 */
+	const statistics& get_statistics() const;
+#endif
+
 protected:
+	typedef std::map<const user*, std::string> token_map;
+
+	typedef typename basic_buffer<Document, Selector>::document_key
+		document_key;
+
+	/** Clients that have logged in and announced to answer
+	 * acknowledgement requests, until they have joined.
+	 */
+	typedef std::set<const net6::user*> ack_client_set;
+
+	typedef std::list<snapshot*> snapshot_list;
+
+	/** Socket that is registered with the selector only for its
+	 * timeout. A zero timeout flushes the outgoing queue at the end of
+	 * the current event loop iteration, others poll snapshots being
+	 * written and swap out idle documents.
+	 */
+	class flush_socket: public net6::socket
+	{
+	public:
+		flush_socket(): net6::socket(-1) {}
+	};
+
 	/** Registers net6 signal handlers. May be used by derived classes
 	 * which override the server_buffer constructor.
 	 */
 	void register_signal_handlers();
 
+	/** Drops queued packets, used when the underlaying net6 object
+	 * is replaced.
+	 */
+	void reset_queue();
+
+	/** Disconnects the clients that have exceeded the send limit.
+	 */
+	void kick_overflow();
+
+	/** Hands a packet for <em>to</em> to net6, used by the outgoing
+	 * queue.
+	 */
+	void net_send(const net6::packet& pack, const net6::user& to) const;
+
+	/** Returns the session token of the given user, creating one if
+	 * the user does not have one yet.
+	 */
+	const std::string& session_token(const user& user);
+
+	/** Returns the number of users, documents and removals that have
+	 * changed since version <em>base</em>. A base of 0 means the
+	 * complete lists.
+	 */
+	unsigned int sync_count(unsigned long base) const;
+
+	/** Sends the users, documents and removals that have changed since
+	 * version <em>base</em> in batches to <em>to</em>.
+	 */
+	void sync_send(const net6::user& to, unsigned long base);
+
+	/** Registers the flush socket with the selector if the outgoing
+	 * queue and the journal have not been flushed yet in the current
+	 * event loop iteration.
+	 */
+	void flush_schedule() const;
+
+	/** Replays the loaded journal entries. If <em>users_only</em> is
+	 * true, only users are replayed, so that they are known before
+	 * anyone else takes a user ID.
+	 */
+	void journal_replay(bool users_only);
+
+	/** Adds the journal generation to a snapshot written by
+	 * journal_compact().
+	 */
+	virtual void serialise_attributes(serialise::writer& writer) const;
+
+	/** Journal handlers.
+	 */
+	void on_journal_users();
+	void on_journal_user_join(const user& user);
+	void on_journal_user_colour(const user& user);
+	void on_journal_document_insert(base_document_info_type& info);
+	void on_journal_document_remove(base_document_info_type& info);
+	void on_journal_document_rename(const std::string& title,
+	                                document_info_type* info);
+	void on_journal_document_apply(const operation<Document>& op,
+	                               const user* author,
+	                               document_info_type* info);
+
+	/** Handlers that version the user and document lists.
+	 */
+	void on_sync_user(const user& user);
+	void on_sync_document_insert(base_document_info_type& info);
+	void on_sync_document_remove(base_document_info_type& info);
+	void on_sync_document_rename(const std::string& title,
+	                             document_info_type* info);
+	void on_sync_document_subscribe(const user& user,
+	                                document_info_type* info);
+
         /** Creates a new document info object according to the type of buffer.
 	 */
 	virtual base_document_info_type*
@@ -156,6 +439,17 @@ protected:
 	virtual base_document_info_type*
 	new_document_info(const serialise::object& obj);
 
+	/** Creates a new document info whose attributes are taken from
+	 * <em>obj</em> and whose content is loaded from the object at
+	 * <em>offset</em> and <em>line</em> in <em>source</em> when it is
+	 * first needed.
+	 */
+	virtual base_document_info_type*
+	new_document_info(const serialise::object& obj,
+	                  const serialise::mapped_file& source,
+	                  std::size_t offset,
+	                  unsigned int line);
+
 	/** Creates the underlaying net6 network object corresponding to the
 	 * buffer's type.
 	 */
@@ -236,11 +530,72 @@ protected:
 	virtual void on_net_command_query(const net6::packet& pack,
 	                                  const user& from);
 
+	/** Flow control: Confirmation of an acknowledgement request.
+	 */
+	virtual void on_net_ack(const net6::packet& pack, const user& from);
+
+	/** Chat history: Request for messages written before a position
+	 * in the history.
+	 */
+	virtual void on_net_chat_backlog(const net6::packet& pack,
+	                                 const user& from);
+
 	/** Commands.
 	 */
 	command_result on_command_emote(const user& from,
 	                                const std::string& paramlist);
 
+#ifndef OBBY_DISABLE_STATISTICS
+	command_result on_command_stats(const user& from,
+	                                const std::string& paramlist);
+#endif
+
+	/** Sends a packet to <em>to</em> immediately, bypassing the
+	 * outgoing queue.
+	 */
+	void send_now(const net6::packet& pack, const net6::user& to);
+
+	/** Flushes the outgoing queue when the flush socket times out.
+	 */
+	void on_flush(net6::io_condition cond);
+
+	/** Finishes snapshots that have been written.
+	 */
+	void on_snapshot(net6::io_condition cond);
+
+	/** Swaps out documents that have been idle for too long.
+	 */
+	void on_swap(net6::io_condition cond);
+
+	/** Removes a document that is deleted from the idle list.
+	 */
+	void on_swap_document_remove(base_document_info_type& info);
+
+	/** Swaps out idle documents except <em>except</em> that have been
+	 * idle for too long or if there are too many of them, and sets the
+	 * swap timer to the next one to expire.
+	 */
+	void swap_expire(const document_info_type* except) const;
+
+	/** Forgets all idle documents, used before the documents are
+	 * deleted.
+	 */
+	void swap_clear();
+
+	/** Captures the session and starts writing it to <em>file</em>.
+	 */
+	snapshot* snapshot_start(const std::string& file,
+	                         serialise::writer::format_type format);
+
+	/** Waits until all snapshots have been written and finishes them.
+	 */
+	void snapshot_wait();
+
+	/** Emits snapshot_event() for a snapshot that has been written
+	 * and truncates the journal if the snapshot compacts it.
+	 */
+	void snapshot_finish(snapshot& snap);
+
 	/** @brief Closes a session.
 	 */
 	virtual void session_close();
@@ -261,6 +616,40 @@ protected:
 	signal_disconnect_type m_signal_disconnect;
 
 	command_map m_command_map;
+
+	mutable send_queue m_send_queue;
+	mutable bool m_flush_pending;
+	flush_socket m_flush_socket;
+
+	snapshot_list m_snapshots;
+	flush_socket m_snapshot_socket;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	mutable statistics m_statistics;
+#endif
+	signal_snapshot_type m_signal_snapshot;
+
+	token_map m_session_tokens;
+
+	sync_history m_sync;
+	ack_client_set m_ack_clients;
+
+	mutable swap_list<document_info_type> m_swap;
+	flush_socket m_swap_socket;
+
+	bool m_journal_enabled;
+	mutable session_journal m_journal;
+
+	/** Session file the documents have been loaded from. Their content
+	 * is parsed from it when it is first needed, so it stays mapped
+	 * until the next session is opened.
+	 */
+	std::auto_ptr<serialise::mapped_file> m_session_source;
+
+	/** Journal generation to store in the session while it is
+	 * captured to compact the journal, 0 otherwise.
+	 */
+	unsigned long m_snapshot_generation;
 private:
 	void reopen_impl(unsigned int port);
 
@@ -281,8 +670,82 @@ template<typename Document, typename Selector>
 basic_server_buffer<Document, Selector>::
 		basic_server_buffer():
 	basic_buffer<Document, Selector>(),
-	m_enable_keepalives(false)
+	m_enable_keepalives(false),
+	m_send_queue(
+		sigc::mem_fun(*this, &basic_server_buffer::net_send),
+		sigc::mem_fun(*this, &basic_server_buffer::flush_schedule)
+	),
+	m_flush_pending(false),
+	m_journal_enabled(false), m_snapshot_generation(0)
 {
+	m_flush_socket.io_event().connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_flush) );
+	m_snapshot_socket.io_event().connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_snapshot) );
+	m_swap_socket.io_event().connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_swap) );
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_send_queue.depth_event().connect(
+		sigc::mem_fun(m_statistics, &statistics::send_queue) );
+#endif
+
+	basic_buffer<Document, Selector>::m_signal_document_remove.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_swap_document_remove
+		)
+	);
+
+	// Journal handlers do nothing unless a journaled session is open.
+	// Journaled users are restored as soon as the user table has been
+	// loaded, this handler is connected before the host buffer's one.
+	this->m_user_table.deserialised_event().connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_journal_users) );
+	basic_buffer<Document, Selector>::m_signal_user_join.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_journal_user_join
+		)
+	);
+	basic_buffer<Document, Selector>::m_signal_user_colour.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_journal_user_colour
+		)
+	);
+	basic_buffer<Document, Selector>::m_signal_document_insert.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_journal_document_insert
+		)
+	);
+	basic_buffer<Document, Selector>::m_signal_document_remove.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_journal_document_remove
+		)
+	);
+
+	// Every change to the lists that clients synchronise on login
+	// gets a version, so that returning clients only get a delta.
+	basic_buffer<Document, Selector>::m_signal_user_join.connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_sync_user) );
+	basic_buffer<Document, Selector>::m_signal_user_colour.connect(
+		sigc::mem_fun(*this, &basic_server_buffer::on_sync_user) );
+	basic_buffer<Document, Selector>::m_signal_document_insert.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_sync_document_insert
+		)
+	);
+	basic_buffer<Document, Selector>::m_signal_document_remove.connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_buffer::on_sync_document_remove
+		)
+	);
+
 	// Note that the command description is translated on server side.
 	// We cannot just send a number or something that the client converts
 	// to localised text since the client does not know the available
@@ -292,6 +755,29 @@ basic_server_buffer<Document, Selector>::
 		_("Sends an action to the chat."),
 		sigc::mem_fun(*this, &basic_server_buffer::on_command_emote)
 	);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_command_map.add_command(
+		"stats",
+		_("Shows what the server and its documents are busy with."),
+		sigc::mem_fun(*this, &basic_server_buffer::on_command_stats)
+	);
+#endif
+}
+
+template<typename Document, typename Selector>
+basic_server_buffer<Document, Selector>::~basic_server_buffer()
+{
+	for(typename snapshot_list::iterator iter = m_snapshots.begin();
+	    iter != m_snapshots.end();
+	    ++ iter)
+	{
+		delete *iter;
+	}
+
+	// Documents may refer to the session source
+	swap_clear();
+	basic_buffer<Document, Selector>::document_clear();
 }
 
 template<typename Document, typename Selector>
@@ -329,12 +815,19 @@ void basic_server_buffer<Document, Selector>::open(unsigned int port)
 
 	basic_buffer<Document, Selector>::m_net.reset(new_net());
 	register_signal_handlers();
+	reset_queue();
 
 	reopen_impl(port);
 
 	// Clear previous documents and users
+	swap_clear();
 	basic_buffer<Document, Selector>::document_clear();
 	basic_buffer<Document, Selector>::m_user_table.clear();
+	m_session_tokens.clear();
+	m_sync.reset();
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.clear();
+#endif
 
 	basic_buffer<Document, Selector>::m_signal_sync_init.emit(0);
 	basic_buffer<Document, Selector>::m_signal_sync_final.emit();
@@ -356,76 +849,152 @@ void basic_server_buffer<Document, Selector>::open(const std::string& session,
 	// Open server
 	basic_buffer<Document, Selector>::m_net.reset(new_net());
 	register_signal_handlers();
+	reset_queue();
 
 	reopen_impl(port);
 
-	// Deserialise file
-	serialise::parser parser;
-	parser.deserialise(session);
-
-	// Clear previous documents and users
-	basic_buffer<Document, Selector>::document_clear();
-	basic_buffer<Document, Selector>::m_user_table.clear();
+	// Read the mapped file incrementally, only one top-level object of
+	// the session is held in memory at a time. The content of documents
+	// is skipped and parsed when somebody first needs it.
+	std::auto_ptr<serialise::mapped_file> file(
+		new serialise::mapped_file(session)
+	);
 
-	basic_buffer<Document, Selector>::m_signal_sync_init.emit(0);
+	serialise::reader reader(file->get_data(), file->get_size() );
 
-	if(parser.get_type() != "obby")
+	if(reader.get_type() != "obby")
 		throw serialise::error(_("File is not an obby document"), 1);
 
 	// Get root object, verify that it is an obby session
-	serialise::object& root = parser.get_root();
-	if(root.get_name() != "session")
+	if(reader.read() != serialise::reader::OBJECT_BEGIN ||
+	   reader.get_name() != "session")
 	{
 		throw serialise::error(
 			_("File is not a stored obby session"),
-			root.get_line()
+			reader.get_line()
 		);
 	}
 
-	serialise::attribute& version_attr =
-		root.get_required_attribute("version");
+	unsigned int root_line = reader.get_line();
+	bool has_version = false;
+	unsigned long generation = 0;
+
+	serialise::reader::event_type event;
+	while( (event = reader.read()) == serialise::reader::ATTRIBUTE)
+	{
+		// TODO: Check version for incompatibilites
+		// TODO: Block higher version files
+		if(reader.get_name() == "version")
+			has_version = true;
+		else if(reader.get_name() == "journal")
+			generation = ::serialise::default_context_from<
+				unsigned long>().from_string(reader.get_value() );
+	}
+
+	if(!has_version)
+	{
+		format_string str(_("Object '%0%' requires attribute '%1%'") );
+		str << "session" << "version";
+		throw serialise::error(str.str(), root_line);
+	}
+
+	// Clear previous documents and users
+	swap_clear();
+	basic_buffer<Document, Selector>::document_clear();
+	basic_buffer<Document, Selector>::m_user_table.clear();
+	m_session_tokens.clear();
+	m_sync.reset();
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.clear();
+#endif
+	m_session_source = file;
+
+	m_journal.close();
+	if(m_journal_enabled)
+		m_journal.load(session, generation);
+
+	basic_buffer<Document, Selector>::m_signal_sync_init.emit(0);
 
-	// TODO: Check version for incompatibilites
-	// TODO: Block higher version files
 	// Check children
-	for(serialise::object::child_iterator iter = root.children_begin();
-	    iter != root.children_end();
-	    ++ iter)
+	for(; event == serialise::reader::OBJECT_BEGIN; event = reader.read() )
 	{
-		if(iter->get_name() == "user_table")
+		serialise::object child;
+		std::size_t offset = reader.get_offset();
+
+		if(reader.get_name() == "document")
+			child.deserialise_attributes(reader);
+		else
+			child.deserialise(reader);
+
+		if(child.get_name() == "user_table")
 		{
 			// Stored user table
 			basic_buffer<Document, Selector>::
 				m_user_table.deserialise(
-					*iter
+					child
 				);
 		}
-		else if(iter->get_name() == "chat")
+		else if(child.get_name() == "chat")
 		{
 			// Stored chat history
 			basic_buffer<Document, Selector>::m_chat.deserialise(
-				*iter,
+				child,
 				basic_buffer<Document, Selector>::m_user_table
 			);
 		}
-		else if(iter->get_name() == "document")
+		else if(child.get_name() == "document")
 		{
-			// Stored document, load it
-			base_document_info_type* info =
-				new_document_info(*iter);
+			// Stored document, load its content on demand
+			base_document_info_type* info = new_document_info(
+				child,
+				*m_session_source,
+				offset,
+				child.get_line()
+			);
+
 			// Add to list
 			basic_buffer<Document, Selector>::document_add(*info);
+
+			// Do not hand out the IDs of stored documents again
+			if(info->get_id() > this->m_doc_counter)
+				this->m_doc_counter = info->get_id();
 		}
 		else
 		{
 			// Unexpected child
 			// TODO: unexpected_child_error
 			format_string str(_("Unexpected child node: '%0%'") );
-			str << iter->get_name();
-			throw serialise::error(str.str(), iter->get_line() );
+			str << child.get_name();
+			throw serialise::error(str.str(), child.get_line() );
 		}
 	}
 
+	if(m_journal_enabled)
+	{
+		// Apply the changes made since the snapshot has been written,
+		// then start over with a fresh snapshot and an empty journal.
+		journal_replay(false);
+
+		m_journal.open(
+			session,
+			reader.is_binary() ?
+				serialise::writer::FORMAT_BINARY :
+				serialise::writer::FORMAT_TEXT,
+			generation
+		);
+
+		// Wait for the snapshot, so that the journal does not
+		// collect changes for a snapshot that is not yet on disk.
+		journal_compact();
+
+		snapshot* compaction = m_journal.get_compaction();
+		compaction->wait();
+		std::string error = compaction->get_error();
+		snapshot_wait();
+
+		if(!error.empty() ) throw std::runtime_error(error);
+	}
+
 	basic_buffer<Document, Selector>::m_signal_sync_final.emit();
 }
 
@@ -487,7 +1056,7 @@ void basic_server_buffer<Document, Selector>::
 		// Tell other clients about removal
 		net6::packet remove_pack("obby_document_remove");
 		remove_pack << &info;
-		net6_server().send(remove_pack);
+		send(remove_pack);
 	}
 
 	// Delete document
@@ -544,6 +1113,36 @@ void basic_server_buffer<Document, Selector>::
 	}
 }
 
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	set_send_limit(std::size_t limit,
+	               send_policy policy)
+{
+	m_send_queue.set_limit(limit, policy == SEND_DISCONNECT);
+}
+
+template<typename Document, typename Selector>
+std::size_t basic_server_buffer<Document, Selector>::get_send_limit() const
+{
+	return m_send_queue.get_limit();
+}
+
+template<typename Document, typename Selector>
+typename basic_server_buffer<Document, Selector>::send_policy
+basic_server_buffer<Document, Selector>::get_send_policy() const
+{
+	return m_send_queue.get_disconnect() ? SEND_DISCONNECT : SEND_PAUSE;
+}
+
+template<typename Document, typename Selector>
+std::size_t basic_server_buffer<Document, Selector>::
+	get_send_queue(const user& user) const
+{
+	if(~user.get_flags() & user::flags::CONNECTED) return 0;
+
+	return m_send_queue.get_depth(user.get_net6() );
+}
+
 template<typename Document, typename Selector>
 command_map& basic_server_buffer<Document, Selector>::get_command_map()
 {
@@ -571,6 +1170,13 @@ basic_server_buffer<Document, Selector>::disconnect_event() const
 	return m_signal_disconnect;
 }
 
+template<typename Document, typename Selector>
+typename basic_server_buffer<Document, Selector>::signal_snapshot_type
+basic_server_buffer<Document, Selector>::snapshot_event() const
+{
+	return m_signal_snapshot;
+}
+
 template<typename Document, typename Selector>
 void basic_server_buffer<Document, Selector>::
 	document_create_impl(const user* owner,
@@ -615,7 +1221,7 @@ void basic_server_buffer<Document, Selector>::
 	{
 		// The owner already knows about the document.
 		if(&(*iter) != owner)
-			net6_server().send(pack, iter->get_net6() );
+			send(pack, iter->get_net6() );
 	}
 }
 
@@ -627,7 +1233,7 @@ void basic_server_buffer<Document, Selector>::
 	{
 		net6::packet message_pack("obby_message");
 		message_pack << writer << message;
-		net6_server().send(message_pack, to.get_net6());
+		send(message_pack, to.get_net6());
 	}
 
 	if(writer == NULL)
@@ -653,7 +1259,7 @@ void basic_server_buffer<Document, Selector>::
 	{
 		net6::packet message_pack("obby_message");
 		message_pack << writer << message;
-		net6_server().send(message_pack);
+		send(message_pack);
 	}
 
 	if(writer == NULL)
@@ -686,7 +1292,7 @@ void basic_server_buffer<Document, Selector>::
 	{
 		net6::packet colour_pack("obby_user_colour");
 		colour_pack << &user << colour;
-		net6_server().send(colour_pack);
+		send(colour_pack);
 	}
 }
 
@@ -698,7 +1304,7 @@ void basic_server_buffer<Document, Selector>::
 	net6::packet welcome_pack("obby_welcome");
 	welcome_pack << PROTOCOL_VERSION;
 
-	net6_server().send(welcome_pack, user6);
+	send_now(welcome_pack, user6);
 
 	// Request encryption after welcome packet.
 	net6_server().request_encryption(user6);
@@ -713,12 +1319,26 @@ template<typename Document, typename Selector>
 void basic_server_buffer<Document, Selector>::
 	on_disconnect(const net6::user& user6)
 {
+	// Packets to this user have to go out before it is removed
+	flush();
+
+	m_send_queue.remove_client(user6);
+	m_sync.remove_client(user6);
+	m_ack_clients.erase(&user6);
+
 	m_signal_disconnect.emit(user6);
 }
 
 template<typename Document, typename Selector>
 void basic_server_buffer<Document, Selector>::on_join(const net6::user& user6)
 {
+	// The synchronisation below is sent directly because it has to
+	// arrive in order with net6's own login packets.
+
+#ifndef OBBY_DISABLE_STATISTICS
+	unsigned long start = statistics::clock();
+#endif
+
 	// Find user in list
 	const user* new_user =
 		basic_buffer<Document, Selector>::m_user_table.find(
@@ -735,49 +1355,69 @@ void basic_server_buffer<Document, Selector>::on_join(const net6::user& user6)
 		throw net6::bad_value(str.str() );
 	}
 
-	// Synchronise non-connected users.
-	for(user_table::iterator iter = basic_buffer<Document, Selector>::
-		m_user_table.begin(user::flags::NONE, user::flags::CONNECTED);
-	    iter != basic_buffer<Document, Selector>::
-		m_user_table.end(user::flags::NONE, user::flags::CONNECTED);
-	    ++ iter)
+	// Count the synchronisation in the outgoing queue of the user
+	m_send_queue.add_client(user6, m_ack_clients.erase(&user6) > 0);
+
+	// Clients that cache the lists get what has changed since the
+	// version they know in batches.
+	unsigned long base;
+	if(m_sync.take_client_base(user6, base) )
 	{
-		net6::packet user_pack("obby_sync_usertable_user");
-		user_pack << iter->get_id() << iter->get_name()
-		          << iter->get_colour();
-		net6_server().send(user_pack, user6);
+		sync_send(user6, base);
 	}
-
-	// Synchronise the document list
-	for(typename basic_buffer<Document, Selector>::document_iterator iter =
-		basic_buffer<Document, Selector>::document_begin();
-	   iter != basic_buffer<Document, Selector>::document_end();
-	   ++ iter)
+	else
 	{
-		// Setup document packet
-		net6::packet document_pack("obby_sync_doclist_document");
-
-		// TODO: Creation of this packet should be a method of
-		// server_document_info
-		document_pack << iter->get_owner() << iter->get_id()
-		              << iter->get_title() << iter->get_suffix()
-		              << iter->get_encoding();
-
-		// Add users that are subscribed
-		for(typename document_info_type::user_iterator user_iter =
-			iter->user_begin();
-		    user_iter != iter->user_end();
-		    ++ user_iter)
+		// Synchronise non-connected users.
+		for(user_table::iterator iter = basic_buffer<Document, Selector>::
+			m_user_table.begin(user::flags::NONE, user::flags::CONNECTED);
+		    iter != basic_buffer<Document, Selector>::
+			m_user_table.end(user::flags::NONE, user::flags::CONNECTED);
+		    ++ iter)
 		{
-			document_pack << &(*user_iter);
+			net6::packet user_pack("obby_sync_usertable_user");
+			user_pack << iter->get_id() << iter->get_name()
+			          << iter->get_colour();
+			send_now(user_pack, user6);
 		}
 
-		net6_server().send(document_pack, user6);
+		// Synchronise the document list
+		for(typename basic_buffer<Document, Selector>::document_iterator iter =
+			basic_buffer<Document, Selector>::document_begin();
+		   iter != basic_buffer<Document, Selector>::document_end();
+		   ++ iter)
+		{
+			// Setup document packet
+			net6::packet document_pack("obby_sync_doclist_document");
+
+			// TODO: Creation of this packet should be a method of
+			// server_document_info
+			document_pack << iter->get_owner() << iter->get_id()
+			              << iter->get_title() << iter->get_suffix()
+			              << iter->get_encoding();
+
+			// Add users that are subscribed
+			for(typename document_info_type::user_iterator user_iter =
+				iter->user_begin();
+			    user_iter != iter->user_end();
+			    ++ user_iter)
+			{
+				document_pack << &(*user_iter);
+			}
+
+			send_now(document_pack, user6);
+		}
 	}
 
-	// Done with synchronising
+	// Done with synchronising. The client may ask for the chat
+	// messages written before this point.
 	net6::packet final_pack("obby_sync_final");
-	net6_server().send(final_pack, user6);
+	const chat& history = basic_buffer<Document, Selector>::m_chat;
+	history.write_position(final_pack, history.message_count() );
+	send_now(final_pack, user6);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.sync(statistics::clock() - start);
+#endif
 
 	// Forward join message to documents
 	// TODO: Let the documents connect to signal_user_join
@@ -827,6 +1467,12 @@ void basic_server_buffer<Document, Selector>::on_part(const net6::user& user6)
 	// TODO: Move part signal emission to remove_user
 	basic_buffer<Document, Selector>::m_signal_user_part.emit(*cur_user);
 	basic_buffer<Document, Selector>::m_user_table.remove_user(*cur_user);
+
+	// net6 announces the part after this handler returned. Packets that
+	// refer to the user must reach the other clients before that.
+	flush();
+
+	m_send_queue.remove_client(user6);
 }
 
 template<typename Document, typename Selector>
@@ -835,6 +1481,10 @@ bool basic_server_buffer<Document, Selector>::
 	        const net6::packet& pack,
 	        net6::login::error& error)
 {
+	// Queued packets to all users must not reach the new one, its
+	// initial synchronisation already reflects them.
+	flush();
+
 	// Do not allow joins from clients whose connection is not encrypted
 	if(!user6.is_encrypted() )
 	{
@@ -919,17 +1569,48 @@ void basic_server_buffer<Document, Selector>::
 	// Send initial sync packet; this is here in on_login() for it to
 	// happen before net6 syncs its users.
 
+	// Clients that cache the user and document list send the version
+	// they know after the passwords. Unless it is from the current
+	// version history, they get the complete lists.
+	bool batched = (pack.get_param_count() > 5);
+	unsigned long sync_base = 0;
+	if(batched)
+	{
+		const std::string& sync_id =
+			pack.get_param(4).net6::parameter::as<std::string>();
+		unsigned long version =
+			pack.get_param(5).net6::parameter::as<unsigned long>();
+
+		sync_base = m_sync.get_base(sync_id, version);
+		m_sync.set_client_base(user6, sync_base);
+	}
+
+	// Clients that answer obby_ack_request say so after the version
+	if(pack.get_param_count() > 6 &&
+	   pack.get_param(6).net6::parameter::as<unsigned int>() != 0)
+		m_ack_clients.insert(&user6);
+
 	// Calculate number of required sync packets (one for each
 	// non-connected user, one for each document in the list).
-	unsigned int sync_n = basic_buffer<Document, Selector>::
-		m_user_table.count(user::flags::NONE, user::flags::NONE);
-	sync_n += basic_buffer<Document, Selector>::document_count();
+	unsigned int sync_n;
+	if(batched)
+	{
+		sync_n = sync_count(sync_base);
+	}
+	else
+	{
+		sync_n = basic_buffer<Document, Selector>::
+			m_user_table.count(user::flags::NONE, user::flags::NONE);
+		sync_n += basic_buffer<Document, Selector>::document_count();
+	}
 
 	// Send initial sync packet with this number, the client may then show
 	// a progressbar or something.
 	net6::packet init_pack("obby_sync_init");
-	init_pack << sync_n;
-	net6_server().send(init_pack, user6);
+	init_pack << sync_n << session_token(*new_user);
+	if(batched)
+		init_pack << m_sync.get_id() << m_sync.get_version() << sync_base;
+	send_now(init_pack, user6);
 }
 
 template<typename Document, typename Selector>
@@ -976,6 +1657,10 @@ void basic_server_buffer<Document, Selector>::on_data(const net6::user& user6,
 		throw net6::bad_value(str.str() );
 	}
 
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.packet_in(pack, *from_user);
+#endif
+
 	// Execute packet
 	if(!execute_packet(pack, *from_user) )
 	{
@@ -1013,6 +1698,12 @@ bool basic_server_buffer<Document, Selector>::
 		if(pack.get_command() == "obby_command_query")
 			{ on_net_command_query(pack, from); return true; }
 
+		if(pack.get_command() == "obby_ack")
+			{ on_net_ack(pack, from); return true; }
+
+		if(pack.get_command() == "obby_chat_backlog")
+			{ on_net_chat_backlog(pack, from); return true; }
+
 		return false;
 	}
 	catch(std::logic_error& e)
@@ -1075,6 +1766,16 @@ void basic_server_buffer<Document, Selector>::
 	send_message_impl(message, &from);
 }
 
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_net_chat_backlog(const net6::packet& pack,
+	                    const user& from)
+{
+	net6::packet reply("obby_chat_backlog");
+	basic_buffer<Document, Selector>::m_chat.write_backlog(pack, reply);
+	send(reply, from.get_net6() );
+}
+
 template<typename Document, typename Selector>
 void basic_server_buffer<Document, Selector>::
 	on_net_user_password(const net6::packet& pack,
@@ -1098,7 +1799,7 @@ void basic_server_buffer<Document, Selector>::
 	if(!basic_buffer<Document, Selector>::check_colour(colour, &from) )
 	{
 		net6::packet reply_pack("obby_user_colour_failed");
-		net6_server().send(reply_pack, from.get_net6() );
+		send(reply_pack, from.get_net6() );
 	}
 	else
 	{
@@ -1137,7 +1838,19 @@ void basic_server_buffer<Document, Selector>::
 	net6::packet reply_pack("obby_command_result");
 	result.append_packet(reply_pack);
 
-	net6_server().send(reply_pack, from.get_net6() );
+	send(reply_pack, from.get_net6() );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_net_ack(const net6::packet& pack,
+	           const user& from)
+{
+	unsigned int request = pack.get_param(0).net6::parameter::as<
+		unsigned int
+	>();
+
+	m_send_queue.ack(from.get_net6(), request);
 }
 
 template<typename Document, typename Selector>
@@ -1159,7 +1872,7 @@ command_result basic_server_buffer<Document, Selector>::
 		// there is no need to send emote message packet extra
 		if(&(*iter) == &from) continue;
 
-		net6_server().send(pack, iter->get_net6() );
+		send(pack, iter->get_net6() );
 	}
 
 	basic_buffer<Document, Selector>::m_chat.add_emote_message(
@@ -1170,27 +1883,946 @@ command_result basic_server_buffer<Document, Selector>::
 	return command_result(command_result::NO_REPLY);
 }
 
+#ifndef OBBY_DISABLE_STATISTICS
 template<typename Document, typename Selector>
-void basic_server_buffer<Document, Selector>::session_close()
+command_result basic_server_buffer<Document, Selector>::
+	on_command_stats(const user& from,
+	                 const std::string& paramlist)
 {
-	session_close_impl();
-	basic_buffer<Document, Selector>::session_close_impl();
-}
+	typedef typename basic_buffer<Document, Selector>::document_iterator
+		document_iterator;
 
-template<typename Document, typename Selector>
-void basic_server_buffer<Document, Selector>::session_close_impl()
-{
-	// Session is closed, so all users have quit
-	user_table& table = this->m_user_table;
+	std::ostringstream reply;
+	reply.setf(std::ios::fixed);
+	reply.precision(1);
 
-	for(user_table::iterator iter =
-		table.begin(user::flags::CONNECTED, user::flags::NONE);
-	    iter != table.end(user::flags::CONNECTED, user::flags::NONE);
-	    ++ iter)
+	m_statistics.report(reply);
+
+	// Documents, busiest first
+	std::vector<std::pair<unsigned long, const document_info_type*> > docs;
+	histogram records;
+
+	for(document_iterator iter =
+		basic_buffer<Document, Selector>::document_begin();
+	    iter != basic_buffer<Document, Selector>::document_end();
+	    ++ iter)
+	{
+		const document_info_type& info =
+			dynamic_cast<const document_info_type&>(*iter);
+
+		records.merge(info.get_statistics().get_record_time() );
+		docs.push_back(std::make_pair(
+			info.get_statistics().get_operation_count(),
+			&info
+		) );
+	}
+
+	reply << "records: " << records.get_count() << ", "
+	      << records.get_mean() << " us mean, "
+	      << records.get_percentile(99) << " us 99th percentile, "
+	      << records.get_max() << " us max\n";
+
+	std::sort(docs.rbegin(), docs.rend() );
+	for(std::size_t i = 0; i < docs.size() && i < 10; ++ i)
+	{
+		const document_info_type& info = *docs[i].second;
+
+		reply << info.get_suffixed_title() << ": ";
+		info.get_statistics().report(reply);
+		reply << ", " << info.get_transform_count()
+		      << " transformations";
+
+		if(!info.is_swapped() )
+		{
+			const typename document_info_type::document_type& doc =
+				info.get_content();
+
+			unsigned long chunks = 0;
+			for(typename document_info_type::document_type::
+				chunk_iterator chunk = doc.chunk_begin();
+			    chunk != doc.chunk_end();
+			    ++ chunk)
+			{
+				++ chunks;
+			}
+
+			reply << ", " << chunks << " chunks";
+		}
+
+		reply << "\n";
+	}
+
+	// The connection of the requesting client. Names and traffic of
+	// the other clients are not handed out to anyone who asks.
+	const statistics::client_map& clients = m_statistics.get_clients();
+
+	traffic client;
+	statistics::client_map::const_iterator client_iter =
+		clients.find(&from);
+	if(client_iter != clients.end() )
+		client = client_iter->second;
+
+	std::size_t acks = 0;
+	for(typename std::vector<std::pair<unsigned long,
+		const document_info_type*> >::const_iterator doc_iter =
+			docs.begin();
+	    doc_iter != docs.end();
+	    ++ doc_iter)
+	{
+		acks += doc_iter->second->get_ack_count(from);
+	}
+
+	reply << from.get_name() << ": "
+	      << client.packets_in << " in ("
+	      << client.bytes_in << " bytes), "
+	      << acks << " unacknowledged records, "
+	      << get_send_queue(from) << " bytes queued\n";
+
+	return command_result(command_result::REPLY, reply.str() );
+}
+
+template<typename Document, typename Selector>
+const statistics& basic_server_buffer<Document, Selector>::
+	get_statistics() const
+{
+	return m_statistics;
+}
+#endif
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	send_now(const net6::packet& pack,
+	         const net6::user& to)
+{
+	m_send_queue.send(pack, to);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.packet_out(pack, 1);
+#endif
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::session_close()
+{
+	session_close_impl();
+	basic_buffer<Document, Selector>::session_close_impl();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::session_close_impl()
+{
+	// Session is closed, so all users have quit
+	user_table& table = this->m_user_table;
+
+	for(user_table::iterator iter =
+		table.begin(user::flags::CONNECTED, user::flags::NONE);
+	    iter != table.end(user::flags::CONNECTED, user::flags::NONE);
+	    ++ iter)
 	{
 		// This call also unsubscribes the user from all documents
 		basic_buffer<Document, Selector>::user_part(*iter);
 	}
+
+	flush();
+	snapshot_wait();
+	m_journal.close();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	send(const net6::packet& pack) const
+{
+	m_send_queue.append(pack);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.packet_out(pack, m_send_queue.get_client_count() );
+#endif
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	send(const net6::packet& pack, const net6::user& to) const
+{
+	m_send_queue.append(pack, to);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.packet_out(pack, 1);
+#endif
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::flush() const
+{
+	if(!m_flush_pending) return;
+
+	// Changes reach the disk before anyone is told about them
+	m_journal.commit();
+
+	net_type& net = dynamic_cast<net_type&>(
+		*basic_buffer<Document, Selector>::m_net
+	);
+
+	net.get_selector().set(m_flush_socket, net6::IO_NONE);
+	m_flush_pending = false;
+
+	m_send_queue.flush();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::kick_overflow()
+{
+	// Kicking a user runs the part handlers, which may remove other
+	// clients from the list.
+	const net6::user* user6;
+	while( (user6 = m_send_queue.pop_overflow()) != NULL)
+	{
+		// The documents keep the state of the user when it parts,
+		// so that it may resume its subscriptions.
+		net6_server().kick(*user6);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	net_send(const net6::packet& pack,
+	         const net6::user& to) const
+{
+	dynamic_cast<net_type&>(
+		*basic_buffer<Document, Selector>::m_net
+	).send(pack, to);
+}
+
+template<typename Document, typename Selector>
+bool basic_server_buffer<Document, Selector>::
+	check_session_token(const user& user,
+	                    const std::string& token) const
+{
+	typename token_map::const_iterator iter = m_session_tokens.find(&user);
+	if(iter == m_session_tokens.end() ) return false;
+	return iter->second == token;
+}
+
+template<typename Document, typename Selector>
+const std::string& basic_server_buffer<Document, Selector>::
+	session_token(const user& user)
+{
+	typename token_map::iterator iter = m_session_tokens.find(&user);
+	if(iter != m_session_tokens.end() ) return iter->second;
+
+	std::stringstream stream;
+	stream << std::hex << user.get_id() << '-' << random_token();
+
+	return m_session_tokens[&user] = stream.str();
+}
+
+template<typename Document, typename Selector>
+unsigned int basic_server_buffer<Document, Selector>::
+	sync_count(unsigned long base) const
+{
+	if(base == 0)
+	{
+		return basic_buffer<Document, Selector>::m_user_table.count(
+			user::flags::NONE,
+			user::flags::NONE
+		) + basic_buffer<Document, Selector>::document_count();
+	}
+
+	return m_sync.count(base);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	sync_send(const net6::user& to, unsigned long base)
+{
+	// Batches stay around 16 KiB, so that a large session does not
+	// need a packet per entry, but a single packet does not hold up
+	// the connection for long either.
+	const std::size_t batch_size = 0x4000;
+
+	const user_table& table = basic_buffer<Document, Selector>::m_user_table;
+	user_table::iterator user_iter =
+		table.begin(user::flags::NONE, user::flags::NONE);
+
+	// Connected users are included because the client caches them
+	// for when they have left.
+	while(user_iter != table.end(user::flags::NONE, user::flags::NONE) )
+	{
+		net6::packet user_pack("obby_sync_usertable");
+		std::size_t bytes = 0;
+
+		for(; user_iter != table.end(user::flags::NONE, user::flags::NONE)
+		      && bytes < batch_size;
+		    ++ user_iter)
+		{
+			if(!m_sync.is_user_changed(user_iter->get_id(), base) )
+				continue;
+
+			user_pack << user_iter->get_id()
+			          << user_iter->get_name()
+			          << user_iter->get_colour();
+			bytes += user_iter->get_name().length() + 16;
+		}
+
+		if(bytes > 0) send_now(user_pack, to);
+	}
+
+	typename basic_buffer<Document, Selector>::document_iterator doc_iter =
+		basic_buffer<Document, Selector>::document_begin();
+
+	while(doc_iter != basic_buffer<Document, Selector>::document_end() )
+	{
+		net6::packet document_pack("obby_sync_doclist");
+		std::size_t bytes = 0;
+
+		for(; doc_iter != basic_buffer<Document, Selector>::
+			document_end() && bytes < batch_size;
+		    ++ doc_iter)
+		{
+			if(!m_sync.is_document_changed(document_key(
+				doc_iter->get_owner_id(),
+				doc_iter->get_id()
+			), base) )
+				continue;
+
+			// Subscribers are preceded by their count, so that
+			// the packet can hold more than one document.
+			document_pack << doc_iter->get_owner_id()
+			              << doc_iter->get_id()
+			              << doc_iter->get_title()
+			              << doc_iter->get_suffix()
+			              << doc_iter->get_encoding()
+			              << static_cast<unsigned int>(
+			                     doc_iter->user_count() );
+
+			for(typename document_info_type::user_iterator
+				sub_iter = doc_iter->user_begin();
+			    sub_iter != doc_iter->user_end();
+			    ++ sub_iter)
+			{
+				document_pack << sub_iter->get_id();
+			}
+
+			bytes += doc_iter->get_title().length() +
+				doc_iter->get_encoding().length() + 32 +
+				doc_iter->user_count() * 4;
+		}
+
+		if(bytes > 0) send_now(document_pack, to);
+	}
+
+	if(base == 0) return;
+
+	const sync_history::document_map& removals = m_sync.get_removals();
+	sync_history::document_map::const_iterator removal_iter =
+		removals.begin();
+
+	while(removal_iter != removals.end() )
+	{
+		net6::packet remove_pack("obby_sync_doclist_remove");
+		std::size_t bytes = 0;
+
+		for(; removal_iter != removals.end() &&
+		      bytes < batch_size;
+		    ++ removal_iter)
+		{
+			if(removal_iter->second <= base) continue;
+
+			remove_pack << removal_iter->first.first
+			            << removal_iter->first.second;
+			bytes += 16;
+		}
+
+		if(bytes > 0) send_now(remove_pack, to);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::on_sync_user(const user& user)
+{
+	m_sync.touch_user(user.get_id() );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_sync_document_insert(base_document_info_type& info)
+{
+	document_info_type& server_info =
+		dynamic_cast<document_info_type&>(info);
+
+	server_info.rename_event().connect(
+		sigc::bind(
+			sigc::mem_fun(
+				*this,
+				&basic_server_buffer::on_sync_document_rename
+			),
+			&server_info
+		)
+	);
+
+	server_info.subscribe_event().connect(
+		sigc::bind(
+			sigc::mem_fun(
+				*this,
+				&basic_server_buffer::on_sync_document_subscribe
+			),
+			&server_info
+		)
+	);
+
+	server_info.unsubscribe_event().connect(
+		sigc::bind(
+			sigc::mem_fun(
+				*this,
+				&basic_server_buffer::on_sync_document_subscribe
+			),
+			&server_info
+		)
+	);
+
+	m_sync.insert_document(
+		document_key(info.get_owner_id(), info.get_id()) );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_sync_document_remove(base_document_info_type& info)
+{
+	m_sync.remove_document(
+		document_key(info.get_owner_id(), info.get_id()) );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_sync_document_rename(const std::string& title,
+	                        document_info_type* info)
+{
+	m_sync.touch_document(
+		document_key(info->get_owner_id(), info->get_id()) );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_sync_document_subscribe(const user& user,
+	                           document_info_type* info)
+{
+	m_sync.touch_document(
+		document_key(info->get_owner_id(), info->get_id()) );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	set_swap_directory(const std::string& directory,
+	                   unsigned int idle_time,
+	                   unsigned int idle_limit)
+{
+	m_swap.set_directory(directory, idle_time, idle_limit);
+}
+
+template<typename Document, typename Selector>
+const std::string&
+basic_server_buffer<Document, Selector>::get_swap_directory() const
+{
+	return m_swap.get_directory();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	document_used(document_info_type& info) const
+{
+	if(m_swap.used(info) )
+		swap_expire(&info);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	swap_expire(const document_info_type* except) const
+{
+	unsigned long timeout;
+	bool pending = m_swap.expire(except, timeout);
+
+	if(!basic_buffer<Document, Selector>::is_open() ) return;
+
+	Selector& selector =
+		basic_buffer<Document, Selector>::m_net->get_selector();
+
+	if(!pending)
+	{
+		selector.set(m_swap_socket, net6::IO_NONE);
+		return;
+	}
+
+	selector.set(m_swap_socket, net6::IO_TIMEOUT);
+	selector.set_timeout(m_swap_socket, timeout);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::swap_clear()
+{
+	m_swap.clear();
+
+	if(basic_buffer<Document, Selector>::is_open() )
+	{
+		basic_buffer<Document, Selector>::m_net->get_selector().set(
+			m_swap_socket,
+			net6::IO_NONE
+		);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_swap(net6::io_condition cond)
+{
+	swap_expire(NULL);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_swap_document_remove(base_document_info_type& info)
+{
+	m_swap.remove(dynamic_cast<document_info_type&>(info) );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::set_journal(bool enable)
+{
+	m_journal_enabled = enable;
+}
+
+template<typename Document, typename Selector>
+bool basic_server_buffer<Document, Selector>::get_journal() const
+{
+	return m_journal_enabled;
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::journal_compact()
+{
+	unsigned long generation = m_journal.compaction_begin();
+	if(generation == 0) return;
+
+	m_snapshot_generation = generation;
+
+	try
+	{
+		m_journal.compaction_start(*snapshot_start(
+			m_journal.get_session_file(),
+			m_journal.get_session_format()
+		) );
+	}
+	catch(...)
+	{
+		m_snapshot_generation = 0;
+		throw;
+	}
+
+	m_snapshot_generation = 0;
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	serialise_async(const std::string& file,
+	                serialise::writer::format_type format)
+{
+	snapshot_start(file, format);
+
+	// Nothing polls for the snapshot without selector
+	if(!basic_buffer<Document, Selector>::is_open() )
+		snapshot_wait();
+}
+
+template<typename Document, typename Selector>
+snapshot* basic_server_buffer<Document, Selector>::
+	snapshot_start(const std::string& file,
+	               serialise::writer::format_type format)
+{
+	// Capturing the session in binary format mostly copies the
+	// documents' text, the snapshot converts it to the requested
+	// format while writing.
+	std::ostringstream stream;
+
+	{
+		serialise::writer writer(
+			stream, "obby", serialise::writer::FORMAT_BINARY
+		);
+
+		basic_buffer<Document, Selector>::serialise(writer);
+		writer.flush();
+	}
+
+	std::string data = stream.str();
+	snapshot* snap = new snapshot(file, format, data);
+	m_snapshots.push_back(snap);
+
+	if(basic_buffer<Document, Selector>::is_open() )
+	{
+		// Poll for the snapshot to complete
+		Selector& selector =
+			basic_buffer<Document, Selector>::m_net->get_selector();
+
+		selector.set(m_snapshot_socket, net6::IO_TIMEOUT);
+		selector.set_timeout(m_snapshot_socket, 50);
+	}
+
+	return snap;
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_snapshot(net6::io_condition cond)
+{
+	typename snapshot_list::iterator iter = m_snapshots.begin();
+	while(iter != m_snapshots.end() )
+	{
+		if(!(*iter)->is_done() )
+		{
+			++ iter;
+			continue;
+		}
+
+		std::auto_ptr<snapshot> snap(*iter);
+		iter = m_snapshots.erase(iter);
+		snapshot_finish(*snap);
+	}
+
+	Selector& selector =
+		basic_buffer<Document, Selector>::m_net->get_selector();
+
+	if(m_snapshots.empty() )
+	{
+		selector.set(m_snapshot_socket, net6::IO_NONE);
+	}
+	else
+	{
+		selector.set(m_snapshot_socket, net6::IO_TIMEOUT);
+		selector.set_timeout(m_snapshot_socket, 50);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::snapshot_wait()
+{
+	while(!m_snapshots.empty() )
+	{
+		std::auto_ptr<snapshot> snap(m_snapshots.front() );
+		m_snapshots.pop_front();
+
+		snap->wait();
+		snapshot_finish(*snap);
+	}
+
+	if(basic_buffer<Document, Selector>::is_open() )
+	{
+		basic_buffer<Document, Selector>::m_net->get_selector().set(
+			m_snapshot_socket,
+			net6::IO_NONE
+		);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::snapshot_finish(snapshot& snap)
+{
+	m_journal.snapshot_done(snap);
+	m_signal_snapshot.emit(snap.get_file(), snap.get_error() );
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::flush_schedule() const
+{
+	if(m_flush_pending) return;
+
+	// Flush at the end of the current selector iteration
+	Selector& selector =
+		basic_buffer<Document, Selector>::m_net->get_selector();
+
+	selector.set(m_flush_socket, net6::IO_TIMEOUT);
+	selector.set_timeout(m_flush_socket, 0);
+	m_flush_pending = true;
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::journal_replay(bool users_only)
+{
+	typedef ::serialise::default_context_from<unsigned int> id_context;
+	typedef ::serialise::default_context_from<colour> colour_context;
+
+	user_table& table = basic_buffer<Document, Selector>::m_user_table;
+
+	journal::entry_list& entries = m_journal.get_entries();
+
+	journal::entry_list::iterator iter = entries.begin();
+	while(iter != entries.end() )
+	{
+		const journal::entry& ent = *iter;
+		const std::string& type = ent.empty() ? "" : ent[0];
+
+		if(type == "user" && ent.size() == 4)
+		{
+			unsigned int id = id_context().from_string(ent[1]);
+			colour col = colour_context().from_string(ent[3]);
+
+			const user* existing = table.find(
+				id, user::flags::NONE, user::flags::NONE
+			);
+
+			if(existing == NULL)
+				table.add_user(id, ent[2], col);
+			else
+				table.set_user_colour(*existing, col);
+		}
+		else if(type == "colour" && ent.size() == 3)
+		{
+			const user* existing = table.find(
+				id_context().from_string(ent[1]),
+				user::flags::NONE,
+				user::flags::NONE
+			);
+
+			if(existing != NULL)
+			{
+				table.set_user_colour(
+					*existing,
+					colour_context().from_string(ent[2])
+				);
+			}
+		}
+		else if(users_only)
+		{
+			++ iter;
+			continue;
+		}
+		else if(type == "document" && ent.size() == 2)
+		{
+			serialise::parser parser;
+			parser.deserialise_memory(ent[1]);
+
+			base_document_info_type* info =
+				new_document_info(parser.get_root() );
+			basic_buffer<Document, Selector>::document_add(*info);
+
+			if(info->get_id() > this->m_doc_counter)
+				this->m_doc_counter = info->get_id();
+		}
+		else if(type == "remove" && ent.size() == 3)
+		{
+			document_info_type* info = document_find(
+				id_context().from_string(ent[1]),
+				id_context().from_string(ent[2])
+			);
+
+			if(info != NULL) document_remove(*info);
+		}
+		else if(type == "rename" && ent.size() == 5)
+		{
+			document_info_type* info = document_find(
+				id_context().from_string(ent[1]),
+				id_context().from_string(ent[2])
+			);
+
+			if(info != NULL)
+			{
+				info->replay_rename(
+					ent[3],
+					id_context().from_string(ent[4])
+				);
+			}
+		}
+		else if(type == "op" && ent.size() >= 4)
+		{
+			document_info_type* info = document_find(
+				id_context().from_string(ent[1]),
+				id_context().from_string(ent[2])
+			);
+
+			unsigned int author_id = id_context().from_string(ent[3]);
+			const user* author = NULL;
+			if(author_id != 0)
+			{
+				author = table.find(
+					author_id,
+					user::flags::NONE,
+					user::flags::NONE
+				);
+			}
+
+			// Rebuild the packet the operation has been stored from
+			net6::packet pack("obby_journal");
+			for(journal::entry::size_type i = 4; i < ent.size(); ++ i)
+				pack << ent[i];
+
+			unsigned int index = 0;
+			std::auto_ptr<operation<Document> > op(
+				operation<Document>::from_packet(
+					pack,
+					index,
+					table
+				)
+			);
+
+			if(info != NULL) info->replay_operation(*op, author);
+		}
+		else
+		{
+			format_string str(_("Journal entry '%0%' is invalid") );
+			str << type;
+			throw std::runtime_error(str.str() );
+		}
+
+		iter = entries.erase(iter);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	serialise_attributes(serialise::writer& writer) const
+{
+	if(m_snapshot_generation == 0) return;
+	writer.add_attribute("journal", m_snapshot_generation);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::on_journal_users()
+{
+	journal_replay(true);
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_user_join(const user& user)
+{
+	if(!m_journal.is_open() ) return;
+
+	m_journal.append_user(user);
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_user_colour(const user& user)
+{
+	if(!m_journal.is_open() ) return;
+
+	m_journal.append_colour(user);
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_document_insert(base_document_info_type& info)
+{
+	document_info_type& server_info =
+		dynamic_cast<document_info_type&>(info);
+
+	// The handlers check themselves whether the session is journaled
+	server_info.rename_event().connect(
+		sigc::bind(
+			sigc::mem_fun(
+				*this,
+				&basic_server_buffer::on_journal_document_rename
+			),
+			&server_info
+		)
+	);
+
+	server_info.apply_event().connect(
+		sigc::bind(
+			sigc::mem_fun(
+				*this,
+				&basic_server_buffer::on_journal_document_apply
+			),
+			&server_info
+		)
+	);
+
+	if(!m_journal.is_open() ) return;
+
+	// Store the whole document, it may have been created with content
+	std::ostringstream stream;
+
+	{
+		serialise::writer writer(
+			stream, "obby", serialise::writer::FORMAT_BINARY
+		);
+
+		writer.begin_object("document");
+		server_info.serialise(writer);
+		writer.end_object();
+	}
+
+	m_journal.append_document(stream.str() );
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_document_remove(base_document_info_type& info)
+{
+	if(!m_journal.is_open() ) return;
+
+	m_journal.append_remove(info.get_owner_id(), info.get_id() );
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_document_rename(const std::string& title,
+	                           document_info_type* info)
+{
+	if(!m_journal.is_open() ) return;
+
+	m_journal.append_rename(
+		info->get_owner_id(),
+		info->get_id(),
+		title,
+		info->get_suffix()
+	);
+
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_journal_document_apply(const operation<Document>& op,
+	                          const user* author,
+	                          document_info_type* info)
+{
+	if(!m_journal.is_open() ) return;
+
+	net6::packet pack("obby_journal");
+	op.append_packet(pack);
+
+	m_journal.append_operation(
+		info->get_owner_id(),
+		info->get_id(),
+		author,
+		pack
+	);
+
+	flush_schedule();
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::reset_queue()
+{
+	// The flush socket was registered with the selector of the previous
+	// net6 object, if any.
+	m_send_queue.clear();
+	m_flush_pending = false;
+}
+
+template<typename Document, typename Selector>
+void basic_server_buffer<Document, Selector>::
+	on_flush(net6::io_condition cond)
+{
+	flush();
+	kick_overflow();
+
+	// Keep the cost of replaying the journal proportional to the size
+	// of the session. Small sessions are not rewritten on every few
+	// changes.
+	if(m_journal.needs_compaction() )
+		journal_compact();
 }
 
 template<typename Document, typename Selector>
@@ -1238,6 +2870,24 @@ basic_server_buffer<Document, Selector>::
 	return new document_info_type(*this, net6_server(), obj);
 }
 
+template<typename Document, typename Selector>
+typename basic_server_buffer<Document, Selector>::base_document_info_type*
+basic_server_buffer<Document, Selector>::
+	new_document_info(const serialise::object& obj,
+	                  const serialise::mapped_file& source,
+	                  std::size_t offset,
+	                  unsigned int line)
+{
+	return new document_info_type(
+		*this,
+		net6_server(),
+		obj,
+		source,
+		offset,
+		line
+	);
+}
+
 template<typename Document, typename Selector>
 typename basic_server_buffer<Document, Selector>::base_net_type*
 basic_server_buffer<Document, Selector>::new_net()
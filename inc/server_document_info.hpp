@@ -19,9 +19,16 @@
 #ifndef _OBBY_SERVER_DOCUMENT_INFO_HPP_
 #define _OBBY_SERVER_DOCUMENT_INFO_HPP_
 
+#include <cstdio>
+#include <set>
 #include <net6/server.hpp>
 #include "serialise/object.hpp"
 #include "serialise/attribute.hpp"
+#include "serialise/parser.hpp"
+#include "serialise/mapped_file.hpp"
+#include "serialise/reader.hpp"
+#include "serialise/writer.hpp"
+#include "format_string.hpp"
 #include "no_operation.hpp"
 #include "split_operation.hpp"
 #include "insert_operation.hpp"
@@ -30,6 +37,7 @@
 #include "jupiter_server.hpp"
 #include "document_packet.hpp"
 #include "document_info.hpp"
+#include "statistics.hpp"
 
 namespace obby
 {
@@ -52,6 +60,9 @@ public:
 	typedef typename buffer_type::net_type net_type;
 	typedef jupiter_server<Document> jupiter_type;
 	typedef typename jupiter_type::record_type record_type;
+	typedef typename jupiter_type::operation_type operation_type;
+	typedef typename jupiter_type::signal_apply_type signal_apply_type;
+	typedef typename base_type::privileges privileges;
 
 	basic_server_document_info(const buffer_type& buffer,
 	                           net_type& net,
@@ -61,12 +72,29 @@ public:
 	                           const std::string& encoding,
 	                           const std::string& content);
 
-	/** Deserialises a document from a serialisation object.
+	/** Deserialises a document from a serialisation object. If the
+	 * buffer has a swap directory, the content is swapped out once the
+	 * document has been idle for long enough.
 	 */
 	basic_server_document_info(const buffer_type& buffer,
 	                           net_type& net,
 	                           const serialise::object& obj);
 
+	/** Deserialises the attributes of a document from <em>obj</em>.
+	 * The content is the object starting at <em>offset</em> and
+	 * <em>line</em> in <em>source</em>, it is not parsed before it is
+	 * first needed. <em>source</em> must remain valid as long as the
+	 * document exists.
+	 */
+	basic_server_document_info(const buffer_type& buffer,
+	                           net_type& net,
+	                           const serialise::object& obj,
+	                           const serialise::mapped_file& source,
+	                           std::size_t offset,
+	                           unsigned int line);
+
+	virtual ~basic_server_document_info();
+
 	/** Inserts the given text at the given position into the document.
 	 */
 	virtual void insert(position pos, const std::string& text);
@@ -87,6 +115,49 @@ public:
 	 */
 	void unsubscribe_user(const user& user);
 
+	/** @brief Subscribes the given user as an observer that reads the
+	 * document without changing it.
+	 *
+	 * Observers are not added to the jupiter server. They receive the
+	 * operations in the order they have been applied to the document,
+	 * from one packet that is built for all of them. They are not in the
+	 * list of subscribed users, and records they send are rejected.
+	 * Unsubscribe them with unsubscribe_user(). Subscription requests
+	 * of users who have the SUBSCRIBE but not the MODIFY privilege
+	 * are turned into observer subscriptions.
+	 */
+	void observe_user(const user& user);
+
+	/** @brief Changes the privileges of <em>user</em> in the document's
+	 * privileges table.
+	 *
+	 * Users need the SUBSCRIBE privilege to subscribe to the document
+	 * or to observe it, and the MODIFY privilege to change it. The
+	 * privileges are checked when the user sends a request, a user who
+	 * is subscribed already stays subscribed.
+	 */
+	void set_privileges(const user& user, privileges privs);
+
+	/** @brief Returns whether <em>user</em> observes the document.
+	 */
+	bool is_observing(const user& user) const;
+
+	/** @brief Returns the number of users observing the document.
+	 */
+	std::size_t observer_count() const;
+
+	/** @brief Applies an operation that has been applied to the document
+	 * in an earlier run of the server, without sending it to anyone.
+	 * Used to replay the buffer's journal.
+	 */
+	void replay_operation(const operation_type& op, const user* author);
+
+	/** @brief Gives the document the title and suffix it has been renamed
+	 * to in an earlier run of the server, without telling anyone. Used to
+	 * replay the buffer's journal.
+	 */
+	void replay_rename(const std::string& new_title, unsigned int suffix);
+
 	/** Called by the buffer if a network event occured that belongs to the
 	 * document.
 	 */
@@ -105,6 +176,60 @@ public:
 	 */
 	virtual void obby_session_close();
 
+	/** Returns whether the document may be serialised. Swapped out
+	 * documents are read back from the swap file or the session they
+	 * have been loaded from.
+	 */
+	virtual bool can_serialise() const;
+
+	/** Writes the document's attributes and content to the current
+	 * object of <em>writer</em>.
+	 */
+	virtual void serialise(serialise::writer& writer) const;
+
+	/** @brief Returns whether the content of the document is in
+	 * memory without anyone being subscribed to it.
+	 */
+	bool is_idle() const;
+
+	/** @brief Returns whether the content of the document has been
+	 * swapped out, or has not been loaded from the session yet.
+	 */
+	bool is_swapped() const;
+
+	/** @brief Writes the content of the document into the buffer's swap
+	 * directory and releases it from memory. The document has to be
+	 * idle.
+	 */
+	void swap_out();
+
+	/** @brief Loads the content of the document from the swap file
+	 * or the session it has been loaded from. get_content() calls this
+	 * if the content is not in memory.
+	 */
+	void swap_in();
+
+	/** Signal which will be emitted for every operation that has been
+	 * applied to the document, with the user who caused it.
+	 */
+	signal_apply_type apply_event() const;
+
+	/** @brief Returns the number of records that have been sent to
+	 * <em>user</em> but have not been acknowledged yet.
+	 */
+	std::size_t get_ack_count(const user& user) const;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	/** @brief Returns the instrumentation counters of the document.
+	 */
+	const document_statistics& get_statistics() const;
+
+	/** @brief Returns how many operations have been transformed since
+	 * the content of the document has been loaded.
+	 */
+	unsigned long get_transform_count() const;
+#endif
+
 protected:
 	/** Internal function that subscribes a user to this document.
 	 */
@@ -114,6 +239,11 @@ protected:
 	 */
 	virtual void user_unsubscribe(const user& user);
 
+	/** Parses or swaps in the content when get_content() is called
+	 * before anything else has needed it.
+	 */
+	virtual void load_content() const;
+
 	/** Inserts text written by <em>author</em> into the document.
 	 */
 	void insert_impl(position pos,
@@ -153,17 +283,33 @@ protected:
 	virtual void on_net_subscribe(const document_packet& pack,
 	                              const user& from);
 
+	/** Request to observe the document.
+	 */
+	virtual void on_net_observe(const document_packet& pack,
+	                            const user& from);
+
 	/** Unsubscribe request.
 	 */
 	virtual void on_net_unsubscribe(const document_packet& pack,
 	                                const obby::user& from);
 
+	/** Request of a reconnected client to resume its subscription.
+	 */
+	virtual void on_net_resume(const document_packet& pack,
+	                           const user& from);
+
 	/** Callback from jupiter implementation with a record
 	 * that may be sent to the given user.
 	 */
 	virtual void on_jupiter_record(const record_type& rec, const user& user,
 	                               const obby::user* from);
 
+#ifndef OBBY_DISABLE_STATISTICS
+	/** Counts an operation applied by the jupiter implementation.
+	 */
+	void on_jupiter_apply(const operation_type& op, const user* from);
+#endif
+
 	/** @brief Broadcasts a user subscription to the other users.
 	 */
 	void broadcast_subscription(const user& user);
@@ -172,12 +318,62 @@ protected:
 	 */
 	void broadcast_unsubscription(const user& user);
 
+	/** @brief Sends an operation that has been applied to the document
+	 * to the observers.
+	 */
+	void broadcast_operation(const operation_type& op, const user* from);
+
 	/** @brief Implementation of the session close callback that does
 	 * not call the base function.
 	 */
 	void session_close_impl();
 
+	/** Creates the jupiter server implementation for the document.
+	 */
+	void jupiter_create();
+
+	/** Sends the content of the document to <em>user</em>.
+	 */
+	void sync_content(const user& user);
+
+	/** Builds the document from the chunks in <em>obj</em>.
+	 */
+	void content_deserialise(const serialise::object& obj);
+
+	/** Copies the chunks of the object <em>reader</em> has just begun
+	 * to <em>writer</em>, without building the document.
+	 */
+	static void content_copy(serialise::reader& reader,
+	                         serialise::writer& writer);
+
+	/** Tells the buffer that the document has been loaded or its
+	 * subscriptions have changed, so that it may swap out documents
+	 * that have been idle for a longer time.
+	 */
+	void document_used();
+
 	std::auto_ptr<jupiter_type> m_jupiter;
+	signal_apply_type m_signal_apply;
+
+	/** File the content has been swapped out to, empty if the content
+	 * is in memory.
+	 */
+	std::string m_swap_file;
+
+	/** Session the content is read from when it is first needed, NULL
+	 * if the content has been loaded already.
+	 */
+	const serialise::mapped_file* m_source;
+	std::size_t m_source_offset;
+	unsigned int m_source_line;
+
+	/** Users observing the document.
+	 */
+	std::set<const user*> m_observers;
+
+#ifndef OBBY_DISABLE_STATISTICS
+	document_statistics m_statistics;
+#endif
 
 public:
 	/** Returns the buffer to which this document_info belongs.
@@ -210,15 +406,14 @@ basic_server_document_info<Document, Selector>::
 		id,
 		title,
 		encoding
-	)
+	),
+	m_source(NULL)
 {
 	base_type::assign_document();
 	base_type::m_document->insert(0, content, NULL);
 
 	// Create jupiter server implementation
-	m_jupiter.reset(new jupiter_type(
-		*basic_document_info<Document, Selector>::m_document
-	) );
+	jupiter_create();
 
 	// Owner is subscribed implicitely
 	if(owner != NULL)
@@ -229,16 +424,12 @@ basic_server_document_info<Document, Selector>::
 		document_packet pack(*this, "rename");
 		pack << static_cast<const obby::user*>(NULL)
 		     << base_type::m_title << base_type::m_suffix;
-		get_net6().send(pack, owner->get_net6());
+		get_buffer().send(pack, owner->get_net6());
+	}
+	else
+	{
+		document_used();
 	}
-
-	// Connect to signals
-	m_jupiter->record_event().connect(
-		sigc::mem_fun(
-			*this,
-			&basic_server_document_info::on_jupiter_record
-		)
-	);
 }
 
 template<typename Document, typename Selector>
@@ -246,48 +437,32 @@ basic_server_document_info<Document, Selector>::
 	basic_server_document_info(const buffer_type& buffer,
 	                           net_type& net,
 	                           const serialise::object& obj):
-	base_type(buffer, net, obj)
+	base_type(buffer, net, obj), m_source(NULL)
 {
-	// TODO: Avoid code duplication somehow
-	// What code duplication? :( -- armin, Fri Mar 10
-
-	// Assign document content
-	base_type::assign_document();
-
-	// Deserialise document
-	for(serialise::object::child_iterator child_it = obj.children_begin();
-	    child_it != obj.children_end();
-	    ++ child_it)
-	{
-		if(child_it->get_name() != "chunk")
-			continue; // TODO: Throw unexpected child error
-
-		const serialise::attribute& content_attr =
-			child_it->get_required_attribute("content");
-		const serialise::attribute& author_attr =
-			child_it->get_required_attribute("author");
+	// The buffer swaps the content out when it has been idle for long
+	// enough.
+	content_deserialise(obj);
+	document_used();
+}
 
-		base_type::m_document->append(
-			content_attr.obby::serialise::attribute::as<std::string>(),
-			author_attr.obby::serialise::attribute::as<const user*>(
-				::serialise::default_context_from<const user*>(
-					buffer.get_user_table()
-				)
-			)
-		);
-	}
+template<typename Document, typename Selector>
+basic_server_document_info<Document, Selector>::
+	basic_server_document_info(const buffer_type& buffer,
+	                           net_type& net,
+	                           const serialise::object& obj,
+	                           const serialise::mapped_file& source,
+	                           std::size_t offset,
+	                           unsigned int line):
+	base_type(buffer, net, obj), m_source(&source),
+	m_source_offset(offset), m_source_line(line)
+{
+}
 
-	// Create jupiter server implementation
-	m_jupiter.reset(new jupiter_type(
-		*basic_document_info<Document, Selector>::m_document
-	) );
-	// Connect to signals
-	m_jupiter->record_event().connect(
-		sigc::mem_fun(
-			*this,
-			&basic_server_document_info::on_jupiter_record
-		)
-	);
+template<typename Document, typename Selector>
+basic_server_document_info<Document, Selector>::~basic_server_document_info()
+{
+	if(!m_swap_file.empty() )
+		std::remove(m_swap_file.c_str() );
 }
 
 template<typename Document, typename Selector>
@@ -330,15 +505,35 @@ void basic_server_document_info<Document, Selector>::
 
 	// TODO: Check userflags for connected?
 
+	swap_in();
+
+	if(m_observers.count(&user) > 0)
+	{
+		throw std::logic_error(
+			"obby::basic_server_document_info::subscribe_user:\n"
+			"User is observing the document"
+		);
+	}
+
 	// Subscribe given user
 	user_subscribe(user);
 
 	// Synchronise initial document to user
+	sync_content(user);
+
+	// Broadcast subscription
+	broadcast_subscription(user);
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	sync_content(const user& user)
+{
 	document_type& doc = *base_type::m_document;
 
 	document_packet init_pack(*this, "sync_init");
 	init_pack << doc.size();
-	get_net6().send(init_pack, user.get_net6() );
+	get_buffer().send(init_pack, user.get_net6() );
 
 	// Send content
 	for(typename document_type::chunk_iterator iter = doc.chunk_begin();
@@ -348,11 +543,8 @@ void basic_server_document_info<Document, Selector>::
 		// TODO: Do not send all at once.
 		document_packet chunk_pack(*this, "sync_chunk");
 		chunk_pack << iter.get_text() << iter.get_author();
-		get_net6().send(chunk_pack, user.get_net6() );
+		get_buffer().send(chunk_pack, user.get_net6() );
 	}
-
-	// Broadcast subscription
-	broadcast_subscription(user);
 }
 
 template<typename Document, typename Selector>
@@ -367,12 +559,98 @@ void basic_server_document_info<Document, Selector>::
 		);
 	}
 
+	// Nobody else knows about observers
+	if(m_observers.erase(&user) > 0)
+	{
+		document_packet pack(*this, "unsubscribe");
+		pack << &user;
+		get_buffer().send(pack, user.get_net6() );
+
+		if(base_type::user_count() == 0 && m_observers.empty() )
+			document_used();
+		return;
+	}
+
 	// Unsubscribe user
 	user_unsubscribe(user);
 	// Broadcast unsubscription
 	broadcast_unsubscription(user);
 }
 
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	observe_user(const user& user)
+{
+	if(base_type::m_net == NULL)
+	{
+		throw std::logic_error(
+			"obby::basic_server_document_info::observe_user:\n"
+			"Cannot subscribe user without having a network object "
+		);
+	}
+
+	if(base_type::is_subscribed(user) || m_observers.count(&user) > 0)
+	{
+		throw std::logic_error(
+			"obby::basic_server_document_info::observe_user:\n"
+			"User is already subscribed"
+		);
+	}
+
+	swap_in();
+	sync_content(user);
+
+	document_packet pack(*this, "observe");
+	get_buffer().send(pack, user.get_net6() );
+
+	m_observers.insert(&user);
+	document_used();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	set_privileges(const user& user,
+	               privileges privs)
+{
+	base_type::m_priv_table->privileges_change(user, privs);
+}
+
+template<typename Document, typename Selector>
+bool basic_server_document_info<Document, Selector>::
+	is_observing(const user& user) const
+{
+	return m_observers.count(&user) > 0;
+}
+
+template<typename Document, typename Selector>
+std::size_t basic_server_document_info<Document, Selector>::
+	observer_count() const
+{
+	return m_observers.size();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	replay_operation(const operation_type& op,
+	                 const user* author)
+{
+	swap_in();
+
+	// Nobody is subscribed while the journal is replayed, so the
+	// operation needs no transformation.
+	op.apply(*base_type::m_document, author);
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	replay_rename(const std::string& new_title,
+	              unsigned int suffix)
+{
+	// Looking for a free suffix again could pick another one than the
+	// rename did, depending on the documents that existed back then.
+	base_type::document_rename(new_title, suffix);
+}
+
 template<typename Document, typename Selector>
 void basic_server_document_info<Document, Selector>::
 	on_net_packet(const document_packet& pack,
@@ -397,7 +675,28 @@ template<typename Document, typename Selector>
 void basic_server_document_info<Document, Selector>::
 	obby_user_part(const user& user)
 {
-	basic_document_info<Document, Selector>::obby_user_part(user);
+	if(m_observers.erase(&user) > 0)
+	{
+		if(base_type::user_count() == 0 && m_observers.empty() )
+			document_used();
+		return;
+	}
+
+	// Keep the jupiter state of the user to allow it to resume its
+	// subscription when it reconnects.
+	if(m_jupiter.get() != NULL && base_type::is_subscribed(user) )
+	{
+		m_jupiter->client_detach(user);
+
+		basic_document_info<Document, Selector>::user_unsubscribe(user);
+
+		if(base_type::user_count() == 0)
+			document_used();
+	}
+	else
+	{
+		basic_document_info<Document, Selector>::obby_user_part(user);
+	}
 }
 
 template<typename Document, typename Selector>
@@ -411,10 +710,15 @@ template<typename Document, typename Selector>
 void basic_server_document_info<Document, Selector>::
 	user_subscribe(const user& user)
 {
+	swap_in();
+
 	// Add client to jupiter
 	m_jupiter->client_add(user);
 	// Call base function
 	basic_document_info<Document, Selector>::user_subscribe(user);
+
+	// Not idle anymore
+	document_used();
 }
 
 template<typename Document, typename Selector>
@@ -425,6 +729,9 @@ void basic_server_document_info<Document, Selector>::
 	basic_document_info<Document, Selector>::user_unsubscribe(user);
 	// Remove client from jupiter
 	m_jupiter->client_remove(user);
+
+	if(base_type::user_count() == 0)
+		document_used();
 }
 
 template<typename Document, typename Selector>
@@ -433,6 +740,8 @@ void basic_server_document_info<Document, Selector>::
 	            const std::string& text,
 	            const user* author)
 {
+	swap_in();
+
 	if(m_jupiter.get() != NULL)
 	{
 		insert_operation<document_type> op(pos, text);
@@ -450,6 +759,8 @@ void basic_server_document_info<Document, Selector>::
 	           position len,
 	           const user* author)
 {
+	swap_in();
+
 	if(m_jupiter.get() != NULL)
 	{
 		delete_operation<document_type> op(pos, len);
@@ -477,7 +788,7 @@ void basic_server_document_info<Document, Selector>::
 		// Forward to clients
 		document_packet pack(*this, "rename");
 		pack << from << new_title << base_type::m_suffix;
-		get_net6().send(pack);
+		get_buffer().send(pack);
 	}
 }
 
@@ -496,9 +807,15 @@ bool basic_server_document_info<Document, Selector>::
 	if(pack.get_command() == "subscribe")
 		{ on_net_subscribe(pack, from); return true; }
 
+	if(pack.get_command() == "observe")
+		{ on_net_observe(pack, from); return true; }
+
 	if(pack.get_command() == "unsubscribe")
 		{ on_net_unsubscribe(pack, from); return true; }
 
+	if(pack.get_command() == "resume")
+		{ on_net_resume(pack, from); return true; }
+
 	return false;
 }
 
@@ -520,8 +837,37 @@ void basic_server_document_info<Document, Selector>::
 	on_net_record(const document_packet& pack,
 	              const user& from)
 {
+	if(m_observers.count(&from) > 0 ||
+	   !base_type::get_privileges_table().privileges_query(
+		from, privileges::MODIFY) )
+	{
+		format_string str(
+			"Got record from observer of document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	// The content of the document is only loaded while somebody is
+	// subscribed to it
+	if(is_swapped() || !base_type::is_subscribed(from) )
+	{
+		format_string str(
+			"Got record from user not subscribed to document "
+			"%0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
 	unsigned int index = 2;
 
+#ifndef OBBY_DISABLE_STATISTICS
+	unsigned long start = statistics::clock();
+#endif
+
 	record_type rec(
 		pack,
 		index,
@@ -529,6 +875,10 @@ void basic_server_document_info<Document, Selector>::
 	);
 
 	m_jupiter->remote_op(rec, &from);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_statistics.record(statistics::clock() - start);
+#endif
 }
 
 template<typename Document, typename Selector>
@@ -536,7 +886,44 @@ void basic_server_document_info<Document, Selector>::
 	on_net_subscribe(const document_packet& pack,
 	                 const user& from)
 {
-	subscribe_user(from);
+	privileges privs = base_type::get_privileges_table().privileges_query(
+		from, privileges::SUBSCRIBE | privileges::MODIFY
+	);
+
+	if(!(privs & privileges::SUBSCRIBE) )
+	{
+		format_string str(
+			"User may not subscribe to document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	// Users who may not change the document observe it
+	if(privs & privileges::MODIFY)
+		subscribe_user(from);
+	else
+		observe_user(from);
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	on_net_observe(const document_packet& pack,
+	               const user& from)
+{
+	if(!base_type::get_privileges_table().privileges_query(
+		from, privileges::SUBSCRIBE) )
+	{
+		format_string str(
+			"User may not subscribe to document %0%/%1%"
+		);
+
+		str << base_type::get_owner_id() << base_type::get_id();
+		throw net6::bad_value(str.str() );
+	}
+
+	observe_user(from);
 }
 
 template<typename Document, typename Selector>
@@ -547,6 +934,49 @@ void basic_server_document_info<Document, Selector>::
 	unsubscribe_user(from);
 }
 
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	on_net_resume(const document_packet& pack,
+	              const user& from)
+{
+	const std::string& token =
+		pack.get_param(0).net6::parameter::as<std::string>();
+
+	vector_time time(
+		pack.get_param(1).net6::parameter::as<unsigned int>(),
+		pack.get_param(2).net6::parameter::as<unsigned int>()
+	);
+
+	// The jupiter state is of no use to users who may not change the
+	// document anymore.
+	if(!base_type::get_privileges_table().privileges_query(
+		from, privileges::MODIFY) )
+	{
+		on_net_subscribe(pack, from);
+		return;
+	}
+
+	// Fall back to a complete synchronisation if the state of the
+	// client is not known anymore.
+	if(m_jupiter.get() == NULL ||
+	   !get_buffer().check_session_token(from, token) ||
+	   !m_jupiter->can_resume(from, time) )
+	{
+		subscribe_user(from);
+		return;
+	}
+
+	document_packet reply(*this, "resume");
+	get_buffer().send(reply, from.get_net6() );
+
+	// Do not add the client to jupiter, it is resumed below
+	basic_document_info<Document, Selector>::user_subscribe(from);
+	broadcast_subscription(from);
+
+	// Send the records the client has missed
+	m_jupiter->client_resume(from, time);
+}
+
 template<typename Document, typename Selector>
 void basic_server_document_info<Document, Selector>::
 	on_jupiter_record(const record_type& rec,
@@ -556,7 +986,7 @@ void basic_server_document_info<Document, Selector>::
 	document_packet pack(*this, "record");
 	pack << from;
 	rec.append_packet(pack);
-	get_net6().send(pack, user.get_net6() );
+	get_buffer().send(pack, user.get_net6() );
 }
 
 template<typename Document, typename Selector>
@@ -565,7 +995,7 @@ void basic_server_document_info<Document, Selector>::
 {
 	document_packet pack(*this, "subscribe");
 	pack << &user;
-	get_net6().send(pack);
+	get_buffer().send(pack);
 }
 
 template<typename Document, typename Selector>
@@ -574,13 +1004,360 @@ void basic_server_document_info<Document, Selector>::
 {
 	document_packet pack(*this, "unsubscribe");
 	pack << &user;
-	get_net6().send(pack);
+	get_buffer().send(pack);
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	broadcast_operation(const operation_type& op,
+	                    const user* from)
+{
+	if(m_observers.empty() ) return;
+
+	// The operation is in the order of the document already, so all
+	// observers get the same packet.
+	document_packet pack(*this, "operation");
+	pack << from;
+	op.append_packet(pack);
+
+	for(typename std::set<const user*>::const_iterator iter =
+		m_observers.begin();
+	    iter != m_observers.end();
+	    ++ iter)
+	{
+		get_buffer().send(pack, (*iter)->get_net6() );
+	}
 }
 
 template<typename Document, typename Selector>
 void basic_server_document_info<Document, Selector>::session_close_impl()
 {
 	m_jupiter.reset(NULL);
+	m_observers.clear();
+}
+
+template<typename Document, typename Selector>
+bool basic_server_document_info<Document, Selector>::can_serialise() const
+{
+	return is_swapped() || base_type::can_serialise();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	serialise(serialise::writer& writer) const
+{
+	if(!is_swapped() )
+	{
+		base_type::serialise(writer);
+		return;
+	}
+
+	base_type::serialise_attributes(writer);
+
+	// Copy chunks from the swap file or the session without building
+	// the document
+	if(m_source != NULL)
+	{
+		serialise::reader reader(
+			m_source->get_data(),
+			m_source->get_size()
+		);
+
+		reader.seek(m_source_offset, m_source_line);
+		reader.read();
+		content_copy(reader, writer);
+	}
+	else
+	{
+		serialise::mapped_file file(m_swap_file);
+		serialise::reader reader(file.get_data(), file.get_size() );
+
+		reader.read();
+		content_copy(reader, writer);
+	}
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	content_copy(serialise::reader& reader,
+	             serialise::writer& writer)
+{
+	// Chunks are the object's only children
+	unsigned int depth = reader.get_depth() + 1;
+
+	serialise::reader::event_type event;
+	while( (event = reader.read()) != serialise::reader::END_OF_INPUT)
+	{
+		switch(event)
+		{
+		case serialise::reader::OBJECT_BEGIN:
+			if(reader.get_depth() == depth)
+				writer.begin_object(reader.get_name() );
+			break;
+		case serialise::reader::ATTRIBUTE:
+			if(reader.get_depth() == depth)
+			{
+				writer.add_attribute(
+					reader.get_name(),
+					reader.get_value_data(),
+					reader.get_value_size()
+				);
+			}
+			break;
+		case serialise::reader::OBJECT_END:
+			if(reader.get_depth() == depth)
+				writer.end_object();
+			else if(reader.get_depth() < depth)
+				return;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+template<typename Document, typename Selector>
+bool basic_server_document_info<Document, Selector>::is_idle() const
+{
+	return !is_swapped() && base_type::user_count() == 0 &&
+		m_observers.empty();
+}
+
+template<typename Document, typename Selector>
+bool basic_server_document_info<Document, Selector>::is_swapped() const
+{
+	return !m_swap_file.empty() || m_source != NULL;
+}
+
+template<typename Document, typename Selector>
+typename basic_server_document_info<Document, Selector>::signal_apply_type
+basic_server_document_info<Document, Selector>::apply_event() const
+{
+	return m_signal_apply;
+}
+
+template<typename Document, typename Selector>
+std::size_t basic_server_document_info<Document, Selector>::
+	get_ack_count(const user& user) const
+{
+	if(m_jupiter.get() == NULL) return 0;
+	return m_jupiter->get_ack_count(user);
+}
+
+#ifndef OBBY_DISABLE_STATISTICS
+template<typename Document, typename Selector>
+const document_statistics&
+basic_server_document_info<Document, Selector>::get_statistics() const
+{
+	return m_statistics;
+}
+
+template<typename Document, typename Selector>
+unsigned long basic_server_document_info<Document, Selector>::
+	get_transform_count() const
+{
+	if(m_jupiter.get() == NULL) return 0;
+	return m_jupiter->get_transform_count();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	on_jupiter_apply(const operation_type& op,
+	                 const user* from)
+{
+	m_statistics.operation();
+}
+#endif
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::swap_out()
+{
+	if(is_swapped() ) return;
+
+	if(base_type::user_count() > 0 || !m_observers.empty() )
+	{
+		throw std::logic_error(
+			"obby::basic_server_document_info::swap_out:\n"
+			"Cannot swap out a document somebody is subscribed to"
+		);
+	}
+
+	const std::string& directory = get_buffer().get_swap_directory();
+	if(directory.empty() )
+	{
+		throw std::logic_error(
+			"obby::basic_server_document_info::swap_out:\n"
+			"Buffer has no swap directory"
+		);
+	}
+
+	format_string str("%0%/%1%-%2%.obby");
+	str << directory << base_type::get_owner_id() << base_type::get_id();
+
+	{
+		serialise::writer writer(
+			str.str(), "obby", serialise::writer::FORMAT_BINARY
+		);
+
+		writer.begin_object("content");
+
+		document_type& doc = *base_type::m_document;
+		for(typename document_type::chunk_iterator iter =
+			doc.chunk_begin();
+		    iter != doc.chunk_end();
+		    ++ iter)
+		{
+			writer.begin_object("chunk");
+			writer.add_attribute("content", iter.get_text() );
+			writer.add_attribute("author", iter.get_author() );
+			writer.end_object();
+		}
+
+		writer.end_object();
+		writer.flush();
+	}
+
+	m_swap_file = str.str();
+
+	// Detached clients cannot resume anymore, they get the whole
+	// document when they subscribe again.
+	m_jupiter.reset(NULL);
+	base_type::release_document();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::load_content() const
+{
+	// Loading the content does not change what the document is
+	const_cast<basic_server_document_info*>(this)->swap_in();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::swap_in()
+{
+	if(m_source != NULL)
+	{
+		// Parse the document where it is stored in the session
+		serialise::reader reader(
+			m_source->get_data(),
+			m_source->get_size()
+		);
+
+		reader.seek(m_source_offset, m_source_line);
+		reader.read();
+
+		serialise::object obj;
+		obj.deserialise(reader);
+
+		content_deserialise(obj);
+		m_source = NULL;
+
+		document_used();
+		return;
+	}
+
+	if(m_swap_file.empty() ) return;
+
+	serialise::parser parser;
+	parser.deserialise(m_swap_file);
+
+	if(parser.get_type() != "obby" ||
+	   parser.get_root().get_name() != "content")
+	{
+		throw serialise::error(
+			_("Swap file does not contain document content"),
+			parser.get_root().get_line()
+		);
+	}
+
+	content_deserialise(parser.get_root() );
+
+	std::remove(m_swap_file.c_str() );
+	m_swap_file.clear();
+
+	document_used();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::jupiter_create()
+{
+	// No jupiter without network connection, see session_close_impl
+	if(base_type::m_net == NULL) return;
+
+	m_jupiter.reset(new jupiter_type(
+		*basic_document_info<Document, Selector>::m_document
+	) );
+
+	m_jupiter->record_event().connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_document_info::on_jupiter_record
+		)
+	);
+
+	m_jupiter->apply_event().connect(
+		sigc::mem_fun(m_signal_apply, &signal_apply_type::emit)
+	);
+
+	m_jupiter->apply_event().connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_document_info::broadcast_operation
+		)
+	);
+
+#ifndef OBBY_DISABLE_STATISTICS
+	m_jupiter->apply_event().connect(
+		sigc::mem_fun(
+			*this,
+			&basic_server_document_info::on_jupiter_apply
+		)
+	);
+#endif
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::
+	content_deserialise(const serialise::object& obj)
+{
+	// Assign document content
+	base_type::assign_document();
+
+	// Look up the names once rather than for every chunk
+	const serialise::identifier chunk_id("chunk");
+	const serialise::identifier content_id("content");
+	const serialise::identifier author_id("author");
+
+	for(serialise::object::child_iterator child_it = obj.children_begin();
+	    child_it != obj.children_end();
+	    ++ child_it)
+	{
+		if(child_it->get_identifier() != chunk_id)
+			continue; // TODO: Throw unexpected child error
+
+		const serialise::attribute& content_attr =
+			child_it->get_required_attribute(content_id);
+		const serialise::attribute& author_attr =
+			child_it->get_required_attribute(author_id);
+
+		base_type::m_document->append(
+			content_attr.obby::serialise::attribute::as<std::string>(),
+			author_attr.obby::serialise::attribute::as<const user*>(
+				::serialise::default_context_from<const user*>(
+					base_type::m_buffer.get_user_table()
+				)
+			)
+		);
+	}
+
+	// Create jupiter server implementation
+	jupiter_create();
+}
+
+template<typename Document, typename Selector>
+void basic_server_document_info<Document, Selector>::document_used()
+{
+	get_buffer().document_used(*this);
 }
 
 template<typename Document, typename Selector>
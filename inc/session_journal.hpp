@@ -0,0 +1,154 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SESSION_JOURNAL_HPP_
+#define _OBBY_SESSION_JOURNAL_HPP_
+
+#include <memory>
+#include <string>
+#include <net6/non_copyable.hpp>
+#include <net6/packet.hpp>
+#include "serialise/writer.hpp"
+#include "user.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+
+namespace obby
+{
+
+/** Journal of the session a server has opened, see
+ * basic_server_buffer::set_journal().
+ *
+ * Every snapshot that compacts the journal gets a new generation. The
+ * journal's first entry names the generation of the snapshot it has been
+ * started with. When a compaction starts, an entry with the generation
+ * of the new snapshot marks where the changes that are not part of it
+ * begin. Once the snapshot has replaced the session file, everything
+ * before the marker is dropped.
+ */
+class session_journal: private net6::non_copyable
+{
+public:
+	session_journal();
+
+	/** Reads the journal of <em>session</em> and keeps its entries for
+	 * replay if it has been started with the snapshot of the given
+	 * generation.
+	 */
+	void load(const std::string& session, unsigned long generation);
+
+	/** Returns the entries read by load() that still need to be
+	 * replayed. They are removed as they are replayed.
+	 */
+	journal::entry_list& get_entries();
+
+	/** Starts journaling changes to <em>session</em>, which has been
+	 * read in <em>format</em> and stores the given generation.
+	 */
+	void open(const std::string& session,
+	          serialise::writer::format_type format,
+	          unsigned long generation);
+
+	/** Stops journaling and forgets entries that have not been
+	 * replayed.
+	 */
+	void close();
+
+	/** Returns whether changes are journaled.
+	 */
+	bool is_open() const;
+
+	/** Returns the session file the journal belongs to and the format
+	 * it has been written in.
+	 */
+	const std::string& get_session_file() const;
+	serialise::writer::format_type get_session_format() const;
+
+	/** Writes the entries appended since the last commit to disk. Does
+	 * nothing if changes are not journaled.
+	 */
+	void commit();
+
+	/** Returns whether the journal has grown larger than the session
+	 * file. Small sessions are not rewritten on every few changes.
+	 */
+	bool needs_compaction() const;
+
+	/** Appends the marker entry of a new generation and returns it.
+	 * The snapshot that is started next must store it. Returns 0 if
+	 * changes are not journaled or a compaction is running already.
+	 */
+	unsigned long compaction_begin();
+
+	/** Remembers the snapshot that has been started after
+	 * compaction_begin().
+	 */
+	void compaction_start(snapshot& snap);
+
+	/** Returns the snapshot that compacts the journal, if any.
+	 */
+	snapshot* get_compaction() const;
+
+	/** Called for every snapshot that has been written. If
+	 * <em>snap</em> compacts the journal and has been written
+	 * successfully, the entries before its marker are dropped.
+	 */
+	void snapshot_done(const snapshot& snap);
+
+	/** Appends entries for changes to the session, which must be
+	 * journaled. They are written to disk by the next commit().
+	 */
+	void append_user(const user& user);
+	void append_colour(const user& user);
+	void append_document(const std::string& data);
+	void append_remove(unsigned int owner_id, unsigned int id);
+	void append_rename(unsigned int owner_id,
+	                   unsigned int id,
+	                   const std::string& title,
+	                   unsigned int suffix);
+
+	/** Appends an operation that has been written to <em>pack</em>.
+	 * It is stored as the parameters of the packet.
+	 */
+	void append_operation(unsigned int owner_id,
+	                      unsigned int id,
+	                      const user* author,
+	                      const net6::packet& pack);
+
+protected:
+	std::auto_ptr<journal> m_journal;
+	journal::entry_list m_entries;
+
+	std::string m_session_file;
+	serialise::writer::format_type m_session_format;
+	unsigned long m_session_size;
+
+	/** Last generation that has been handed out.
+	 */
+	unsigned long m_generation;
+
+	/** Snapshot that compacts the journal, if any, and the size of the
+	 * journal up to the marker entry of its generation.
+	 */
+	snapshot* m_compaction;
+	unsigned long m_compaction_offset;
+};
+
+} // namespace obby
+
+#endif // _OBBY_SESSION_JOURNAL_HPP_
@@ -0,0 +1,106 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SNAPSHOT_HPP_
+#define _OBBY_SNAPSHOT_HPP_
+
+#include <string>
+#include <net6/non_copyable.hpp>
+#include "serialise/writer.hpp"
+
+namespace obby
+{
+
+/** Session snapshot that is written to a file in the background.
+ *
+ * The session is captured by serialising it into memory in binary
+ * format, which is little more than copying its text. Converting it to
+ * the requested format and writing it to disk happens in a separate
+ * thread, so the event loop does not have to wait for the disk. Where
+ * threads are not available, the snapshot is written before the
+ * constructor returns.
+ */
+class snapshot: private net6::non_copyable
+{
+public:
+	/** Starts writing <em>data</em>, a session serialised in binary
+	 * format, to <em>file</em> in the given format. The snapshot takes
+	 * over the content of <em>data</em>, which is empty afterwards.
+	 * The file is replaced only when the snapshot has reached the
+	 * disk completely.
+	 */
+	snapshot(const std::string& file,
+	         serialise::writer::format_type format,
+	         std::string& data);
+
+	/** Waits until the snapshot has been written.
+	 */
+	~snapshot();
+
+	/** Returns the file the snapshot is written to.
+	 */
+	const std::string& get_file() const;
+
+	/** Returns whether writing the snapshot has finished, either
+	 * successfully or not.
+	 */
+	bool is_done() const;
+
+	/** Waits until writing the snapshot has finished.
+	 */
+	void wait();
+
+	/** Returns why the snapshot could not be written, or an empty
+	 * string if it has been written successfully. Must not be called
+	 * before writing has finished.
+	 */
+	const std::string& get_error() const;
+
+	/** Returns the size of the written file. Must not be called before
+	 * writing has finished.
+	 */
+	unsigned long get_size() const;
+
+protected:
+	/** Thread state, it depends on the platform.
+	 */
+	struct thread_data;
+
+	static void* thread_func(void* data);
+
+	/** Writes the snapshot and records the result.
+	 */
+	void run();
+
+	/** Writes the snapshot, throws on failure.
+	 */
+	void write();
+
+	std::string m_file;
+	serialise::writer::format_type m_format;
+	std::string m_data;
+
+	std::string m_error;
+	unsigned long m_size;
+
+	thread_data* m_thread;
+};
+
+} // namespace obby
+
+#endif // _OBBY_SNAPSHOT_HPP_
@@ -0,0 +1,221 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_STATISTICS_HPP_
+#define _OBBY_STATISTICS_HPP_
+
+#include <ctime>
+#include <string>
+#include <map>
+#include <ostream>
+#include <net6/packet.hpp>
+#include "user.hpp"
+
+namespace obby
+{
+
+/** Distribution of values in buckets of powers of two.
+ *
+ * Bucket 0 counts the value 0, bucket n the values from 2^(n-1) up to
+ * 2^n - 1.
+ */
+class histogram
+{
+public:
+	static const unsigned int BUCKET_COUNT = 33;
+
+	histogram();
+
+	/** Adds a value to the distribution.
+	 */
+	void add(unsigned long value);
+
+	/** Adds all values of <em>other</em> to this distribution.
+	 */
+	void merge(const histogram& other);
+
+	/** Returns how many values have been added.
+	 */
+	unsigned long get_count() const;
+
+	/** Returns the largest value that has been added.
+	 */
+	unsigned long get_max() const;
+
+	/** Returns the mean of all values, or 0 if there are none.
+	 */
+	double get_mean() const;
+
+	/** Returns an upper bound for the value below which
+	 * <em>percent</em> percent of the values lie. It is exact up to
+	 * the bucket size.
+	 */
+	unsigned long get_percentile(unsigned int percent) const;
+
+	/** Returns the number of values in bucket <em>n</em>.
+	 */
+	unsigned long get_bucket(unsigned int n) const;
+
+protected:
+	unsigned long m_buckets[BUCKET_COUNT];
+	unsigned long m_count;
+	unsigned long m_max;
+	double m_sum;
+};
+
+/** Packets and bytes exchanged with clients.
+ */
+struct traffic
+{
+	traffic();
+
+	unsigned long packets_in;
+	unsigned long bytes_in;
+	unsigned long packets_out;
+	unsigned long bytes_out;
+};
+
+/** Instrumentation counters of a server.
+ *
+ * The server counts packets and bytes per command and per client and
+ * measures how long the initial synchronisation of clients takes.
+ * Documents keep their own counters, see document_statistics. Unless
+ * OBBY_DISABLE_STATISTICS is defined, basic_server_buffer maintains an
+ * object of this class and reports it with the "stats" command. Defining
+ * it removes the instrumentation from the server completely.
+ */
+class statistics
+{
+public:
+	typedef std::map<std::string, traffic> traffic_map;
+	typedef std::map<const user*, traffic> client_map;
+
+	statistics();
+
+	/** Returns a clock in microseconds. Only differences between two
+	 * values are meaningful, the clock wraps around.
+	 */
+	static unsigned long clock();
+
+	/** Returns the name a packet is counted under. Document packets
+	 * are told apart by the document command they carry.
+	 */
+	static std::string get_command(const net6::packet& pack);
+
+	/** Returns the number of bytes <em>pack</em> takes on the wire,
+	 * not counting escape characters.
+	 */
+	static std::size_t get_size(const net6::packet& pack);
+
+	/** Counts a packet that has been received from <em>from</em>.
+	 */
+	void packet_in(const net6::packet& pack, const user& from);
+
+	/** Counts a packet that has been sent to <em>recipients</em>
+	 * clients.
+	 */
+	void packet_out(const net6::packet& pack, unsigned int recipients);
+
+	/** Adds the time it took to synchronise a client that has joined.
+	 */
+	void sync(unsigned long duration);
+
+	/** Adds the bytes a client had in its outgoing queue when it
+	 * answered an acknowledgement request or net6 had written
+	 * everything to it.
+	 */
+	void send_queue(std::size_t depth);
+
+	/** Resets all counters. Must be called before the users the
+	 * counters refer to are deleted.
+	 */
+	void clear();
+
+	/** Returns the time since which the counters have been collected.
+	 */
+	std::time_t get_start_time() const;
+
+	const traffic_map& get_commands() const;
+	const client_map& get_clients() const;
+
+	/** Returns the distribution of synchronisation times in
+	 * microseconds.
+	 */
+	const histogram& get_sync_time() const;
+
+	/** Returns the distribution of the outgoing queues of the
+	 * clients in bytes.
+	 */
+	const histogram& get_send_queue() const;
+
+	/** Writes a summary of the traffic per command, the
+	 * synchronisation times and the outgoing queues to <em>out</em>,
+	 * one line each.
+	 */
+	void report(std::ostream& out) const;
+
+protected:
+	std::time_t m_start_time;
+	traffic_map m_commands;
+	client_map m_clients;
+	histogram m_sync_time;
+	histogram m_send_queue;
+};
+
+/** Instrumentation counters of a single document.
+ */
+class document_statistics
+{
+public:
+	document_statistics();
+
+	/** Counts an operation that has been applied to the document.
+	 */
+	void operation();
+
+	/** Adds the time it took to process a record from a client.
+	 */
+	void record(unsigned long duration);
+
+	/** Returns how many operations have been applied.
+	 */
+	unsigned long get_operation_count() const;
+
+	/** Returns the operations per second since the first one.
+	 */
+	double get_operation_rate() const;
+
+	/** Returns the distribution of the time records from clients took
+	 * to process, in microseconds.
+	 */
+	const histogram& get_record_time() const;
+
+	/** Writes the operation count and rate and the record time to
+	 * <em>out</em>, without a line break.
+	 */
+	void report(std::ostream& out) const;
+
+protected:
+	unsigned long m_operations;
+	std::time_t m_first_operation;
+	histogram m_record_time;
+};
+
+} // namespace obby
+
+#endif // _OBBY_STATISTICS_HPP_
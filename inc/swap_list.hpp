@@ -0,0 +1,206 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SWAP_LIST_HPP_
+#define _OBBY_SWAP_LIST_HPP_
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <net6/non_copyable.hpp>
+
+namespace obby
+{
+
+/** Documents of a server that nobody is subscribed to, in the order in
+ * which they have become idle.
+ *
+ * Documents that have been idle for too long, or the ones that have been
+ * idle longest if there are too many, are swapped out. The server tells
+ * the list when a document may have become idle and calls expire() when
+ * the time of the oldest one has run out.
+ */
+template<typename DocumentInfo>
+class swap_list: private net6::non_copyable
+{
+public:
+	typedef DocumentInfo document_info_type;
+
+	swap_list();
+
+	/** Sets the directory documents are swapped out to, an empty one
+	 * disables swapping. See basic_server_buffer::set_swap_directory().
+	 */
+	void set_directory(const std::string& directory,
+	                   unsigned int idle_time,
+	                   unsigned int idle_limit);
+
+	const std::string& get_directory() const;
+
+	/** Appends <em>info</em> to the list if it is idle, removes it
+	 * otherwise. Returns whether it has been appended.
+	 */
+	bool used(document_info_type& info);
+
+	/** Removes <em>info</em> from the list, used when it is deleted.
+	 */
+	void remove(const document_info_type& info);
+
+	/** Swaps out idle documents except <em>except</em> that have been
+	 * idle for too long or if there are too many of them. Returns
+	 * whether documents are left that wait for their time to run out,
+	 * and in <em>timeout</em> the milliseconds until the first one
+	 * does.
+	 */
+	bool expire(const document_info_type* except, unsigned long& timeout);
+
+	/** Forgets all idle documents.
+	 */
+	void clear();
+
+protected:
+	/** Document nobody is subscribed to, and the time since when.
+	 */
+	struct idle_document
+	{
+		idle_document(document_info_type* info, std::time_t since):
+			info(info), since(since) {}
+
+		document_info_type* info;
+		std::time_t since;
+	};
+
+	/** Idle documents, the one that has been idle longest first.
+	 */
+	typedef std::list<idle_document> idle_list;
+	typedef std::map<const document_info_type*,
+	                 typename idle_list::iterator> idle_map;
+
+	std::string m_directory;
+	unsigned int m_idle_time;
+	unsigned int m_idle_limit;
+
+	idle_list m_idle;
+	idle_map m_index;
+};
+
+template<typename DocumentInfo>
+swap_list<DocumentInfo>::swap_list():
+	m_idle_time(300), m_idle_limit(16)
+{
+}
+
+template<typename DocumentInfo>
+void swap_list<DocumentInfo>::set_directory(const std::string& directory,
+                                            unsigned int idle_time,
+                                            unsigned int idle_limit)
+{
+	m_directory = directory;
+	m_idle_time = idle_time;
+	m_idle_limit = idle_limit;
+}
+
+template<typename DocumentInfo>
+const std::string& swap_list<DocumentInfo>::get_directory() const
+{
+	return m_directory;
+}
+
+template<typename DocumentInfo>
+bool swap_list<DocumentInfo>::used(document_info_type& info)
+{
+	if(m_directory.empty() ) return false;
+
+	remove(info);
+	if(!info.is_idle() ) return false;
+
+	m_idle.push_back(idle_document(&info, std::time(NULL) ) );
+	m_index[&info] = -- m_idle.end();
+	return true;
+}
+
+template<typename DocumentInfo>
+void swap_list<DocumentInfo>::remove(const document_info_type& info)
+{
+	typename idle_map::iterator iter = m_index.find(&info);
+	if(iter == m_index.end() ) return;
+
+	m_idle.erase(iter->second);
+	m_index.erase(iter);
+}
+
+template<typename DocumentInfo>
+bool swap_list<DocumentInfo>::expire(const document_info_type* except,
+                                     unsigned long& timeout)
+{
+	std::time_t now = std::time(NULL);
+
+	while(!m_idle.empty() )
+	{
+		const idle_document& oldest = m_idle.front();
+		document_info_type* info = oldest.info;
+
+		// Documents in use are only removed from the list when they
+		// become idle again, or when they are found here.
+		if(info->is_idle() )
+		{
+			bool expired = m_idle_time > 0 &&
+				now - oldest.since >=
+				static_cast<std::time_t>(m_idle_time);
+
+			if(info == except ||
+			   (!expired && m_idle.size() <= m_idle_limit) )
+				break;
+		}
+
+		m_index.erase(info);
+		m_idle.pop_front();
+
+		if(!info->is_idle() ) continue;
+
+		try
+		{
+			info->swap_out();
+		}
+		catch(std::runtime_error&)
+		{
+			// The document stays in memory if it cannot be
+			// written, it is tried again when it becomes idle
+			// the next time.
+		}
+	}
+
+	if(m_idle.empty() || m_idle_time == 0) return false;
+
+	std::time_t expiry = m_idle.front().since + m_idle_time;
+	timeout = expiry > now ? (expiry - now) * 1000 : 0;
+	return true;
+}
+
+template<typename DocumentInfo>
+void swap_list<DocumentInfo>::clear()
+{
+	m_idle.clear();
+	m_index.clear();
+}
+
+} // namespace obby
+
+#endif // _OBBY_SWAP_LIST_HPP_
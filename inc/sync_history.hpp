@@ -0,0 +1,136 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _OBBY_SYNC_HISTORY_HPP_
+#define _OBBY_SYNC_HISTORY_HPP_
+
+#include <map>
+#include <string>
+#include <net6/non_copyable.hpp>
+#include <net6/user.hpp>
+
+namespace obby
+{
+
+/** Version history of the user and document lists of a server.
+ *
+ * Every change to the lists that clients synchronise when they log in
+ * gets a new version. Clients that cache the lists present the version
+ * they know and only get what has changed since. Users and documents
+ * loaded with a session have no version, they are only part of the
+ * complete lists.
+ */
+class sync_history: private net6::non_copyable
+{
+public:
+	/** Owner and ID of a document.
+	 */
+	typedef std::pair<unsigned int, unsigned int> document_key;
+
+	typedef std::map<unsigned int, unsigned long> user_map;
+	typedef std::map<document_key, unsigned long> document_map;
+
+	sync_history();
+
+	/** Starts a new history. Versions of the previous one are not
+	 * accepted anymore.
+	 */
+	void reset();
+
+	/** Returns the identifier of the history. A client's cached version
+	 * is only meaningful for the history it has been taken from.
+	 */
+	const std::string& get_id() const;
+
+	/** Returns the current version.
+	 */
+	unsigned long get_version() const;
+
+	/** Returns the version a client that knows <em>version</em> of the
+	 * history <em>id</em> gets the changes since, or 0 if it needs the
+	 * complete lists.
+	 */
+	unsigned long get_base(const std::string& id,
+	                       unsigned long version) const;
+
+	/** Gives the user or document the next version.
+	 */
+	void touch_user(unsigned int id);
+	void touch_document(const document_key& key);
+
+	/** Gives a document that has been added the next version.
+	 */
+	void insert_document(const document_key& key);
+
+	/** Records the removal of a document with the next version.
+	 * Only the latest removals are kept, clients that know a version
+	 * before the oldest one get the complete lists.
+	 */
+	void remove_document(const document_key& key);
+
+	/** Returns whether the user or document has been changed after
+	 * version <em>base</em>. Everything has been changed after 0.
+	 */
+	bool is_user_changed(unsigned int id, unsigned long base) const;
+	bool is_document_changed(const document_key& key,
+	                         unsigned long base) const;
+
+	/** Returns the number of users, documents and removals that have
+	 * been changed after version <em>base</em>, which must not be 0.
+	 */
+	unsigned int count(unsigned long base) const;
+
+	/** Returns the removed documents and the versions they have been
+	 * removed at.
+	 */
+	const document_map& get_removals() const;
+
+	/** Remembers the version <em>user6</em> has asked for when it
+	 * logged in, until it joins.
+	 */
+	void set_client_base(const net6::user& user6, unsigned long base);
+
+	/** Retrieves and forgets the version <em>user6</em> has asked for.
+	 * Returns false if the client does not cache the lists.
+	 */
+	bool take_client_base(const net6::user& user6, unsigned long& base);
+
+	/** Forgets a client that has gone away.
+	 */
+	void remove_client(const net6::user& user6);
+
+protected:
+	typedef std::map<const net6::user*, unsigned long> base_map;
+
+	std::string m_id;
+	unsigned long m_version;
+
+	/** Oldest version a delta may be computed from. Removals before
+	 * it have been forgotten.
+	 */
+	unsigned long m_floor;
+
+	user_map m_users;
+	document_map m_documents;
+	document_map m_removals;
+	base_map m_bases;
+};
+
+} // namespace obby
+
+#endif // _OBBY_SYNC_HISTORY_HPP_
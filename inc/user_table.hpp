@@ -239,10 +239,27 @@ protected:
 	 */
 	user* find_int(const std::string& name);
 
+	/** Internal functions to keep the lookup indices in sync when a
+	 * user gets connected or disconnected.
+	 */
+	void index_connect(user& cur_user);
+	void index_disconnect(user& cur_user);
+
+	typedef std::map<const net6::user*, user*> net6_map;
+	typedef std::map<std::string, user*> name_map;
+
 	/** List holding the users.
 	 */
 	user_map m_user_map;
 
+	/** Indices to look up users by their name or by the underlaying
+	 * net6::user, and the users that currently have the connected flag
+	 * set. Users are only owned by m_user_map.
+	 */
+	name_map m_name_map;
+	net6_map m_net6_map;
+	user_map m_connected_map;
+
 	signal_deserialised_type m_signal_deserialised;
 };
 
@@ -16,24 +16,11 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <algorithm>
 #include "format_string.hpp"
 #include "common.hpp"
 #include "chat.hpp"
 
-namespace
-{
-	// Discards old messages
-	void discard_messages(std::list<obby::chat::message*>& list,
-	                      unsigned int max)
-	{
-		while(list.size() > max)
-		{
-			delete list.front();
-			list.pop_front();
-		}
-	}
-}
-
 obby::chat::message::message(const std::string& text,
                              std::time_t timestamp):
 	m_text(text), m_timestamp(timestamp)
@@ -184,10 +171,103 @@ std::string obby::chat::system_message::repr() const
 	return m_text;
 }
 
-/*obby::chat::chat(unsigned int max_messages):
-	m_max_messages(max_messages)
+obby::chat::message_iterator::message_iterator():
+	m_chat(NULL), m_index(0), m_message(NULL)
+{
+}
+
+obby::chat::message_iterator::message_iterator(const chat& chat,
+                                               std::size_t index):
+	m_chat(&chat), m_index(index), m_message(NULL)
+{
+}
+
+obby::chat::message_iterator::message_iterator(const message_iterator& other):
+	m_chat(other.m_chat), m_index(other.m_index), m_message(NULL)
+{
+}
+
+obby::chat::message_iterator::~message_iterator()
+{
+	reset();
+}
+
+obby::chat::message_iterator&
+obby::chat::message_iterator::operator=(const message_iterator& other)
 {
-}*/
+	if(&other != this)
+	{
+		reset();
+		m_chat = other.m_chat;
+		m_index = other.m_index;
+	}
+
+	return *this;
+}
+
+const obby::chat::message& obby::chat::message_iterator::operator*() const
+{
+	if(m_message == NULL)
+		m_message = m_chat->create_message(m_index);
+
+	return *m_message;
+}
+
+const obby::chat::message* obby::chat::message_iterator::operator->() const
+{
+	return &operator*();
+}
+
+obby::chat::message_iterator& obby::chat::message_iterator::operator++()
+{
+	reset();
+	++ m_index;
+	return *this;
+}
+
+obby::chat::message_iterator obby::chat::message_iterator::operator++(int)
+{
+	message_iterator temp(*this);
+	++ *this;
+	return temp;
+}
+
+obby::chat::message_iterator& obby::chat::message_iterator::operator--()
+{
+	reset();
+	-- m_index;
+	return *this;
+}
+
+obby::chat::message_iterator obby::chat::message_iterator::operator--(int)
+{
+	message_iterator temp(*this);
+	-- *this;
+	return temp;
+}
+
+bool obby::chat::message_iterator::
+	operator==(const message_iterator& other) const
+{
+	return m_chat == other.m_chat && m_index == other.m_index;
+}
+
+bool obby::chat::message_iterator::
+	operator!=(const message_iterator& other) const
+{
+	return !(*this == other);
+}
+
+std::size_t obby::chat::message_iterator::get_index() const
+{
+	return m_index;
+}
+
+void obby::chat::message_iterator::reset()
+{
+	delete m_message;
+	m_message = NULL;
+}
 
 obby::chat::~chat()
 {
@@ -196,27 +276,41 @@ obby::chat::~chat()
 
 void obby::chat::serialise(serialise::object& obj) const
 {
-	for(message_iterator iter = message_begin();
-	    iter != message_end();
-	    ++ iter)
+	for(std::size_t i = 0; i < m_count; ++ i)
 	{
-		message* msg = &(*iter);
+		const record& rec = get_record(i);
 		serialise::object& child = obj.add_child();
 
-		// Set child name according to message type
-		// TODO: virtual call that gets this string
-		if(dynamic_cast<emote_message*>(msg) != NULL)
-			child.set_name("emote_message");
-		else if(dynamic_cast<user_message*>(msg) != NULL)
-			child.set_name("user_message");
-		else if(dynamic_cast<server_message*>(msg) != NULL)
-			child.set_name("server_message");
-		else if(dynamic_cast<system_message*>(msg) != NULL)
-			child.set_name("system_message");
-		else
-			throw std::logic_error("obby::chat::serialise");
+		child.set_name(type_name(rec.type) );
+		child.add_attribute("text").set_value(
+			m_arena.substr(rec.offset, rec.length)
+		);
+		child.add_attribute("timestamp").set_value(rec.timestamp);
 
-		iter->serialise(child);
+		if(rec.from != NULL)
+			child.add_attribute("user").set_value(rec.from);
+	}
+}
+
+void obby::chat::serialise(serialise::writer& writer) const
+{
+	// Texts are written straight from the arena
+	for(std::size_t i = 0; i < m_count; ++ i)
+	{
+		const record& rec = get_record(i);
+
+		writer.begin_object(type_name(rec.type) );
+		writer.add_attribute(
+			"text",
+			m_arena.data() + rec.offset,
+			rec.length
+		);
+		writer.add_attribute("timestamp", rec.timestamp);
+
+		if(rec.from != NULL)
+			writer.add_attribute("user", rec.from);
+
+		writer.end_object();
 	}
 }
 
@@ -231,19 +325,43 @@ void obby::chat::deserialise(const serialise::object& obj,
 	{
 		if(iter->get_name() == "emote_message")
 		{
-			add_message(new emote_message(*iter, user_table) );
+			emote_message msg(*iter, user_table);
+			add_message(
+				EMOTE_MESSAGE,
+				msg.get_text(),
+				msg.get_timestamp(),
+				&msg.get_user()
+			);
 		}
 		else if(iter->get_name() == "user_message")
 		{
-			add_message(new user_message(*iter, user_table) );
+			user_message msg(*iter, user_table);
+			add_message(
+				USER_MESSAGE,
+				msg.get_text(),
+				msg.get_timestamp(),
+				&msg.get_user()
+			);
 		}
 		else if(iter->get_name() == "server_message")
 		{
-			add_message(new server_message(*iter, user_table) );
+			server_message msg(*iter, user_table);
+			add_message(
+				SERVER_MESSAGE,
+				msg.get_text(),
+				msg.get_timestamp(),
+				NULL
+			);
 		}
 		else if(iter->get_name() == "system_message")
 		{
-			add_message(new system_message(*iter, user_table) );
+			system_message msg(*iter, user_table);
+			add_message(
+				SYSTEM_MESSAGE,
+				msg.get_text(),
+				msg.get_timestamp(),
+				NULL
+			);
 		}
 		else
 		{
@@ -254,46 +372,144 @@ void obby::chat::deserialise(const serialise::object& obj,
 		}
 	}
 
-	add_message(new system_message(_("Restored session"), std::time(NULL)));
+	add_message(
+		SYSTEM_MESSAGE,
+		_("Restored session"),
+		std::time(NULL),
+		NULL
+	);
 }
 
 void obby::chat::clear()
 {
-	for(std::list<message*>::iterator iter = m_messages.begin();
-	    iter != m_messages.end();
-	    ++ iter)
-	{
-		delete *iter;
-	}
-
-	m_messages.clear();
+	// Keep the memory for the next session
+	m_first = 0;
+	m_count = 0;
+	m_arena.erase();
 }
 
 void obby::chat::add_user_message(const std::string& text,
                                   const user& from)
 {
-	add_message(new user_message(text, std::time(NULL), from) );
+	add_message(USER_MESSAGE, text, std::time(NULL), &from);
 }
 
 void obby::chat::add_emote_message(const std::string& text,
                                    const user& from)
 {
-	add_message(new emote_message(text, std::time(NULL), from) );
+	add_message(EMOTE_MESSAGE, text, std::time(NULL), &from);
 }
 
 void obby::chat::add_server_message(const std::string& text)
 {
-	add_message(new server_message(text, std::time(NULL)) );
+	add_message(SERVER_MESSAGE, text, std::time(NULL), NULL);
 }
 
 obby::chat::message_iterator obby::chat::message_begin() const
 {
-	return m_messages.begin();
+	return message_iterator(*this, 0);
 }
 
 obby::chat::message_iterator obby::chat::message_end() const
 {
-	return m_messages.end();
+	return message_iterator(*this, m_count);
+}
+
+obby::chat::message_iterator obby::chat::message_at(std::size_t index) const
+{
+	return message_iterator(*this, index < m_count ? index : m_count);
+}
+
+obby::chat::message_iterator obby::chat::message_find(std::time_t timestamp) const
+{
+	// Timestamps do not decrease in the history
+	std::size_t first = 0, last = m_count;
+	while(first < last)
+	{
+		std::size_t middle = first + (last - first) / 2;
+		if(get_record(middle).timestamp < timestamp)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return message_iterator(*this, first);
+}
+
+std::size_t obby::chat::message_count() const
+{
+	return m_count;
+}
+
+obby::chat::message_data obby::chat::message_data_at(std::size_t index) const
+{
+	if(index >= m_count)
+	{
+		throw std::logic_error(
+			"obby::chat::message_data_at:\n"
+			"Index is out of range"
+		);
+	}
+
+	const record& rec = get_record(index);
+
+	message_data data;
+	data.type = type_name(rec.type);
+	data.timestamp = rec.timestamp;
+	data.from = rec.from;
+	data.text = m_arena.data() + rec.offset;
+	data.length = rec.length;
+	return data;
+}
+
+void obby::chat::write_position(net6::packet& pack, std::size_t index) const
+{
+	std::time_t timestamp = 0;
+	unsigned int skip = 0;
+	if(index > 0)
+	{
+		timestamp = get_record(index - 1).timestamp;
+		skip = index - message_find(timestamp).get_index();
+	}
+
+	pack << timestamp << skip << static_cast<unsigned int>(index);
+}
+
+void obby::chat::write_backlog(const net6::packet& request,
+                               net6::packet& reply) const
+{
+	std::time_t timestamp =
+		request.get_param(0).net6::parameter::as<std::time_t>();
+	unsigned int skip =
+		request.get_param(1).net6::parameter::as<unsigned int>();
+	unsigned int count =
+		request.get_param(2).net6::parameter::as<unsigned int>();
+
+	std::size_t end = std::min(
+		message_find(timestamp).get_index() + skip,
+		m_count
+	);
+
+	// Send at most 100 messages and about 16 KiB per request
+	count = std::min(count, 100u);
+
+	std::size_t begin = end;
+	std::size_t bytes = 0;
+	while(begin > 0 && end - begin < count && bytes < 0x4000)
+	{
+		-- begin;
+		bytes += get_record(begin).length + 32;
+	}
+
+	write_position(reply, begin);
+
+	// The fields are read straight from the history
+	for(std::size_t i = begin; i < end; ++ i)
+	{
+		const message_data data = message_data_at(i);
+		reply << data.type << data.timestamp << data.from
+		      << std::string(data.text, data.length);
+	}
 }
 
 obby::chat::signal_message_type obby::chat::message_event() const
@@ -301,11 +517,120 @@ obby::chat::signal_message_type obby::chat::message_event() const
 	return m_signal_message;
 }
 
-void obby::chat::add_message(message* msg)
+void obby::chat::add_message(message_type type,
+                             const std::string& text,
+                             std::time_t timestamp,
+                             const user* from)
+{
+	// The history is searched by time, so a clock that has been set
+	// back must not reorder it.
+	if(m_count > 0 && timestamp < get_record(m_count - 1).timestamp)
+		timestamp = get_record(m_count - 1).timestamp;
+
+	if(m_max_messages > 0)
+	{
+		if(m_records.size() < m_max_messages)
+			m_records.resize(m_max_messages);
+
+		// Overwrite the oldest record if the ring is full
+		if(m_count == m_max_messages)
+		{
+			m_first = (m_first + 1) % m_max_messages;
+			-- m_count;
+		}
+
+		// Drop the texts of discarded records once they take more
+		// space than the remaining ones.
+		std::size_t dead = (m_count > 0 ?
+			get_record(0).offset : m_arena.size() );
+
+		if(dead > 0 && dead >= m_arena.size() - dead)
+		{
+			m_arena.erase(0, dead);
+			for(std::size_t i = 0; i < m_count; ++ i)
+			{
+				m_records[(m_first + i) % m_max_messages].offset
+					-= dead;
+			}
+		}
+
+		record& rec = m_records[(m_first + m_count) % m_max_messages];
+		rec.type = type;
+		rec.timestamp = timestamp;
+		rec.from = from;
+		rec.offset = m_arena.size();
+		rec.length = text.length();
+
+		m_arena.append(text);
+		++ m_count;
+	}
+
+	// The announced message only lives during the emission
+	switch(type)
+	{
+	case USER_MESSAGE:
+		{
+			user_message msg(text, timestamp, *from);
+			m_signal_message.emit(msg);
+		}
+		break;
+	case EMOTE_MESSAGE:
+		{
+			emote_message msg(text, timestamp, *from);
+			m_signal_message.emit(msg);
+		}
+		break;
+	case SERVER_MESSAGE:
+		{
+			server_message msg(text, timestamp);
+			m_signal_message.emit(msg);
+		}
+		break;
+	case SYSTEM_MESSAGE:
+		{
+			system_message msg(text, timestamp);
+			m_signal_message.emit(msg);
+		}
+		break;
+	}
+}
+
+const obby::chat::record& obby::chat::get_record(std::size_t index) const
+{
+	return m_records[(m_first + index) % m_max_messages];
+}
+
+obby::chat::message* obby::chat::create_message(std::size_t index) const
+{
+	const record& rec = get_record(index);
+	std::string text(m_arena, rec.offset, rec.length);
+
+	switch(rec.type)
+	{
+	case USER_MESSAGE:
+		return new user_message(text, rec.timestamp, *rec.from);
+	case EMOTE_MESSAGE:
+		return new emote_message(text, rec.timestamp, *rec.from);
+	case SERVER_MESSAGE:
+		return new server_message(text, rec.timestamp);
+	case SYSTEM_MESSAGE:
+		return new system_message(text, rec.timestamp);
+	}
+
+	throw std::logic_error("obby::chat::create_message");
+}
+
+const char* obby::chat::type_name(message_type type)
 {
-	m_messages.push_back(msg);
-	discard_messages(m_messages, m_max_messages);
-	m_signal_message.emit(*msg);
+	switch(type)
+	{
+	case USER_MESSAGE: return "user_message";
+	case EMOTE_MESSAGE: return "emote_message";
+	case SERVER_MESSAGE: return "server_message";
+	case SYSTEM_MESSAGE: return "system_message";
+	}
+
+	throw std::logic_error("obby::chat::type_name");
 }
 
 void obby::chat::on_sync_init(unsigned int)
@@ -331,12 +656,12 @@ void obby::chat::on_user_join(const user& user)
 
 	obby::format_string str(_("%0% has joined") );
 	str << user.get_name();
-	add_message(new system_message(str.str(), std::time(NULL)) );
+	add_message(SYSTEM_MESSAGE, str.str(), std::time(NULL), NULL);
 }
 
 void obby::chat::on_user_part(const user& user)
 {
 	obby::format_string str(_("%0% has left") );
 	str << user.get_name();
-	add_message(new system_message(str.str(), std::time(NULL)) );
+	add_message(SYSTEM_MESSAGE, str.str(), std::time(NULL), NULL);
 }
@@ -16,6 +16,16 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#ifdef WIN32
+# include <process.h>
+#else
+# include <unistd.h>
+#endif
+
 #include "common.hpp"
 #include "config.hpp"
 
@@ -84,6 +94,53 @@ const char* obby::_(const char* msgid)
 #endif
 }
 
+std::string obby::random_token()
+{
+	unsigned char data[16];
+	std::size_t count = 0;
+
+#ifndef WIN32
+	std::FILE* source = std::fopen("/dev/urandom", "rb");
+	if(source != NULL)
+	{
+		count = std::fread(data, 1, sizeof(data), source);
+		std::fclose(source);
+	}
+#endif
+
+	if(count < sizeof(data) )
+	{
+		static bool seeded = false;
+		if(!seeded)
+		{
+#ifdef WIN32
+			unsigned long pid = _getpid();
+#else
+			unsigned long pid = getpid();
+#endif
+			std::srand(static_cast<unsigned int>(
+				std::time(NULL) ^ (pid << 16) ^ pid) );
+			seeded = true;
+		}
+
+		for(; count < sizeof(data); ++ count)
+			data[count] = static_cast<unsigned char>(std::rand() );
+	}
+
+	static const char digits[] = "0123456789abcdef";
+
+	std::string token;
+	token.reserve(sizeof(data) * 2);
+
+	for(std::size_t i = 0; i < sizeof(data); ++ i)
+	{
+		token += digits[data[i] >> 4];
+		token += digits[data[i] & 0x0f];
+	}
+
+	return token;
+}
+
 #ifdef USE_IPV6
 const bool obby::IPV6_ENABLED = true;
 #else
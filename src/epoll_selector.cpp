@@ -0,0 +1,397 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "common.hpp"
+#include "format_string.hpp"
+#include "epoll_selector.hpp"
+
+namespace
+{
+	// Events taken from the kernel per call
+	const int max_events = 256;
+
+	const int io_mask =
+		net6::IO_INCOMING | net6::IO_OUTGOING | net6::IO_ERROR;
+
+	// A socket with an error or whose peer hung up is readable and
+	// writable, as with select().
+	int from_epoll(unsigned int events)
+	{
+		int cond = net6::IO_NONE;
+		if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			cond |= net6::IO_INCOMING;
+		if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+			cond |= net6::IO_OUTGOING;
+		if(events & EPOLLERR)
+			cond |= net6::IO_ERROR;
+		return cond;
+	}
+
+	int from_poll(short events)
+	{
+		int cond = net6::IO_NONE;
+		if(events & (POLLIN | POLLHUP | POLLERR))
+			cond |= net6::IO_INCOMING;
+		if(events & (POLLOUT | POLLHUP | POLLERR))
+			cond |= net6::IO_OUTGOING;
+		if(events & POLLERR)
+			cond |= net6::IO_ERROR;
+		return cond;
+	}
+
+	void throw_error(const char* what)
+	{
+		obby::format_string str(obby::_("%0% failed: %1%") );
+		str << what << std::strerror(errno);
+		throw std::runtime_error(str.str() );
+	}
+}
+
+obby::epoll_selector::epoll_selector():
+	m_epoll(epoll_create(1024) )
+{
+	if(m_epoll == -1)
+		throw_error("epoll_create");
+}
+
+obby::epoll_selector::~epoll_selector()
+{
+	for(watch_map::iterator iter = m_watches.begin();
+	    iter != m_watches.end();
+	    ++ iter)
+	{
+		delete iter->second;
+	}
+
+	close(m_epoll);
+}
+
+net6::io_condition
+obby::epoll_selector::get(const net6::socket& sock) const
+{
+	watch_map::const_iterator iter = m_watches.find(&sock);
+	if(iter == m_watches.end() ) return net6::IO_NONE;
+	return iter->second->cond;
+}
+
+void obby::epoll_selector::set(const net6::socket& sock,
+                               net6::io_condition cond)
+{
+	watch_map::iterator iter = m_watches.find(&sock);
+	if(cond == net6::IO_NONE)
+	{
+		if(iter != m_watches.end() ) remove(iter);
+		return;
+	}
+
+	watch* w;
+	if(iter == m_watches.end() )
+	{
+		w = new watch;
+		w->sock = &sock;
+		w->cond = net6::IO_NONE;
+		w->ready = net6::IO_NONE;
+		w->fd = -1;
+		w->queued = false;
+		w->deadline = 0;
+		m_watches[&sock] = w;
+	}
+	else
+	{
+		w = iter->second;
+	}
+
+	// The timeout starts with zero milliseconds until set_timeout()
+	// is called.
+	bool had_timeout = (w->cond & net6::IO_TIMEOUT) != 0;
+	bool has_timeout = (cond & net6::IO_TIMEOUT) != 0;
+
+	if(had_timeout && !has_timeout)
+	{
+		m_timers.erase(std::make_pair(w->deadline, &sock) );
+	}
+	else if(!had_timeout && has_timeout)
+	{
+		w->deadline = now();
+		m_timers.insert(std::make_pair(w->deadline, &sock) );
+	}
+
+	w->cond = cond;
+	update(*w);
+}
+
+unsigned long
+obby::epoll_selector::get_timeout(const net6::socket& sock) const
+{
+	watch_map::const_iterator iter = m_watches.find(&sock);
+	if(iter == m_watches.end() ) return 0;
+
+	const watch& w = *iter->second;
+	if( (w.cond & net6::IO_TIMEOUT) == 0) return 0;
+
+	unsigned long current = now();
+	return w.deadline > current ? w.deadline - current : 0;
+}
+
+void obby::epoll_selector::set_timeout(const net6::socket& sock,
+                                       unsigned long timeout)
+{
+	watch_map::iterator iter = m_watches.find(&sock);
+	if(iter == m_watches.end() ||
+	   (iter->second->cond & net6::IO_TIMEOUT) == 0)
+	{
+		throw std::logic_error(
+			"obby::epoll_selector::set_timeout:\n"
+			"Socket is not watched for IO_TIMEOUT"
+		);
+	}
+
+	watch& w = *iter->second;
+	m_timers.erase(std::make_pair(w.deadline, &sock) );
+	w.deadline = now() + timeout;
+	m_timers.insert(std::make_pair(w.deadline, &sock) );
+}
+
+void obby::epoll_selector::select()
+{
+	wait(-1);
+}
+
+void obby::epoll_selector::select(unsigned long timeout)
+{
+	wait(static_cast<long>(timeout) );
+}
+
+void obby::epoll_selector::wait(long timeout)
+{
+	recheck();
+
+	// Do not sleep at all if sockets are still ready, and not beyond
+	// the next timeout.
+	if(!m_ready.empty() )
+	{
+		timeout = 0;
+	}
+	else if(!m_timers.empty() )
+	{
+		unsigned long current = now();
+		unsigned long deadline = m_timers.begin()->first;
+		long left = deadline > current ? deadline - current : 0;
+		if(timeout < 0 || left < timeout) timeout = left;
+	}
+
+	epoll_event events[max_events];
+	int count = epoll_wait(m_epoll, events, max_events, timeout);
+	if(count == -1)
+	{
+		if(errno != EINTR) throw_error("epoll_wait");
+		count = 0;
+	}
+
+	for(int i = 0; i < count; ++ i)
+	{
+		watch& w = *static_cast<watch*>(events[i].data.ptr);
+		w.ready = static_cast<net6::io_condition>(
+			w.ready | from_epoll(events[i].events) );
+
+		if(!w.queued && (w.ready & w.cond) != 0)
+		{
+			w.queued = true;
+			m_ready.push_back(w.sock);
+		}
+	}
+
+	// Handlers may watch and unwatch sockets, including the ones that
+	// are yet to be reported.
+	socket_list ready(m_ready);
+	for(socket_list::iterator iter = ready.begin();
+	    iter != ready.end();
+	    ++ iter)
+	{
+		watch_map::iterator w = m_watches.find(*iter);
+		if(w == m_watches.end() ) continue;
+
+		int cond = w->second->ready & w->second->cond & io_mask;
+		if(cond == net6::IO_NONE) continue;
+
+		(*iter)->io_event().emit(static_cast<net6::io_condition>(cond) );
+	}
+
+	// Timeouts set by the handlers of these are reported in the next
+	// call.
+	unsigned long current = now();
+	socket_list expired;
+	for(timer_set::iterator iter = m_timers.begin();
+	    iter != m_timers.end() && iter->first <= current;
+	    ++ iter)
+	{
+		expired.push_back(iter->second);
+	}
+
+	for(socket_list::iterator iter = expired.begin();
+	    iter != expired.end();
+	    ++ iter)
+	{
+		watch_map::iterator w = m_watches.find(*iter);
+		if(w == m_watches.end() ) continue;
+		if( (w->second->cond & net6::IO_TIMEOUT) == 0) continue;
+		if(w->second->deadline > current) continue;
+
+		set(**iter, static_cast<net6::io_condition>(
+			w->second->cond & ~net6::IO_TIMEOUT) );
+		(*iter)->io_event().emit(net6::IO_TIMEOUT);
+	}
+}
+
+void obby::epoll_selector::recheck()
+{
+	if(m_ready.empty() ) return;
+
+	std::vector<pollfd> fds(m_ready.size() );
+	for(socket_list::size_type i = 0; i < m_ready.size(); ++ i)
+	{
+		const watch& w = *m_watches[m_ready[i]];
+
+		fds[i].fd = w.fd;
+		fds[i].events = 0;
+		fds[i].revents = 0;
+
+		if(w.cond & net6::IO_INCOMING) fds[i].events |= POLLIN;
+		if(w.cond & net6::IO_OUTGOING) fds[i].events |= POLLOUT;
+	}
+
+	if(poll(&fds[0], fds.size(), 0) == -1)
+	{
+		if(errno != EINTR) throw_error("poll");
+		return;
+	}
+
+	// Only the conditions that have been polled for are known now, the
+	// others are kept for when the socket is watched for them.
+	socket_list still_ready;
+	for(socket_list::size_type i = 0; i < m_ready.size(); ++ i)
+	{
+		watch& w = *m_watches[m_ready[i]];
+
+		int polled = from_poll(fds[i].events) | net6::IO_ERROR;
+		w.ready = static_cast<net6::io_condition>(
+			(w.ready & ~polled) | from_poll(fds[i].revents) );
+
+		if( (w.ready & w.cond) != 0)
+			still_ready.push_back(w.sock);
+		else
+			w.queued = false;
+	}
+
+	m_ready.swap(still_ready);
+}
+
+void obby::epoll_selector::update(watch& w)
+{
+	// Sockets that are only watched for a timeout may not even have a
+	// file descriptor.
+	int fd = (w.cond & io_mask) != 0 ? w.sock->cobj() : -1;
+
+	if(fd != w.fd)
+	{
+		// Fails if the descriptor has already been closed, which
+		// removed it from the epoll instance anyway.
+		if(w.fd != -1)
+		{
+			epoll_ctl(m_epoll, EPOLL_CTL_DEL, w.fd, NULL);
+			m_fds.erase(w.fd);
+		}
+
+		if(fd != -1)
+		{
+			// A socket that was destroyed while being watched left
+			// the descriptor behind.
+			fd_map::iterator other = m_fds.find(fd);
+			if(other != m_fds.end() )
+			{
+				epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+				other->second->fd = -1;
+				other->second->ready = net6::IO_NONE;
+				m_fds.erase(other);
+			}
+
+			// The socket is reported ready once when it is added
+			epoll_event event;
+			event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+			event.data.ptr = &w;
+
+			if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1)
+				throw_error("epoll_ctl");
+
+			m_fds[fd] = &w;
+		}
+
+		w.fd = fd;
+		w.ready = net6::IO_NONE;
+	}
+
+	// The kernel does not report a socket that has been ready already
+	// again.
+	if(!w.queued && (w.ready & w.cond) != 0)
+	{
+		w.queued = true;
+		m_ready.push_back(w.sock);
+	}
+}
+
+void obby::epoll_selector::remove(watch_map::iterator iter)
+{
+	watch* w = iter->second;
+
+	if(w->fd != -1)
+	{
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, w->fd, NULL);
+		m_fds.erase(w->fd);
+	}
+
+	if(w->cond & net6::IO_TIMEOUT)
+		m_timers.erase(std::make_pair(w->deadline, w->sock) );
+
+	if(w->queued)
+	{
+		m_ready.erase(
+			std::find(m_ready.begin(), m_ready.end(), w->sock) );
+	}
+
+	m_watches.erase(iter);
+	delete w;
+}
+
+unsigned long obby::epoll_selector::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
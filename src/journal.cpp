@@ -0,0 +1,285 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.hpp"
+
+#include <stdexcept>
+
+#ifdef HAVE_FSYNC
+# include <unistd.h>
+#endif
+
+#include "common.hpp"
+#include "format_string.hpp"
+#include "serialise/mapped_file.hpp"
+#include "journal.hpp"
+
+namespace
+{
+	void write_u32(std::string& target, unsigned long value)
+	{
+		target += static_cast<char>(value & 0xff);
+		target += static_cast<char>( (value >> 8) & 0xff);
+		target += static_cast<char>( (value >> 16) & 0xff);
+		target += static_cast<char>( (value >> 24) & 0xff);
+	}
+
+	unsigned long read_u32(const char* data)
+	{
+		const unsigned char* bytes =
+			reinterpret_cast<const unsigned char*>(data);
+
+		return static_cast<unsigned long>(bytes[0]) |
+		       static_cast<unsigned long>(bytes[1]) << 8 |
+		       static_cast<unsigned long>(bytes[2]) << 16 |
+		       static_cast<unsigned long>(bytes[3]) << 24;
+	}
+
+	/** Adler-32 checksum of an entry.
+	 */
+	unsigned long checksum(const char* data, std::size_t size)
+	{
+		unsigned long a = 1, b = 0;
+		for(std::size_t i = 0; i < size; ++ i)
+		{
+			a = (a + static_cast<unsigned char>(data[i]) ) % 65521;
+			b = (b + a) % 65521;
+		}
+
+		return (b << 16) | a;
+	}
+
+	/** Appends <em>ent</em> with its length and checksum to
+	 * <em>target</em>.
+	 */
+	void write_entry(std::string& target,
+	                 const obby::journal::entry& ent)
+	{
+		std::string payload;
+		write_u32(payload, ent.size() );
+
+		for(obby::journal::entry::const_iterator iter = ent.begin();
+		    iter != ent.end();
+		    ++ iter)
+		{
+			write_u32(payload, iter->size() );
+			payload += *iter;
+		}
+
+		write_u32(target, payload.size() );
+		write_u32(target, checksum(payload.data(), payload.size()) );
+		target += payload;
+	}
+
+	void sync_fp(std::FILE* fp)
+	{
+#ifdef HAVE_FSYNC
+		fsync(fileno(fp) );
+#endif
+	}
+}
+
+obby::journal::journal(const std::string& file):
+	m_file(file), m_fp(NULL), m_size(0)
+{
+	open("ab");
+
+	std::fseek(m_fp, 0, SEEK_END);
+	m_size = std::ftell(m_fp);
+}
+
+obby::journal::~journal()
+{
+	// Do not lose pending entries if the owner did not commit them
+	try
+	{
+		commit();
+	}
+	catch(std::runtime_error& e)
+	{
+	}
+
+	std::fclose(m_fp);
+}
+
+const std::string& obby::journal::get_file() const
+{
+	return m_file;
+}
+
+unsigned long obby::journal::get_size() const
+{
+	return m_size + m_pending.size();
+}
+
+bool obby::journal::has_pending() const
+{
+	return !m_pending.empty();
+}
+
+void obby::journal::append(const entry& ent)
+{
+	write_entry(m_pending, ent);
+}
+
+void obby::journal::commit()
+{
+	if(m_pending.empty() ) return;
+
+	if(std::fwrite(m_pending.data(), 1, m_pending.size(), m_fp) !=
+	   m_pending.size() || std::fflush(m_fp) != 0)
+	{
+		format_string str(_("Could not write to journal '%0%'") );
+		str << m_file;
+		throw std::runtime_error(str.str() );
+	}
+
+	sync_fp(m_fp);
+
+	m_size += m_pending.size();
+	m_pending.clear();
+}
+
+void obby::journal::truncate(unsigned long offset, const entry& header)
+{
+	commit();
+
+	std::string content;
+	write_entry(content, header);
+
+	// Keep the entries behind offset
+	if(offset < m_size)
+	{
+		std::string tail(m_size - offset, '\0');
+
+		std::FILE* fp = std::fopen(m_file.c_str(), "rb");
+		if(fp == NULL || std::fseek(fp, offset, SEEK_SET) != 0 ||
+		   std::fread(&tail[0], 1, tail.size(), fp) != tail.size() )
+		{
+			if(fp != NULL) std::fclose(fp);
+
+			format_string str(_("Could not read journal '%0%'") );
+			str << m_file;
+			throw std::runtime_error(str.str() );
+		}
+
+		std::fclose(fp);
+		content += tail;
+	}
+
+	// Replace the journal only when the new one is on disk, so that
+	// a crash leaves either of them behind.
+	std::string temp = m_file + ".new";
+	std::FILE* fp = std::fopen(temp.c_str(), "wb");
+	if(fp == NULL ||
+	   std::fwrite(content.data(), 1, content.size(), fp) !=
+	   content.size() || std::fflush(fp) != 0)
+	{
+		if(fp != NULL) std::fclose(fp);
+		std::remove(temp.c_str() );
+
+		format_string str(_("Could not write to journal '%0%'") );
+		str << temp;
+		throw std::runtime_error(str.str() );
+	}
+
+	sync_fp(fp);
+
+	if(std::rename(temp.c_str(), m_file.c_str()) != 0)
+	{
+		std::fclose(fp);
+		std::remove(temp.c_str() );
+
+		format_string str(_("Could not write to journal '%0%'") );
+		str << m_file;
+		throw std::runtime_error(str.str() );
+	}
+
+	// The new file is appended to through the handle it has been
+	// written with, which is positioned at its end. Reopening it could
+	// fail and leave no handle to append to.
+	std::fclose(m_fp);
+	m_fp = fp;
+	m_size = content.size();
+}
+
+void obby::journal::read(const std::string& file, entry_list& entries)
+{
+	std::FILE* fp = std::fopen(file.c_str(), "rb");
+	if(fp == NULL) return;
+	std::fclose(fp);
+
+	serialise::mapped_file content(file);
+	const char* data = content.get_data();
+	std::size_t size = content.get_size();
+
+	std::size_t pos = 0;
+	while(size - pos >= 8)
+	{
+		std::size_t len = read_u32(data + pos);
+		unsigned long sum = read_u32(data + pos + 4);
+		pos += 8;
+
+		if(size - pos < len || checksum(data + pos, len) != sum)
+			return;
+
+		const char* cur = data + pos;
+		const char* end = cur + len;
+		pos += len;
+
+		if(end - cur < 4) return;
+		std::size_t count = read_u32(cur);
+		cur += 4;
+
+		entry ent;
+		for(; count > 0; -- count)
+		{
+			if(end - cur < 4) return;
+			std::size_t field_len = read_u32(cur);
+			cur += 4;
+
+			if(static_cast<std::size_t>(end - cur) < field_len)
+				return;
+
+			ent.push_back(std::string(cur, field_len) );
+			cur += field_len;
+		}
+
+		entries.push_back(ent);
+	}
+}
+
+void obby::journal::sync(const std::string& file)
+{
+	std::FILE* fp = std::fopen(file.c_str(), "rb");
+	if(fp == NULL) return;
+
+	sync_fp(fp);
+	std::fclose(fp);
+}
+
+void obby::journal::open(const char* mode)
+{
+	m_fp = std::fopen(m_file.c_str(), mode);
+	if(m_fp == NULL)
+	{
+		format_string str(_("Could not open journal '%0%'") );
+		str << m_file;
+		throw std::runtime_error(str.str() );
+	}
+}
@@ -0,0 +1,348 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <sigc++/adaptors/bind.h>
+#include <net6/error.hpp>
+#include "statistics.hpp"
+#include "send_queue.hpp"
+
+obby::send_queue::packet::packet(const net6::packet& pack):
+	pack(pack), size(statistics::get_size(pack) ), refs(0)
+{
+}
+
+obby::send_queue::window::window(bool acks):
+	acks(acks), sent(0), acked(0), requested(0), request(0),
+	pending(false), queued(0), ready(false)
+{
+}
+
+obby::send_queue::send_queue(const slot_send_type& send,
+                             const slot_schedule_type& schedule):
+	m_send(send), m_schedule(schedule), m_limit(0), m_disconnect(false)
+{
+}
+
+obby::send_queue::~send_queue()
+{
+	clear();
+}
+
+void obby::send_queue::set_limit(std::size_t limit, bool disconnect)
+{
+	m_limit = limit;
+	m_disconnect = disconnect;
+
+	// Packets held back under the old limit go out with the next flush
+	for(window_map::iterator iter = m_windows.begin();
+	    iter != m_windows.end();
+	    ++ iter)
+	{
+		if(!iter->second.queue.empty() )
+			ready(iter->second, *iter->first);
+	}
+}
+
+std::size_t obby::send_queue::get_limit() const
+{
+	return m_limit;
+}
+
+bool obby::send_queue::get_disconnect() const
+{
+	return m_disconnect;
+}
+
+void obby::send_queue::add_client(const net6::user& user6, bool acks)
+{
+	window& win = m_windows.insert(
+		std::make_pair(&user6, window(acks))
+	).first->second;
+
+	win.drain = user6.get_connection().send_event().connect(
+		sigc::bind(
+			sigc::mem_fun(*this, &send_queue::on_drain),
+			&user6
+		)
+	);
+}
+
+void obby::send_queue::remove_client(const net6::user& user6)
+{
+	m_overflow.erase(&user6);
+
+	window_map::iterator iter = m_windows.find(&user6);
+	if(iter == m_windows.end() ) return;
+
+	drop(iter->second);
+	iter->second.drain.disconnect();
+	m_windows.erase(iter);
+}
+
+std::size_t obby::send_queue::get_client_count() const
+{
+	return m_windows.size();
+}
+
+std::size_t obby::send_queue::get_depth(const net6::user& user6) const
+{
+	window_map::const_iterator iter = m_windows.find(&user6);
+	if(iter == m_windows.end() ) return 0;
+
+	const window& win = iter->second;
+	return win.sent - win.acked + win.queued;
+}
+
+void obby::send_queue::append(const net6::packet& pack)
+{
+	packet_list::iterator iter =
+		m_packets.insert(m_packets.end(), packet(pack) );
+
+	for(window_map::const_iterator window_iter = m_windows.begin();
+	    window_iter != m_windows.end();
+	    ++ window_iter)
+	{
+		push(iter, *window_iter->first);
+	}
+
+	// Nobody to send it to
+	if(iter->refs == 0)
+		m_packets.erase(iter);
+}
+
+void obby::send_queue::append(const net6::packet& pack,
+                              const net6::user& to)
+{
+	packet_list::iterator iter =
+		m_packets.insert(m_packets.end(), packet(pack) );
+
+	push(iter, to);
+
+	// Sent already, or dropped
+	if(iter->refs == 0)
+		m_packets.erase(iter);
+}
+
+void obby::send_queue::send(const net6::packet& pack,
+                            const net6::user& to)
+{
+	send(pack, statistics::get_size(pack), to);
+}
+
+void obby::send_queue::flush()
+{
+	// Flushing a queue does not add to the list
+	for(std::vector<const net6::user*>::const_iterator iter =
+		m_ready.begin();
+	    iter != m_ready.end();
+	    ++ iter)
+	{
+		// The client may have gone away since
+		window_map::iterator window_iter = m_windows.find(*iter);
+		if(window_iter == m_windows.end() ) continue;
+
+		window_iter->second.ready = false;
+		flush(window_iter->second, **iter);
+	}
+
+	m_ready.clear();
+}
+
+void obby::send_queue::ack(const net6::user& user6, unsigned int request)
+{
+	window_map::iterator iter = m_windows.find(&user6);
+
+	if(iter == m_windows.end() || !iter->second.pending ||
+	   iter->second.request != request)
+	{
+		throw net6::bad_value("Unexpected acknowledgement");
+	}
+
+	window& win = iter->second;
+	m_signal_depth.emit(win.sent - win.acked + win.queued);
+
+	// Everything sent up to the request has arrived. net6 may have
+	// written more than that to the socket already.
+	win.acked = std::max(win.acked, win.requested);
+	win.pending = false;
+
+	if(!win.queue.empty() )
+		ready(win, user6);
+}
+
+const net6::user* obby::send_queue::pop_overflow()
+{
+	while(!m_overflow.empty() )
+	{
+		const net6::user* user6 = *m_overflow.begin();
+		m_overflow.erase(m_overflow.begin() );
+
+		if(m_windows.find(user6) != m_windows.end() )
+			return user6;
+	}
+
+	return NULL;
+}
+
+void obby::send_queue::clear()
+{
+	for(window_map::iterator iter = m_windows.begin();
+	    iter != m_windows.end();
+	    ++ iter)
+	{
+		iter->second.drain.disconnect();
+	}
+
+	m_packets.clear();
+	m_windows.clear();
+	m_ready.clear();
+	m_overflow.clear();
+}
+
+obby::send_queue::signal_depth_type obby::send_queue::depth_event() const
+{
+	return m_signal_depth;
+}
+
+void obby::send_queue::push(packet_list::iterator pack,
+                            const net6::user& to)
+{
+	window_map::iterator iter = m_windows.find(&to);
+
+	// Not logged in yet
+	if(iter == m_windows.end() )
+	{
+		send(pack->pack, pack->size, to);
+		return;
+	}
+
+	// Packets for the client are dropped, it is disconnected anyway
+	if(m_overflow.count(&to) > 0) return;
+
+	window& win = iter->second;
+	win.queue.push_back(pack);
+	win.queued += pack->size;
+	++ pack->refs;
+
+	ready(win, to);
+}
+
+void obby::send_queue::send(const net6::packet& pack,
+                            std::size_t size,
+                            const net6::user& to)
+{
+	m_send(pack, to);
+
+	// Not logged in yet
+	window_map::iterator iter = m_windows.find(&to);
+	if(iter == m_windows.end() ) return;
+
+	iter->second.sent += size;
+	request(iter->second, to);
+}
+
+void obby::send_queue::request(window& win, const net6::user& to)
+{
+	// Ask twice per limit, so that the client confirms the first half
+	// while the second one is under way.
+	unsigned long interval = m_limit > 0 ? m_limit / 2 : 0x10000;
+
+	if(!win.acks || win.pending || win.sent - win.acked < interval)
+		return;
+
+	net6::packet pack("obby_ack_request");
+	pack << ++ win.request;
+
+	m_send(pack, to);
+
+	win.sent += statistics::get_size(pack);
+	win.requested = win.sent;
+	win.pending = true;
+}
+
+void obby::send_queue::ready(window& win, const net6::user& to)
+{
+	if(!win.ready)
+	{
+		m_ready.push_back(&to);
+		win.ready = true;
+	}
+
+	m_schedule();
+}
+
+void obby::send_queue::flush(window& win, const net6::user& to)
+{
+	while(!win.queue.empty() &&
+	      (m_limit == 0 || win.sent - win.acked < m_limit) )
+	{
+		packet_list::iterator pack = win.queue.front();
+		win.queue.pop_front();
+		win.queued -= pack->size;
+
+		m_send(pack->pack, to);
+		win.sent += pack->size;
+
+		if(-- pack->refs == 0)
+			m_packets.erase(pack);
+
+		request(win, to);
+	}
+
+	if(win.queue.empty() ) return;
+
+	// The rest waits for the client to catch up, unless that is
+	// too much to wait for.
+	if(m_disconnect || win.queued > m_limit)
+	{
+		m_overflow.insert(&to);
+		drop(win);
+		m_schedule();
+	}
+}
+
+void obby::send_queue::drop(window& win)
+{
+	for(std::deque<packet_list::iterator>::iterator iter =
+		win.queue.begin();
+	    iter != win.queue.end();
+	    ++ iter)
+	{
+		if(-- (*iter)->refs == 0)
+			m_packets.erase(*iter);
+	}
+
+	win.queue.clear();
+	win.queued = 0;
+}
+
+void obby::send_queue::on_drain(const net6::user* user6)
+{
+	window_map::iterator iter = m_windows.find(user6);
+	if(iter == m_windows.end() ) return;
+
+	window& win = iter->second;
+	m_signal_depth.emit(win.sent - win.acked + win.queued);
+
+	win.acked = win.sent;
+
+	// Packets held back go out with the next flush
+	if(!win.queue.empty() )
+		ready(win, *user6);
+}
@@ -22,7 +22,7 @@
 #include "serialise/attribute.hpp"
 
 obby::serialise::attribute::attribute(
-	const std::string& name,
+	const identifier& name,
 	const std::string& value
 ) :
 	m_name(name), m_value(value), m_line(0)
@@ -33,9 +33,9 @@ void obby::serialise::attribute::serialise(
 	token_list& tokens
 ) const
 {
-	tokens.add(token::TYPE_IDENTIFIER, m_name, 0);
+	tokens.add(token::TYPE_IDENTIFIER, m_name.get_name(), 0);
 	tokens.add(token::TYPE_ASSIGNMENT, "=", 0);
-	tokens.add(token::TYPE_STRING, m_value.serialised(), 0);
+	tokens.add(token::TYPE_STRING, m_value, 0);
 }
 
 void obby::serialise::attribute::deserialise(
@@ -52,7 +52,7 @@ void obby::serialise::attribute::deserialise(
 	if(iter->get_type() != token::TYPE_ASSIGNMENT)
 	{
 		obby::format_string str(_("Expected '=' after %0%") );
-		str << m_name;
+		str << m_name.get_name();
 		throw error(str.str(), iter->get_line() );
 	}
 
@@ -65,13 +65,24 @@ void obby::serialise::attribute::deserialise(
 			"Expected string literal as value for attribute '%0%'"
 		) );
 
-		str << m_name;
+		str << m_name.get_name();
 		throw error(str.str(), iter->get_line() );
 	}
 	m_value = iter->get_text();
 	++ iter;
 }
 
+void obby::serialise::attribute::deserialise(
+	const reader& src
+)
+{
+	m_name = src.get_name();
+	// Copy the value straight from the input, get_value() would make
+	// another copy inside the reader first.
+	m_value.assign(src.get_value_data(), src.get_value_size() );
+	m_line = src.get_line();
+}
+
 void obby::serialise::attribute::set_value(
 	const std::string& value
 )
@@ -81,10 +92,16 @@ void obby::serialise::attribute::set_value(
 
 const std::string& obby::serialise::attribute::get_value() const
 {
-	return m_value.serialised();
+	return m_value;
 }
 
 const std::string& obby::serialise::attribute::get_name() const
+{
+	return m_name.get_name();
+}
+
+const obby::serialise::identifier&
+obby::serialise::attribute::get_identifier() const
 {
 	return m_name;
 }
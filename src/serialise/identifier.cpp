@@ -0,0 +1,91 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <map>
+#include <vector>
+#include "serialise/identifier.hpp"
+
+namespace
+{
+	typedef obby::serialise::identifier::handle_type handle_type;
+
+	/** Interned names. The map's keys never move, so the list of names
+	 * indexed by handle refers to them.
+	 */
+	struct identifier_table
+	{
+		typedef std::map<std::string, handle_type> handle_map;
+
+		identifier_table()
+		{
+			// The empty name always has handle 0
+			intern("");
+		}
+
+		handle_type intern(const std::string& name)
+		{
+			std::pair<handle_map::iterator, bool> result =
+				handles.insert(
+					handle_map::value_type(
+						name,
+						static_cast<handle_type>(
+							names.size()
+						)
+					)
+				);
+
+			if(result.second)
+				names.push_back(&result.first->first);
+
+			return result.first->second;
+		}
+
+		handle_map handles;
+		std::vector<const std::string*> names;
+	};
+
+	identifier_table& get_table()
+	{
+		static identifier_table table;
+		return table;
+	}
+}
+
+obby::serialise::identifier::identifier():
+	m_handle(0)
+{
+}
+
+obby::serialise::identifier::identifier(
+	const std::string& name
+) :
+	m_handle(get_table().intern(name) )
+{
+}
+
+obby::serialise::identifier::identifier(
+	const char* name
+) :
+	m_handle(get_table().intern(name) )
+{
+}
+
+const std::string& obby::serialise::identifier::get_name() const
+{
+	return *get_table().names[m_handle];
+}
@@ -0,0 +1,124 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.hpp"
+
+#include <fstream>
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# define OBBY_USE_MMAP
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#include "common.hpp"
+#include "format_string.hpp"
+#include "serialise/error.hpp"
+#include "serialise/mapped_file.hpp"
+
+namespace
+{
+	void throw_open_error(const std::string& file)
+	{
+		obby::format_string str(obby::_(
+			"Could not open file '%0%' for reading"
+		) );
+
+		str << file;
+		throw obby::serialise::error(str.str(), 0);
+	}
+}
+
+obby::serialise::mapped_file::mapped_file(
+	const std::string& file
+) :
+	m_data(""), m_size(0), m_mapped(false)
+{
+#ifdef OBBY_USE_MMAP
+	int fd = open(file.c_str(), O_RDONLY);
+	if(fd == -1) throw_open_error(file);
+
+	struct stat st;
+	if(fstat(fd, &st) == -1)
+	{
+		close(fd);
+		throw_open_error(file);
+	}
+
+	// Empty files cannot be mapped
+	if(st.st_size > 0)
+	{
+		void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		                  fd, 0);
+
+		if(addr != MAP_FAILED)
+		{
+#ifdef MADV_SEQUENTIAL
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+#endif
+			m_data = static_cast<const char*>(addr);
+			m_size = st.st_size;
+			m_mapped = true;
+		}
+	}
+
+	// The mapping stays valid without the descriptor
+	close(fd);
+	if(m_mapped || st.st_size == 0) return;
+#endif
+
+	// Read file into memory if it could not be mapped
+	std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+	if(!in) throw_open_error(file);
+
+	const std::size_t bufsize = 64 * 1024;
+	while(in)
+	{
+		std::size_t pos = m_buffer.size();
+		m_buffer.resize(pos + bufsize);
+		in.read(&m_buffer[pos], bufsize);
+		m_buffer.resize(pos + in.gcount() );
+	}
+
+	if(!m_buffer.empty() )
+	{
+		m_data = &m_buffer[0];
+		m_size = m_buffer.size();
+	}
+}
+
+obby::serialise::mapped_file::~mapped_file()
+{
+#ifdef OBBY_USE_MMAP
+	if(m_mapped)
+		munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+const char* obby::serialise::mapped_file::get_data() const
+{
+	return m_data;
+}
+
+std::size_t obby::serialise::mapped_file::get_size() const
+{
+	return m_size;
+}
@@ -21,37 +21,6 @@
 #include "serialise/error.hpp"
 #include "serialise/object.hpp"
 
-obby::serialise::object::attribute_iterator::attribute_iterator(
-	const base_iterator& base
-) :
-	base_iterator(base)
-{
-}
-/*
-obby::serialise::object::attribute_iterator::value_type&
-obby::serialise::object::attribute_iterator::operator*()
-{
-	return base_iterator::operator->()->second;
-}
-*/
-const obby::serialise::object::attribute_iterator::value_type&
-obby::serialise::object::attribute_iterator::operator*() const
-{
-	return base_iterator::operator->()->second;
-}
-/*
-obby::serialise::object::attribute_iterator::value_type*
-obby::serialise::object::attribute_iterator::operator->()
-{
-	return &base_iterator::operator->()->second;
-}
-*/
-const obby::serialise::object::attribute_iterator::value_type*
-obby::serialise::object::attribute_iterator::operator->() const
-{
-	return &base_iterator::operator->()->second;
-}
-
 obby::serialise::object::object(
 	const object* parent
 ) :
@@ -67,7 +36,7 @@ void obby::serialise::object::serialise(
 	unsigned int indentation_deep = get_indentation();
 
 	// Add object name
-	tokens.add(token::TYPE_IDENTIFIER, m_name, 0);
+	tokens.add(token::TYPE_IDENTIFIER, m_name.get_name(), 0);
 
 	// Add attributes
 	for(attribute_iterator iter = attributes_begin();
@@ -111,7 +80,7 @@ void obby::serialise::object::deserialise(
 	// Expect any number of attributes
 	while(iter != tokens.end() &&
 	      iter->get_type() == token::TYPE_IDENTIFIER)
-		m_attributes[iter->get_text()].deserialise(tokens, iter);
+		add_attribute(iter->get_text() ).deserialise(tokens, iter);
 
 	// Indentation (for child objects)
 	while(iter != tokens.end() &&
@@ -163,6 +132,56 @@ void obby::serialise::object::deserialise(
 	}
 }
 
+void obby::serialise::object::deserialise(
+	reader& src
+)
+{
+	m_name = src.get_name();
+	m_line = src.get_line();
+
+	for(;;)
+	{
+		switch(src.read() )
+		{
+		case reader::ATTRIBUTE:
+			add_attribute(src.get_name() ).deserialise(src);
+			break;
+		case reader::OBJECT_BEGIN:
+			add_child().deserialise(src);
+			break;
+		case reader::OBJECT_END:
+			return;
+		case reader::END_OF_INPUT:
+			throw error(_("Unexpected end of input"), src.get_line() );
+		}
+	}
+}
+
+void obby::serialise::object::deserialise_attributes(
+	reader& src
+)
+{
+	m_name = src.get_name();
+	m_line = src.get_line();
+
+	for(;;)
+	{
+		switch(src.read() )
+		{
+		case reader::ATTRIBUTE:
+			add_attribute(src.get_name() ).deserialise(src);
+			break;
+		case reader::OBJECT_BEGIN:
+			src.skip_object();
+			break;
+		case reader::OBJECT_END:
+			return;
+		case reader::END_OF_INPUT:
+			throw error(_("Unexpected end of input"), src.get_line() );
+		}
+	}
+}
+
 const obby::serialise::object* obby::serialise::object::get_parent() const
 {
 	return m_parent;
@@ -175,68 +194,88 @@ obby::serialise::object& obby::serialise::object::add_child()
 }
 
 const std::string& obby::serialise::object::get_name() const
+{
+	return m_name.get_name();
+}
+
+const obby::serialise::identifier&
+obby::serialise::object::get_identifier() const
 {
 	return m_name;
 }
 
 void obby::serialise::object::set_name(
-	const std::string& name
+	const identifier& name
 )
 {
 	m_name = name;
 }
 
 obby::serialise::attribute& obby::serialise::object::add_attribute(
-	const std::string& name
+	const identifier& name
 )
 {
-	return m_attributes.insert(
-		std::make_pair(name, attribute(name))
-	).first->second;
+	attribute* existing = get_attribute(name);
+	if(existing != NULL) return *existing;
+
+	m_attributes.push_back(attribute(name) );
+	return m_attributes.back();
 }
 
 obby::serialise::attribute*
-obby::serialise::object::get_attribute(const std::string& name)
+obby::serialise::object::get_attribute(const identifier& name)
 {
-	attribute_map::iterator iter = m_attributes.find(name);
-	if(iter == m_attributes.end() ) return NULL;
-	return &iter->second;
+	for(attribute_list::iterator iter = m_attributes.begin();
+	    iter != m_attributes.end();
+	    ++ iter)
+	{
+		if(iter->get_identifier() == name)
+			return &(*iter);
+	}
+
+	return NULL;
 }
 
 const obby::serialise::attribute*
-obby::serialise::object::get_attribute(const std::string& name) const
+obby::serialise::object::get_attribute(const identifier& name) const
 {
-	attribute_map::const_iterator iter = m_attributes.find(name);
-	if(iter == m_attributes.end() ) return NULL;
-	return &iter->second;
+	for(attribute_list::const_iterator iter = m_attributes.begin();
+	    iter != m_attributes.end();
+	    ++ iter)
+	{
+		if(iter->get_identifier() == name)
+			return &(*iter);
+	}
+
+	return NULL;
 }
 
 obby::serialise::attribute&
-obby::serialise::object::get_required_attribute(const std::string& name)
+obby::serialise::object::get_required_attribute(const identifier& name)
 {
-	attribute_map::iterator iter = m_attributes.find(name);
-	if(iter == m_attributes.end() )
+	attribute* attr = get_attribute(name);
+	if(attr == NULL)
 	{
 		format_string str(_("Object '%0%' requires attribute '%1%'") );
-		str << m_name << name;
+		str << m_name.get_name() << name.get_name();
 		throw error(str.str(), m_line);
 	}
 
-	return iter->second;
+	return *attr;
 }
 
 const obby::serialise::attribute&
-obby::serialise::object::get_required_attribute(const std::string& name) const
+obby::serialise::object::get_required_attribute(const identifier& name) const
 {
-	attribute_map::const_iterator iter = m_attributes.find(name);
-	if(iter == m_attributes.end() )
+	const attribute* attr = get_attribute(name);
+	if(attr == NULL)
 	{
 		format_string str(_("Object '%0%' requires attribute '%1%'") );
-		str << m_name << name;
+		str << m_name.get_name() << name.get_name();
 		throw error(str.str(), m_line);
 	}
 
-	return iter->second;
+	return *attr;
 }
 
 obby::serialise::object::attribute_iterator
@@ -20,6 +20,9 @@
 #include "common.hpp"
 #include "format_string.hpp"
 #include "serialise/error.hpp"
+#include "serialise/mapped_file.hpp"
+#include "serialise/reader.hpp"
+#include "serialise/writer.hpp"
 #include "serialise/parser.hpp"
 
 obby::serialise::parser::parser()
@@ -28,153 +31,58 @@ obby::serialise::parser::parser()
 
 void obby::serialise::parser::deserialise(const std::string& file)
 {
-	std::ifstream in(file.c_str() );
-
-	if(!in)
-	{
-		obby::format_string str(_(
-			"Could not open file '%0%' for reading"
-		) );
-
-		str << file;
-		throw error(str.str(), 0);
-	}
-
-	deserialise(in);
+	mapped_file in(file);
+	reader src(in.get_data(), in.get_size() );
+	deserialise(src);
 }
 
 void obby::serialise::parser::deserialise(std::istream& stream)
 {
-	const unsigned int bufsize = 1024;
-	char readbuf[bufsize];
-	std::string result;
-
-	// Initial preallocation
-	result.reserve(bufsize << 3);
-
-#ifdef WIN32
-	// Other effort (see below) seems not to work on WIN32, the eofflag is
-	// set after the first 1024 Bytes have been read. Is this a bug in
-	// mingw?
-	std::string line;
-	while(std::getline(stream, line) )
-	{
-		// More preallocation, if the following line exceeds the
-		// current capacity
-		if(result.capacity() < result.length() + bufsize)
-			result.reserve(result.capacity() * 2);
-
-		result += line;
-		result += '\n';
-	}
-#else
-	while(stream)
-	{
-		// More preallocation, if the following 1024 byte exceeds the
-		// current capacity
-		if(result.capacity() < result.length() + bufsize)
-			result.reserve(result.capacity() * 2);
-
-		// Read data, append to resulting string
-		stream.read(readbuf, bufsize);
-		result.append(readbuf, stream.gcount() );
-	}
-#endif
-
-	deserialise_memory(result);
+	reader src(stream);
+	deserialise(src);
 }
 
 void obby::serialise::parser::deserialise_memory(const std::string& mem)
 {
-	token_list list;
-	list.deserialise(mem);
-	token_list::iterator iter = list.begin();
-
-	// Get initial '!'
-	if(iter->get_type() != token::TYPE_EXCLAMATION)
-	{
-		throw error(
-			_("Expected initial exclamation mark"),
-			iter->get_line()
-		);
-	}
-	list.next_token(iter);
-
-	// Read document type
-	if(iter->get_type() != token::TYPE_IDENTIFIER)
-	{
-		throw error(
-			_("Expected document type after '!'"),
-			iter->get_line()
-		);
-	}
-	m_type = iter->get_text();
-	list.next_token(iter);
-
-	// Get indentation for following object
-	if(iter->get_type() != token::TYPE_INDENTATION)
-	{
-		throw error(
-			_("Expected newline after document type"),
-			iter->get_line()
-		);
-	}
+	reader src(mem.data(), mem.size() );
+	deserialise(src);
+}
 
-	// Must be top-level (indentation == 0)
-	if(iter->get_text().length() > 0)
-	{
-		throw error(
-			_("Expected top-level object after document type"),
-			iter->get_line()
-		);
-	}
-	list.next_token(iter);
+void obby::serialise::parser::deserialise(reader& src)
+{
+	m_type = src.get_type();
 
 	// Root object should follow
-	if(iter->get_type() != token::TYPE_IDENTIFIER)
+	if(src.read() != reader::OBJECT_BEGIN)
 	{
 		throw error(
 			_("Expected root object after document type"),
-			iter->get_line()
+			src.get_line()
 		);
 	}
 
-	m_object.deserialise(list, iter);
-
-	// Must be EOF now
-	if(iter != list.end() )
-	{
-		format_string str(_("Expected end of input instead of '%0%'") );
-		str << iter->get_text();
-		throw error(str.str(), iter->get_line() );
-	}
+	// The reader makes sure that nothing follows the root object
+	m_object.deserialise(src);
 }
 
-void obby::serialise::parser::serialise(const std::string& file) const
+void obby::serialise::parser::serialise(
+	const std::string& file,
+	writer::format_type format
+) const
 {
-	std::ofstream out(file.c_str() );
-	if(!out)
-	{
-		obby::format_string str(
-			_("Could not open file '%0%' for writing")
-		);
-
-		str << file;
-		throw std::runtime_error(str.str() );
-	}
-
-	serialise(out);
+	writer dest(file, m_type, format);
+	dest.add_object(m_object);
+	dest.flush();
 }
 
-void obby::serialise::parser::serialise(std::ostream& stream) const
+void obby::serialise::parser::serialise(
+	std::ostream& stream,
+	writer::format_type format
+) const
 {
-	// Get string
-	std::string result;
-	serialise_memory(result);
-
-	// Write it into the file
-	stream << result;
-	stream.flush();
+	writer dest(stream, m_type, format);
+	dest.add_object(m_object);
+	dest.flush();
 }
 
 void obby::serialise::parser::serialise_memory(std::string& mem) const
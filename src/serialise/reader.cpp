@@ -0,0 +1,677 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include "common.hpp"
+#include "format_string.hpp"
+#include "serialise/error.hpp"
+#include "serialise/binary.hpp"
+#include "serialise/reader.hpp"
+#include "serialise/token.hpp"
+
+namespace
+{
+	bool is_identifier(int c)
+	{
+		return c != -1 && (isalnum(c) || c == '_');
+	}
+
+	bool is_blank(int c)
+	{
+		return c != -1 && c != '\n' && isspace(c);
+	}
+
+	/** Returns <em>size</em> bytes at <em>data</em> in a readable form,
+	 * with unprintable bytes written as \xNN.
+	 */
+	std::string printable(const char* data, std::size_t size)
+	{
+		static const char hex[] = "0123456789abcdef";
+
+		std::string result;
+		for(std::size_t i = 0; i < size; ++ i)
+		{
+			unsigned char c = static_cast<unsigned char>(data[i]);
+			if(isprint(c) && c != '\\')
+			{
+				result += static_cast<char>(c);
+			}
+			else
+			{
+				result += "\\x";
+				result += hex[c >> 4];
+				result += hex[c & 0x0f];
+			}
+		}
+
+		return result;
+	}
+
+	// Size of the read buffer
+	const std::vector<char>::size_type BUFFER_SIZE = 64 * 1024;
+}
+
+obby::serialise::reader::reader(
+	std::istream& stream
+) :
+	m_stream(&stream), m_buffer(BUFFER_SIZE), m_data(&m_buffer[0]),
+	m_pos(0), m_end(0), m_value_data(""), m_value_size(0),
+	m_value_valid(true), m_depth(0), m_line(1), m_cur_line(1), m_state(STATE_LINE_BEGIN),
+	m_open(0), m_pending_ends(0), m_pending_begin(false), m_next_line(0),
+	m_offset(0), m_next_offset(0), m_had_root(false), m_binary(false)
+{
+	read_header();
+}
+
+obby::serialise::reader::reader(
+	const char* data,
+	std::size_t size
+) :
+	m_stream(NULL), m_data(data), m_pos(0), m_end(size),
+	m_value_data(""), m_value_size(0), m_value_valid(true),
+	m_depth(0), m_line(1), m_cur_line(1), m_state(STATE_LINE_BEGIN),
+	m_open(0), m_pending_ends(0), m_pending_begin(false), m_next_line(0),
+	m_offset(0), m_next_offset(0), m_had_root(false), m_binary(false)
+{
+	read_header();
+}
+
+const std::string& obby::serialise::reader::get_type() const
+{
+	return m_type;
+}
+
+obby::serialise::reader::event_type obby::serialise::reader::read()
+{
+	if(m_binary)
+		return read_binary();
+
+	// Close objects before reporting the next one
+	if(m_pending_ends > 0)
+	{
+		-- m_pending_ends;
+		m_depth = -- m_open;
+		return OBJECT_END;
+	}
+
+	if(m_pending_begin)
+	{
+		m_pending_begin = false;
+		m_name.swap(m_next_name);
+		m_line = m_next_line;
+		m_offset = m_next_offset;
+		m_depth = m_open ++;
+		m_state = STATE_ATTRIBUTES;
+		return OBJECT_BEGIN;
+	}
+
+	if(m_state == STATE_END)
+		return END_OF_INPUT;
+
+	if(m_state == STATE_ATTRIBUTES)
+	{
+		skip_blanks();
+		skip_comment();
+
+		int c = peek();
+		if(is_identifier(c) )
+		{
+			m_line = m_cur_line;
+			read_identifier(m_name);
+			skip_blanks();
+
+			if(peek() != '=')
+			{
+				obby::format_string str(_("Expected '=' after %0%") );
+				str << m_name;
+				throw error(str.str(), m_cur_line);
+			}
+
+			advance();
+			skip_blanks();
+
+			if(peek() != '\"')
+			{
+				obby::format_string str(_(
+					"Expected string literal as value for "
+					"attribute '%0%'"
+				) );
+
+				str << m_name;
+				throw error(str.str(), m_cur_line);
+			}
+
+			read_string();
+			return ATTRIBUTE;
+		}
+
+		if(c != '\n' && c != -1)
+		{
+			obby::format_string str(_("Unexpected token: '%0%'") );
+			str << static_cast<char>(c);
+			throw error(str.str(), m_cur_line);
+		}
+
+		m_state = STATE_LINE_BEGIN;
+	}
+
+	for(;;)
+	{
+		int c = peek();
+
+		// End of input closes all open objects
+		if(c == -1)
+		{
+			if(!m_had_root)
+				throw error(_("Unexpected end of input"), m_cur_line);
+
+			m_state = STATE_END;
+			m_pending_ends = m_open;
+			return read();
+		}
+
+		if(c == '\n')
+		{
+			advance();
+			continue;
+		}
+
+		std::size_t line_begin = m_pos;
+		unsigned int indentation = 0;
+		for(; is_blank(c); c = peek() )
+		{
+			++ indentation;
+			advance();
+		}
+
+		// Skip empty lines and comments
+		if(c == '#')
+		{
+			skip_comment();
+			continue;
+		}
+
+		if(c == '\n' || c == -1)
+			continue;
+
+		if(!is_identifier(c) )
+		{
+			throw error(
+				_("Expected child object after indentation"),
+				m_cur_line
+			);
+		}
+
+		m_next_line = m_cur_line;
+		m_next_offset = line_begin;
+		read_identifier(m_next_name);
+
+		if(!m_had_root)
+		{
+			if(indentation > 0)
+			{
+				throw error(
+					_("Expected top-level object after "
+					  "document type"),
+					m_next_line
+				);
+			}
+		}
+		else if(indentation == 0)
+		{
+			format_string str(
+				_("Expected end of input instead of '%0%'")
+			);
+
+			str << m_next_name;
+			throw error(str.str(), m_next_line);
+		}
+		else if(indentation > m_open)
+		{
+			throw error(
+				_("Child object's indentation must be "
+				  "parent's plus one"),
+				m_next_line
+			);
+		}
+
+		m_had_root = true;
+		m_pending_ends = m_open - indentation;
+		m_pending_begin = true;
+		return read();
+	}
+}
+
+const std::string& obby::serialise::reader::get_name() const
+{
+	return m_name;
+}
+
+const std::string& obby::serialise::reader::get_value() const
+{
+	// Copy value referring to the input
+	if(!m_value_valid)
+	{
+		m_value.assign(m_value_data, m_value_size);
+		m_value_valid = true;
+	}
+
+	return m_value;
+}
+
+const char* obby::serialise::reader::get_value_data() const
+{
+	return m_value_data;
+}
+
+std::size_t obby::serialise::reader::get_value_size() const
+{
+	return m_value_size;
+}
+
+unsigned int obby::serialise::reader::get_depth() const
+{
+	return m_depth;
+}
+
+unsigned int obby::serialise::reader::get_line() const
+{
+	return m_line;
+}
+
+bool obby::serialise::reader::is_binary() const
+{
+	return m_binary;
+}
+
+const obby::serialise::reader::index_type&
+obby::serialise::reader::get_index() const
+{
+	return m_index;
+}
+
+std::size_t obby::serialise::reader::get_offset() const
+{
+	return m_offset;
+}
+
+void obby::serialise::reader::seek(std::size_t offset, unsigned int line)
+{
+	if(m_stream != NULL)
+	{
+		throw std::logic_error(
+			"obby::serialise::reader::seek:\n"
+			"Seeking requires input in memory"
+		);
+	}
+
+	// Children of the root object are tagged in binary snapshots and
+	// indented by one level in text input.
+	if(offset >= m_end ||
+	   (m_binary && m_data[offset] != binary::TAG_OBJECT_BEGIN) ||
+	   (!m_binary && !is_blank(m_data[offset])) )
+	{
+		throw std::logic_error(
+			"obby::serialise::reader::seek:\n"
+			"Offset does not refer to an object"
+		);
+	}
+
+	// Continue as if the root object had just been begun
+	m_pos = offset;
+	m_open = 1;
+	m_had_root = true;
+	m_state = STATE_LINE_BEGIN;
+	m_pending_ends = 0;
+	m_pending_begin = false;
+
+	if(!m_binary)
+		m_line = m_cur_line = line;
+}
+
+void obby::serialise::reader::skip_object()
+{
+	unsigned int depth = m_open - 1;
+
+	event_type event;
+	while( (event = read()) != END_OF_INPUT)
+		if(event == OBJECT_END && m_depth == depth)
+			return;
+
+	throw error(_("Unexpected end of input"), m_cur_line);
+}
+
+int obby::serialise::reader::peek()
+{
+	if(m_pos == m_end && !fill() )
+		return -1;
+
+	// Nullbyte identifies end of input
+	if(m_data[m_pos] == '\0')
+		return -1;
+
+	return static_cast<unsigned char>(m_data[m_pos]);
+}
+
+void obby::serialise::reader::advance()
+{
+	if(m_data[m_pos] == '\n')
+		++ m_cur_line;
+
+	++ m_pos;
+}
+
+bool obby::serialise::reader::fill()
+{
+	// A memory block is available as a whole
+	if(m_stream == NULL)
+		return false;
+
+	m_pos = 0;
+
+#ifdef WIN32
+	// read() seems not to work on WIN32, the eofflag is set after the
+	// first block has been read. Is this a bug in mingw?
+	std::string line;
+	if(!std::getline(*m_stream, line) )
+	{
+		m_end = 0;
+		return false;
+	}
+
+	line += '\n';
+	m_buffer.assign(line.begin(), line.end() );
+	m_end = m_buffer.size();
+#else
+	m_stream->read(&m_buffer[0], m_buffer.size() );
+	m_end = m_stream->gcount();
+#endif
+
+	m_data = &m_buffer[0];
+
+	return m_end > 0;
+}
+
+void obby::serialise::reader::read_header()
+{
+	if(peek() == static_cast<unsigned char>(binary::MAGIC[0]) )
+	{
+		read_binary_header();
+		return;
+	}
+
+	skip_blanks();
+	skip_comment();
+
+	if(peek() != '!')
+		throw error(_("Expected initial exclamation mark"), m_cur_line);
+
+	advance();
+	skip_blanks();
+
+	if(!is_identifier(peek() ) )
+		throw error(_("Expected document type after '!'"), m_cur_line);
+
+	read_identifier(m_type);
+	skip_blanks();
+	skip_comment();
+
+	if(peek() != '\n')
+	{
+		throw error(
+			_("Expected newline after document type"),
+			m_cur_line
+		);
+	}
+}
+
+void obby::serialise::reader::read_binary_header()
+{
+	std::string storage;
+	const char* magic = read_bytes(binary::MAGIC_SIZE, storage);
+	if(std::memcmp(magic, binary::MAGIC, binary::MAGIC_SIZE) != 0)
+	{
+		obby::format_string str(
+			_("Unknown binary snapshot signature: '%0%'")
+		);
+
+		str << printable(magic, binary::MAGIC_SIZE);
+		throw error(str.str(), 0);
+	}
+
+	m_binary = true;
+	m_line = m_cur_line = 0;
+
+	if(read_size() != binary::VERSION)
+		throw error(_("Unsupported binary snapshot version"), 0);
+
+	std::size_t len = read_size();
+	m_type.assign(read_bytes(len, storage), len);
+
+	if(m_stream == NULL)
+		read_binary_index();
+}
+
+void obby::serialise::reader::read_binary_index()
+{
+	// Offset of the index is stored in the last four bytes
+	if(m_end - m_pos < 4)
+		throw error(_("Unexpected end of input"), 0);
+
+	std::size_t orig_pos = m_pos;
+	std::string storage;
+
+	m_pos = m_end - 4;
+	std::size_t index_pos = read_size();
+	if(index_pos < orig_pos || index_pos >= m_end - 4 ||
+	   m_data[index_pos] != binary::TAG_INDEX)
+	{
+		throw error(_("Binary snapshot has no valid index"), 0);
+	}
+
+	m_pos = index_pos + 1;
+	std::size_t count = read_size();
+	if(count > (m_end - m_pos) / 4)
+		throw error(_("Binary snapshot has no valid index"), 0);
+
+	m_index.resize(count);
+	for(std::size_t i = 0; i < count; ++ i)
+		m_index[i] = read_size();
+
+	m_pos = orig_pos;
+}
+
+obby::serialise::reader::event_type obby::serialise::reader::read_binary()
+{
+	if(m_state == STATE_END)
+		return END_OF_INPUT;
+
+	std::string storage;
+	std::size_t offset = m_pos;
+	char tag = *read_bytes(1, storage);
+
+	std::size_t len;
+	switch(tag)
+	{
+	case binary::TAG_OBJECT_BEGIN:
+		if(m_open == 0 && m_had_root)
+			throw error(_("Expected end of input"), 0);
+
+		len = read_size();
+		m_name.assign(read_bytes(len, storage), len);
+
+		m_offset = offset;
+		m_had_root = true;
+		m_depth = m_open ++;
+		return OBJECT_BEGIN;
+	case binary::TAG_ATTRIBUTE:
+		if(m_open == 0)
+			throw error(_("Unexpected end of input"), 0);
+
+		len = read_size();
+		m_name.assign(read_bytes(len, storage), len);
+
+		len = read_size();
+		m_value_data = read_bytes(len, m_value);
+		m_value_size = len;
+		m_value_valid = (m_value_data == m_value.data() );
+
+		m_depth = m_open - 1;
+		return ATTRIBUTE;
+	case binary::TAG_OBJECT_END:
+		if(m_open == 0)
+			throw error(_("Unexpected end of input"), 0);
+
+		m_depth = -- m_open;
+
+		// Nothing but the index follows the root object
+		if(m_open == 0)
+			m_state = STATE_END;
+
+		return OBJECT_END;
+	default:
+		throw error(_("Binary snapshot is corrupted"), 0);
+	}
+}
+
+const char* obby::serialise::reader::read_bytes(std::size_t count,
+                                                std::string& storage)
+{
+	if(m_end - m_pos >= count)
+	{
+		const char* result = m_data + m_pos;
+		m_pos += count;
+		return result;
+	}
+
+	// Collect the bytes from several blocks of the stream
+	storage.assign(m_data + m_pos, m_end - m_pos);
+	m_pos = m_end;
+
+	while(storage.size() < count)
+	{
+		if(!fill() )
+			throw error(_("Unexpected end of input"), m_cur_line);
+
+		std::size_t take = std::min(count - storage.size(), m_end);
+		storage.append(m_data, take);
+		m_pos = take;
+	}
+
+	return storage.data();
+}
+
+std::size_t obby::serialise::reader::read_size()
+{
+	std::string storage;
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(
+		read_bytes(4, storage)
+	);
+
+	return static_cast<std::size_t>(bytes[0]) |
+	       static_cast<std::size_t>(bytes[1]) << 8 |
+	       static_cast<std::size_t>(bytes[2]) << 16 |
+	       static_cast<std::size_t>(bytes[3]) << 24;
+}
+
+void obby::serialise::reader::read_identifier(std::string& target)
+{
+	target.clear();
+	for(int c = peek(); is_identifier(c); c = peek() )
+	{
+		target += static_cast<char>(c);
+		advance();
+	}
+}
+
+void obby::serialise::reader::read_string()
+{
+	unsigned int orig_line = m_cur_line;
+
+	// Skip opening '"'
+	advance();
+
+	// Look for the end of the string in the current window. If it
+	// contains no escape sequences, the value is referred to in place.
+	std::size_t end = m_pos;
+	unsigned int lines = 0;
+	for(; end < m_end; ++ end)
+	{
+		char c = m_data[end];
+		if(c == '\"' || c == '\\' || c == '\0') break;
+		if(c == '\n') ++ lines;
+	}
+
+	if(end < m_end && m_data[end] == '\"')
+	{
+		m_value_data = m_data + m_pos;
+		m_value_size = end - m_pos;
+		m_value_valid = false;
+
+		m_cur_line += lines;
+		m_pos = end + 1;
+		return;
+	}
+
+	read_string_escaped(orig_line);
+}
+
+void obby::serialise::reader::read_string_escaped(unsigned int orig_line)
+{
+	// Collect the literal as is and let unescape() replace the escape
+	// sequences, so that the tokeniser and the reader agree on them.
+	m_value.clear();
+
+	bool escaped = false;
+	for(;;)
+	{
+		int c = peek();
+		if(c == -1)
+			throw error(_("String not closed"), orig_line);
+
+		advance();
+		if(c == '\"' && !escaped)
+			break;
+
+		escaped = (c == '\\' && !escaped);
+		m_value += static_cast<char>(c);
+	}
+
+	unescape(m_value, orig_line);
+
+	m_value_data = m_value.data();
+	m_value_size = m_value.size();
+	m_value_valid = true;
+}
+
+void obby::serialise::reader::skip_blanks()
+{
+	while(is_blank(peek() ) )
+		advance();
+}
+
+void obby::serialise::reader::skip_comment()
+{
+	if(peek() != '#') return;
+
+	for(int c = peek(); c != '\n' && c != -1; c = peek() )
+		advance();
+}
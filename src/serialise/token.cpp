@@ -16,6 +16,8 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <cstring>
+#include <algorithm>
 #include "common.hpp"
 #include "format_string.hpp"
 #include "serialise/error.hpp"
@@ -33,74 +35,51 @@ namespace
 		return obby::_(msgid);
 	}
 
-	void escape(
-		std::string& src
-	)
-	{
-		std::string::size_type pos = 0;
-		while( (pos = src.find_first_of("\n\t\\\"", pos)) != std::string::npos)
-		{
-			std::string replace_with;
+	// Machine word that is scanned at once for special characters
+	typedef unsigned long word_type;
 
-			switch(src[pos])
-			{
-			case '\n':
-				replace_with = "\\n";
-				break;
-			case '\t':
-				replace_with = "\\t";
-				break;
-			case '\\':
-				replace_with = "\\\\";
-				break;
-			case '\"':
-				replace_with = "\\\"";
-				break;
-			}
+	const word_type WORD_ONES = ~static_cast<word_type>(0) / 0xff;
+	const word_type WORD_HIGHS = WORD_ONES * 0x80;
 
-			src.replace(pos, 1, replace_with);
-			pos += replace_with.length();
-		}
+	/** Returns nonzero if any byte of <em>word</em> equals <em>c</em>.
+	 */
+	inline word_type word_has_byte(word_type word, unsigned char c)
+	{
+		word_type x = word ^ (WORD_ONES * c);
+		return (x - WORD_ONES) & ~x & WORD_HIGHS;
+	}
+
+	inline bool is_special(char c)
+	{
+		return c == '\n' || c == '\t' || c == '\\' || c == '\"';
 	}
 
-	void unescape(
-		std::string& src,
-		unsigned int src_line
+	/** Returns the first character in [begin, end) that has to be
+	 * escaped, or end if there is none. Strings are checked a word at a
+	 * time since most of them contain only few special characters.
+	 */
+	const char* find_special(
+		const char* begin,
+		const char* end
 	)
 	{
-		std::string::size_type pos = 0;
-		while( (pos = src.find('\\', pos)) != std::string::npos)
+		while(static_cast<std::size_t>(end - begin) >= sizeof(word_type) )
 		{
-			char replace_with;
+			word_type word;
+			std::memcpy(&word, begin, sizeof(word_type) );
 
-			// \\ cannot be at end of string - terminating " would
-			// have been escaped
-			switch(src[pos + 1])
-			{
-			case 'n':
-				replace_with = '\n';
-				break;
-			case '\\':
-				replace_with = '\\';
+			if(word_has_byte(word, '\n') | word_has_byte(word, '\t') |
+			   word_has_byte(word, '\\') | word_has_byte(word, '\"'))
 				break;
-			case 't':
-				replace_with = '\t';
-				break;
-			case '\"':
-				replace_with = '\"';
-				break;
-			default:
-				obby::format_string str(
-					_("Unexpected escape sequence: \\%0%")
-				);
-
-				str << src[pos + 1];
-				throw error(str.str(), src_line);
-			}
 
-			src.replace(pos, 2, 1, replace_with);
-			++ pos;
+			begin += sizeof(word_type);
 		}
+
+		for(; begin != end; ++ begin)
+			if(is_special(*begin) )
+				break;
+
+		return begin;
 	}
 
 	void tokenise_identifier(
@@ -289,7 +268,6 @@ namespace
 	void detokenise(const token_list& list, std::string& target)
 	{
 		bool line_begin = true;
-		std::string escaped_string;
 
 		for(token_list::iterator iter = list.begin();
 		    iter != list.end();
@@ -298,16 +276,18 @@ namespace
 			switch(iter->get_type() )
 			{
 			case token::TYPE_INDENTATION:
-				target.append("\n" + iter->get_text() );
+				target += '\n';
+				target.append(iter->get_text() );
 				line_begin = true;
 				break;
 			case token::TYPE_STRING:
-				escaped_string = iter->get_text();
-				escape(escaped_string);
-
-				target.append("\"");
-				target.append(escaped_string);
-				target.append("\"");
+				target += '\"';
+				escape(
+					iter->get_text().data(),
+					iter->get_text().size(),
+					target
+				);
+				target += '\"';
 
 				line_begin = false;
 				break;
@@ -325,6 +305,87 @@ namespace
 	}
 }
 
+void obby::serialise::escape(
+	const char* src,
+	std::size_t size,
+	std::string& target
+)
+{
+	const char* end = src + size;
+
+	target.reserve(target.size() + size);
+	for(;;)
+	{
+		const char* special = find_special(src, end);
+		target.append(src, special);
+		if(special == end) break;
+
+		target += '\\';
+		switch(*special)
+		{
+		case '\n':
+			target += 'n';
+			break;
+		case '\t':
+			target += 't';
+			break;
+		default:
+			target += *special;
+			break;
+		}
+
+		src = special + 1;
+	}
+}
+
+void obby::serialise::unescape(
+	std::string& src,
+	unsigned int src_line
+)
+{
+	std::string::size_type pos = src.find('\\');
+	if(pos == std::string::npos) return;
+
+	std::string::iterator out = src.begin() + pos;
+	while(pos != std::string::npos)
+	{
+		// \\ cannot be at end of string - terminating " would
+		// have been escaped
+		switch(src[pos + 1])
+		{
+		case 'n':
+			*out = '\n';
+			break;
+		case '\\':
+			*out = '\\';
+			break;
+		case 't':
+			*out = '\t';
+			break;
+		case '\"':
+			*out = '\"';
+			break;
+		default:
+			format_string str(
+				_("Unexpected escape sequence: \\%0%")
+			);
+
+			str << src[pos + 1];
+			throw error(str.str(), src_line);
+		}
+
+		// Move text up to the next escape sequence
+		std::string::size_type next = src.find('\\', pos + 2);
+		std::string::iterator span_end = (next == std::string::npos) ?
+			src.end() : src.begin() + next;
+
+		out = std::copy(src.begin() + pos + 2, span_end, out + 1);
+		pos = next;
+	}
+
+	src.erase(out, src.end() );
+}
+
 obby::serialise::token::token(
 	type type,
 	const std::string& text,
@@ -0,0 +1,261 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdexcept>
+#include "common.hpp"
+#include "format_string.hpp"
+#include "serialise/token.hpp"
+#include "serialise/object.hpp"
+#include "serialise/binary.hpp"
+#include "serialise/writer.hpp"
+
+namespace
+{
+	// Output is written to the stream in blocks of this size
+	const std::string::size_type BUFFER_SIZE = 64 * 1024;
+}
+
+obby::serialise::writer::writer(
+	std::ostream& stream,
+	const std::string& type,
+	format_type format
+) :
+	m_stream(stream), m_format(format), m_offset(0), m_depth(0),
+	m_has_children(false)
+{
+	write_header(type);
+}
+
+obby::serialise::writer::writer(
+	const std::string& file,
+	const std::string& type,
+	format_type format
+) :
+	m_file(file.c_str(), format == FORMAT_BINARY ?
+		std::ios::out | std::ios::binary : std::ios::out),
+	m_stream(m_file), m_format(format), m_offset(0), m_depth(0),
+	m_has_children(false)
+{
+	if(!m_file)
+	{
+		obby::format_string str(
+			_("Could not open file '%0%' for writing")
+		);
+
+		str << file;
+		throw std::runtime_error(str.str() );
+	}
+
+	write_header(type);
+}
+
+obby::serialise::writer::~writer()
+{
+	// Do not throw from the destructor, flush() reports write errors
+	if(m_stream)
+	{
+		m_stream.write(m_buffer.data(), m_buffer.size() );
+		m_stream.flush();
+	}
+}
+
+void obby::serialise::writer::begin_object(
+	const std::string& name
+)
+{
+	if(m_format == FORMAT_BINARY)
+	{
+		// Remember where the root's children begin
+		if(m_depth == 1)
+			m_index.push_back(m_offset + m_buffer.size() );
+
+		m_buffer += static_cast<char>(binary::TAG_OBJECT_BEGIN);
+		write_string(name.data(), name.size() );
+	}
+	else
+	{
+		m_buffer += '\n';
+		m_buffer.append(m_depth, ' ');
+		m_buffer += name;
+	}
+
+	++ m_depth;
+	m_has_children = false;
+}
+
+void obby::serialise::writer::end_object()
+{
+	if(m_depth == 0)
+	{
+		throw std::logic_error(
+			"obby::serialise::writer::end_object:\n"
+			"No object to end"
+		);
+	}
+
+	-- m_depth;
+
+	if(m_format == FORMAT_BINARY)
+	{
+		m_buffer += static_cast<char>(binary::TAG_OBJECT_END);
+		if(m_depth == 0) write_index();
+	}
+
+	// The parent has at least this child
+	m_has_children = true;
+	flush_buffer();
+}
+
+void obby::serialise::writer::add_attribute(
+	const std::string& name,
+	const std::string& value
+)
+{
+	add_attribute(name, value.data(), value.size() );
+}
+
+void obby::serialise::writer::add_attribute(
+	const std::string& name,
+	const char* value,
+	std::size_t size
+)
+{
+	if(m_depth == 0 || m_has_children)
+	{
+		throw std::logic_error(
+			"obby::serialise::writer::add_attribute:\n"
+			"Attributes must precede child objects"
+		);
+	}
+
+	if(m_format == FORMAT_BINARY)
+	{
+		m_buffer += static_cast<char>(binary::TAG_ATTRIBUTE);
+		write_string(name.data(), name.size() );
+		write_string(value, size);
+		return;
+	}
+
+	m_buffer += ' ';
+	m_buffer += name;
+	m_buffer += "=\"";
+	escape(value, size, m_buffer);
+	m_buffer += '\"';
+}
+
+void obby::serialise::writer::add_object(
+	const object& obj
+)
+{
+	begin_object(obj.get_name() );
+
+	for(object::attribute_iterator iter = obj.attributes_begin();
+	    iter != obj.attributes_end();
+	    ++ iter)
+	{
+		add_attribute(iter->get_name(), iter->get_value() );
+	}
+
+	for(object::child_iterator iter = obj.children_begin();
+	    iter != obj.children_end();
+	    ++ iter)
+	{
+		add_object(*iter);
+	}
+
+	end_object();
+}
+
+void obby::serialise::writer::flush()
+{
+	write_buffer();
+	m_stream.flush();
+
+	if(!m_stream)
+		throw std::runtime_error(_("Could not write serialised data") );
+}
+
+void obby::serialise::writer::flush_buffer()
+{
+	if(m_buffer.size() < BUFFER_SIZE) return;
+	write_buffer();
+}
+
+void obby::serialise::writer::write_buffer()
+{
+	m_stream.write(m_buffer.data(), m_buffer.size() );
+	m_offset += m_buffer.size();
+	m_buffer.clear();
+
+	if(!m_stream)
+		throw std::runtime_error(_("Could not write serialised data") );
+}
+
+void obby::serialise::writer::write_header(const std::string& type)
+{
+	m_buffer.reserve(BUFFER_SIZE);
+
+	if(m_format == FORMAT_BINARY)
+	{
+		m_buffer.append(binary::MAGIC, binary::MAGIC_SIZE);
+		write_size(binary::VERSION);
+		write_string(type.data(), type.size() );
+	}
+	else
+	{
+		m_buffer += '!';
+		m_buffer += type;
+	}
+}
+
+void obby::serialise::writer::write_index()
+{
+	std::size_t index_pos = m_offset + m_buffer.size();
+
+	m_buffer += static_cast<char>(binary::TAG_INDEX);
+	write_size(m_index.size() );
+
+	for(std::vector<std::size_t>::size_type i = 0; i < m_index.size(); ++ i)
+		write_size(m_index[i]);
+
+	write_size(index_pos);
+	m_index.clear();
+}
+
+void obby::serialise::writer::write_size(std::size_t size)
+{
+	// Sizes and offsets are stored with 32 bit
+	if(size > 0xffffffffUL)
+	{
+		throw std::runtime_error(
+			_("Session is too large for the binary format")
+		);
+	}
+
+	m_buffer += static_cast<char>(size & 0xff);
+	m_buffer += static_cast<char>( (size >> 8) & 0xff);
+	m_buffer += static_cast<char>( (size >> 16) & 0xff);
+	m_buffer += static_cast<char>( (size >> 24) & 0xff);
+}
+
+void obby::serialise::writer::write_string(const char* data,
+                                           std::size_t size)
+{
+	write_size(size);
+	m_buffer.append(data, size);
+}
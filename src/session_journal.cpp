@@ -0,0 +1,265 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <net6/serialise.hpp>
+#include "session_journal.hpp"
+
+namespace
+{
+	std::string to_string(unsigned long value)
+	{
+		return ::serialise::default_context_to<unsigned long>().
+			to_string(value);
+	}
+
+	std::string to_string(unsigned int value)
+	{
+		return ::serialise::default_context_to<unsigned int>().
+			to_string(value);
+	}
+}
+
+obby::session_journal::session_journal():
+	m_session_format(serialise::writer::FORMAT_TEXT), m_session_size(0),
+	m_generation(0), m_compaction(NULL), m_compaction_offset(0)
+{
+}
+
+void obby::session_journal::load(const std::string& session,
+                                 unsigned long generation)
+{
+	journal::entry_list entries;
+	journal::read(session + ".journal", entries);
+
+	m_generation = 0;
+	if(entries.empty() || entries.front().size() != 2 ||
+	   entries.front()[0] != "journal")
+		return;
+
+	// The changes that are not part of the session file follow the
+	// header or the marker entry that carries its generation. If there
+	// is none, they are contained in the session file already.
+	typedef ::serialise::default_context_from<unsigned long> context;
+	journal::entry_list::iterator begin = entries.end();
+
+	for(journal::entry_list::iterator iter = entries.begin();
+	    iter != entries.end();
+	    ++ iter)
+	{
+		if(iter->size() != 2 ||
+		   ( (*iter)[0] != "journal" && (*iter)[0] != "snapshot") )
+			continue;
+
+		unsigned long entry_generation =
+			context().from_string( (*iter)[1]);
+
+		if(entry_generation > m_generation)
+			m_generation = entry_generation;
+		if(generation != 0 && entry_generation == generation)
+			begin = iter;
+	}
+
+	if(begin == entries.end() ) return;
+
+	for(++ begin; begin != entries.end(); ++ begin)
+	{
+		if(begin->size() == 2 && (*begin)[0] == "snapshot")
+			continue;
+
+		m_entries.push_back(*begin);
+	}
+}
+
+obby::journal::entry_list& obby::session_journal::get_entries()
+{
+	return m_entries;
+}
+
+void obby::session_journal::open(const std::string& session,
+                                 serialise::writer::format_type format,
+                                 unsigned long generation)
+{
+	m_journal.reset(new journal(session + ".journal") );
+
+	m_session_file = session;
+	m_session_format = format;
+	m_generation = std::max(m_generation, generation);
+}
+
+void obby::session_journal::close()
+{
+	m_journal.reset(NULL);
+	m_entries.clear();
+}
+
+bool obby::session_journal::is_open() const
+{
+	return m_journal.get() != NULL;
+}
+
+const std::string& obby::session_journal::get_session_file() const
+{
+	return m_session_file;
+}
+
+obby::serialise::writer::format_type
+obby::session_journal::get_session_format() const
+{
+	return m_session_format;
+}
+
+void obby::session_journal::commit()
+{
+	if(m_journal.get() != NULL)
+		m_journal->commit();
+}
+
+bool obby::session_journal::needs_compaction() const
+{
+	return m_journal.get() != NULL &&
+		m_journal->get_size() > std::max(m_session_size, 0x10000ul);
+}
+
+unsigned long obby::session_journal::compaction_begin()
+{
+	if(m_journal.get() == NULL || m_compaction != NULL) return 0;
+
+	// Changes journaled after this entry are not part of the snapshot.
+	// Until the snapshot replaces the session file, the journal
+	// remains valid for the old one.
+	journal::entry marker;
+	marker.push_back("snapshot");
+	marker.push_back(to_string(++ m_generation) );
+
+	m_journal->append(marker);
+	m_journal->commit();
+	m_compaction_offset = m_journal->get_size();
+
+	return m_generation;
+}
+
+void obby::session_journal::compaction_start(snapshot& snap)
+{
+	m_compaction = &snap;
+}
+
+obby::snapshot* obby::session_journal::get_compaction() const
+{
+	return m_compaction;
+}
+
+void obby::session_journal::snapshot_done(const snapshot& snap)
+{
+	if(&snap != m_compaction) return;
+	m_compaction = NULL;
+
+	// Changes before the marker entry are part of the new session
+	// file now.
+	if(snap.get_error().empty() && m_journal.get() != NULL)
+	{
+		m_session_size = snap.get_size();
+
+		journal::entry header;
+		header.push_back("journal");
+		header.push_back(to_string(m_generation) );
+
+		m_journal->truncate(m_compaction_offset, header);
+	}
+}
+
+void obby::session_journal::append_user(const user& user)
+{
+	journal::entry entry;
+	entry.push_back("user");
+	entry.push_back(to_string(user.get_id() ) );
+	entry.push_back(user.get_name() );
+	entry.push_back(
+		::serialise::default_context_to<colour>().to_string(
+			user.get_colour()
+		)
+	);
+
+	m_journal->append(entry);
+}
+
+void obby::session_journal::append_colour(const user& user)
+{
+	journal::entry entry;
+	entry.push_back("colour");
+	entry.push_back(to_string(user.get_id() ) );
+	entry.push_back(
+		::serialise::default_context_to<colour>().to_string(
+			user.get_colour()
+		)
+	);
+
+	m_journal->append(entry);
+}
+
+void obby::session_journal::append_document(const std::string& data)
+{
+	journal::entry entry;
+	entry.push_back("document");
+	entry.push_back(data);
+
+	m_journal->append(entry);
+}
+
+void obby::session_journal::append_remove(unsigned int owner_id,
+                                          unsigned int id)
+{
+	journal::entry entry;
+	entry.push_back("remove");
+	entry.push_back(to_string(owner_id) );
+	entry.push_back(to_string(id) );
+
+	m_journal->append(entry);
+}
+
+void obby::session_journal::append_rename(unsigned int owner_id,
+                                          unsigned int id,
+                                          const std::string& title,
+                                          unsigned int suffix)
+{
+	journal::entry entry;
+	entry.push_back("rename");
+	entry.push_back(to_string(owner_id) );
+	entry.push_back(to_string(id) );
+	entry.push_back(title);
+	entry.push_back(to_string(suffix) );
+
+	m_journal->append(entry);
+}
+
+void obby::session_journal::append_operation(unsigned int owner_id,
+                                             unsigned int id,
+                                             const user* author,
+                                             const net6::packet& pack)
+{
+	journal::entry entry;
+	entry.push_back("op");
+	entry.push_back(to_string(owner_id) );
+	entry.push_back(to_string(id) );
+	entry.push_back(to_string(author == NULL ? 0u : author->get_id() ) );
+
+	for(unsigned int i = 0; i < pack.get_param_count(); ++ i)
+		entry.push_back(pack.get_param(i).serialised() );
+
+	m_journal->append(entry);
+}
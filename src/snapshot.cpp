@@ -0,0 +1,219 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "common.hpp"
+#include "format_string.hpp"
+#include "serialise/reader.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+
+struct obby::snapshot::thread_data
+{
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+	mutable pthread_mutex_t mutex;
+	bool joined;
+#endif
+	bool done;
+};
+
+namespace
+{
+	void convert(obby::serialise::reader& src,
+	             obby::serialise::writer& dest)
+	{
+		for(;;)
+		{
+			switch(src.read() )
+			{
+			case obby::serialise::reader::OBJECT_BEGIN:
+				dest.begin_object(src.get_name() );
+				break;
+			case obby::serialise::reader::ATTRIBUTE:
+				dest.add_attribute(
+					src.get_name(),
+					src.get_value_data(),
+					src.get_value_size()
+				);
+				break;
+			case obby::serialise::reader::OBJECT_END:
+				dest.end_object();
+				break;
+			case obby::serialise::reader::END_OF_INPUT:
+				return;
+			}
+		}
+	}
+
+	void throw_write_error(const std::string& file)
+	{
+		obby::format_string str(obby::_(
+			"Could not open file '%0%' for writing"
+		) );
+
+		str << file;
+		throw std::runtime_error(str.str() );
+	}
+}
+
+obby::snapshot::snapshot(const std::string& file,
+                         serialise::writer::format_type format,
+                         std::string& data):
+	m_file(file), m_format(format), m_size(0),
+	m_thread(new thread_data)
+{
+	m_data.swap(data);
+	m_thread->done = false;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&m_thread->mutex, NULL);
+	m_thread->joined = false;
+
+	if(pthread_create(&m_thread->thread, NULL, &thread_func, this) == 0)
+		return;
+
+	// Write it right away if no thread could be created
+	m_thread->joined = true;
+#endif
+
+	run();
+}
+
+obby::snapshot::~snapshot()
+{
+	wait();
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&m_thread->mutex);
+#endif
+	delete m_thread;
+}
+
+const std::string& obby::snapshot::get_file() const
+{
+	return m_file;
+}
+
+bool obby::snapshot::is_done() const
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&m_thread->mutex);
+	bool done = m_thread->done;
+	pthread_mutex_unlock(&m_thread->mutex);
+	return done;
+#else
+	return m_thread->done;
+#endif
+}
+
+void obby::snapshot::wait()
+{
+#ifdef HAVE_PTHREAD
+	if(m_thread->joined) return;
+
+	pthread_join(m_thread->thread, NULL);
+	m_thread->joined = true;
+#endif
+}
+
+const std::string& obby::snapshot::get_error() const
+{
+	return m_error;
+}
+
+unsigned long obby::snapshot::get_size() const
+{
+	return m_size;
+}
+
+void* obby::snapshot::thread_func(void* data)
+{
+	static_cast<snapshot*>(data)->run();
+	return NULL;
+}
+
+void obby::snapshot::run()
+{
+	try
+	{
+		write();
+	}
+	catch(std::exception& e)
+	{
+		m_error = e.what();
+	}
+
+	// Release the memory before anyone else waits for it
+	std::string().swap(m_data);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&m_thread->mutex);
+	m_thread->done = true;
+	pthread_mutex_unlock(&m_thread->mutex);
+#else
+	m_thread->done = true;
+#endif
+}
+
+void obby::snapshot::write()
+{
+	std::string temp = m_file + ".new";
+
+	{
+		std::ofstream stream(
+			temp.c_str(),
+			std::ios_base::out | std::ios_base::binary
+		);
+
+		if(!stream) throw_write_error(temp);
+
+		if(m_format == serialise::writer::FORMAT_BINARY)
+		{
+			// Already in the requested format
+			stream.write(m_data.data(), m_data.size() );
+		}
+		else
+		{
+			serialise::reader src(m_data.data(), m_data.size() );
+			serialise::writer dest(stream, src.get_type(), m_format);
+
+			convert(src, dest);
+			dest.flush();
+		}
+
+		stream.flush();
+		if(!stream) throw_write_error(temp);
+
+		m_size = stream.tellp();
+	}
+
+	journal::sync(temp);
+
+	if(std::rename(temp.c_str(), m_file.c_str()) != 0)
+		throw_write_error(m_file);
+}
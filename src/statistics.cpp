@@ -0,0 +1,282 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#include "statistics.hpp"
+
+obby::histogram::histogram():
+	m_count(0), m_max(0), m_sum(0)
+{
+	for(unsigned int i = 0; i < BUCKET_COUNT; ++ i)
+		m_buckets[i] = 0;
+}
+
+void obby::histogram::add(unsigned long value)
+{
+	unsigned int bucket = 0;
+	for(unsigned long rest = value; rest > 0; rest >>= 1)
+		++ bucket;
+
+	if(bucket >= BUCKET_COUNT)
+		bucket = BUCKET_COUNT - 1;
+
+	++ m_buckets[bucket];
+	++ m_count;
+	m_sum += value;
+
+	if(value > m_max)
+		m_max = value;
+}
+
+void obby::histogram::merge(const histogram& other)
+{
+	for(unsigned int i = 0; i < BUCKET_COUNT; ++ i)
+		m_buckets[i] += other.m_buckets[i];
+
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+
+	if(other.m_max > m_max)
+		m_max = other.m_max;
+}
+
+unsigned long obby::histogram::get_count() const
+{
+	return m_count;
+}
+
+unsigned long obby::histogram::get_max() const
+{
+	return m_max;
+}
+
+double obby::histogram::get_mean() const
+{
+	if(m_count == 0) return 0;
+	return m_sum / m_count;
+}
+
+unsigned long obby::histogram::get_percentile(unsigned int percent) const
+{
+	// Number of values that lie below the percentile
+	double wanted = static_cast<double>(m_count) * percent / 100;
+
+	unsigned long seen = 0;
+	for(unsigned int i = 0; i < BUCKET_COUNT; ++ i)
+	{
+		seen += m_buckets[i];
+		if(seen > 0 && seen >= wanted)
+		{
+			// Upper bound of the bucket, but not above the maximum
+			unsigned long bound = (i == 0) ? 0 : (2ul << (i - 1)) - 1;
+			return bound < m_max ? bound : m_max;
+		}
+	}
+
+	return m_max;
+}
+
+unsigned long obby::histogram::get_bucket(unsigned int n) const
+{
+	return m_buckets[n];
+}
+
+obby::traffic::traffic():
+	packets_in(0), bytes_in(0), packets_out(0), bytes_out(0)
+{
+}
+
+obby::statistics::statistics():
+	m_start_time(std::time(NULL) )
+{
+}
+
+unsigned long obby::statistics::clock()
+{
+#ifdef WIN32
+	return GetTickCount() * 1000ul;
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ul + tv.tv_usec;
+#endif
+}
+
+std::string obby::statistics::get_command(const net6::packet& pack)
+{
+	if(pack.get_command() != "obby_document" || pack.get_param_count() < 2)
+		return pack.get_command();
+
+	// The document command is the second parameter
+	return pack.get_command() + ":" + pack.get_param(1).serialised();
+}
+
+std::size_t obby::statistics::get_size(const net6::packet& pack)
+{
+	// Command and parameters are separated by colons, the packet is
+	// terminated by a newline.
+	std::size_t size = pack.get_command().size() + 1;
+	for(unsigned int i = 0; i < pack.get_param_count(); ++ i)
+		size += pack.get_param(i).serialised().size() + 1;
+
+	return size;
+}
+
+void obby::statistics::packet_in(const net6::packet& pack, const user& from)
+{
+	std::size_t size = get_size(pack);
+
+	traffic& command = m_commands[get_command(pack)];
+	++ command.packets_in;
+	command.bytes_in += size;
+
+	traffic& client = m_clients[&from];
+	++ client.packets_in;
+	client.bytes_in += size;
+}
+
+void obby::statistics::packet_out(const net6::packet& pack,
+                                  unsigned int recipients)
+{
+	traffic& command = m_commands[get_command(pack)];
+	command.packets_out += recipients;
+	command.bytes_out += get_size(pack) * recipients;
+}
+
+void obby::statistics::sync(unsigned long duration)
+{
+	m_sync_time.add(duration);
+}
+
+void obby::statistics::send_queue(std::size_t depth)
+{
+	m_send_queue.add(depth);
+}
+
+void obby::statistics::clear()
+{
+	m_start_time = std::time(NULL);
+	m_commands.clear();
+	m_clients.clear();
+	m_sync_time = histogram();
+	m_send_queue = histogram();
+}
+
+std::time_t obby::statistics::get_start_time() const
+{
+	return m_start_time;
+}
+
+const obby::statistics::traffic_map& obby::statistics::get_commands() const
+{
+	return m_commands;
+}
+
+const obby::statistics::client_map& obby::statistics::get_clients() const
+{
+	return m_clients;
+}
+
+const obby::histogram& obby::statistics::get_sync_time() const
+{
+	return m_sync_time;
+}
+
+const obby::histogram& obby::statistics::get_send_queue() const
+{
+	return m_send_queue;
+}
+
+void obby::statistics::report(std::ostream& out) const
+{
+	// This is a diagnostic dump, it is not translated.
+	out << "Statistics of the last "
+	    << std::time(NULL) - m_start_time << " seconds\n";
+
+	for(traffic_map::const_iterator iter = m_commands.begin();
+	    iter != m_commands.end();
+	    ++ iter)
+	{
+		out << iter->first << ": "
+		    << iter->second.packets_in << " in ("
+		    << iter->second.bytes_in << " bytes), "
+		    << iter->second.packets_out << " out ("
+		    << iter->second.bytes_out << " bytes)\n";
+	}
+
+	out << "synchronisations: " << m_sync_time.get_count() << ", "
+	    << m_sync_time.get_mean() << " us mean, "
+	    << m_sync_time.get_percentile(99) << " us 99th percentile\n";
+
+	out << "outgoing queues: " << m_send_queue.get_count() << " samples, "
+	    << m_send_queue.get_mean() << " bytes mean, "
+	    << m_send_queue.get_percentile(99) << " bytes 99th percentile, "
+	    << m_send_queue.get_max() << " bytes max\n";
+}
+
+obby::document_statistics::document_statistics():
+	m_operations(0), m_first_operation(0)
+{
+}
+
+void obby::document_statistics::operation()
+{
+	if(m_operations == 0)
+		m_first_operation = std::time(NULL);
+
+	++ m_operations;
+}
+
+void obby::document_statistics::record(unsigned long duration)
+{
+	m_record_time.add(duration);
+}
+
+unsigned long obby::document_statistics::get_operation_count() const
+{
+	return m_operations;
+}
+
+double obby::document_statistics::get_operation_rate() const
+{
+	if(m_operations == 0) return 0;
+
+	// Do not report enormous rates for a document that has just been
+	// changed for the first time.
+	double elapsed = std::difftime(std::time(NULL), m_first_operation);
+	if(elapsed < 1) elapsed = 1;
+
+	return m_operations / elapsed;
+}
+
+const obby::histogram& obby::document_statistics::get_record_time() const
+{
+	return m_record_time;
+}
+
+void obby::document_statistics::report(std::ostream& out) const
+{
+	out << m_operations << " operations ("
+	    << get_operation_rate() << "/s), "
+	    << m_record_time.get_percentile(99) << " us 99th percentile";
+}
@@ -0,0 +1,175 @@
+/* libobby - Network text editing library
+ * Copyright (C) 2005 0x539 dev group
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "common.hpp"
+#include "sync_history.hpp"
+
+namespace
+{
+	/** Removals that are remembered at most.
+	 */
+	const std::size_t max_removals = 1024;
+}
+
+obby::sync_history::sync_history():
+	m_version(0), m_floor(0)
+{
+}
+
+void obby::sync_history::reset()
+{
+	m_id = random_token();
+	m_version = 0;
+	m_floor = 0;
+
+	m_users.clear();
+	m_documents.clear();
+	m_removals.clear();
+	m_bases.clear();
+}
+
+const std::string& obby::sync_history::get_id() const
+{
+	return m_id;
+}
+
+unsigned long obby::sync_history::get_version() const
+{
+	return m_version;
+}
+
+unsigned long obby::sync_history::get_base(const std::string& id,
+                                           unsigned long version) const
+{
+	if(id != m_id || version < m_floor || version > m_version)
+		return 0;
+
+	return version;
+}
+
+void obby::sync_history::touch_user(unsigned int id)
+{
+	m_users[id] = ++ m_version;
+}
+
+void obby::sync_history::touch_document(const document_key& key)
+{
+	m_documents[key] = ++ m_version;
+}
+
+void obby::sync_history::insert_document(const document_key& key)
+{
+	m_removals.erase(key);
+	touch_document(key);
+}
+
+void obby::sync_history::remove_document(const document_key& key)
+{
+	m_documents.erase(key);
+	m_removals[key] = ++ m_version;
+
+	// Forget the oldest removal when there are too many. Clients
+	// that know an earlier version get the complete lists.
+	if(m_removals.size() > max_removals)
+	{
+		document_map::iterator oldest = m_removals.begin();
+
+		for(document_map::iterator iter = m_removals.begin();
+		    iter != m_removals.end();
+		    ++ iter)
+		{
+			if(iter->second < oldest->second) oldest = iter;
+		}
+
+		m_floor = oldest->second;
+		m_removals.erase(oldest);
+	}
+}
+
+bool obby::sync_history::is_user_changed(unsigned int id,
+                                         unsigned long base) const
+{
+	if(base == 0) return true;
+
+	user_map::const_iterator iter = m_users.find(id);
+	return iter != m_users.end() && iter->second > base;
+}
+
+bool obby::sync_history::is_document_changed(const document_key& key,
+                                             unsigned long base) const
+{
+	if(base == 0) return true;
+
+	document_map::const_iterator iter = m_documents.find(key);
+	return iter != m_documents.end() && iter->second > base;
+}
+
+unsigned int obby::sync_history::count(unsigned long base) const
+{
+	unsigned int count = 0;
+	for(user_map::const_iterator iter = m_users.begin();
+	    iter != m_users.end();
+	    ++ iter)
+	{
+		if(iter->second > base) ++ count;
+	}
+
+	for(document_map::const_iterator iter = m_documents.begin();
+	    iter != m_documents.end();
+	    ++ iter)
+	{
+		if(iter->second > base) ++ count;
+	}
+
+	for(document_map::const_iterator iter = m_removals.begin();
+	    iter != m_removals.end();
+	    ++ iter)
+	{
+		if(iter->second > base) ++ count;
+	}
+
+	return count;
+}
+
+const obby::sync_history::document_map&
+obby::sync_history::get_removals() const
+{
+	return m_removals;
+}
+
+void obby::sync_history::set_client_base(const net6::user& user6,
+                                         unsigned long base)
+{
+	m_bases[&user6] = base;
+}
+
+bool obby::sync_history::take_client_base(const net6::user& user6,
+                                          unsigned long& base)
+{
+	base_map::iterator iter = m_bases.find(&user6);
+	if(iter == m_bases.end() ) return false;
+
+	base = iter->second;
+	m_bases.erase(iter);
+	return true;
+}
+
+void obby::sync_history::remove_client(const net6::user& user6)
+{
+	m_bases.erase(&user6);
+}
@@ -68,6 +68,12 @@ void obby::user_table::deserialise(const serialise::object& obj)
 
 			// Insert into user map
 			m_user_map[new_user->get_id()] = new_user;
+			m_name_map.insert(
+				name_map::value_type(
+					new_user->get_name(),
+					new_user
+				)
+			);
 		}
 		else
 		{
@@ -87,6 +93,9 @@ void obby::user_table::clear()
 		delete i->second;
 
 	m_user_map.clear();
+	m_name_map.clear();
+	m_net6_map.clear();
+	m_connected_map.clear();
 }
 
 const obby::user* obby::user_table::add_user(unsigned int id,
@@ -104,6 +113,7 @@ const obby::user* obby::user_table::add_user(unsigned int id,
 
 		// Assign new net6::user to existing obby::user.
 		existing_user->assign_net6(user6, colour);
+		index_connect(*existing_user);
 		return existing_user;
 	}
 	else
@@ -117,6 +127,8 @@ const obby::user* obby::user_table::add_user(unsigned int id,
 
 		// Insert user into user list
 		m_user_map[id] = new_user;
+		m_name_map[new_user->get_name()] = new_user;
+		index_connect(*new_user);
 
 		return new_user;
 	}
@@ -140,6 +152,7 @@ const obby::user* obby::user_table::add_user(unsigned int id,
 
 	user* new_user = new user(id, name, colour);
 	m_user_map[id] = new_user;
+	m_name_map[name] = new_user;
 
 	return new_user;
 }
@@ -148,7 +161,9 @@ void obby::user_table::remove_user(const user& user_to_remove)
 {
 	// Release underlaying net6::user object, this disables the connected
 	// flag, too. Keep the user in the list to recognize him if he rejoins.
-	const_cast<user&>(user_to_remove).release_net6();
+	user& cur_user = const_cast<user&>(user_to_remove);
+	index_disconnect(cur_user);
+	cur_user.release_net6();
 }
 
 void obby::user_table::set_user_password(const user& user,
@@ -165,12 +180,9 @@ void obby::user_table::set_user_colour(const user& user,
 
 unsigned int obby::user_table::find_free_id() const
 {
-	unsigned int free_id = 1;
-	for(base_iterator i = m_user_map.begin(); i != m_user_map.end(); ++ i)
-		if( i->second->get_id() >= free_id)
-			free_id = i->second->get_id() + 1;
-
-	return free_id;
+	// The map is sorted by ID, so the highest one is the last one
+	if(m_user_map.empty() ) return 1;
+	return m_user_map.rbegin()->first + 1;
 }
 
 obby::user_table::iterator obby::user_table::begin(user::flags inc_flags,
@@ -201,36 +213,24 @@ const obby::user* obby::user_table::find(const net6::user& user,
                                          user::flags inc_flags,
                                          user::flags exc_flags) const
 {
-	for(base_iterator i = m_user_map.begin(); i != m_user_map.end(); ++ i)
-	{
-		if(~i->second->get_flags() & user::flags::CONNECTED) continue;
-		if( &i->second->get_net6() != &user) continue;
+	net6_map::const_iterator iter = m_net6_map.find(&user);
+	if(iter == m_net6_map.end() ) return NULL;
 
-		user::flags flags = i->second->get_flags();
-		if(!iterator::check_flags(flags, inc_flags, exc_flags) )
-			continue;
-
-		return i->second;
-	}
-
-	return NULL;
+	user::flags flags = iter->second->get_flags();
+	if(!iterator::check_flags(flags, inc_flags, exc_flags) ) return NULL;
+	return iter->second;
 }
 
 const obby::user* obby::user_table::find(const std::string& name,
                                          user::flags inc_flags,
                                          user::flags exc_flags) const
 {
-	for(base_iterator i = m_user_map.begin(); i != m_user_map.end(); ++ i)
-	{
-		if(i->second->get_name() != name) continue;
+	name_map::const_iterator iter = m_name_map.find(name);
+	if(iter == m_name_map.end() ) return NULL;
 
-		user::flags flags = i->second->get_flags();
-		if(!iterator::check_flags(flags, inc_flags, exc_flags) )
-			continue;
-		return i->second;
-	}
-
-	return NULL;
+	user::flags flags = iter->second->get_flags();
+	if(!iterator::check_flags(flags, inc_flags, exc_flags) ) return NULL;
+	return iter->second;
 }
 
 obby::user_table::size_type obby::user_table::count(user::flags inc_flags,
@@ -240,6 +240,15 @@ obby::user_table::size_type obby::user_table::count(user::flags inc_flags,
 	if(inc_flags == user::flags::NONE && exc_flags == user::flags::NONE)
 		return m_user_map.size();
 
+	// Connected users are indexed separately
+	if(inc_flags == user::flags::CONNECTED &&
+	   exc_flags == user::flags::NONE)
+		return m_connected_map.size();
+
+	if(inc_flags == user::flags::NONE &&
+	   exc_flags == user::flags::CONNECTED)
+		return m_user_map.size() - m_connected_map.size();
+
 	size_type c = 0;
 	for(iterator iter = begin(inc_flags, exc_flags);
 	    iter != end(inc_flags, exc_flags);
@@ -268,13 +277,22 @@ obby::user& obby::user_table::lookup(unsigned int id)
 
 obby::user* obby::user_table::find_int(const std::string& name)
 {
-	for(base_iterator iter = m_user_map.begin();
-	    iter != m_user_map.end();
-	    ++ iter)
-	{
-		if(iter->second->get_name() == name)
-			return iter->second;
-	}
+	name_map::const_iterator iter = m_name_map.find(name);
+	if(iter == m_name_map.end() ) return NULL;
+	return iter->second;
+}
+
+void obby::user_table::index_connect(user& cur_user)
+{
+	m_net6_map[&cur_user.get_net6()] = &cur_user;
+	m_connected_map[cur_user.get_id()] = &cur_user;
+}
+
+void obby::user_table::index_disconnect(user& cur_user)
+{
+	// Users that are not connected have no net6::user to look up
+	if(~cur_user.get_flags() & user::flags::CONNECTED) return;
 
-	return NULL;
+	m_net6_map.erase(&cur_user.get_net6() );
+	m_connected_map.erase(cur_user.get_id() );
 }
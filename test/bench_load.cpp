@@ -0,0 +1,1154 @@
+// End-to-end load test: runs a server_buffer and a number of simulated
+// clients in separate processes that talk to each other over loopback. The
+// clients log in, subscribe to documents, type, paste, erase and chat.
+// Reported are the time from an insertion at one client until it has been
+// applied at another one, the CPU time the server spends per operation and
+// whether all replicas of every document converged. Edits are scheduled
+// independently of how fast the server answers, so that a slow server
+// shows up as latency instead of as a lower edit rate.
+// Run with "make bench" or pass -h for the options. Requires fork().
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "config.hpp"
+#include "error.hpp"
+#include "colour.hpp"
+#include "document.hpp"
+#include "statistics.hpp"
+#include "server_buffer.hpp"
+#include "client_buffer.hpp"
+
+#ifdef HAVE_SYS_EPOLL_H
+# include "epoll_selector.hpp"
+#endif
+
+namespace
+{
+	/** Distribution of a random quantity, given as "kind:mean" on the
+	 * command line. kind is one of "fixed", "uniform" (between zero and
+	 * twice the mean) and "exp". "off" disables the event.
+	 */
+	class distribution
+	{
+	public:
+		enum kind_type {
+			OFF,
+			FIXED,
+			UNIFORM,
+			EXPONENTIAL
+		};
+
+		distribution(kind_type kind, double mean):
+			m_kind(kind), m_mean(mean) {}
+
+		distribution(const std::string& spec);
+
+		bool is_off() const { return m_kind == OFF; }
+		double sample() const;
+		std::string str() const;
+
+	private:
+		kind_type m_kind;
+		double m_mean;
+	};
+
+	distribution::distribution(const std::string& spec):
+		m_kind(OFF), m_mean(0.0)
+	{
+		if(spec == "off") return;
+
+		std::string::size_type pos = spec.find(':');
+		if(pos == std::string::npos)
+			throw std::invalid_argument("Expected kind:mean: " + spec);
+
+		const std::string kind = spec.substr(0, pos);
+		if(kind == "fixed") m_kind = FIXED;
+		else if(kind == "uniform") m_kind = UNIFORM;
+		else if(kind == "exp") m_kind = EXPONENTIAL;
+		else throw std::invalid_argument("Unknown distribution: " + kind);
+
+		m_mean = std::strtod(spec.c_str() + pos + 1, NULL);
+		if(m_mean <= 0.0)
+			throw std::invalid_argument("Mean must be positive: " + spec);
+	}
+
+	double distribution::sample() const
+	{
+		switch(m_kind)
+		{
+		case FIXED:
+			return m_mean;
+		case UNIFORM:
+			return drand48() * 2.0 * m_mean;
+		case EXPONENTIAL:
+			return -m_mean * std::log(1.0 - drand48() );
+		default:
+			return 0.0;
+		}
+	}
+
+	std::string distribution::str() const
+	{
+		static const char* const names[] = {
+			"off", "fixed", "uniform", "exp"
+		};
+
+		if(m_kind == OFF) return names[OFF];
+
+		std::ostringstream stream;
+		stream << names[m_kind] << ':' << m_mean;
+		return stream.str();
+	}
+
+	struct options
+	{
+		unsigned int port;
+		unsigned int clients;
+		unsigned int documents;
+		unsigned int subscriptions;
+		/** Time the clients edit, in seconds.
+		 */
+		double duration;
+		/** Time to wait for outstanding operations after the clients
+		 * stopped editing, in seconds.
+		 */
+		double settle;
+		/** Milliseconds between two edits of a client.
+		 */
+		distribution edit;
+		/** Number of characters inserted by a paste.
+		 */
+		distribution paste;
+		double paste_probability;
+		double erase_probability;
+		/** Milliseconds between two chat messages of a client.
+		 */
+		distribution chat;
+		/** Whether the server uses obby::epoll_selector.
+		 */
+		bool epoll;
+		/** Connections that are opened in addition to the clients but
+		 * never log in.
+		 */
+		unsigned int idle;
+		/** Bytes a client may have unacknowledged before the server
+		 * holds back packets for it, 0 for no limit.
+		 */
+		unsigned long send_limit;
+	};
+
+	/** Clients get colours from a grid in which any two differ enough
+	 * not to be rejected as similar by the server.
+	 */
+	const unsigned int max_clients = 2048;
+
+	const char* const document_prefix = "load";
+	const char* const client_prefix = "client";
+
+	std::string numbered(const char* prefix, unsigned int n)
+	{
+		std::ostringstream stream;
+		stream << prefix << n;
+		return stream.str();
+	}
+
+	unsigned int number(const char* prefix, const std::string& name)
+	{
+		return std::strtoul(name.c_str() + std::strlen(prefix), NULL, 10);
+	}
+
+	obby::colour client_colour(unsigned int index)
+	{
+		// Points of a 16x16x16 grid with even coordinate sum: Two of
+		// them differ by at least 32 in the sum of their components.
+		unsigned int x = index % 16;
+		unsigned int y = (index / 16) % 16;
+		unsigned int z = (index / 256) * 2 + (x + y) % 2;
+		return obby::colour(x * 16 + 8, y * 16 + 8, z * 16 + 8);
+	}
+
+	/** Documents client <em>client</em> subscribes to.
+	 */
+	bool is_subscriber(const options& opts,
+	                   unsigned int client,
+	                   unsigned int document)
+	{
+		unsigned int offset =
+			(document + opts.documents - client % opts.documents) %
+			opts.documents;
+		return offset < opts.subscriptions;
+	}
+
+	/** Signed difference between two points in time as returned by
+	 * obby::statistics::clock(), which may wrap around.
+	 */
+	long time_diff(unsigned long to, unsigned long from)
+	{
+		return static_cast<long>(to - from);
+	}
+
+	unsigned long cpu_time()
+	{
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+			1000000ul + usage.ru_utime.tv_usec +
+			usage.ru_stime.tv_usec;
+	}
+
+	/** FNV-1a hash to compare document replicas.
+	 */
+	unsigned long hash(const std::string& str)
+	{
+		unsigned long value = 2166136261ul;
+		for(std::string::size_type i = 0; i < str.size(); ++ i)
+		{
+			value ^= static_cast<unsigned char>(str[i]);
+			value = (value * 16777619ul) & 0xfffffffful;
+		}
+
+		return value;
+	}
+
+	std::string random_text(std::size_t length)
+	{
+		std::string text(length, ' ');
+		for(std::size_t i = 0; i < length; ++ i)
+		{
+			double r = drand48();
+			if(r < 0.02) text[i] = '\n';
+			else if(r < 0.17) text[i] = ' ';
+			else text[i] = 'a' + static_cast<char>(drand48() * 26);
+		}
+
+		return text;
+	}
+
+	void write_all(int fd, const std::string& str)
+	{
+		std::string::size_type pos = 0;
+		while(pos < str.size() )
+		{
+			ssize_t result = write(fd, str.data() + pos, str.size() - pos);
+			if(result == -1 && errno == EINTR) continue;
+			if(result <= 0)
+				throw std::runtime_error("Could not write to pipe");
+			pos += result;
+		}
+	}
+
+	/** Waits until the parent process sends a command.
+	 */
+	char read_command(int fd)
+	{
+		char command;
+		ssize_t result;
+		do { result = read(fd, &command, 1); }
+		while(result == -1 && errno == EINTR);
+
+		if(result != 1)
+			throw std::runtime_error("Parent process went away");
+		return command;
+	}
+
+	/** Returns a command of the parent process if one is available,
+	 * otherwise zero. <em>fd</em> must be non-blocking.
+	 */
+	char poll_command(int fd)
+	{
+		char command;
+		ssize_t result = read(fd, &command, 1);
+		if(result == 1) return command;
+		if(result == 0 || (errno != EAGAIN && errno != EINTR) )
+			throw std::runtime_error("Parent process went away");
+		return 0;
+	}
+
+	/** Pipe ends the parent holds for its children. Other children
+	 * must not keep them open, so that a child notices when the
+	 * parent went away.
+	 */
+	std::vector<int> parent_fds;
+
+	void set_nonblocking(int fd)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	/** Allows the process as many file descriptors as it may get, for
+	 * idle connections.
+	 */
+	void raise_fd_limit()
+	{
+		rlimit limit;
+		if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+		{
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+	}
+
+	/** Runs the server until the parent process sends 'q'. 's' marks
+	 * the start of the measurement.
+	 */
+	template<typename Buffer>
+	void serve(const options& opts, int control, int report)
+	{
+		Buffer buffer;
+		buffer.set_send_limit(opts.send_limit);
+		buffer.open(opts.port);
+
+		for(unsigned int i = 0; i < opts.documents; ++ i)
+			buffer.document_create(numbered(document_prefix, i), "UTF-8");
+
+		write_all(report, "ready\n");
+		set_nonblocking(control);
+
+		unsigned long cpu_start = cpu_time();
+		for(;;)
+		{
+			buffer.get_selector().select(100);
+
+			char command = poll_command(control);
+			if(command == 's') cpu_start = cpu_time();
+			if(command == 'q') break;
+		}
+
+		std::ostringstream stream;
+		stream << "cpu " << cpu_time() - cpu_start << '\n';
+
+		for(typename Buffer::document_iterator iter =
+			buffer.document_begin();
+		    iter != buffer.document_end();
+		    ++ iter)
+		{
+			const std::string text = iter->get_content().get_text();
+			stream << "doc " << number(document_prefix, iter->get_title())
+			       << ' ' << text.size() << ' ' << hash(text) << '\n';
+		}
+
+		write_all(report, stream.str() );
+	}
+
+	void run_server(const options& opts, int control, int report)
+	{
+		raise_fd_limit();
+
+#ifdef HAVE_SYS_EPOLL_H
+		if(opts.epoll)
+		{
+			serve<obby::basic_server_buffer<
+				obby::document,
+				obby::epoll_selector
+			> >(opts, control, report);
+			return;
+		}
+#endif
+
+		serve<obby::server_buffer>(opts, control, report);
+	}
+
+	/** Opens opts.idle connections to the server and keeps them until
+	 * the parent process sends 'q'.
+	 */
+	void run_idler(const options& opts, int control, int report)
+	{
+		raise_fd_limit();
+
+		sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(opts.port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		std::vector<int> sockets;
+		for(unsigned int i = 0; i < opts.idle; ++ i)
+		{
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			if(fd == -1 || connect(fd,
+				reinterpret_cast<sockaddr*>(&addr),
+				sizeof(addr)) == -1)
+			{
+				throw std::runtime_error(
+					"Could not open idle connection");
+			}
+
+			sockets.push_back(fd);
+		}
+
+		write_all(report, "ready\n");
+		while(read_command(control) != 'q') {}
+
+		for(std::vector<int>::size_type i = 0; i < sockets.size(); ++ i)
+			close(sockets[i]);
+	}
+
+	class simulated_client;
+
+	/** The client whose process this is.
+	 */
+	simulated_client* probe = NULL;
+
+	/** Document that tells the client about insertions made by other
+	 * users, so that it can take the time they took to arrive.
+	 */
+	class probe_document: public obby::document
+	{
+	public:
+		probe_document(const template_type& tmpl):
+			obby::document(tmpl) {}
+
+		using obby::document::insert;
+
+		void insert(obby::position pos,
+		            const std::string& str,
+		            const obby::user* author);
+	};
+
+	typedef obby::basic_client_buffer<probe_document, net6::selector>
+		probe_buffer;
+
+	class simulated_client: public sigc::trackable
+	{
+	public:
+		simulated_client(const options& opts, unsigned int index);
+
+		void run(int control, int report);
+
+		/** Called by probe_document when a remote insertion has been
+		 * applied.
+		 */
+		void on_insert(const probe_document& doc,
+		               const obby::user& author);
+
+	private:
+		typedef probe_buffer::document_info_type document_info_type;
+
+		struct subscription
+		{
+			document_info_type* info;
+			unsigned int index;
+			obby::position cursor;
+			unsigned int sent;
+		};
+
+		void on_welcome();
+		void on_login_failed(obby::login::error error);
+		void on_close();
+		void on_sync_final();
+
+		void poll(unsigned long timeout);
+		void subscribe();
+		void edit();
+
+		const options& m_opts;
+		unsigned int m_index;
+
+		probe_buffer m_buffer;
+		bool m_synced;
+
+		std::vector<subscription> m_subscriptions;
+		std::map<const probe_document*, unsigned int> m_documents;
+
+		/** Insertions received per author and document.
+		 */
+		std::map<std::pair<unsigned int, unsigned int>, unsigned int>
+			m_received;
+
+		std::ostringstream m_log;
+		unsigned long m_inserts;
+		unsigned long m_erases;
+		unsigned long m_messages;
+	};
+
+	void probe_document::insert(obby::position pos,
+	                            const std::string& str,
+	                            const obby::user* author)
+	{
+		obby::document::insert(pos, str, author);
+
+		// Insertions without author come from the initial sync
+		if(probe != NULL && author != NULL)
+			probe->on_insert(*this, *author);
+	}
+
+	simulated_client::simulated_client(const options& opts,
+	                                   unsigned int index):
+		m_opts(opts), m_index(index), m_synced(false),
+		m_inserts(0), m_erases(0), m_messages(0)
+	{
+		m_buffer.welcome_event().connect(
+			sigc::mem_fun(*this, &simulated_client::on_welcome) );
+		m_buffer.login_failed_event().connect(
+			sigc::mem_fun(*this, &simulated_client::on_login_failed) );
+		m_buffer.close_event().connect(
+			sigc::mem_fun(*this, &simulated_client::on_close) );
+		m_buffer.sync_final_event().connect(
+			sigc::mem_fun(*this, &simulated_client::on_sync_final) );
+	}
+
+	void simulated_client::on_welcome()
+	{
+		m_buffer.login(
+			numbered(client_prefix, m_index),
+			client_colour(m_index)
+		);
+	}
+
+	void simulated_client::on_login_failed(obby::login::error error)
+	{
+		throw std::runtime_error(
+			"Login failed: " + obby::login::errstring(error) );
+	}
+
+	void simulated_client::on_close()
+	{
+		throw std::runtime_error("Connection to the server lost");
+	}
+
+	void simulated_client::on_sync_final()
+	{
+		m_synced = true;
+	}
+
+	void simulated_client::poll(unsigned long timeout)
+	{
+		m_buffer.get_selector().select(timeout);
+	}
+
+	void simulated_client::subscribe()
+	{
+		for(probe_buffer::document_iterator iter =
+			m_buffer.document_begin();
+		    iter != m_buffer.document_end();
+		    ++ iter)
+		{
+			unsigned int index =
+				number(document_prefix, iter->get_title() );
+			if(!is_subscriber(m_opts, m_index, index)) continue;
+
+			document_info_type& info =
+				dynamic_cast<document_info_type&>(*iter);
+			info.subscribe();
+
+			subscription sub = { &info, index, 0, 0 };
+			m_subscriptions.push_back(sub);
+		}
+
+		for(std::vector<subscription>::size_type i = 0;
+		    i < m_subscriptions.size();
+		    ++ i)
+		{
+			while(!m_subscriptions[i].info->is_subscribed() )
+				poll(100);
+
+			m_documents[&m_subscriptions[i].info->get_content()] =
+				m_subscriptions[i].index;
+		}
+	}
+
+	void simulated_client::edit()
+	{
+		subscription& sub = m_subscriptions[
+			static_cast<std::size_t>(drand48() * m_subscriptions.size())
+		];
+
+		// Typing continues where the cursor was unless the user
+		// clicks somewhere else.
+		const obby::position size = sub.info->get_content().size();
+		if(sub.cursor > size || drand48() < 0.05)
+			sub.cursor = static_cast<obby::position>(drand48() * size);
+
+		if(sub.cursor > 0 && drand48() < m_opts.erase_probability)
+		{
+			sub.info->erase(sub.cursor - 1, 1);
+			-- sub.cursor;
+			++ m_erases;
+			return;
+		}
+
+		std::size_t length = 1;
+		if(drand48() < m_opts.paste_probability && !m_opts.paste.is_off())
+		{
+			length = std::max(
+				static_cast<std::size_t>(m_opts.paste.sample() ),
+				static_cast<std::size_t>(1)
+			);
+		}
+
+		const std::string text = random_text(length);
+		m_log << "send " << sub.index << ' ' << sub.sent ++ << ' '
+		      << obby::statistics::clock() << '\n';
+
+		sub.info->insert(sub.cursor, text);
+		sub.cursor += text.size();
+		++ m_inserts;
+	}
+
+	void simulated_client::on_insert(const probe_document& doc,
+	                                 const obby::user& author)
+	{
+		if(&author == &m_buffer.get_self() ) return;
+
+		std::map<const probe_document*, unsigned int>::const_iterator
+			iter = m_documents.find(&doc);
+		if(iter == m_documents.end() ) return;
+
+		unsigned int from = number(client_prefix, author.get_name() );
+		unsigned int& seq = m_received[std::make_pair(from, iter->second)];
+
+		m_log << "recv " << from << ' ' << iter->second << ' ' << seq ++
+		      << ' ' << obby::statistics::clock() << '\n';
+	}
+
+	void simulated_client::run(int control, int report)
+	{
+		srand48(m_index + 1);
+		probe = this;
+
+		m_buffer.connect("localhost", m_opts.port);
+		while(!m_synced) poll(100);
+
+		subscribe();
+		write_all(report, "ready\n");
+
+		while(read_command(control) != 's') ;
+		set_nonblocking(control);
+
+		const bool edits = !m_opts.edit.is_off() && !m_subscriptions.empty();
+		const bool chats = !m_opts.chat.is_off();
+
+		const unsigned long start = obby::statistics::clock();
+		const unsigned long end =
+			start + static_cast<unsigned long>(m_opts.duration * 1e6);
+
+		unsigned long next_edit =
+			start + static_cast<unsigned long>(m_opts.edit.sample() * 1e3);
+		unsigned long next_chat =
+			start + static_cast<unsigned long>(m_opts.chat.sample() * 1e3);
+
+		for(unsigned long now = start; time_diff(end, now) > 0;
+		    now = obby::statistics::clock() )
+		{
+			if(edits && time_diff(now, next_edit) >= 0)
+			{
+				edit();
+				next_edit += static_cast<unsigned long>(
+					m_opts.edit.sample() * 1e3);
+			}
+
+			if(chats && time_diff(now, next_chat) >= 0)
+			{
+				m_buffer.send_message(
+					numbered("message ", m_messages ++) );
+				next_chat += static_cast<unsigned long>(
+					m_opts.chat.sample() * 1e3);
+			}
+
+			unsigned long next = end;
+			if(edits && time_diff(next, next_edit) > 0) next = next_edit;
+			if(chats && time_diff(next, next_chat) > 0) next = next_chat;
+
+			long wait = time_diff(next, obby::statistics::clock() );
+			poll(wait > 0 ? (wait + 999) / 1000 : 0);
+		}
+
+		write_all(report, "done\n");
+
+		// Apply what the others still send until the parent is sure
+		// that everything has arrived.
+		while(poll_command(control) != 'q')
+			poll(100);
+
+		for(std::vector<subscription>::size_type i = 0;
+		    i < m_subscriptions.size();
+		    ++ i)
+		{
+			const std::string text =
+				m_subscriptions[i].info->get_content().get_text();
+			m_log << "doc " << m_subscriptions[i].index << ' '
+			      << text.size() << ' ' << hash(text) << '\n';
+		}
+
+		m_log << "count " << m_inserts << ' ' << m_erases << ' '
+		      << m_messages << '\n';
+		write_all(report, m_log.str() );
+	}
+
+	void run_client(const options& opts,
+	                unsigned int index,
+	                int control,
+	                int report)
+	{
+		simulated_client client(opts, index);
+		client.run(control, report);
+	}
+
+	/** A forked server or client process.
+	 */
+	struct child
+	{
+		pid_t pid;
+		/** Commands to the child.
+		 */
+		int control;
+		/** Results of the child, line by line.
+		 */
+		FILE* report;
+	};
+
+	const int server_index = -1;
+	const int idler_index = -2;
+
+	/** Forks a process that runs run_server(), run_idler() or
+	 * run_client().
+	 */
+	child spawn(const options& opts, int index)
+	{
+		int control[2], report[2];
+		if(pipe(control) == -1 || pipe(report) == -1)
+			throw std::runtime_error("Could not create pipe");
+
+		std::cout.flush();
+		pid_t pid = fork();
+		if(pid == -1)
+			throw std::runtime_error("Could not fork");
+
+		if(pid == 0)
+		{
+			close(control[1]);
+			close(report[0]);
+
+			for(std::vector<int>::size_type i = 0;
+			    i < parent_fds.size();
+			    ++ i)
+			{
+				close(parent_fds[i]);
+			}
+
+			int result = EXIT_SUCCESS;
+			try
+			{
+				if(index == server_index)
+					run_server(opts, control[0], report[1]);
+				else if(index == idler_index)
+					run_idler(opts, control[0], report[1]);
+				else
+					run_client(opts, index, control[0], report[1]);
+			}
+			catch(std::exception& e)
+			{
+				std::cerr << (index == server_index ? "server" :
+				              index == idler_index ? "idler" : "client")
+				          << ": " << e.what() << std::endl;
+				result = EXIT_FAILURE;
+			}
+
+			_exit(result);
+		}
+
+		close(control[0]);
+		close(report[1]);
+
+		parent_fds.push_back(control[1]);
+		parent_fds.push_back(report[0]);
+
+		child result = { pid, control[1], fdopen(report[0], "r") };
+		return result;
+	}
+
+	void send_command(const child& proc, char command)
+	{
+		write_all(proc.control, std::string(1, command) );
+	}
+
+	/** Reads the next line a child reported. Returns false at the end
+	 * of its report.
+	 */
+	bool read_line(const child& proc, std::string& line)
+	{
+		line.clear();
+
+		char buf[256];
+		while(std::fgets(buf, sizeof(buf), proc.report) != NULL)
+		{
+			line += buf;
+			if(!line.empty() && line[line.size() - 1] == '\n')
+			{
+				line.erase(line.size() - 1);
+				return true;
+			}
+		}
+
+		return !line.empty();
+	}
+
+	void expect_line(const child& proc, const std::string& expected)
+	{
+		std::string line;
+		if(!read_line(proc, line) || line != expected)
+			throw std::runtime_error("Child process failed");
+	}
+
+	bool finish(const child& proc)
+	{
+		int status;
+		parent_fds.erase(
+			std::remove(parent_fds.begin(), parent_fds.end(),
+			            fileno(proc.report) ),
+			parent_fds.end()
+		);
+		parent_fds.erase(
+			std::remove(parent_fds.begin(), parent_fds.end(),
+			            proc.control),
+			parent_fds.end()
+		);
+
+		std::fclose(proc.report);
+		close(proc.control);
+		waitpid(proc.pid, &status, 0);
+		return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+	}
+
+	struct replica
+	{
+		unsigned long size;
+		unsigned long hash;
+
+		bool operator==(const replica& other) const
+		{
+			return size == other.size && hash == other.hash;
+		}
+	};
+
+	/** Identifies an insertion by author, document and sequence number.
+	 */
+	struct insertion
+	{
+		unsigned int author;
+		unsigned int document;
+		unsigned int seq;
+
+		bool operator<(const insertion& other) const
+		{
+			if(author != other.author) return author < other.author;
+			if(document != other.document)
+				return document < other.document;
+			return seq < other.seq;
+		}
+	};
+
+	double percentile(const std::vector<long>& sorted, double fraction)
+	{
+		if(sorted.empty() ) return 0.0;
+
+		std::vector<long>::size_type index =
+			static_cast<std::vector<long>::size_type>(
+				std::ceil(fraction * sorted.size() ) );
+		if(index > 0) -- index;
+		return sorted[index] / 1000.0;
+	}
+
+	/** Runs the benchmark and returns whether all replicas converged
+	 * and every insertion arrived everywhere.
+	 */
+	bool run(const options& opts)
+	{
+		std::cout << opts.clients << " clients, " << opts.documents
+		          << " documents, " << opts.subscriptions
+		          << " subscriptions per client, " << opts.duration
+		          << " s; edit " << opts.edit.str() << " ms, paste "
+		          << opts.paste_probability << ' ' << opts.paste.str()
+		          << " chars, erase " << opts.erase_probability
+		          << ", chat " << opts.chat.str() << " ms; "
+		          << (opts.epoll ? "epoll" : "select") << ", "
+		          << opts.idle << " idle connections, send limit "
+		          << opts.send_limit << " bytes" << std::endl;
+
+		child server = spawn(opts, server_index);
+		expect_line(server, "ready");
+
+		child idler = { 0, -1, NULL };
+		if(opts.idle > 0)
+		{
+			idler = spawn(opts, idler_index);
+			expect_line(idler, "ready");
+		}
+
+		std::vector<child> clients;
+		for(unsigned int i = 0; i < opts.clients; ++ i)
+			clients.push_back(spawn(opts, i) );
+
+		for(unsigned int i = 0; i < opts.clients; ++ i)
+			expect_line(clients[i], "ready");
+
+		send_command(server, 's');
+		for(unsigned int i = 0; i < opts.clients; ++ i)
+			send_command(clients[i], 's');
+
+		for(unsigned int i = 0; i < opts.clients; ++ i)
+			expect_line(clients[i], "done");
+
+		usleep(static_cast<useconds_t>(opts.settle * 1e6) );
+
+		std::map<insertion, unsigned long> sent;
+		std::vector<std::pair<insertion, unsigned long> > received;
+		std::map<unsigned int, std::vector<replica> > replicas;
+		unsigned long inserts = 0, erases = 0, messages = 0;
+		bool success = true;
+
+		for(unsigned int i = 0; i < opts.clients; ++ i)
+		{
+			send_command(clients[i], 'q');
+
+			std::string line;
+			while(read_line(clients[i], line) )
+			{
+				std::istringstream stream(line);
+				std::string kind;
+				stream >> kind;
+
+				insertion ins = { i, 0, 0 };
+				unsigned long time;
+				replica rep;
+
+				if(kind == "send")
+				{
+					stream >> ins.document >> ins.seq >> time;
+					sent[ins] = time;
+				}
+				else if(kind == "recv")
+				{
+					stream >> ins.author >> ins.document
+					       >> ins.seq >> time;
+					received.push_back(std::make_pair(ins, time) );
+				}
+				else if(kind == "doc")
+				{
+					stream >> ins.document >> rep.size >> rep.hash;
+					replicas[ins.document].push_back(rep);
+				}
+				else if(kind == "count")
+				{
+					unsigned long ins_count, erase_count, msg_count;
+					stream >> ins_count >> erase_count >> msg_count;
+					inserts += ins_count;
+					erases += erase_count;
+					messages += msg_count;
+				}
+			}
+
+			if(!finish(clients[i]) ) success = false;
+		}
+
+		if(opts.idle > 0)
+		{
+			send_command(idler, 'q');
+			if(!finish(idler) ) success = false;
+		}
+
+		send_command(server, 'q');
+
+		unsigned long server_cpu = 0;
+		std::map<unsigned int, replica> server_replicas;
+
+		std::string line;
+		while(read_line(server, line) )
+		{
+			std::istringstream stream(line);
+			std::string kind;
+			stream >> kind;
+
+			if(kind == "cpu")
+			{
+				stream >> server_cpu;
+			}
+			else if(kind == "doc")
+			{
+				unsigned int document;
+				replica rep;
+				stream >> document >> rep.size >> rep.hash;
+				server_replicas[document] = rep;
+			}
+		}
+
+		if(!finish(server) ) success = false;
+
+		// Every insertion should have arrived at every other
+		// subscriber of its document.
+		unsigned long expected = 0;
+		for(std::map<insertion, unsigned long>::const_iterator iter =
+			sent.begin();
+		    iter != sent.end();
+		    ++ iter)
+		{
+			for(unsigned int i = 0; i < opts.clients; ++ i)
+			{
+				if(i != iter->first.author &&
+				   is_subscriber(opts, i, iter->first.document) )
+					++ expected;
+			}
+		}
+
+		std::vector<long> latencies;
+		for(std::vector<std::pair<insertion, unsigned long> >::
+			const_iterator iter = received.begin();
+		    iter != received.end();
+		    ++ iter)
+		{
+			std::map<insertion, unsigned long>::const_iterator send =
+				sent.find(iter->first);
+			if(send != sent.end() )
+			{
+				latencies.push_back(
+					time_diff(iter->second, send->second) );
+			}
+		}
+
+		std::sort(latencies.begin(), latencies.end() );
+
+		unsigned int converged = 0;
+		for(unsigned int doc = 0; doc < opts.documents; ++ doc)
+		{
+			std::map<unsigned int, replica>::const_iterator server_rep =
+				server_replicas.find(doc);
+			const std::vector<replica>& reps = replicas[doc];
+
+			bool equal = (server_rep != server_replicas.end() );
+			for(std::vector<replica>::size_type i = 0;
+			    equal && i < reps.size();
+			    ++ i)
+			{
+				equal = (reps[i] == server_rep->second);
+			}
+
+			if(equal) ++ converged;
+		}
+
+		const unsigned long operations = inserts + erases;
+		const unsigned long missing =
+			expected > latencies.size() ? expected - latencies.size() : 0;
+
+		std::cout << std::fixed << std::setprecision(1)
+		          << "  operations   " << operations << " ("
+		          << operations / opts.duration << "/s), "
+		          << messages << " chat messages" << std::endl
+		          << std::setprecision(2)
+		          << "  latency      p50 " << percentile(latencies, 0.5)
+		          << " ms, p99 " << percentile(latencies, 0.99)
+		          << " ms, p99.9 " << percentile(latencies, 0.999)
+		          << " ms (" << latencies.size() << " deliveries, "
+		          << missing << " missing)" << std::endl
+		          << "  server CPU   "
+		          << (operations > 0 ?
+		              static_cast<double>(server_cpu) / operations : 0.0)
+		          << " us/op" << std::endl
+		          << "  convergence  " << converged << " of "
+		          << opts.documents << " documents converged" << std::endl;
+
+		return success && missing == 0 && converged == opts.documents;
+	}
+
+	void usage(const char* name)
+	{
+		std::cerr
+			<< "Usage: " << name << " [options]\n"
+			<< "  -c clients        number of clients (8)\n"
+			<< "  -d documents      number of documents (4)\n"
+			<< "  -s subscriptions  documents per client (2)\n"
+			<< "  -t seconds        time to edit (10)\n"
+			<< "  -w seconds        time to wait for convergence (2)\n"
+			<< "  -e dist           ms between edits (exp:200)\n"
+			<< "  -l dist           length of pastes (exp:200)\n"
+			<< "  -p probability    edit is a paste (0.02)\n"
+			<< "  -x probability    edit is an erasure (0.1)\n"
+			<< "  -m dist           ms between chat messages (exp:10000)\n"
+#ifdef HAVE_SYS_EPOLL_H
+			<< "  -E                server uses obby::epoll_selector\n"
+#endif
+			<< "  -i connections    idle connections to the server (0)\n"
+			<< "  -Q bytes          send limit per client, 0 for none (0)\n"
+			<< "  -P port           port of the server (6523)\n"
+			<< "dist is fixed:mean, uniform:mean, exp:mean or off."
+			<< std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) try
+{
+	options opts = {
+		6523, 8, 4, 2, 10.0, 2.0,
+		distribution(distribution::EXPONENTIAL, 200.0),
+		distribution(distribution::EXPONENTIAL, 200.0),
+		0.02, 0.1,
+		distribution(distribution::EXPONENTIAL, 10000.0),
+		false, 0, 0
+	};
+
+	int opt;
+	while( (opt = getopt(argc, argv, "c:d:s:t:w:e:l:p:x:m:Ei:Q:P:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'c': opts.clients = std::strtoul(optarg, NULL, 10); break;
+		case 'd': opts.documents = std::strtoul(optarg, NULL, 10); break;
+		case 's': opts.subscriptions = std::strtoul(optarg, NULL, 10); break;
+		case 't': opts.duration = std::strtod(optarg, NULL); break;
+		case 'w': opts.settle = std::strtod(optarg, NULL); break;
+		case 'e': opts.edit = distribution(optarg); break;
+		case 'l': opts.paste = distribution(optarg); break;
+		case 'p': opts.paste_probability = std::strtod(optarg, NULL); break;
+		case 'x': opts.erase_probability = std::strtod(optarg, NULL); break;
+		case 'm': opts.chat = distribution(optarg); break;
+#ifdef HAVE_SYS_EPOLL_H
+		case 'E': opts.epoll = true; break;
+#endif
+		case 'i': opts.idle = std::strtoul(optarg, NULL, 10); break;
+		case 'Q': opts.send_limit = std::strtoul(optarg, NULL, 10); break;
+		case 'P': opts.port = std::strtoul(optarg, NULL, 10); break;
+		default: usage(argv[0]); return EXIT_FAILURE;
+		}
+	}
+
+	if(optind != argc || opts.clients == 0 || opts.documents == 0 ||
+	   opts.clients > max_clients || opts.duration <= 0.0)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	opts.subscriptions = std::min(opts.subscriptions, opts.documents);
+
+	// A child that died must not kill the parent through its pipe
+	signal(SIGPIPE, SIG_IGN);
+
+	return run(opts) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Benchmark failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,201 @@
+// Measures what a wake-up of the selector costs while many connections are
+// idle: one socket pair is active, all others are watched but never become
+// readable. Reported is the time per wake-up for net6::selector, which can
+// only watch up to FD_SETSIZE sockets, and obby::epoll_selector.
+// Run with "make bench", or pass the numbers of watched sockets.
+
+#include <cstdlib>
+#include <cstdio>
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+
+#include <net6/socket.hpp>
+#include <net6/select.hpp>
+
+#include "config.hpp"
+
+#ifdef HAVE_SYS_EPOLL_H
+# include "epoll_selector.hpp"
+#endif
+
+namespace
+{
+	/** Socket of a pair created by socketpair(). The descriptor is
+	 * closed by net6::socket.
+	 */
+	class pair_socket: public net6::socket
+	{
+	public:
+		pair_socket(socket_type fd): net6::socket(fd)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		}
+	};
+
+	/** Reads what arrives at the active socket.
+	 */
+	class wakeup_counter
+	{
+	public:
+		wakeup_counter(const pair_socket& sock):
+			m_sock(sock), m_count(0) {}
+
+		void on_io(net6::io_condition cond)
+		{
+			char buf[64];
+			ssize_t len;
+			while( (len = read(m_sock.cobj(), buf, sizeof(buf))) > 0)
+				m_count += len;
+		}
+
+		unsigned long get_count() const { return m_count; }
+
+	private:
+		const pair_socket& m_sock;
+		unsigned long m_count;
+	};
+
+	double now()
+	{
+		timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1e6;
+	}
+
+	/** Returns the microseconds per wake-up of a <em>Selector</em> while
+	 * <em>sockets</em> sockets are watched.
+	 */
+	template<typename Selector>
+	double wakeup_cost(unsigned int sockets, unsigned int iterations)
+	{
+		Selector selector;
+		std::vector<pair_socket*> idle;
+
+		for(unsigned int i = 0; i + 1 < sockets; i += 2)
+		{
+			int fds[2];
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+				throw std::runtime_error("socketpair failed");
+
+			idle.push_back(new pair_socket(fds[0]) );
+			idle.push_back(new pair_socket(fds[1]) );
+			selector.set(*idle[idle.size() - 2], net6::IO_INCOMING);
+			selector.set(*idle.back(), net6::IO_INCOMING);
+		}
+
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			throw std::runtime_error("socketpair failed");
+
+		pair_socket active(fds[0]);
+		pair_socket sender(fds[1]);
+		wakeup_counter counter(active);
+		active.io_event().connect(
+			sigc::mem_fun(counter, &wakeup_counter::on_io) );
+		selector.set(active, net6::IO_INCOMING);
+
+		double start = now();
+		for(unsigned int i = 0; i < iterations; ++ i)
+		{
+			if(write(sender.cobj(), "x", 1) != 1)
+				throw std::runtime_error("write failed");
+
+			selector.select();
+		}
+		double elapsed = now() - start;
+
+		if(counter.get_count() != iterations)
+			throw std::runtime_error("Selector missed a wake-up");
+
+		selector.set(active, net6::IO_NONE);
+		for(std::vector<pair_socket*>::iterator iter = idle.begin();
+		    iter != idle.end();
+		    ++ iter)
+		{
+			selector.set(**iter, net6::IO_NONE);
+			delete *iter;
+		}
+
+		return elapsed / iterations * 1e6;
+	}
+
+	void bench(unsigned int sockets)
+	{
+		const unsigned int iterations = 20000;
+
+		std::cout << std::setw(8) << sockets << " sockets:";
+
+		if(sockets < FD_SETSIZE)
+		{
+			std::cout << std::fixed << std::setprecision(1)
+			          << std::setw(13)
+			          << wakeup_cost<net6::selector>(
+			                 sockets,
+			                 iterations
+			             )
+			          << " us";
+		}
+		else
+		{
+			std::cout << std::setw(16) << "-";
+		}
+
+#ifdef HAVE_SYS_EPOLL_H
+		std::cout << std::fixed << std::setprecision(1)
+		          << std::setw(13)
+		          << wakeup_cost<obby::epoll_selector>(
+		                 sockets,
+		                 iterations
+		             )
+		          << " us";
+#endif
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) try
+{
+	// Ten thousand sockets exceed the default limit of most systems
+	rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::cout << std::setw(17) << "" << std::setw(16) << "net6::selector"
+#ifdef HAVE_SYS_EPOLL_H
+	          << std::setw(16) << "epoll_selector"
+#endif
+	          << std::endl;
+
+	if(argc > 1)
+	{
+		for(int i = 1; i < argc; ++ i)
+			bench(std::strtoul(argv[i], NULL, 10) );
+	}
+	else
+	{
+		bench(100);
+		bench(1000);
+		bench(10000);
+	}
+
+	return EXIT_SUCCESS;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Benchmark failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,392 @@
+// Measures the persistence path on synthetic sessions: throughput in MB/s
+// of the input or output, allocations per run and peak RSS of the process.
+// Run with "make bench", or pass "documents chunks authors escapes" to
+// benchmark a single session.
+
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <new>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+
+#ifndef WIN32
+# include <sys/resource.h>
+#endif
+
+#include "serialise/token.hpp"
+#include "serialise/object.hpp"
+#include "serialise/parser.hpp"
+#include "serialise/writer.hpp"
+#include "common.hpp"
+#include "colour.hpp"
+#include "server_buffer.hpp"
+
+// Counts every allocation made through operator new
+namespace
+{
+	unsigned long allocations = 0;
+}
+
+void* operator new(std::size_t size) throw(std::bad_alloc)
+{
+	++ allocations;
+
+	void* mem = std::malloc(size > 0 ? size : 1);
+	if(mem == NULL) throw std::bad_alloc();
+	return mem;
+}
+
+void operator delete(void* mem) throw()
+{
+	std::free(mem);
+}
+
+namespace
+{
+	/** Parameters of a synthetic session.
+	 */
+	struct session_params
+	{
+		const char* name;
+		unsigned int documents;
+		unsigned int chunks;
+		unsigned int authors;
+		/** Fraction of characters that have to be escaped.
+		 */
+		double escapes;
+	};
+
+	const session_params default_sessions[] = {
+		{ "small",         10,   100,  2, 0.0  },
+		{ "many_docs",   1000,    10,  8, 0.01 },
+		{ "large_docs",    10, 10000, 32, 0.01 },
+		{ "escape_heavy", 100,   100,  4, 0.25 }
+	};
+
+	const unsigned int chunk_length = 48;
+	const char* const session_file = "bench_session.obby";
+
+	/** Minimum time a benchmark is repeated for, in seconds.
+	 */
+	const double min_time = 0.2;
+
+	/** Deterministic pseudo-random numbers, so that every run
+	 * benchmarks the same sessions.
+	 */
+	unsigned long random_state = 1;
+
+	unsigned long random_next()
+	{
+		random_state = random_state * 1103515245 + 12345;
+		return (random_state / 65536) % 32768;
+	}
+
+	std::string chunk_text(double escapes)
+	{
+		static const char special[] = { '\"', '\\', '\n', '\t' };
+
+		std::string text;
+		for(unsigned int i = 0; i < chunk_length; ++ i)
+		{
+			if(random_next() < escapes * 32768)
+				text += special[random_next() % 4];
+			else if(random_next() % 6 == 0)
+				text += ' ';
+			else
+				text += static_cast<char>('a' + random_next() % 26);
+		}
+
+		return text;
+	}
+
+	/** Writes a session with the given parameters to <em>stream</em>.
+	 */
+	void generate(const session_params& params,
+	              std::ostream& stream,
+	              obby::serialise::writer::format_type format)
+	{
+		random_state = 1;
+
+		obby::serialise::writer writer(stream, "obby", format);
+		writer.begin_object("session");
+		writer.add_attribute("version", obby_version() );
+
+		writer.begin_object("user_table");
+		for(unsigned int i = 1; i <= params.authors; ++ i)
+		{
+			std::ostringstream name;
+			name << "user" << i;
+
+			writer.begin_object("user");
+			writer.add_attribute("id", i);
+			writer.add_attribute("name", name.str() );
+			writer.add_attribute(
+				"colour",
+				obby::colour(i * 40 % 256, i * 80 % 256, 128)
+			);
+			writer.end_object();
+		}
+		writer.end_object();
+
+		writer.begin_object("chat");
+		writer.end_object();
+
+		for(unsigned int doc = 1; doc <= params.documents; ++ doc)
+		{
+			std::ostringstream title;
+			title << "document" << doc;
+
+			writer.begin_object("document");
+			writer.add_attribute("owner", 1);
+			writer.add_attribute("id", doc);
+			writer.add_attribute("title", title.str() );
+			writer.add_attribute("suffix", 1);
+			writer.add_attribute("encoding", "UTF-8");
+
+			for(unsigned int i = 0; i < params.chunks; ++ i)
+			{
+				writer.begin_object("chunk");
+				writer.add_attribute(
+					"content",
+					chunk_text(params.escapes)
+				);
+				writer.add_attribute(
+					"author",
+					1 + random_next() % params.authors
+				);
+				writer.end_object();
+			}
+
+			writer.end_object();
+		}
+
+		writer.end_object();
+	}
+
+	unsigned long peak_rss()
+	{
+#ifndef WIN32
+		rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage) == 0)
+			return usage.ru_maxrss;
+#endif
+		return 0;
+	}
+
+	/** Repeats a benchmark for at least min_time seconds and prints
+	 * throughput, allocations per run and the peak RSS of the process.
+	 */
+	template<typename Func>
+	void measure(const char* name, std::size_t bytes, Func func)
+	{
+		unsigned long runs = 0;
+		unsigned long allocs = allocations;
+		std::clock_t start = std::clock();
+		double elapsed;
+
+		do
+		{
+			func();
+			++ runs;
+			elapsed = double(std::clock() - start) / CLOCKS_PER_SEC;
+		} while(elapsed < min_time);
+
+		allocs = (allocations - allocs) / runs;
+		double rate = bytes / 1048576.0 * runs / elapsed;
+
+		std::ostringstream line;
+		line << "  " << std::left << std::setw(24) << name
+		     << std::right << std::fixed << std::setprecision(1)
+		     << std::setw(9) << rate << " MB/s"
+		     << std::setw(12) << allocs << " allocs"
+		     << std::setw(10) << peak_rss() << " KiB peak";
+
+		std::cout << line.str() << std::endl;
+	}
+
+	struct tokenise
+	{
+		const std::string& text;
+
+		void operator()() const
+		{
+			obby::serialise::token_list list;
+			list.deserialise(text);
+		}
+	};
+
+	struct object_from_tokens
+	{
+		const obby::serialise::token_list& list;
+
+		void operator()() const
+		{
+			// Skip document type and top-level indentation
+			obby::serialise::token_list::iterator iter = list.begin();
+			for(unsigned int i = 0; i < 3; ++ i)
+				list.next_token(iter);
+
+			obby::serialise::object root;
+			root.deserialise(list, iter);
+		}
+	};
+
+	struct parse
+	{
+		const std::string& text;
+
+		void operator()() const
+		{
+			obby::serialise::parser parser;
+			parser.deserialise_memory(text);
+		}
+	};
+
+	struct write_session
+	{
+		const obby::serialise::parser& parser;
+		obby::serialise::writer::format_type format;
+
+		void operator()() const
+		{
+			std::ostringstream stream;
+			parser.serialise(stream, format);
+		}
+	};
+
+	/** Opens the session with a server buffer, loads every document
+	 * and writes the session back.
+	 */
+	struct round_trip
+	{
+		obby::serialise::writer::format_type format;
+
+		void operator()() const
+		{
+			obby::server_buffer buffer;
+			buffer.open(session_file, 0);
+
+			for(obby::server_buffer::document_iterator iter =
+				buffer.document_begin();
+			    iter != buffer.document_end();
+			    ++ iter)
+			{
+				dynamic_cast<obby::server_buffer::document_info_type&>(
+					*iter).swap_in();
+			}
+
+			buffer.serialise(session_file, format);
+			buffer.close();
+		}
+	};
+
+	void run(const session_params& params)
+	{
+		std::ostringstream text_stream, binary_stream;
+		generate(params, text_stream, obby::serialise::writer::FORMAT_TEXT);
+		generate(
+			params,
+			binary_stream,
+			obby::serialise::writer::FORMAT_BINARY
+		);
+
+		const std::string text = text_stream.str();
+		const std::string binary = binary_stream.str();
+
+		std::cout << params.name << ": " << params.documents
+		          << " documents, " << params.chunks << " chunks, "
+		          << params.authors << " authors, " << params.escapes
+		          << " escapes, " << text.size() << " bytes text, "
+		          << binary.size() << " bytes binary" << std::endl;
+
+		obby::serialise::token_list list;
+		list.deserialise(text);
+
+		obby::serialise::parser parser;
+		parser.deserialise_memory(text);
+
+		tokenise tok = { text };
+		object_from_tokens obj = { list };
+		parse text_parse = { text };
+		parse binary_parse = { binary };
+		write_session text_serialise = {
+			parser, obby::serialise::writer::FORMAT_TEXT
+		};
+		write_session binary_serialise = {
+			parser, obby::serialise::writer::FORMAT_BINARY
+		};
+		round_trip text_round_trip = {
+			obby::serialise::writer::FORMAT_TEXT
+		};
+		round_trip binary_round_trip = {
+			obby::serialise::writer::FORMAT_BINARY
+		};
+
+		measure("token_list::deserialise", text.size(), tok);
+		measure("object::deserialise", text.size(), obj);
+		measure("parser (text)", text.size(), text_parse);
+		measure("parser (binary)", binary.size(), binary_parse);
+		measure("serialise (text)", text.size(), text_serialise);
+		measure("serialise (binary)", binary.size(), binary_serialise);
+
+		// The buffer reads back what it has written before
+		{
+			std::ofstream out(session_file, std::ios::binary);
+			out << text;
+		}
+
+		measure("buffer (text)", text.size(), text_round_trip);
+
+		{
+			std::ofstream out(session_file, std::ios::binary);
+			out << binary;
+		}
+
+		measure("buffer (binary)", binary.size(), binary_round_trip);
+		std::remove(session_file);
+	}
+}
+
+int main(int argc, char* argv[]) try
+{
+	if(argc == 5)
+	{
+		// Single session given on the command line
+		session_params params = {
+			"custom",
+			std::strtoul(argv[1], NULL, 10),
+			std::strtoul(argv[2], NULL, 10),
+			std::strtoul(argv[3], NULL, 10),
+			std::strtod(argv[4], NULL)
+		};
+
+		if(params.authors == 0) params.authors = 1;
+		run(params);
+	}
+	else if(argc == 1)
+	{
+		const std::size_t count =
+			sizeof(default_sessions) / sizeof(default_sessions[0]);
+
+		for(std::size_t i = 0; i < count; ++ i)
+			run(default_sessions[i]);
+	}
+	else
+	{
+		std::cerr << "Usage: " << argv[0]
+		          << " [documents chunks authors escapes]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Benchmark failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
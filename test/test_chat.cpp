@@ -0,0 +1,333 @@
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sigc++/sigc++.h>
+#include "serialise/object.hpp"
+#include "user_table.hpp"
+#include "chat.hpp"
+
+namespace
+{
+	/** Document a test_buffer would announce.
+	 */
+	class test_document
+	{
+	public:
+		const obby::user* get_owner() const { return NULL; }
+		const std::string& get_title() const { return m_title; }
+
+	private:
+		std::string m_title;
+	};
+
+	/** Provides the signals a chat connects to. Nothing emits them.
+	 */
+	class test_buffer
+	{
+	public:
+		typedef test_document document_info_type;
+
+		typedef sigc::signal<void, unsigned int> signal_sync_init_type;
+		typedef sigc::signal<void> signal_sync_final_type;
+		typedef sigc::signal<void, const obby::user&> signal_user_type;
+		typedef sigc::signal<void, document_info_type&>
+			signal_document_type;
+
+		signal_sync_init_type sync_init_event() const
+			{ return m_signal_sync_init; }
+		signal_sync_final_type sync_final_event() const
+			{ return m_signal_sync_final; }
+		signal_user_type user_join_event() const
+			{ return m_signal_user_join; }
+		signal_user_type user_part_event() const
+			{ return m_signal_user_part; }
+		signal_document_type document_insert_event() const
+			{ return m_signal_document_insert; }
+		signal_document_type document_remove_event() const
+			{ return m_signal_document_remove; }
+
+	private:
+		signal_sync_init_type m_signal_sync_init;
+		signal_sync_final_type m_signal_sync_final;
+		signal_user_type m_signal_user_join;
+		signal_user_type m_signal_user_part;
+		signal_document_type m_signal_document_insert;
+		signal_document_type m_signal_document_remove;
+	};
+
+	std::string numbered(const std::string& prefix, unsigned int number)
+	{
+		std::ostringstream stream;
+		stream << prefix << number;
+		return stream.str();
+	}
+
+	std::string text_at(const obby::chat& chat, std::size_t index)
+	{
+		return chat.message_at(index)->get_text();
+	}
+
+	/** Adds a server message with the given timestamp to a history
+	 * that is deserialised later.
+	 */
+	void add_message(obby::serialise::object& history,
+	                 const std::string& text,
+	                 std::time_t timestamp)
+	{
+		obby::serialise::object& child = history.add_child();
+		child.set_name("server_message");
+		child.add_attribute("text").set_value(text);
+		child.add_attribute("timestamp").set_value(timestamp);
+	}
+
+	/** The newest messages replace the oldest ones once the history
+	 * holds max_messages of them.
+	 */
+	void test_ring()
+	{
+		test_buffer buffer;
+		obby::user_table table;
+		const obby::user* alice =
+			table.add_user(1, "alice", obby::colour(255, 0, 0) );
+
+		obby::chat chat(buffer, 5);
+		for(unsigned int i = 0; i < 12; ++ i)
+		{
+			if(i % 2 == 0)
+				chat.add_user_message(numbered("message ", i), *alice);
+			else
+				chat.add_server_message(numbered("message ", i) );
+
+			if(chat.message_count() != (i < 5 ? i + 1 : 5) )
+				throw std::logic_error("history has a wrong size");
+		}
+
+		for(std::size_t i = 0; i < 5; ++ i)
+		{
+			if(text_at(chat, i) != numbered("message ", i + 7) )
+				throw std::logic_error("ring lost the newest messages");
+		}
+
+		// Iterating walks the ring from the oldest message
+		std::size_t index = 0;
+		for(obby::chat::message_iterator iter = chat.message_begin();
+		    iter != chat.message_end();
+		    ++ iter, ++ index)
+		{
+			if(iter.get_index() != index ||
+			   iter->get_text() != numbered("message ", index + 7) )
+				throw std::logic_error("iterator is out of order");
+		}
+
+		if(index != 5 || chat.message_at(5) != chat.message_end() )
+			throw std::logic_error("iterator runs past the history");
+
+		const obby::chat::user_message* msg =
+			dynamic_cast<const obby::chat::user_message*>(
+				&*chat.message_at(1) );
+		if(msg == NULL || &msg->get_user() != alice)
+			throw std::logic_error("user message lost its author");
+
+		// The fields match the message objects
+		for(std::size_t i = 0; i < 5; ++ i)
+		{
+			obby::chat::message_data data = chat.message_data_at(i);
+			bool user = (i % 2 == 1);
+
+			if(std::string(data.type) !=
+			   (user ? "user_message" : "server_message") ||
+			   data.from != (user ? alice : NULL) ||
+			   data.timestamp != chat.message_at(i)->get_timestamp() ||
+			   std::string(data.text, data.length) != text_at(chat, i) )
+				throw std::logic_error("message data is wrong");
+		}
+
+		chat.clear();
+		chat.add_server_message("after clear");
+		if(chat.message_count() != 1 || text_at(chat, 0) != "after clear")
+			throw std::logic_error("clear left messages behind");
+
+		obby::chat none(buffer, 0);
+		none.add_server_message("dropped");
+		if(none.message_count() != 0)
+			throw std::logic_error("history without room kept a message");
+	}
+
+	/** Texts of discarded messages are dropped from the arena from time
+	 * to time, which moves the texts of the others.
+	 */
+	void test_compaction()
+	{
+		test_buffer buffer;
+		obby::chat chat(buffer, 4);
+		std::deque<std::string> expected;
+
+		for(unsigned int i = 0; i < 300; ++ i)
+		{
+			// Lengths vary so that the texts do not line up
+			std::string text(
+				(i * 37) % 61,
+				static_cast<char>('a' + i % 26)
+			);
+			text += numbered("#", i);
+
+			chat.add_server_message(text);
+			expected.push_back(text);
+			if(expected.size() > 4) expected.pop_front();
+
+			for(std::size_t j = 0; j < expected.size(); ++ j)
+			{
+				if(text_at(chat, j) != expected[j])
+				{
+					throw std::logic_error(
+						"text moved by compaction");
+				}
+			}
+		}
+	}
+
+	/** message_find() returns the first message not older than the
+	 * given time, also when the ring has wrapped around.
+	 */
+	void test_find(unsigned int max_messages)
+	{
+		const std::time_t timestamps[] = {
+			10, 10, 20, 30, 30, 30, 40, 50, 60, 25, 70, 70
+		};
+		const std::size_t count = sizeof(timestamps) / sizeof(timestamps[0]);
+
+		obby::serialise::object history(NULL);
+		for(std::size_t i = 0; i < count; ++ i)
+			add_message(history, numbered("message ", i), timestamps[i]);
+
+		test_buffer buffer;
+		obby::user_table table;
+		obby::chat chat(buffer, max_messages);
+		chat.deserialise(history, table);
+
+		// A message older than its predecessor is moved to the
+		// predecessor's time to keep the history sorted.
+		std::time_t previous = 0;
+		for(obby::chat::message_iterator iter = chat.message_begin();
+		    iter != chat.message_end();
+		    ++ iter)
+		{
+			if(iter->get_timestamp() < previous)
+				throw std::logic_error("history is not sorted");
+			previous = iter->get_timestamp();
+		}
+
+		for(std::time_t time = 0; time <= 80; ++ time)
+		{
+			std::size_t index = 0;
+			while(index < chat.message_count() &&
+			      chat.message_at(index)->get_timestamp() < time)
+				++ index;
+
+			if(chat.message_find(time) != chat.message_at(index) )
+			{
+				std::ostringstream stream;
+				stream << "message_find(" << time << ") with "
+				       << max_messages << " messages";
+				throw std::logic_error(stream.str() );
+			}
+		}
+
+		// "Restored session" is added at the current time
+		if(chat.message_find(std::time(NULL) + 1) != chat.message_end() )
+			throw std::logic_error("message_find found a future message");
+	}
+
+	/** Asks for <em>count</em> messages before the position at the
+	 * beginning of <em>position</em>, like a client does.
+	 */
+	net6::packet backlog_request(const net6::packet& position,
+	                             unsigned int count)
+	{
+		net6::packet request("obby_chat_backlog");
+		request << position.get_param(0).net6::parameter::as<std::time_t>()
+		        << position.get_param(1).net6::parameter::as<unsigned int>()
+		        << count;
+		return request;
+	}
+
+	/** Returns the texts of the messages in a backlog reply.
+	 */
+	std::deque<std::string> backlog_texts(const net6::packet& reply)
+	{
+		std::deque<std::string> texts;
+		for(unsigned int i = 3; i + 3 < reply.get_param_count(); i += 4)
+		{
+			texts.push_back(reply.get_param(i + 3).
+				net6::parameter::as<std::string>() );
+		}
+
+		return texts;
+	}
+
+	/** The backlog is sent in parts from the newest to the oldest
+	 * message. Positions stay valid when old messages are discarded.
+	 */
+	void test_backlog()
+	{
+		const std::time_t timestamps[] = { 10, 15, 20, 30, 40 };
+
+		obby::serialise::object history(NULL);
+		for(unsigned int i = 0; i < 5; ++ i)
+			add_message(history, numbered("message ", i), timestamps[i]);
+
+		test_buffer buffer;
+		obby::user_table table;
+		obby::chat chat(buffer, 6);
+		chat.deserialise(history, table);
+
+		net6::packet position("obby_sync_final");
+		chat.write_position(position, chat.message_count() );
+
+		net6::packet first("obby_chat_backlog");
+		chat.write_backlog(backlog_request(position, 3), first);
+
+		// "Restored session" is the newest message
+		std::deque<std::string> texts = backlog_texts(first);
+		if(texts.size() != 3 || texts[0] != "message 3" ||
+		   texts[1] != "message 4")
+			throw std::logic_error("backlog sent the wrong messages");
+
+		if(first.get_param(2).net6::parameter::as<unsigned int>() != 3)
+			throw std::logic_error("backlog counted the wrong messages");
+
+		// Discards "message 0" and "message 1"
+		chat.add_server_message("message 5");
+		chat.add_server_message("message 6");
+
+		net6::packet second("obby_chat_backlog");
+		chat.write_backlog(backlog_request(first, 10), second);
+
+		texts = backlog_texts(second);
+		if(texts.size() != 1 || texts[0] != "message 2")
+			throw std::logic_error("backlog position has moved");
+
+		if(second.get_param(2).net6::parameter::as<unsigned int>() != 0)
+			throw std::logic_error("backlog did not reach the end");
+	}
+}
+
+int main() try
+{
+	test_ring();
+	test_compaction();
+	test_find(100);
+	test_find(6);
+	test_backlog();
+
+	std::cout << "Chat test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Chat test failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
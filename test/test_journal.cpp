@@ -0,0 +1,299 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include "journal.hpp"
+#include "server_buffer.hpp"
+
+// Checks the journal file format on its own, and that a journaled server
+// replays its changes when the session is opened again.
+
+namespace
+{
+	const char* const journal_file = "test_journal.journal";
+	const char* const session_file = "test_journal.obby";
+
+	typedef obby::server_buffer::document_info_type document_info;
+
+	obby::journal::entry make_entry(const std::string& type,
+	                                const std::string& value)
+	{
+		obby::journal::entry ent;
+		ent.push_back(type);
+		ent.push_back(value);
+		return ent;
+	}
+
+	void expect_entries(const std::string& file,
+	                    const obby::journal::entry_list& expected,
+	                    const std::string& what)
+	{
+		obby::journal::entry_list entries;
+		obby::journal::read(file, entries);
+
+		if(entries != expected)
+			throw std::logic_error(what);
+	}
+
+	long file_size(const std::string& file)
+	{
+		std::FILE* fp = std::fopen(file.c_str(), "rb");
+		if(fp == NULL) throw std::runtime_error("Cannot open " + file);
+
+		std::fseek(fp, 0, SEEK_END);
+		long size = std::ftell(fp);
+		std::fclose(fp);
+		return size;
+	}
+
+	/** Entries are read back as they have been committed, an entry
+	 * without all of its bytes or with a wrong checksum ends the
+	 * journal.
+	 */
+	void test_file()
+	{
+		std::remove(journal_file);
+
+		obby::journal::entry_list expected;
+		expected.push_back(make_entry("journal", "1") );
+		expected.push_back(make_entry("op", std::string("a\0b", 3)) );
+		expected.push_back(make_entry("rename", "") );
+
+		{
+			obby::journal jour(journal_file);
+			for(obby::journal::entry_list::const_iterator iter =
+				expected.begin();
+			    iter != expected.end();
+			    ++ iter)
+			{
+				jour.append(*iter);
+			}
+
+			// Nothing is written before the commit
+			expect_entries(journal_file, obby::journal::entry_list(),
+			               "entries were written before commit");
+
+			jour.commit();
+			if(jour.has_pending() ||
+			   jour.get_size() !=
+			   static_cast<unsigned long>(file_size(journal_file)) )
+				throw std::logic_error("commit left entries behind");
+		}
+
+		expect_entries(journal_file, expected, "entries differ");
+
+		// A crash while the next entry was written
+		long complete = file_size(journal_file);
+		{
+			std::FILE* fp = std::fopen(journal_file, "ab");
+			std::fwrite("\x20\x00\x00\x00\x01\x02", 1, 6, fp);
+			std::fclose(fp);
+		}
+
+		expect_entries(journal_file, expected, "torn tail was read");
+
+		// Appending after a torn tail starts a new entry, readers
+		// stop at the torn one.
+		{
+			obby::journal jour(journal_file);
+			jour.append(make_entry("user", "2") );
+		}
+
+		expect_entries(journal_file, expected,
+		               "entry behind a torn tail was read");
+
+		// A damaged byte in the last complete entry
+		{
+			std::FILE* fp = std::fopen(journal_file, "r+b");
+			std::fseek(fp, complete - 1, SEEK_SET);
+			std::fputc('x', fp);
+			std::fclose(fp);
+		}
+
+		expected.pop_back();
+		expect_entries(journal_file, expected,
+		               "entry with wrong checksum was read");
+
+		// truncate() keeps the entries behind the offset
+		std::remove(journal_file);
+		{
+			obby::journal jour(journal_file);
+			jour.append(make_entry("journal", "1") );
+			jour.append(make_entry("op", "old") );
+			jour.append(make_entry("snapshot", "2") );
+			jour.commit();
+
+			unsigned long offset = jour.get_size();
+			jour.append(make_entry("op", "new") );
+			jour.truncate(offset, make_entry("journal", "2") );
+		}
+
+		expected.clear();
+		expected.push_back(make_entry("journal", "2") );
+		expected.push_back(make_entry("op", "new") );
+		expect_entries(journal_file, expected, "truncate lost entries");
+
+		std::remove(journal_file);
+	}
+
+	unsigned int open(obby::server_buffer& buffer, const char* session)
+	{
+		// Another test may still use a port
+		for(unsigned int port = 6560; port < 6580; ++ port)
+		{
+			try
+			{
+				if(session == NULL)
+					buffer.open(port);
+				else
+					buffer.open(session, port);
+
+				return port;
+			}
+			catch(net6::error& e)
+			{
+			}
+		}
+
+		throw std::runtime_error("No port to open the server on");
+	}
+
+	std::string text(const obby::server_buffer& buffer, unsigned int id)
+	{
+		document_info* info = buffer.document_find(0, id);
+		if(info == NULL) return "<removed>";
+
+		return info->get_title() + ": " +
+			info->get_content().get_text();
+	}
+
+	/** Returns the types of the entries that a session opened now
+	 * would replay.
+	 */
+	std::multiset<std::string> pending_types()
+	{
+		obby::journal::entry_list entries;
+		obby::journal::read(std::string(session_file) + ".journal",
+		                    entries);
+
+		std::multiset<std::string> types;
+		bool marked = false;
+		for(obby::journal::entry_list::const_iterator iter =
+			entries.begin();
+		    iter != entries.end();
+		    ++ iter)
+		{
+			// Entries in front of the last marker are part of the
+			// session file.
+			if( (*iter)[0] == "journal" || (*iter)[0] == "snapshot")
+			{
+				types.clear();
+				marked = true;
+			}
+			else if(marked)
+			{
+				types.insert( (*iter)[0]);
+			}
+		}
+
+		return types;
+	}
+
+	/** Changes made to a journaled session survive a server that goes
+	 * away without saving. Compaction writes them into the session
+	 * file, and the journal keeps only what is newer.
+	 */
+	void test_replay()
+	{
+		std::string journal_name = std::string(session_file) + ".journal";
+		std::remove(session_file);
+		std::remove(journal_name.c_str() );
+
+		{
+			obby::server_buffer buffer;
+			open(buffer, NULL);
+			buffer.document_create("first", "UTF-8", "one");
+			buffer.document_create("second", "UTF-8", "two");
+			buffer.serialise(session_file);
+		}
+
+		{
+			obby::server_buffer buffer;
+			buffer.set_journal(true);
+			open(buffer, session_file);
+
+			buffer.document_find(0, 1)->insert(3, " more");
+			buffer.document_find(0, 2)->rename("renamed");
+			buffer.document_create("third", "UTF-8", "three");
+			buffer.document_remove(*buffer.document_find(0, 1) );
+
+			// Closing commits the journal, but does not save
+			buffer.close();
+		}
+
+		std::multiset<std::string> types = pending_types();
+		if(types.count("op") == 0 || types.count("rename") != 1 ||
+		   types.count("document") != 1 || types.count("remove") != 1)
+			throw std::logic_error("changes were not journaled");
+
+		{
+			obby::server_buffer buffer;
+			buffer.set_journal(true);
+			open(buffer, session_file);
+
+			if(text(buffer, 1) != "<removed>" ||
+			   text(buffer, 2) != "renamed: two" ||
+			   text(buffer, 3) != "third: three")
+				throw std::logic_error("journal was not replayed");
+
+			// Opening compacts the journal
+			if(!pending_types().empty() )
+				throw std::logic_error("journal was not compacted");
+
+			buffer.document_find(0, 3)->insert(0, "a ");
+			buffer.close();
+		}
+
+		// Only the change behind the marker is replayed, not the ones
+		// already written to the session file.
+		{
+			obby::server_buffer buffer;
+			buffer.set_journal(true);
+			open(buffer, session_file);
+
+			if(text(buffer, 2) != "renamed: two" ||
+			   text(buffer, 3) != "third: a three")
+				throw std::logic_error("journal was replayed twice");
+
+			buffer.close();
+		}
+
+		// The session file alone has all of it now
+		{
+			obby::server_buffer buffer;
+			open(buffer, session_file);
+
+			if(text(buffer, 1) != "<removed>" ||
+			   text(buffer, 3) != "third: a three")
+				throw std::logic_error("snapshot misses changes");
+		}
+
+		std::remove(session_file);
+		std::remove(journal_name.c_str() );
+	}
+}
+
+int main() try
+{
+	test_file();
+	test_replay();
+
+	std::cout << "Journal test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Journal test failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
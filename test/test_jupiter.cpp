@@ -275,6 +275,140 @@ void test(const std::string& line)
 	// TODO: Delete allocated memory
 }
 
+void deliver(jupiter_client& client,
+             std::list<record_wrapper>& recs,
+             std::list<record_wrapper>::size_type count)
+{
+	while(count > 0 && !recs.empty() )
+	{
+		client.remote_op(*recs.front().rec, recs.front().from);
+		delete recs.front().rec;
+		recs.pop_front();
+		-- count;
+	}
+}
+
+void discard(std::list<record_wrapper>& recs)
+{
+	for(std::list<record_wrapper>::iterator iter = recs.begin();
+	    iter != recs.end(); ++ iter)
+	{
+		delete iter->rec;
+	}
+
+	recs.clear();
+}
+
+void server_insert(jupiter_server& server,
+                   obby::position pos,
+                   const std::string& text)
+{
+	obby::insert_operation<obby::document> op(pos, text);
+	server.local_op(op, NULL);
+}
+
+void test_resume()
+{
+	obby::user user1(1, "user1", obby::colour(5, 5, 5) );
+
+	obby::document::template_type templ;
+	obby::document serv_doc(templ);
+	obby::document client_doc(templ);
+
+	serv_doc.insert(0, "abc", NULL);
+	client_doc.insert(0, "abc", NULL);
+
+	// Keep at most four records per client
+	jupiter_server server(serv_doc, 4);
+	server.client_add(user1);
+
+	std::auto_ptr<jupiter_client> client(new jupiter_client(client_doc) );
+
+	std::vector<std::list<record_wrapper> > client_rec;
+	client_rec.resize(1);
+
+	server.record_event().connect(
+		sigc::bind(
+			sigc::ptr_fun(&server_record),
+			sigc::ref(client_rec)
+		)
+	);
+
+	server_insert(server, 0, "1");
+	server_insert(server, 0, "2");
+
+	// The client receives the first record only, then loses its
+	// connection. The second one is lost with it.
+	deliver(*client, client_rec[0], 1);
+	discard(client_rec[0]);
+	server.client_detach(user1);
+
+	server_insert(server, 0, "3");
+	if(!client_rec[0].empty() )
+		throw std::runtime_error("Detached client received a record");
+
+	std::auto_ptr<jupiter_client::algorithm_type> algorithm =
+		client->release_algorithm();
+	obby::vector_time time = algorithm->get_time();
+
+	if(!server.can_resume(user1, time) )
+		throw std::runtime_error("Client cannot be resumed");
+
+	// Resuming sends the records the client has missed
+	client.reset(new jupiter_client(client_doc, algorithm) );
+	server.client_resume(user1, time);
+	deliver(*client, client_rec[0], client_rec[0].size() );
+
+	if(client_doc.get_text() != serv_doc.get_text() ||
+	   serv_doc.get_text() != "321abc")
+	{
+		throw std::runtime_error(
+			"Resumed client document \"" + client_doc.get_text() +
+			"\" differs from server document \"" +
+			serv_doc.get_text() + "\""
+		);
+	}
+
+	// Changes of the resumed client reach the server
+	client->record_event().connect(
+		sigc::bind(
+			sigc::ptr_fun(&client_record),
+			sigc::ref(client_rec[0])
+		)
+	);
+
+	obby::insert_operation<obby::document> op(6, "4");
+	client->local_op(op, &user1);
+
+	server.remote_op(*client_rec[0].front().rec, &user1);
+	discard(client_rec[0]);
+
+	if(serv_doc.get_text() != "321abc4")
+		throw std::runtime_error("Server did not apply client record");
+
+	// A client that missed more records than the history holds
+	// cannot be resumed anymore.
+	server.client_detach(user1);
+	time = client->release_algorithm()->get_time();
+
+	for(unsigned int i = 0; i < 5; ++ i)
+		server_insert(server, 0, "x");
+
+	if(server.can_resume(user1, time) )
+		throw std::runtime_error("Trimmed client can be resumed");
+
+	try
+	{
+		server.client_resume(user1, time);
+	}
+	catch(std::logic_error&)
+	{
+		return;
+	}
+
+	throw std::runtime_error("Trimmed client has been resumed");
+}
+
 int main(int argc, char* argv[])
 {
 	std::cout << argv[0] << std::endl;
@@ -305,6 +439,20 @@ int main(int argc, char* argv[])
 	unsigned int line_num = 0;
 
 	bool result = true;
+
+	std::cout << "Resume test: ";
+
+	try
+	{
+		test_resume();
+		std::cout << "passed!" << std::endl;
+	}
+	catch(std::exception& e)
+	{
+		std::cout << e.what() << std::endl;
+		result = false;
+	}
+
 	while(std::getline(file, line) )
 	{
 		++ line_num;
@@ -0,0 +1,310 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sigc++/sigc++.h>
+#include "server_buffer.hpp"
+#include "client_buffer.hpp"
+
+// Runs a server and its clients in this process, over loopback, to check
+// that observers get every change and that records from users without
+// the MODIFY privilege are rejected.
+
+namespace
+{
+	typedef obby::server_buffer::document_info_type server_info;
+	typedef obby::client_buffer::document_info_type client_info;
+	typedef server_info::privileges privileges;
+
+	/** Rounds of pump() to wait for something before giving up.
+	 */
+	const unsigned int max_rounds = 500;
+
+	class test_client: public sigc::trackable
+	{
+	public:
+		test_client(const std::string& name, const obby::colour& colour):
+			m_name(name), m_colour(colour), m_synced(false),
+			m_closed(false)
+		{
+			m_buffer.welcome_event().connect(
+				sigc::mem_fun(*this, &test_client::on_welcome) );
+			m_buffer.sync_final_event().connect(
+				sigc::mem_fun(*this, &test_client::on_sync_final) );
+			m_buffer.close_event().connect(
+				sigc::mem_fun(*this, &test_client::on_close) );
+		}
+
+		void connect(unsigned int port)
+		{
+			m_buffer.connect("localhost", port);
+		}
+
+		void select()
+		{
+			if(!m_closed) m_buffer.get_selector().select(0);
+		}
+
+		bool is_synced() const { return m_synced; }
+		bool is_closed() const { return m_closed; }
+		const std::string& get_name() const { return m_name; }
+
+		/** Returns the only document of the session.
+		 */
+		client_info& document()
+		{
+			client_info* info = dynamic_cast<client_info*>(
+				m_buffer.document_find(0, 1) );
+
+			if(info == NULL)
+				throw std::logic_error(m_name + " has no document");
+
+			return *info;
+		}
+
+		bool is_subscribed()
+		{
+			return document().get_subscription_state() ==
+				client_info::SUBSCRIBED;
+		}
+
+		std::string text()
+		{
+			return document().get_content().get_text();
+		}
+
+	private:
+		void on_welcome() { m_buffer.login(m_name, m_colour); }
+		void on_sync_final() { m_synced = true; }
+		void on_close() { m_closed = true; }
+
+		std::string m_name;
+		obby::colour m_colour;
+		obby::client_buffer m_buffer;
+		bool m_synced;
+		bool m_closed;
+	};
+
+	/** A server with one document and three clients. The editor may
+	 * change the document, the reader subscribes without having the
+	 * privilege to change it, and the watcher asks to observe.
+	 */
+	class session
+	{
+	public:
+		session():
+			editor("editor", obby::colour(255, 0, 0) ),
+			reader("reader", obby::colour(0, 255, 0) ),
+			watcher("watcher", obby::colour(0, 0, 255) )
+		{
+			unsigned int port = open();
+			server.document_create("observed", "UTF-8", "base");
+
+			editor.connect(port);
+			reader.connect(port);
+			watcher.connect(port);
+
+			for(unsigned int i = 0; i < max_rounds; ++ i)
+			{
+				if(editor.is_synced() && reader.is_synced() &&
+				   watcher.is_synced() )
+					return;
+
+				pump();
+			}
+
+			throw std::logic_error("Clients did not log in");
+		}
+
+		/** Lets the server and every client handle what has arrived.
+		 */
+		void pump()
+		{
+			server.get_selector().select(10);
+			editor.select();
+			reader.select();
+			watcher.select();
+		}
+
+		server_info& document()
+		{
+			server_info* info = server.document_find(0, 1);
+			if(info == NULL)
+				throw std::logic_error("Server has no document");
+
+			return *info;
+		}
+
+		const obby::user& user(const test_client& client)
+		{
+			const obby::user* found = server.get_user_table().find(
+				client.get_name(),
+				obby::user::flags::CONNECTED,
+				obby::user::flags::NONE
+			);
+
+			if(found == NULL)
+			{
+				throw std::logic_error(
+					client.get_name() + " is not logged in");
+			}
+
+			return *found;
+		}
+
+		/** Pumps until every client that is still connected has the
+		 * content of the server.
+		 */
+		void converge()
+		{
+			for(unsigned int i = 0; i < max_rounds; ++ i)
+			{
+				if(has_server_text(editor) &&
+				   has_server_text(reader) &&
+				   has_server_text(watcher) )
+					return;
+
+				pump();
+			}
+
+			throw std::logic_error("Documents did not converge");
+		}
+
+		obby::server_buffer server;
+		test_client editor;
+		test_client reader;
+		test_client watcher;
+
+	private:
+		unsigned int open()
+		{
+			// Another test may still use a port
+			for(unsigned int port = 6540; port < 6560; ++ port)
+			{
+				try
+				{
+					server.open(port);
+					return port;
+				}
+				catch(std::exception& e)
+				{
+				}
+			}
+
+			throw std::runtime_error("No port to open the server on");
+		}
+
+		bool has_server_text(test_client& client)
+		{
+			return client.is_closed() ||
+				client.text() == document().get_content().get_text();
+		}
+	};
+
+	void test_fan_out(session& s)
+	{
+		s.document().set_privileges(
+			s.user(s.reader),
+			privileges::SUBSCRIBE
+		);
+
+		s.editor.document().subscribe();
+		s.reader.document().subscribe();
+		s.watcher.document().observe();
+
+		for(unsigned int i = 0; i < max_rounds; ++ i)
+		{
+			if(s.editor.is_subscribed() && s.reader.is_subscribed() &&
+			   s.watcher.is_subscribed() )
+				break;
+
+			s.pump();
+		}
+
+		if(!s.editor.is_subscribed() || s.editor.document().is_observing())
+			throw std::logic_error("Editor is not subscribed");
+
+		// Without MODIFY, a subscription request makes an observer
+		if(!s.reader.is_subscribed() || !s.reader.document().is_observing())
+			throw std::logic_error("Reader does not observe");
+
+		if(!s.watcher.is_subscribed() ||
+		   !s.watcher.document().is_observing())
+			throw std::logic_error("Watcher does not observe");
+
+		// Observers are not listed as subscribed users
+		if(!s.document().is_subscribed(s.user(s.editor) ) ||
+		   s.document().is_subscribed(s.user(s.reader) ) ||
+		   s.document().is_subscribed(s.user(s.watcher) ) )
+			throw std::logic_error("Observers are listed as subscribed");
+
+		try
+		{
+			s.reader.document().insert(0, "x");
+			throw std::runtime_error("Observer changed the document");
+		}
+		catch(std::logic_error& e)
+		{
+		}
+
+		// Changes of the editor and of the server both reach observers
+		for(unsigned int i = 0; i < 40; ++ i)
+		{
+			std::ostringstream text;
+			text << i;
+
+			const obby::position size =
+				s.editor.document().get_content().size();
+			s.editor.document().insert((i * 7) % (size + 1), text.str() );
+
+			if(i % 5 == 0)
+				s.document().insert(0, "s");
+
+			s.pump();
+		}
+
+		s.converge();
+	}
+
+	void test_reject(session& s)
+	{
+		const std::string before = s.document().get_content().get_text();
+
+		// The editor still thinks it may change the document
+		s.document().set_privileges(
+			s.user(s.editor),
+			privileges::SUBSCRIBE
+		);
+
+		s.editor.document().insert(0, "rejected");
+
+		for(unsigned int i = 0; i < max_rounds; ++ i)
+		{
+			if(s.editor.is_closed() ) break;
+			s.pump();
+		}
+
+		if(!s.editor.is_closed() )
+			throw std::logic_error("Record without MODIFY was accepted");
+
+		s.converge();
+
+		if(s.document().get_content().get_text() != before)
+			throw std::logic_error("Rejected record changed the document");
+	}
+}
+
+int main() try
+{
+	session s;
+	test_fan_out(s);
+	test_reject(s);
+
+	std::cout << "Observer test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
+catch(std::exception& e)
+{
+	std::cerr << "Observer test failed: " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
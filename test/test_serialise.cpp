@@ -1,6 +1,12 @@
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
+#include "serialise/error.hpp"
+#include "serialise/identifier.hpp"
 #include "serialise/parser.hpp"
+#include "serialise/reader.hpp"
+#include "serialise/token.hpp"
 
 namespace
 {
@@ -14,10 +20,176 @@ namespace
 		"  child_2_2\n"
 		" child_3\n"
 		"  child_3_1 attribute=\"value\"";
+
+	/** Escapes <em>value</em> and reads it back through the tokeniser
+	 * and through the reader, from memory and from a stream.
+	 */
+	void check_escape(const std::string& value)
+	{
+		std::string literal;
+		obby::serialise::escape(value.data(), value.size(), literal);
+
+		std::string unescaped(literal);
+		obby::serialise::unescape(unescaped, 1);
+		if(unescaped != value)
+			throw std::logic_error("unescape does not revert escape");
+
+		std::string input = "!obby\nroot value=\"" + literal + "\"";
+
+		obby::serialise::token_list tokens;
+		tokens.deserialise(input);
+
+		obby::serialise::token_list::iterator iter = tokens.begin();
+		while(iter->get_type() != obby::serialise::token::TYPE_STRING)
+			tokens.next_token(iter);
+
+		if(iter->get_text() != value)
+			throw std::logic_error("tokeniser does not revert escape");
+
+		obby::serialise::reader mem_reader(input.data(), input.size() );
+		mem_reader.read();
+		mem_reader.read();
+		if(mem_reader.get_value() != value)
+			throw std::logic_error("reader does not revert escape");
+
+		std::istringstream stream(input);
+		obby::serialise::reader stream_reader(stream);
+		stream_reader.read();
+		stream_reader.read();
+		if(stream_reader.get_value() != value)
+			throw std::logic_error("stream reader does not revert escape");
+	}
+
+	void test_escape()
+	{
+		const char* values[] = {
+			"", "plain", "\"", "\\", "\n", "\t", "\\\"",
+			"\\n", "a\\", "\"quoted\"", "line\nline\n", "\\\\\\"
+		};
+
+		for(unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); ++ i)
+			check_escape(values[i]);
+
+		// Special characters around the boundaries of the words that
+		// find_special() scans at once
+		const char specials[] = { '\"', '\\', '\n', '\t' };
+		for(unsigned int len = 1; len <= 33; ++ len)
+		{
+			for(unsigned int pos = 0; pos < len; ++ pos)
+			{
+				for(unsigned int i = 0; i < sizeof(specials); ++ i)
+				{
+					std::string value(len, 'x');
+					value[pos] = specials[i];
+					check_escape(value);
+				}
+			}
+		}
+
+		// Unknown escape sequences are rejected by both
+		const std::string bad = "!obby\nroot value=\"a\\qb\"";
+		try
+		{
+			obby::serialise::token_list tokens;
+			tokens.deserialise(bad);
+			throw std::logic_error("tokeniser accepted unknown escape");
+		}
+		catch(obby::serialise::error& e) {}
+
+		try
+		{
+			obby::serialise::reader reader(bad.data(), bad.size() );
+			reader.read();
+			reader.read();
+			throw std::logic_error("reader accepted unknown escape");
+		}
+		catch(obby::serialise::error& e) {}
+	}
+
+	void test_signature()
+	{
+		// Binary input with a damaged signature is reported as such
+		const std::string damaged("\x89OBBX\r\n\x1a", 8);
+		try
+		{
+			obby::serialise::reader reader(
+				damaged.data(),
+				damaged.size()
+			);
+
+			throw std::logic_error("reader accepted bad signature");
+		}
+		catch(obby::serialise::error& e)
+		{
+			std::string msg = e.what();
+			if(msg.find("\\x89OBBX\\x0d\\x0a\\x1a") == std::string::npos)
+				throw std::logic_error("bad signature not reported");
+		}
+	}
+
+	void test_identifier()
+	{
+		using obby::serialise::identifier;
+
+		if(identifier().get_handle() != 0 || identifier("") != identifier() ||
+		   !identifier().get_name().empty() )
+			throw std::logic_error("empty identifier has no handle 0");
+
+		identifier foo("foo");
+		const std::string* foo_name = &foo.get_name();
+		if(identifier(std::string("foo") ) != foo ||
+		   identifier("bar") == foo || *foo_name != "foo")
+			throw std::logic_error("names are not interned");
+
+		// Handles and names must not move while the table grows
+		std::vector<identifier> ids;
+		for(unsigned int i = 0; i < 1000; ++ i)
+		{
+			std::ostringstream name;
+			name << "name_" << i;
+			ids.push_back(identifier(name.str()) );
+		}
+
+		if(identifier("foo").get_handle() != foo.get_handle() ||
+		   &identifier("foo").get_name() != foo_name)
+			throw std::logic_error("identifier moved");
+
+		for(unsigned int i = 0; i < ids.size(); ++ i)
+		{
+			std::ostringstream name;
+			name << "name_" << i;
+			if(ids[i].get_name() != name.str() ||
+			   identifier(name.str()) != ids[i])
+				throw std::logic_error("identifier changed");
+		}
+
+		// Attributes are looked up by identifier
+		obby::serialise::object obj;
+		obj.add_attribute("a").set_value("1");
+		obj.add_attribute("b").set_value("2");
+		obj.add_attribute("a").set_value("3");
+
+		if(obj.attributes_end() - obj.attributes_begin() != 2 ||
+		   obj.get_attribute("a")->get_value() != "3" ||
+		   obj.get_attribute(identifier("b") )->get_value() != "2" ||
+		   obj.get_attribute("c") != NULL)
+			throw std::logic_error("attribute lookup failed");
+
+		try
+		{
+			obj.get_required_attribute("c");
+			throw std::logic_error("missing attribute not reported");
+		}
+		catch(obby::serialise::error& e) {}
+	}
 }
 
 int main() try
 {
+	test_escape();
+	test_signature();
+	test_identifier();
+
 	obby::serialise::parser parser;
 	parser.deserialise_memory(document);
 
@@ -27,6 +199,41 @@ int main() try
 	if(parsed_document != document)
 		throw std::logic_error("output differs from input");
 
+	// Binary snapshot must hold the same tree
+	std::ostringstream binary_stream;
+	parser.serialise(binary_stream, obby::serialise::writer::FORMAT_BINARY);
+
+	obby::serialise::parser binary_parser;
+	binary_parser.deserialise_memory(binary_stream.str() );
+
+	std::string binary_document;
+	binary_parser.serialise_memory(binary_document);
+
+	if(binary_document != document)
+		throw std::logic_error("binary output differs from input");
+
+	// Skip an object and seek back to it
+	obby::serialise::reader reader(document.data(), document.size() );
+	reader.read(); // root
+	reader.read(); // child_1
+	reader.skip_object();
+
+	if(reader.read() != obby::serialise::reader::OBJECT_BEGIN ||
+	   reader.get_name() != "child_2")
+		throw std::logic_error("skip_object skipped too much");
+
+	std::size_t offset = reader.get_offset();
+	reader.skip_object();
+
+	if(reader.read() != obby::serialise::reader::OBJECT_BEGIN ||
+	   reader.get_name() != "child_3")
+		throw std::logic_error("skip_object did not skip children");
+
+	reader.seek(offset, 4);
+	if(reader.read() != obby::serialise::reader::OBJECT_BEGIN ||
+	   reader.get_name() != "child_2" || reader.get_line() != 4)
+		throw std::logic_error("seek did not return to object");
+
 	std::cout << "Serialisation test passed" << std::endl;
 	return EXIT_SUCCESS;
 }